@@ -5,6 +5,7 @@
 #include "BasicProcessing.h"
 #include "MaxImageDef.h"
 #include "ICCProfileTransform.h"
+#include "ProcessingThreadPool.h"
 
 struct AvifReader::avif_cache {
 	avifDecoder* decoder;
@@ -35,7 +36,8 @@ void* AvifReader::ReadImage(int& width,
 	exif_chunk = NULL;
 
 	avifResult result;
-	int nthreads = 256; // sets maximum number of active threads allowed for libavif, default is 1
+	// libavif cannot use the processing thread pool, limit its threads to the thread budget of the pool
+	int nthreads = CProcessingThreadPool::This().GetNumberOfThreads();
 
 	// Cache animations
 	if (cache.decoder == NULL) {
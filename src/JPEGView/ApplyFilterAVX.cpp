@@ -12,38 +12,94 @@
 
 #ifdef _WIN64
 
-CXMMImage* ApplyFilter_AVX(int nSourceHeight, int nTargetHeight, int nWidth,
-	int nStartY_FP, int nStartX, int nIncrementY_FP,
-	const AVXFilterKernelBlock& filter,
-	int nFilterOffset, const CXMMImage* pSourceImg) {
+// Filters one row of nNumberOfBlocksX blocks of 16 pixels in y direction, with a kernel of nFilterLen elements
+// or filterLen elements if nFilterLen is 0. With a compile time kernel length, the loop is completely unrolled.
+// Returns the destination pointer after the filtered blocks.
+template<int nFilterLen>
+inline static __m256i* FilterRow_AVX(const __m256i* pSourceRow, const __m256i* pFilterStart, int filterLen,
+	int nChannelLenBytes, int nNumberOfBlocksX, __m256i ymm0, __m256i* pDestination) {
+
+	const int nNumElements = (nFilterLen > 0) ? nFilterLen : filterLen;
+	__m256i ymm1;
+	__m256i ymm2;
+	__m256i ymm3;
+	__m256i ymm4;
+	__m256i ymm5;
+	__m256i ymm6;
+	__m256i ymm7;
 
-	int nStartXAligned = nStartX & ~15;
-	int nEndXAligned = (nStartX + nWidth + 15) & ~15;
-	CXMMImage* tempImage = new CXMMImage(nEndXAligned - nStartXAligned, nTargetHeight, 16);
-	if (tempImage->AlignedPtr() == NULL) {
-		delete tempImage;
-		return NULL;
+	for (int x = 0; x < nNumberOfBlocksX; x++) {
+		const __m256i* pSource = pSourceRow;
+		const __m256i* pFilter = pFilterStart;
+		ymm4 = _mm256_setzero_si256();
+		ymm5 = _mm256_setzero_si256();
+		ymm6 = _mm256_setzero_si256();
+		for (int i = 0; i < nNumElements; i++) {
+			ymm7 = *pFilter;
+
+			// the pixel data RED channel
+			ymm2 = *pSource;
+			ymm2 = _mm256_add_epi16(ymm2, ymm2);
+			ymm2 = _mm256_mulhi_epi16(ymm2, ymm7);
+			ymm2 = _mm256_add_epi16(ymm2, ymm2);
+			ymm4 = _mm256_adds_epi16(ymm4, ymm2);
+			pSource = (__m256i*)((uint8*)pSource + nChannelLenBytes);
+
+			// the pixel data GREEN channel
+			ymm3 = *pSource;
+			ymm3 = _mm256_add_epi16(ymm3, ymm3);
+			ymm3 = _mm256_mulhi_epi16(ymm3, ymm7);
+			ymm3 = _mm256_add_epi16(ymm3, ymm3);
+			ymm5 = _mm256_adds_epi16(ymm5, ymm3);
+			pSource = (__m256i*)((uint8*)pSource + nChannelLenBytes);
+
+			// the pixel data BLUE channel
+			ymm2 = *pSource;
+			ymm2 = _mm256_add_epi16(ymm2, ymm2);
+			ymm2 = _mm256_mulhi_epi16(ymm2, ymm7);
+			ymm2 = _mm256_add_epi16(ymm2, ymm2);
+			ymm6 = _mm256_adds_epi16(ymm6, ymm2);
+			pSource = (__m256i*)((uint8*)pSource + nChannelLenBytes);
+
+			pFilter++;
+		}
+
+		// limit to range 0 (in ymm1), 16383-42 (in ymm0)
+		ymm4 = _mm256_min_epi16(ymm4, ymm0);
+		ymm5 = _mm256_min_epi16(ymm5, ymm0);
+		ymm6 = _mm256_min_epi16(ymm6, ymm0);
+
+		ymm1 = _mm256_setzero_si256();
+
+		ymm4 = _mm256_max_epi16(ymm4, ymm1);
+		ymm5 = _mm256_max_epi16(ymm5, ymm1);
+		ymm6 = _mm256_max_epi16(ymm6, ymm1);
+
+		// store result in blocks
+		*pDestination++ = ymm4;
+		*pDestination++ = ymm5;
+		*pDestination++ = ymm6;
+
+		pSourceRow++;
 	}
+	return pDestination;
+}
+
+// See ApplyFilter_AVX(), nFilterLen is the length of the kernels or 0 if not known at compile time.
+// Rows with kernels of another length (border handling kernels) are processed with the generic loop.
+template<int nFilterLen>
+static void ApplyFilter_AVX_Core(int nTargetHeight, int nStartY_FP, int nIncrementY_FP,
+	const AVXFilterKernelBlock& filter, int nFilterOffset,
+	const uint8* pSourceStart, int nChannelLenBytes, int nNumberOfBlocksX, CXMMImage* pTargetImg) {
 
 	int nCurY = nStartY_FP;
-	int nChannelLenBytes = pSourceImg->GetPaddedWidth() * sizeof(short);
 	int nRowLenBytes = nChannelLenBytes * 3;
-	int nNumberOfBlocksX = (nEndXAligned - nStartXAligned) >> 4;
-	const uint8* pSourceStart = (const uint8*)pSourceImg->AlignedPtr() + nStartXAligned * sizeof(short);
 	AVXFilterKernel** pKernelIndexStart = filter.Indices;
 
 	DECLARE_ALIGNED_QQWORD(ONE_XMM, 16383 - 42); // 1.0 in fixed point notation, minus rounding correction
 
 	__m256i ymm0 = *((__m256i*)ONE_XMM);
-	__m256i ymm1 = _mm256_setzero_si256();
-	__m256i ymm2;
-	__m256i ymm3;
-	__m256i ymm4 = _mm256_setzero_si256();
-	__m256i ymm5 = _mm256_setzero_si256();
-	__m256i ymm6 = _mm256_setzero_si256();
-	__m256i ymm7;
-
-	__m256i* pDestination = (__m256i*)tempImage->AlignedPtr();
+	__m256i* pDestination = (__m256i*)pTargetImg->AlignedPtr();
 
 	for (int y = 0; y < nTargetHeight; y++) {
 		uint32 nCurYInt = (uint32)nCurY >> 16; // integer part of Y
@@ -54,63 +110,57 @@ CXMMImage* ApplyFilter_AVX(int nSourceHeight, int nTargetHeight, int nWidth,
 		const __m256i* pFilterStart = (__m256i*)&(pKernel->Kernel);
 		const __m256i* pSourceRow = (const __m256i*)(pSourceStart + ((int)nCurYInt - filterOffset) * nRowLenBytes);
 
-		for (int x = 0; x < nNumberOfBlocksX; x++) {
-			const __m256i* pSource = pSourceRow;
-			const __m256i* pFilter = pFilterStart;
-			ymm4 = _mm256_setzero_si256();
-			ymm5 = _mm256_setzero_si256();
-			ymm6 = _mm256_setzero_si256();
-			for (int i = 0; i < filterLen; i++) {
-				ymm7 = *pFilter;
-
-				// the pixel data RED channel
-				ymm2 = *pSource;
-				ymm2 = _mm256_add_epi16(ymm2, ymm2);
-				ymm2 = _mm256_mulhi_epi16(ymm2, ymm7);
-				ymm2 = _mm256_add_epi16(ymm2, ymm2);
-				ymm4 = _mm256_adds_epi16(ymm4, ymm2);
-				pSource = (__m256i*)((uint8*)pSource + nChannelLenBytes);
-
-				// the pixel data GREEN channel
-				ymm3 = *pSource;
-				ymm3 = _mm256_add_epi16(ymm3, ymm3);
-				ymm3 = _mm256_mulhi_epi16(ymm3, ymm7);
-				ymm3 = _mm256_add_epi16(ymm3, ymm3);
-				ymm5 = _mm256_adds_epi16(ymm5, ymm3);
-				pSource = (__m256i*)((uint8*)pSource + nChannelLenBytes);
-
-				// the pixel data BLUE channel
-				ymm2 = *pSource;
-				ymm2 = _mm256_add_epi16(ymm2, ymm2);
-				ymm2 = _mm256_mulhi_epi16(ymm2, ymm7);
-				ymm2 = _mm256_add_epi16(ymm2, ymm2);
-				ymm6 = _mm256_adds_epi16(ymm6, ymm2);
-				pSource = (__m256i*)((uint8*)pSource + nChannelLenBytes);
-
-				pFilter++;
-			}
-
-			// limit to range 0 (in ymm1), 16383-42 (in ymm0)
-			ymm4 = _mm256_min_epi16(ymm4, ymm0);
-			ymm5 = _mm256_min_epi16(ymm5, ymm0);
-			ymm6 = _mm256_min_epi16(ymm6, ymm0);
-
-			ymm1 = _mm256_setzero_si256();
-
-			ymm4 = _mm256_max_epi16(ymm4, ymm1);
-			ymm5 = _mm256_max_epi16(ymm5, ymm1);
-			ymm6 = _mm256_max_epi16(ymm6, ymm1);
-
-			// store result in blocks
-			*pDestination++ = ymm4;
-			*pDestination++ = ymm5;
-			*pDestination++ = ymm6;
-
-			pSourceRow++;
-		};
+		if (nFilterLen > 0 && filterLen == nFilterLen) {
+			pDestination = FilterRow_AVX<nFilterLen>(pSourceRow, pFilterStart, nFilterLen, nChannelLenBytes, nNumberOfBlocksX, ymm0, pDestination);
+		} else {
+			pDestination = FilterRow_AVX<0>(pSourceRow, pFilterStart, filterLen, nChannelLenBytes, nNumberOfBlocksX, ymm0, pDestination);
+		}
 
 		nCurY += nIncrementY_FP;
 	};
+}
+
+CXMMImage* ApplyFilter_AVX(int nSourceHeight, int nTargetHeight, int nWidth,
+	int nStartY_FP, int nStartX, int nIncrementY_FP,
+	const AVXFilterKernelBlock& filter,
+	int nFilterOffset, const CXMMImage* pSourceImg) {
+
+	int nStartXAligned = nStartX & ~15;
+	int nEndXAligned = (nStartX + nWidth + 15) & ~15;
+	CXMMImage* tempImage = new CXMMImage(nEndXAligned - nStartXAligned, nTargetHeight, 16);
+	if (tempImage->AlignedPtr() == NULL) {
+		delete tempImage;
+		return NULL;
+	}
+
+	int nChannelLenBytes = pSourceImg->GetPaddedWidth() * sizeof(short);
+	int nNumberOfBlocksX = (nEndXAligned - nStartXAligned) >> 4;
+	const uint8* pSourceStart = (const uint8*)pSourceImg->AlignedPtr() + nStartXAligned * sizeof(short);
+
+	// the filter loop is specialized for the kernel length
+	switch (GetMaxFilterLen(filter, nFilterOffset, nTargetHeight)) {
+		case 3:
+			ApplyFilter_AVX_Core<3>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		case 4:
+			ApplyFilter_AVX_Core<4>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		case 5:
+			ApplyFilter_AVX_Core<5>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		case 6:
+			ApplyFilter_AVX_Core<6>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		case 7:
+			ApplyFilter_AVX_Core<7>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		case 8:
+			ApplyFilter_AVX_Core<8>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		default:
+			ApplyFilter_AVX_Core<0>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+	}
 
 	return tempImage;
 }
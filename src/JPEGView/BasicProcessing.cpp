@@ -5,10 +5,13 @@
 #include "Helpers.h"
 #include "WorkThread.h"
 #include "ProcessingThreadPool.h"
+#include "BufferPool.h"
 #ifdef _WIN64
 #include "ApplyFilterAVX.h"
 #endif
 #include <math.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
 
 
 // This macro allows for aligned definition of a 16 byte value with initialization of the 8 components
@@ -20,6 +23,9 @@
 
 #define ALPHA_OPAQUE 0xFF000000
 
+// Copies of at least this size are written with non-temporal stores, they would evict the caches anyway
+static const size_t NON_TEMPORAL_COPY_MIN_BYTES = 16 * 1024 * 1024;
+
 // holds last resize timing info
 static TCHAR s_TimingInfo[256];
 
@@ -31,7 +37,7 @@ static void* SampleDown_HQ_MMX_SSE_Core(CSize fullTargetSize, CPoint fullTargetO
 	CSize sourceSize, const void* pIJLPixels, int nChannels, double dSharpen,
 	EFilterType eFilter, bool bSSE, uint8* pTarget);
 
-static void* SampleDown_HQ_AVX_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
+static void* SampleDown_HQ_Tiled_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
 	CSize sourceSize, const void* pIJLPixels, int nChannels, double dSharpen,
 	EFilterType eFilter, uint8* pTarget);
 
@@ -47,6 +53,9 @@ static void* ApplyLDC32bpp_Core(CSize fullTargetSize, CPoint fullTargetOffset, C
 	CSize ldcMapSize, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap,
 	float fBlackPt, float fWhitePt, float fBlackPtSteepness, uint32* pTarget);
 
+static void ApplyCorrections32bpp_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize dibSize,
+	uint32* pPixels, const CBasicProcessing::Corrections& corrections);
+
 static int16* GaussFilter16bpp1Channel_Core(CSize fullSize, CPoint offset, CSize rect, int nTargetWidth, double dRadius,
 	const int16* pSourcePixels, int16* pTargetPixels);
 
@@ -54,10 +63,28 @@ static void* UnsharpMask_Core(CSize fullSize, CPoint offset, CSize rect, double
 	const int16* pGrayImage, const int16* pSmoothedGrayImage, const void* pSourcePixels, void* pTargetPixels, int nChannels);
 
 static void* RotateHQ_Core(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize,
-	const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor);
+	const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor, bool bUseSSE);
 
 static void* TrapezoidHQ_Core(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize,
-	const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor);
+	const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor, bool bUseSSE);
+
+// Source position of the first pixel of a target row and the source position increment per target pixel, in 16.16 fixed point
+struct CBilinearRowMapping {
+	int32 X;
+	int32 Y;
+	int32 IncrementX;
+	int32 IncrementY;
+};
+
+template<int nChannels>
+static void BilinearSample_Core(const CBilinearRowMapping* pRowMappings, CSize dibSize, CSize sourceSize,
+	const void* pSourcePixels, uint32 nBackColor, bool bUseSSE, const CBasicProcessing::Corrections* pCorrections, uint32* pTarget);
+
+static void OrientDIB32bpp_Core(const uint32* pSource, int nWidth, int nHeight, uint32* pTarget,
+	int nRotationAngleCW, bool bMirrorH, bool bUseSSE, int nStartY, int nEndY);
+
+static void CopyRect32bpp_Core(uint32* pTarget, int nTargetStride, const uint32* pSource, int nSourceStride,
+	CSize rectSize, bool bNonTemporal);
 
 //---------------------------------------------------------------------------------------------
 
@@ -66,9 +93,11 @@ class CRequestUpDownSampling : public CProcessingRequest {
 public:
 	CRequestUpDownSampling(const void* pSourcePixels, CSize sourceSize, void* pTargetPixels,
 		CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
-		int nChannels, double dSharpen, EFilterType eFilter, CBasicProcessing::SIMDArchitecture simd)
+		int nChannels, double dSharpen, EFilterType eFilter, CBasicProcessing::SIMDArchitecture simd,
+		const CBasicProcessing::Corrections* pCorrections)
 		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, fullTargetSize, fullTargetOffset, clippedTargetSize) {
 		Channels = nChannels;
+		Corrections = pCorrections;
 		Sharpen = dSharpen;
 		Filter = eFilter;
 		SIMD = simd;
@@ -76,24 +105,25 @@ public:
 	}
 
 	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		void* pResult;
 		if (Filter == Filter_Upsampling_Bicubic) {
 			if (SIMD == CBasicProcessing::AVX2)
-				return NULL != SampleUp_HQ_AVX_Core(FullTargetSize,
+				pResult = SampleUp_HQ_AVX_Core(FullTargetSize,
 					CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
 					CSize(ClippedTargetSize.cx, sizeY),
 					SourceSize, SourcePixels,
 					Channels,
 					(uint8*)TargetPixels + ClippedTargetSize.cx * 4 * offsetY);
 			else
-				return NULL != SampleUp_HQ_MMX_SSE_Core(FullTargetSize,
+				pResult = SampleUp_HQ_MMX_SSE_Core(FullTargetSize,
 					CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
 					CSize(ClippedTargetSize.cx, sizeY),
 					SourceSize, SourcePixels,
 					Channels, SIMD == CBasicProcessing::SSE,
 					(uint8*)TargetPixels + ClippedTargetSize.cx * 4 * offsetY);
 		}
-		else if (SIMD == CBasicProcessing::AVX2)
-			return NULL != SampleDown_HQ_AVX_Core(FullTargetSize,
+		else if (SIMD != CBasicProcessing::MMX)
+			pResult = SampleDown_HQ_Tiled_Core(FullTargetSize,
 				CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
 				CSize(ClippedTargetSize.cx, sizeY),
 				SourceSize, SourcePixels,
@@ -101,19 +131,29 @@ public:
 				Filter,
 				(uint8*)TargetPixels + ClippedTargetSize.cx * 4 * offsetY);
 		else
-			return NULL != SampleDown_HQ_MMX_SSE_Core(FullTargetSize,
+			pResult = SampleDown_HQ_MMX_SSE_Core(FullTargetSize,
 				CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
 				CSize(ClippedTargetSize.cx, sizeY),
 				SourceSize, SourcePixels,
 				Channels, Sharpen,
-				Filter, SIMD == CBasicProcessing::SSE,
+				Filter, false,
 				(uint8*)TargetPixels + ClippedTargetSize.cx * 4 * offsetY);
+		if (pResult == NULL) {
+			return false;
+		}
+		if (Corrections != NULL) {
+			// the strip is still in the cache, apply the color corrections now instead of in a separate pass
+			ApplyCorrections32bpp_Core(FullTargetSize, CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
+				CSize(ClippedTargetSize.cx, sizeY), (uint32*)TargetPixels + ClippedTargetSize.cx * offsetY, *Corrections);
+		}
+		return true;
 	}
 
 	int Channels;
 	double Sharpen;
 	EFilterType Filter;
 	CBasicProcessing::SIMDArchitecture SIMD;
+	const CBasicProcessing::Corrections* Corrections;
 };
 
 class CRequestLDC : public CProcessingRequest {
@@ -152,6 +192,26 @@ public:
 	float BlackPtSteepness;
 };
 
+class CRequestCorrections : public CProcessingRequest {
+public:
+	CRequestCorrections(void* pPixels, CSize dibSize, CSize fullTargetSize, CPoint fullTargetOffset,
+		const CBasicProcessing::Corrections& corrections)
+		: CProcessingRequest(pPixels, dibSize, pPixels, fullTargetSize, fullTargetOffset, dibSize),
+		Corrections(corrections) {
+	}
+
+	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		ApplyCorrections32bpp_Core(FullTargetSize,
+			CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
+			CSize(ClippedTargetSize.cx, sizeY),
+			(uint32*)TargetPixels + ClippedTargetSize.cx * offsetY,
+			Corrections);
+		return true;
+	}
+
+	const CBasicProcessing::Corrections& Corrections;
+};
+
 class CRequestGauss : public CProcessingRequest {
 public:
 	CRequestGauss(const int16* pSourcePixels, CSize fullSize, CPoint offset, CSize rect, double dRadius, int16* pTargetPixels)
@@ -206,43 +266,124 @@ public:
 class CRequestRotate : public CProcessingRequest {
 public:
 	CRequestRotate(const void* pSourcePixels, CPoint targetOffset, CSize targetSize, double dRotation,
-		CSize sourceSize, void* pTargetPixels, int nChannels, COLORREF backColor)
+		CSize sourceSize, void* pTargetPixels, int nChannels, COLORREF backColor, bool bUseSSE)
 		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, targetSize, targetOffset, targetSize) {
 		Rotation = dRotation;
 		Channels = nChannels;
 		BackColor = backColor;
+		UseSSE = bUseSSE;
 	}
 
 	virtual bool ProcessStrip(int offsetY, int sizeY) {
 		return NULL != RotateHQ_Core(CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
 			CSize(FullTargetSize.cx, sizeY), Rotation, SourceSize, SourcePixels,
-			(uint8*)TargetPixels + FullTargetSize.cx * 4 * offsetY, Channels, BackColor);
+			(uint8*)TargetPixels + FullTargetSize.cx * 4 * offsetY, Channels, BackColor, UseSSE);
 	}
 
 	double Rotation;
 	int Channels;
 	COLORREF BackColor;
+	bool UseSSE;
 };
 
 class CRequestTrapezoid : public CProcessingRequest {
 public:
 	CRequestTrapezoid(const void* pSourcePixels, CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid,
-		CSize sourceSize, void* pTargetPixels, int nChannels, COLORREF backColor)
+		CSize sourceSize, void* pTargetPixels, int nChannels, COLORREF backColor, bool bUseSSE)
 		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, targetSize, targetOffset, targetSize) {
 		Trapezoid = trapezoid;
 		Channels = nChannels;
 		BackColor = backColor;
+		UseSSE = bUseSSE;
 	}
 
 	virtual bool ProcessStrip(int offsetY, int sizeY) {
 		return NULL != TrapezoidHQ_Core(CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY),
 			CSize(FullTargetSize.cx, sizeY), Trapezoid, SourceSize, SourcePixels,
-			(uint8*)TargetPixels + FullTargetSize.cx * 4 * offsetY, Channels, BackColor);
+			(uint8*)TargetPixels + FullTargetSize.cx * 4 * offsetY, Channels, BackColor, UseSSE);
 	}
 
 	CTrapezoid Trapezoid;
 	int Channels;
 	COLORREF BackColor;
+	bool UseSSE;
+};
+
+class CRequestBilinearSample : public CProcessingRequest {
+public:
+	CRequestBilinearSample(const void* pSourcePixels, CSize sourceSize, void* pTargetPixels, CSize targetSize,
+		const CBilinearRowMapping* pRowMappings, int nChannels, uint32 nBackColor, bool bUseSSE,
+		const CBasicProcessing::Corrections* pCorrections)
+		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, targetSize, CPoint(0, 0), targetSize) {
+		RowMappings = pRowMappings;
+		Channels = nChannels;
+		BackColor = nBackColor;
+		UseSSE = bUseSSE;
+		Corrections = pCorrections;
+	}
+
+	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		uint32* pTarget = (uint32*)TargetPixels + ClippedTargetSize.cx * offsetY;
+		if (Channels == 1) {
+			BilinearSample_Core<1>(RowMappings + offsetY, CSize(ClippedTargetSize.cx, sizeY), SourceSize, SourcePixels,
+				BackColor, UseSSE, Corrections, pTarget);
+		} else if (Channels == 3) {
+			BilinearSample_Core<3>(RowMappings + offsetY, CSize(ClippedTargetSize.cx, sizeY), SourceSize, SourcePixels,
+				BackColor, UseSSE, Corrections, pTarget);
+		} else {
+			BilinearSample_Core<4>(RowMappings + offsetY, CSize(ClippedTargetSize.cx, sizeY), SourceSize, SourcePixels,
+				BackColor, UseSSE, Corrections, pTarget);
+		}
+		return true;
+	}
+
+	const CBilinearRowMapping* RowMappings;
+	int Channels;
+	uint32 BackColor;
+	bool UseSSE;
+	const CBasicProcessing::Corrections* Corrections;
+};
+
+class CRequestOrient : public CProcessingRequest {
+public:
+	CRequestOrient(const void* pSourcePixels, CSize sourceSize, void* pTargetPixels, CSize targetSize,
+		int nRotationAngleCW, bool bMirrorH, bool bUseSSE)
+		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, targetSize, CPoint(0, 0), targetSize) {
+		RotationAngleCW = nRotationAngleCW;
+		MirrorH = bMirrorH;
+		UseSSE = bUseSSE;
+		StripPadding = 32; // the core processes blocks of 32 rows
+	}
+
+	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		OrientDIB32bpp_Core((const uint32*)SourcePixels, SourceSize.cx, SourceSize.cy, (uint32*)TargetPixels,
+			RotationAngleCW, MirrorH, UseSSE, offsetY, offsetY + sizeY);
+		return true;
+	}
+
+	int RotationAngleCW;
+	bool MirrorH;
+	bool UseSSE;
+};
+
+// The width of the source and target sizes are the strides of the images
+class CRequestCopyRect : public CProcessingRequest {
+public:
+	CRequestCopyRect(const uint32* pSourcePixels, int nSourceStride, uint32* pTargetPixels, int nTargetStride,
+		CSize rectSize, bool bNonTemporal)
+		: CProcessingRequest(pSourcePixels, CSize(nSourceStride, rectSize.cy), pTargetPixels,
+		CSize(nTargetStride, rectSize.cy), CPoint(0, 0), rectSize) {
+		NonTemporal = bNonTemporal;
+	}
+
+	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		CopyRect32bpp_Core((uint32*)TargetPixels + FullTargetSize.cx * offsetY, FullTargetSize.cx,
+			(const uint32*)SourcePixels + SourceSize.cx * offsetY, SourceSize.cx,
+			CSize(ClippedTargetSize.cx, sizeY), NonTemporal);
+		return true;
+	}
+
+	bool NonTemporal;
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -324,28 +465,29 @@ int16* CBasicProcessing::Create1Channel16bppGrayscaleImage(int nWidth, int nHeig
 		LUTs[512 + i] = (uint32)(0.114 * i * cdScaler + 0.5);
 	}
 
-	int16* pNewImage = new(std::nothrow) int16[nWidth * nHeight];
+	int16* pNewImage = (int16*)CBufferPool::This().Allocate((size_t)nWidth * nHeight * sizeof(int16));
 	if (pNewImage == NULL) return NULL;
 	int nPadSrc = Helpers::DoPadding(nWidth*nChannels, 4) - nWidth*nChannels;
 	int16* pTarget = pNewImage;
 	const uint8* pSource = (uint8*)pDIBPixels;
 	for (int j = 0; j < nHeight; j++) {
-		for (int i = 0; i < nWidth; i++) {
-			*pTarget++ = (LUTs[pSource[0]] + LUTs[256 + pSource[1]] + LUTs[512 + pSource[2]] + 32767) >> 10; // from 24 to 14 bits
-			pSource += nChannels;
+		if (nChannels == 1) {
+			for (int i = 0; i < nWidth; i++) {
+				*pTarget++ = *pSource++ << 6; // from 8 to 14 bits
+			}
+		} else {
+			for (int i = 0; i < nWidth; i++) {
+				*pTarget++ = (LUTs[pSource[0]] + LUTs[256 + pSource[1]] + LUTs[512 + pSource[2]] + 32767) >> 10; // from 24 to 14 bits
+				pSource += nChannels;
+			}
 		}
 		pSource += nPadSrc;
 	}
 	return pNewImage;
 }
 
-void* CBasicProcessing::Apply3ChannelLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const uint8* pLUT) {
-	if (pDIBPixels == NULL || pLUT == NULL) {
-		return NULL;
-	}
-
-	uint32* pTarget = new(std::nothrow) uint32[nWidth * nHeight];
-	if (pTarget == NULL) return NULL;
+// pTarget can be the same as pDIBPixels
+static void Apply3ChannelLUT32bpp_Core(int nWidth, int nHeight, const void* pDIBPixels, const uint8* pLUT, uint32* pTarget) {
 	const uint32* pSrc = (uint32*)pDIBPixels;
 	uint32* pTgt = pTarget;
 	for (int j = 0; j < nHeight; j++) {
@@ -356,18 +498,23 @@ void* CBasicProcessing::Apply3ChannelLUT32bpp(int nWidth, int nHeight, const voi
 			pTgt++; pSrc++;
 		}
 	}
-	return pTarget;
 }
 
-void* CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT) {
-	if (pDIBPixels == NULL || pSatLUTs == NULL || pLUT == NULL) {
+void* CBasicProcessing::Apply3ChannelLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const uint8* pLUT) {
+	if (pDIBPixels == NULL || pLUT == NULL) {
 		return NULL;
 	}
 
+	uint32* pTarget = (uint32*)CBufferPool::This().Allocate((size_t)nWidth * nHeight * sizeof(uint32));
+	if (pTarget == NULL) return NULL;
+	Apply3ChannelLUT32bpp_Core(nWidth, nHeight, pDIBPixels, pLUT, pTarget);
+	return pTarget;
+}
+
+// pTarget can be the same as pDIBPixels
+static void ApplySaturationAnd3ChannelLUT32bpp_Core(int nWidth, int nHeight, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, uint32* pTarget) {
 	const int cnScaler = 1 << 16;
 	const int cnMax = 255 * cnScaler;
-	uint32* pTarget = new(std::nothrow) uint32[nWidth * nHeight];
-	if (pTarget == NULL) return NULL;
 	const uint32* pSrc = (uint32*)pDIBPixels;
 	uint32* pTgt = pTarget;
 	for (int j = 0; j < nHeight; j++) {
@@ -384,6 +531,16 @@ void* CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp(int nWidth, int nHeig
 			pTgt++; pSrc++;
 		}
 	}
+}
+
+void* CBasicProcessing::ApplySaturationAnd3ChannelLUT32bpp(int nWidth, int nHeight, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT) {
+	if (pDIBPixels == NULL || pSatLUTs == NULL || pLUT == NULL) {
+		return NULL;
+	}
+
+	uint32* pTarget = (uint32*)CBufferPool::This().Allocate((size_t)nWidth * nHeight * sizeof(uint32));
+	if (pTarget == NULL) return NULL;
+	ApplySaturationAnd3ChannelLUT32bpp_Core(nWidth, nHeight, pDIBPixels, pSatLUTs, pLUT, pTarget);
 	return pTarget;
 }
 
@@ -425,6 +582,47 @@ static int32* CreateMulLUT(float fBlackPt, float fWhitePt, float fBlackPtSteepne
 	return pNewLUT;
 }
 
+// Bilinear interpolation of the LDC map at the map position nMapX, nMapY (16.16 fixed point).
+// Returns the mask value in [-127, 128].
+static inline int32 InterpolateLDCMask(const uint8* pLDCMap, int nLDCMapWidth, uint32 nMapX, uint32 nMapY) {
+	uint32 nFracX = nMapX & 0xFFFF;
+	uint32 nFracY = nMapY & 0xFFFF;
+	const uint8* pLDCMapSrc = pLDCMap + nLDCMapWidth * (nMapY >> 16) + (nMapX >> 16);
+	uint32 nMaskTopLeft  = pLDCMapSrc[0];
+	uint32 nMaskTopRight = pLDCMapSrc[1];
+	uint32 nMaskBottomLeft = pLDCMapSrc[nLDCMapWidth];
+	uint32 nMaskBottomRight = pLDCMapSrc[nLDCMapWidth + 1];
+	uint32 nLeft = ((int)nFracY*(int)(nMaskBottomLeft - nMaskTopLeft) >> 16) + nMaskTopLeft;
+	uint32 nRight = ((int)nFracY*(int)(nMaskBottomRight - nMaskTopRight) >> 16) + nMaskTopRight;
+	return ((int)nFracX*(int)(nRight - nLeft) >> 16) + nLeft - 127;
+}
+
+// Applies the saturation LUTs (can be NULL), the three channel LUT and the LDC mask value to one pixel
+static inline uint32 ApplyLUTsAndLDCToPixel(uint32 nSrcPixels, int32 nMaskValue, const int32* pSatLUTs, const uint8* pLUT, const int32* pMulLUT) {
+	const int cnMax = 255 * (1 << 16);
+	int32 nBlue, nGreen, nRed;
+	if (pSatLUTs == NULL) {
+		nBlue = pLUT[nSrcPixels & 0xFF];
+		nGreen = pLUT[((nSrcPixels >> 8) & 0xFF) + 256];
+		nRed = pLUT[((nSrcPixels >> 16) & 0xFF) + 512];
+	} else {
+		// Apply saturation LUTs and three channel LUT
+		int32 nSrcBlue = nSrcPixels & 0xFF;
+		int32 nSrcGreen = (nSrcPixels >> 8) & 0xFF;
+		int32 nSrcRed = (nSrcPixels >> 16) & 0xFF;
+		nRed = pSatLUTs[nSrcRed] + pSatLUTs[256 + nSrcGreen] + pSatLUTs[512 + nSrcBlue];
+		nGreen = pSatLUTs[768 + nSrcRed] + pSatLUTs[1024 + nSrcGreen] + pSatLUTs[512 + nSrcBlue];
+		nBlue = pSatLUTs[768 + nSrcRed] + pSatLUTs[256 + nSrcGreen] + pSatLUTs[1280 + nSrcBlue];
+		nBlue = pLUT[max(0, min(cnMax, nBlue)) >> 16];
+		nGreen = pLUT[(max(0, min(cnMax, nGreen)) >> 16) + 256];
+		nRed = pLUT[(max(0, min(cnMax, nRed)) >> 16) + 512];
+	}
+	nBlue = nBlue + (nMaskValue*pMulLUT[nBlue] >> 14);
+	nGreen = nGreen + (nMaskValue*pMulLUT[nGreen] >> 14);
+	nRed = nRed + (nMaskValue*pMulLUT[nRed] >> 14);
+	return max(0, min(255, (int)nBlue)) + max(0, min(255, (int)nGreen))*256 + max(0, min(255, (int)nRed))*65536 + ALPHA_OPAQUE;
+}
+
 void* ApplyLDC32bpp_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize dibSize,
 									  CSize ldcMapSize, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap,
 									  float fBlackPt, float fWhitePt, float fBlackPtSteepness, uint32* pTarget) {
@@ -436,73 +634,17 @@ void* ApplyLDC32bpp_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize di
 	uint32 nCurY = fullTargetOffset.y*nIncrementY;
 	uint32 nStartX = fullTargetOffset.x*nIncrementX;
 
-	const int cnScaler = 1 << 16;
-	const int cnMax = 255 * cnScaler;
 	const int32* pMulLUT = CreateMulLUT(fBlackPt, fWhitePt, fBlackPtSteepness);
 	const uint32* pSrc = (uint32*)pDIBPixels;
 	uint32* pTgt = pTarget;
 	for (int j = 0; j < dibSize.cy; j++) {
-		uint32 nCurYTrunc = nCurY >> 16;
-		uint32 nCurYFrac = nCurY & 0xFFFF;
-		const uint8* pLDCMapSrc = pLDCMap + ldcMapSize.cx * nCurYTrunc;
 		uint32 nCurX = nStartX;
-		if (pSatLUTs == NULL) {
-			for (int i = 0; i < dibSize.cx; i++) {
-				// perform bilinear interpolation of mask
-				uint32 nCurXTrunc = nCurX >> 16;
-				uint32 nCurXFrac = nCurX & 0xFFFF;
-				uint32 nMaskTopLeft  = pLDCMapSrc[nCurXTrunc];
-				uint32 nMaskTopRight = pLDCMapSrc[nCurXTrunc + 1];
-				uint32 nMaskBottomLeft = pLDCMapSrc[nCurXTrunc + ldcMapSize.cx];
-				uint32 nMaskBottomRight = pLDCMapSrc[nCurXTrunc + ldcMapSize.cx + 1];
-				uint32 nLeft = ((int)nCurYFrac*(int)(nMaskBottomLeft - nMaskTopLeft) >> 16) + nMaskTopLeft;
-				uint32 nRight = ((int)nCurYFrac*(int)(nMaskBottomRight - nMaskTopRight) >> 16) + nMaskTopRight;
-				int32 nMaskValue = ((int)nCurXFrac*(int)(nRight - nLeft) >> 16) + nLeft - 127;
-
-				uint32 nSrcPixels = *pSrc;
-				uint32 nBlue = pLUT[nSrcPixels & 0xFF];
-				nBlue = nBlue + (nMaskValue*pMulLUT[nBlue] >> 14);
-				uint32 nGreen = pLUT[((nSrcPixels >> 8) & 0xFF) + 256];
-				nGreen = nGreen + (nMaskValue*pMulLUT[nGreen] >> 14);
-				uint32 nRed = pLUT[((nSrcPixels >> 16) & 0xFF) + 512];
-				nRed = nRed + (nMaskValue*pMulLUT[nRed] >> 14);
-
-				*pTgt = max(0, min(255, (int)nBlue)) + max(0, min(255, (int)nGreen))*256 + max(0, min(255, (int)nRed))*65536 + ALPHA_OPAQUE;
-				pTgt++; pSrc++;
-				nCurX += nIncrementX;
-			}
-		} else {
-			for (int i = 0; i < dibSize.cx; i++) {
-				// perform bilinear interpolation of mask
-				uint32 nCurXTrunc = nCurX >> 16;
-				uint32 nCurXFrac = nCurX & 0xFFFF;
-				uint32 nMaskTopLeft  = pLDCMapSrc[nCurXTrunc];
-				uint32 nMaskTopRight = pLDCMapSrc[nCurXTrunc + 1];
-				uint32 nMaskBottomLeft = pLDCMapSrc[nCurXTrunc + ldcMapSize.cx];
-				uint32 nMaskBottomRight = pLDCMapSrc[nCurXTrunc + ldcMapSize.cx + 1];
-				uint32 nLeft = ((int)nCurYFrac*(int)(nMaskBottomLeft - nMaskTopLeft) >> 16) + nMaskTopLeft;
-				uint32 nRight = ((int)nCurYFrac*(int)(nMaskBottomRight - nMaskTopRight) >> 16) + nMaskTopRight;
-				int32 nMaskValue = ((int)nCurXFrac*(int)(nRight - nLeft) >> 16) + nLeft - 127;
-
-				// Apply saturation LUTs and three channel LUT
-				uint32 nSrcPixels = *pSrc;
-				int32 nSrcBlue = nSrcPixels & 0xFF;
-				int32 nSrcGreen = (nSrcPixels >> 8) & 0xFF;
-				int32 nSrcRed = (nSrcPixels >> 16) & 0xFF;
-				int32 nRed = pSatLUTs[nSrcRed] + pSatLUTs[256 + nSrcGreen] + pSatLUTs[512 + nSrcBlue];
-				int32 nGreen = pSatLUTs[768 + nSrcRed] + pSatLUTs[1024 + nSrcGreen] + pSatLUTs[512 + nSrcBlue];
-				int32 nBlue = pSatLUTs[768 + nSrcRed] + pSatLUTs[256 + nSrcGreen] + pSatLUTs[1280 + nSrcBlue];
-				nBlue = pLUT[max(0, min(cnMax, nBlue)) >> 16];
-				nBlue = nBlue + (nMaskValue*pMulLUT[nBlue] >> 14);
-				nGreen = pLUT[(max(0, min(cnMax, nGreen)) >> 16) + 256];
-				nGreen = nGreen + (nMaskValue*pMulLUT[nGreen] >> 14);
-				nRed = pLUT[(max(0, min(cnMax, nRed)) >> 16) + 512];
-				nRed = nRed + (nMaskValue*pMulLUT[nRed] >> 14);
-
-				*pTgt = max(0, min(255, (int)nBlue)) + max(0, min(255, (int)nGreen))*256 + max(0, min(255, (int)nRed))*65536 + ALPHA_OPAQUE;
-				pTgt++; pSrc++;
-				nCurX += nIncrementX;
-			}
+		for (int i = 0; i < dibSize.cx; i++) {
+			// perform bilinear interpolation of mask
+			int32 nMaskValue = InterpolateLDCMask(pLDCMap, ldcMapSize.cx, nCurX, nCurY);
+			*pTgt = ApplyLUTsAndLDCToPixel(*pSrc, nMaskValue, pSatLUTs, pLUT, pMulLUT);
+			pTgt++; pSrc++;
+			nCurX += nIncrementX;
 		}
 		nCurY += nIncrementY;
 	}
@@ -522,14 +664,39 @@ void* CBasicProcessing::ApplyLDC32bpp(CSize fullTargetSize, CPoint fullTargetOff
 		return Apply3ChannelLUT32bpp(clippedTargetSize.cx, clippedTargetSize.cy, pDIBPixels, pLUT);
 	}
 
-	uint32* pTarget = new(std::nothrow) uint32[clippedTargetSize.cx * clippedTargetSize.cy];
+	uint32* pTarget = (uint32*)CBufferPool::This().Allocate((size_t)clippedTargetSize.cx * clippedTargetSize.cy * sizeof(uint32));
 	if (pTarget == NULL) return NULL;
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
 	CRequestLDC request(pDIBPixels, clippedTargetSize, pTarget, fullTargetSize, fullTargetOffset,
 		ldcMapSize, pSatLUTs, pLUT, pLDCMap, fBlackPt, fWhitePt, fBlackPtSteepness);
-	bool bSuccess = threadPool.Process(&request);
+	if (!threadPool.Process(&request)) {
+		CBufferPool::This().Free(pTarget);
+		return NULL;
+	}
+	return pTarget;
+}
 
-	return bSuccess ? pTarget : NULL;
+void ApplyCorrections32bpp_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize dibSize,
+								uint32* pPixels, const CBasicProcessing::Corrections& corrections) {
+	if (corrections.LDCMap != NULL && fullTargetSize.cx > 2 && fullTargetSize.cy > 2) {
+		ApplyLDC32bpp_Core(fullTargetSize, fullTargetOffset, dibSize, corrections.LDCMapSize, pPixels,
+			corrections.SatLUTs, corrections.LUT, corrections.LDCMap,
+			corrections.BlackPt, corrections.WhitePt, corrections.BlackPtSteepness, pPixels);
+	} else if (corrections.SatLUTs != NULL) {
+		ApplySaturationAnd3ChannelLUT32bpp_Core(dibSize.cx, dibSize.cy, pPixels, corrections.SatLUTs, corrections.LUT, pPixels);
+	} else {
+		Apply3ChannelLUT32bpp_Core(dibSize.cx, dibSize.cy, pPixels, corrections.LUT, pPixels);
+	}
+}
+
+bool CBasicProcessing::ApplyCorrections32bpp(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
+											 void* pDIBPixels, const Corrections& corrections) {
+	if (pDIBPixels == NULL || corrections.LUT == NULL) {
+		return false;
+	}
+	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
+	CRequestCorrections request(pDIBPixels, clippedTargetSize, fullTargetSize, fullTargetOffset, corrections);
+	return threadPool.Process(&request);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -582,45 +749,117 @@ void CBasicProcessing::FillRectangle32bpp(int nWidth, int nHeight, void* pDIBPix
 // Conversion and rotation methods
 /////////////////////////////////////////////////////////////////////////////////////////////
 
-// Rotate a block of a 32 bit DIB from source to target by 90 or 270 degrees
-static void RotateBlock32bpp(const uint32* pSrc, uint32* pTgt, int nWidth, int nHeight,
-							 int nXStart, int nYStart, int nBlockWidth, int nBlockHeight, bool bCW) {
-	int nIncTargetLine = nHeight;
-	int nIncSource = nWidth - nBlockWidth;
-	const uint32* pSource = pSrc + nWidth * nYStart + nXStart;
-	uint32* pTarget = bCW ? pTgt + nIncTargetLine * nXStart + (nHeight - 1 - nYStart) :
-		pTgt + nIncTargetLine * (nWidth - 1 - nXStart) + nYStart;
-	uint32* pStartYPtr = pTarget;
-	if (!bCW) nIncTargetLine = -nIncTargetLine;
-	int nIncStartYPtr = bCW ? -1 : +1;
-
-	for (uint32 i = 0; i < nBlockHeight; i++) {
-		for (uint32 j = 0; j < nBlockWidth; j++) {
-			*pTarget = *pSource;
-			pTarget += nIncTargetLine;
-			pSource++;
+// Transposes a block of 4x4 pixels: the vectors c0 to c3 are the columns of the block, the rows are returned in c0 to c3
+static inline void Transpose4x4Pixels(__m128i& c0, __m128i& c1, __m128i& c2, __m128i& c3) {
+	__m128i t0 = _mm_unpacklo_epi32(c0, c1);
+	__m128i t1 = _mm_unpacklo_epi32(c2, c3);
+	__m128i t2 = _mm_unpackhi_epi32(c0, c1);
+	__m128i t3 = _mm_unpackhi_epi32(c2, c3);
+	c0 = _mm_unpacklo_epi64(t0, t1);
+	c1 = _mm_unpackhi_epi64(t0, t1);
+	c2 = _mm_unpacklo_epi64(t2, t3);
+	c3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+// Orients the target rows nStartY to nEndY - 1, see CBasicProcessing::OrientDIB32bpp().
+// For 90 and 270 degrees, the target is processed in tiles of 32x32 pixels to keep the source cache lines in the cache.
+// With SSE, the tiles are processed in blocks of 4x4 pixels that are transposed in registers.
+static void OrientDIB32bpp_Core(const uint32* pSource, int nWidth, int nHeight, uint32* pTarget,
+	int nRotationAngleCW, bool bMirrorH, bool bUseSSE, int nStartY, int nEndY) {
+	bool bSwapWH = nRotationAngleCW == 90 || nRotationAngleCW == 270;
+	int nTargetWidth = bSwapWH ? nHeight : nWidth;
+
+	// Source index of the target pixel (0, 0) before mirroring and source index increments per target pixel in x and y direction
+	int nStart, nIncX, nIncY;
+	switch (nRotationAngleCW) {
+		case 90: nStart = (nHeight - 1) * nWidth; nIncX = -nWidth; nIncY = 1; break;
+		case 180: nStart = nHeight * nWidth - 1; nIncX = -1; nIncY = -nWidth; break;
+		case 270: nStart = nWidth - 1; nIncX = nWidth; nIncY = -1; break;
+		default: nStart = 0; nIncX = 1; nIncY = nWidth; break;
+	}
+	if (bMirrorH) {
+		nStart += (nTargetWidth - 1) * nIncX;
+		nIncX = -nIncX;
+	}
+
+	if (!bSwapWH) {
+		// the target rows are source rows, possibly reversed
+		for (int j = nStartY; j < nEndY; j++) {
+			const uint32* pSrc = pSource + nStart + j * nIncY;
+			uint32* pTgt = pTarget + j * nTargetWidth;
+			if (nIncX == 1) {
+				memcpy(pTgt, pSrc, nTargetWidth * sizeof(uint32));
+				continue;
+			}
+			int i = 0;
+			if (bUseSSE) {
+				for (; i + 4 <= nTargetWidth; i += 4) {
+					__m128i pixels = _mm_loadu_si128((const __m128i*)(pSrc - i - 3));
+					_mm_storeu_si128((__m128i*)(pTgt + i), _mm_shuffle_epi32(pixels, _MM_SHUFFLE(0, 1, 2, 3)));
+				}
+			}
+			for (; i < nTargetWidth; i++) {
+				pTgt[i] = pSrc[-i];
+			}
 		}
-		pStartYPtr += nIncStartYPtr;
-		pTarget = pStartYPtr;
-		pSource += nIncSource;
+		return;
 	}
-}
 
-// 180 degrees rotation
-static void* Rotate32bpp180(int nWidth, int nHeight, const void* pDIBPixels) {
-	uint32* pTarget = new(std::nothrow) uint32[nWidth * nHeight];
-	if (pTarget == NULL) return NULL;
-	const uint32* pSource = (uint32*)pDIBPixels;
-	for (uint32 i = 0; i < nHeight; i++) {
-		uint32* pTgt = pTarget + nWidth*(nHeight - 1 - i) + (nWidth - 1);
-		const uint32* pSrc = pSource + nWidth*i;
-		for (uint32 j = 0; j < nWidth; j++) {
-			*pTgt = *pSrc;
-			pTgt -= 1;
-			pSrc += 1;
+	// the target columns are source rows, the four pixels of a 4x4 block column are loaded with one (unaligned) load
+	int nLoadOffset = (nIncY == 1) ? 0 : -3;
+	const int cnBlockSize = 32;
+	for (int nBlockY = nStartY; nBlockY < nEndY; nBlockY += cnBlockSize) {
+		int nBlockEndY = min(nBlockY + cnBlockSize, nEndY);
+		for (int nBlockX = 0; nBlockX < nTargetWidth; nBlockX += cnBlockSize) {
+			int nBlockEndX = min(nBlockX + cnBlockSize, nTargetWidth);
+			int j = nBlockY;
+			if (bUseSSE) {
+				for (; j + 4 <= nBlockEndY; j += 4) {
+					const uint32* pSrc = pSource + nStart + j * nIncY + nLoadOffset;
+					uint32* pTgt = pTarget + j * nTargetWidth;
+					int i = nBlockX;
+					for (; i + 4 <= nBlockEndX; i += 4) {
+						__m128i c0 = _mm_loadu_si128((const __m128i*)(pSrc + i * nIncX));
+						__m128i c1 = _mm_loadu_si128((const __m128i*)(pSrc + (i + 1) * nIncX));
+						__m128i c2 = _mm_loadu_si128((const __m128i*)(pSrc + (i + 2) * nIncX));
+						__m128i c3 = _mm_loadu_si128((const __m128i*)(pSrc + (i + 3) * nIncX));
+						Transpose4x4Pixels(c0, c1, c2, c3);
+						if (nIncY != 1) {
+							// the columns have been loaded bottom up
+							__m128i t = c0; c0 = c3; c3 = t;
+							t = c1; c1 = c2; c2 = t;
+						}
+						_mm_storeu_si128((__m128i*)(pTgt + i), c0);
+						_mm_storeu_si128((__m128i*)(pTgt + nTargetWidth + i), c1);
+						_mm_storeu_si128((__m128i*)(pTgt + 2 * nTargetWidth + i), c2);
+						_mm_storeu_si128((__m128i*)(pTgt + 3 * nTargetWidth + i), c3);
+					}
+					for (; i < nBlockEndX; i++) {
+						for (int k = 0; k < 4; k++) {
+							pTgt[k * nTargetWidth + i] = pSource[nStart + (j + k) * nIncY + i * nIncX];
+						}
+					}
+				}
+			}
+			for (; j < nBlockEndY; j++) {
+				const uint32* pSrc = pSource + nStart + j * nIncY + nBlockX * nIncX;
+				uint32* pTgt = pTarget + j * nTargetWidth + nBlockX;
+				for (int i = nBlockX; i < nBlockEndX; i++) {
+					*pTgt++ = *pSrc;
+					pSrc += nIncX;
+				}
+			}
 		}
 	}
-	return pTarget;
+}
+
+// Orients the DIB into pTarget on the processing thread pool
+static void OrientDIB32bpp_Parallel(void* pTarget, int nWidth, int nHeight, const void* pDIBPixels, int nRotationAngleCW, bool bMirrorH) {
+	bool bSwapWH = nRotationAngleCW == 90 || nRotationAngleCW == 270;
+	CSize targetSize = bSwapWH ? CSize(nHeight, nWidth) : CSize(nWidth, nHeight);
+	CRequestOrient request(pDIBPixels, CSize(nWidth, nHeight), pTarget, targetSize, nRotationAngleCW, bMirrorH,
+		Helpers::ProbeCPU() >= Helpers::CPU_SSE);
+	CProcessingThreadPool::This().Process(&request);
 }
 
 void* CBasicProcessing::Rotate32bpp(int nWidth, int nHeight, const void* pDIBPixels, int nRotationAngleCW) {
@@ -629,28 +868,23 @@ void* CBasicProcessing::Rotate32bpp(int nWidth, int nHeight, const void* pDIBPix
 	}
 	if (nRotationAngleCW != 90 && nRotationAngleCW != 180 && nRotationAngleCW != 270) {
 		return NULL; // not allowed
-	} else if (nRotationAngleCW == 180) {
-		return Rotate32bpp180(nWidth, nHeight, pDIBPixels);
 	}
 
 	uint32* pTarget = new(std::nothrow) uint32[nHeight * nWidth];
 	if (pTarget == NULL) return NULL;
-	const uint32* pSource = (uint32*)pDIBPixels;
+	OrientDIB32bpp_Parallel(pTarget, nWidth, nHeight, pDIBPixels, nRotationAngleCW, false);
+	return pTarget;
+}
 
-	const int cnBlockSize = 32;
-	int nX = 0, nY = 0;
-	while (nY < nHeight) {
-		nX = 0;
-		while (nX < nWidth) {
-			RotateBlock32bpp(pSource, pTarget, nWidth, nHeight,
-				nX, nY, 
-				min(cnBlockSize, nWidth - nX),
-				min(cnBlockSize, nHeight - nY), nRotationAngleCW == 90);
-			nX += cnBlockSize;
-		}
-		nY += cnBlockSize;
+void* CBasicProcessing::OrientDIB32bpp(void* pTarget, int nWidth, int nHeight, const void* pDIBPixels, int nRotationAngleCW, bool bMirrorH) {
+	if (pDIBPixels == NULL || (nRotationAngleCW != 0 && nRotationAngleCW != 90 && nRotationAngleCW != 180 && nRotationAngleCW != 270)) {
+		return NULL;
 	}
-
+	if (pTarget == NULL) {
+		pTarget = CBufferPool::This().Allocate((size_t)nWidth * nHeight * sizeof(uint32));
+		if (pTarget == NULL) return NULL;
+	}
+	OrientDIB32bpp_Parallel(pTarget, nWidth, nHeight, pDIBPixels, nRotationAngleCW, bMirrorH);
 	return pTarget;
 }
 
@@ -662,28 +896,15 @@ void* CBasicProcessing::Mirror32bpp(int nWidth, int nHeight, const void* pDIBPix
 void* CBasicProcessing::MirrorH32bpp(int nWidth, int nHeight, const void* pDIBPixels) {
 	uint32* pTarget = new(std::nothrow) uint32[nWidth * nHeight];
 	if (pTarget == NULL) return NULL;
-	uint32* pTgt = pTarget;
-	for (int j = 0; j < nHeight; j++) {
-		const uint32* pSource = (uint32*)pDIBPixels + (j + 1) * nWidth - 1;
-		for (int i = 0; i < nWidth; i++) {
-			*pTgt = *pSource;
-			pTgt++; pSource--;
-		}
-	}
+	OrientDIB32bpp_Parallel(pTarget, nWidth, nHeight, pDIBPixels, 0, true);
 	return pTarget;
 }
 
 void* CBasicProcessing::MirrorV32bpp(int nWidth, int nHeight, const void* pDIBPixels) {
 	uint32* pTarget = new(std::nothrow) uint32[nWidth * nHeight];
 	if (pTarget == NULL) return NULL;
-	uint32* pTgt = pTarget;
-	for (int j = 0; j < nHeight; j++) {
-		const uint32* pSource = (uint32*)pDIBPixels + (nHeight - 1 - j) * nWidth;
-		for (int i = 0; i < nWidth; i++) {
-			*pTgt = *pSource;
-			pTgt++; pSource++;
-		}
-	}
+	// vertical mirroring is a rotation by 180 degrees followed by horizontal mirroring
+	OrientDIB32bpp_Parallel(pTarget, nWidth, nHeight, pDIBPixels, 180, true);
 	return pTarget;
 }
 
@@ -712,23 +933,199 @@ void CBasicProcessing::MirrorVInplace(int nWidth, int nHeight, int nStride, void
 	}
 }
 
+// Pixel format conversions: One row converter per conversion, the rows are converted in parallel on the thread pool.
+// The SSSE3 converters use pshufb, SSSE3 is available on all CPUs that support AVX2.
+
+static void ConvertRow8bppPalette(const uint8* pSource, uint8* pTarget, int nWidth, const void* pContext) {
+	const uint32* pPalette = (const uint32*)pContext;
+	uint32* pTgt = (uint32*)pTarget;
+	for (int i = 0; i < nWidth; i++) {
+		pTgt[i] = pPalette[pSource[i]];
+	}
+}
+
+static void ConvertRow32To24bpp(const uint8* pSource, uint8* pTarget, int nWidth, const void* pContext) {
+	const uint32* pSrc = (const uint32*)pSource;
+	int i = 0;
+	for (; i + 4 <= nWidth; i += 4) {
+		// four pixels are packed into three 32 bit words
+		uint32 nWord0 = (pSrc[i] & 0xFFFFFF) | (pSrc[i + 1] << 24);
+		uint32 nWord1 = ((pSrc[i + 1] >> 8) & 0xFFFF) | (pSrc[i + 2] << 16);
+		uint32 nWord2 = ((pSrc[i + 2] >> 16) & 0xFF) | (pSrc[i + 3] << 8);
+		memcpy(pTarget + i * 3, &nWord0, 4);
+		memcpy(pTarget + i * 3 + 4, &nWord1, 4);
+		memcpy(pTarget + i * 3 + 8, &nWord2, 4);
+	}
+	for (; i < nWidth; i++) {
+		pTarget[i * 3] = pSource[i * 4];
+		pTarget[i * 3 + 1] = pSource[i * 4 + 1];
+		pTarget[i * 3 + 2] = pSource[i * 4 + 2];
+	}
+}
+
+static void ConvertRow32To24bpp_SSSE3(const uint8* pSource, uint8* pTarget, int nWidth, const void* pContext) {
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int i = 0;
+	// 16 bytes are stored for 4 pixels (12 bytes), the last 4 bytes are overwritten by the next pixels
+	for (; i + 6 <= nWidth; i += 4) {
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(pSource + i * 4));
+		_mm_storeu_si128((__m128i*)(pTarget + i * 3), _mm_shuffle_epi8(pixels, shuffle));
+	}
+	ConvertRow32To24bpp(pSource + i * 4, pTarget + i * 3, nWidth - i, pContext);
+}
+
+static void ConvertRow1To4Channels(const uint8* pSource, uint8* pTarget, int nWidth, const void* pContext) {
+	uint32* pTgt = (uint32*)pTarget;
+	int i = 0;
+	const __m128i alpha = _mm_set1_epi8((char)0xFF);
+	for (; i + 16 <= nWidth; i += 16) {
+		__m128i gray = _mm_loadu_si128((const __m128i*)(pSource + i));
+		__m128i grayGrayLo = _mm_unpacklo_epi8(gray, gray);
+		__m128i grayGrayHi = _mm_unpackhi_epi8(gray, gray);
+		__m128i grayAlphaLo = _mm_unpacklo_epi8(gray, alpha);
+		__m128i grayAlphaHi = _mm_unpackhi_epi8(gray, alpha);
+		_mm_storeu_si128((__m128i*)(pTgt + i), _mm_unpacklo_epi16(grayGrayLo, grayAlphaLo));
+		_mm_storeu_si128((__m128i*)(pTgt + i + 4), _mm_unpackhi_epi16(grayGrayLo, grayAlphaLo));
+		_mm_storeu_si128((__m128i*)(pTgt + i + 8), _mm_unpacklo_epi16(grayGrayHi, grayAlphaHi));
+		_mm_storeu_si128((__m128i*)(pTgt + i + 12), _mm_unpackhi_epi16(grayGrayHi, grayAlphaHi));
+	}
+	for (; i < nWidth; i++) {
+		pTgt[i] = pSource[i] * 0x010101 + ALPHA_OPAQUE;
+	}
+}
+
+static void ConvertRow16bppGray(const uint8* pSource, uint8* pTarget, int nWidth, const void* pContext) {
+	const int16* pSrc = (const int16*)pSource;
+	const int cnChunkSize = 256;
+	uint8 grayValues[cnChunkSize];
+	for (int i = 0; i < nWidth; i += cnChunkSize) {
+		int nChunk = min(cnChunkSize, nWidth - i);
+		int k = 0;
+		for (; k + 16 <= nChunk; k += 16) {
+			// from 14 to 8 bits
+			__m128i lo = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(pSrc + i + k)), 6);
+			__m128i hi = _mm_srai_epi16(_mm_loadu_si128((const __m128i*)(pSrc + i + k + 8)), 6);
+			_mm_storeu_si128((__m128i*)(grayValues + k), _mm_packus_epi16(lo, hi));
+		}
+		for (; k < nChunk; k++) {
+			grayValues[k] = (uint8)(pSrc[i + k] >> 6);
+		}
+		ConvertRow1To4Channels(grayValues, pTarget + i * 4, nChunk, NULL);
+	}
+}
+
+static void ConvertRow3To4Channels(const uint8* pSource, uint8* pTarget, int nWidth, const void* pContext) {
+	uint32* pTgt = (uint32*)pTarget;
+	int i = 0;
+	for (; i + 4 <= nWidth; i += 4) {
+		// three 32 bit words contain four pixels
+		uint32 nWord0, nWord1, nWord2;
+		memcpy(&nWord0, pSource + i * 3, 4);
+		memcpy(&nWord1, pSource + i * 3 + 4, 4);
+		memcpy(&nWord2, pSource + i * 3 + 8, 4);
+		pTgt[i] = nWord0 | ALPHA_OPAQUE;
+		pTgt[i + 1] = (nWord0 >> 24) | (nWord1 << 8) | ALPHA_OPAQUE;
+		pTgt[i + 2] = (nWord1 >> 16) | (nWord2 << 16) | ALPHA_OPAQUE;
+		pTgt[i + 3] = (nWord2 >> 8) | ALPHA_OPAQUE;
+	}
+	for (; i < nWidth; i++) {
+		pTgt[i] = pSource[i * 3] + pSource[i * 3 + 1] * 256 + pSource[i * 3 + 2] * 65536 + ALPHA_OPAQUE;
+	}
+}
+
+static void ConvertRow3To4Channels_SSSE3(const uint8* pSource, uint8* pTarget, int nWidth, const void* pContext) {
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32(ALPHA_OPAQUE);
+	int i = 0;
+	// 16 bytes are loaded for 4 pixels (12 bytes), stop before reading behind the row
+	for (; i + 6 <= nWidth; i += 4) {
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(pSource + i * 3));
+		_mm_storeu_si128((__m128i*)(pTarget + i * 4), _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha));
+	}
+	ConvertRow3To4Channels(pSource + i * 3, pTarget + i * 4, nWidth - i, pContext);
+}
+
+static void ConvertRowSetAlpha(const uint8* pSource, uint8* pTarget, int nWidth, const void* pContext) {
+	const uint32* pSrc = (const uint32*)pSource;
+	uint32* pTgt = (uint32*)pTarget;
+	const __m128i alpha = _mm_set1_epi32(ALPHA_OPAQUE);
+	int i = 0;
+	for (; i + 4 <= nWidth; i += 4) {
+		_mm_storeu_si128((__m128i*)(pTgt + i), _mm_or_si128(_mm_loadu_si128((const __m128i*)(pSrc + i)), alpha));
+	}
+	for (; i < nWidth; i++) {
+		pTgt[i] = pSrc[i] | ALPHA_OPAQUE;
+	}
+}
+
+static void ConvertRowRGBAToBGRA(const uint8* pSource, uint8* pTarget, int nWidth, const void* pContext) {
+	const uint32* pSrc = (const uint32*)pSource;
+	uint32* pTgt = (uint32*)pTarget;
+	const __m128i maskGA = _mm_set1_epi32(0xFF00FF00);
+	const __m128i maskB = _mm_set1_epi32(0x000000FF);
+	int i = 0;
+	for (; i + 4 <= nWidth; i += 4) {
+		// swap the bytes 0 and 2 of each pixel
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(pSrc + i));
+		__m128i swapped = _mm_or_si128(_mm_and_si128(pixels, maskGA),
+			_mm_or_si128(_mm_and_si128(_mm_srli_epi32(pixels, 16), maskB), _mm_slli_epi32(_mm_and_si128(pixels, maskB), 16)));
+		_mm_storeu_si128((__m128i*)(pTgt + i), swapped);
+	}
+	for (; i < nWidth; i++) {
+		uint32 nPixel = pSrc[i];
+		pTgt[i] = (nPixel & 0xFF00FF00) | ((nPixel >> 16) & 0xFF) | ((nPixel & 0xFF) << 16);
+	}
+}
+
+typedef void (*ConvertRowFunction)(const uint8* pSource, uint8* pTarget, int nWidth, const void* pContext);
+
+// Strides are in bytes and may be negative (bottom-up images)
+class CRequestConvertRows : public CProcessingRequest {
+public:
+	CRequestConvertRows(const void* pSourcePixels, int nSourceStride, void* pTargetPixels, int nTargetStride,
+		int nWidth, int nHeight, ConvertRowFunction pConvertRow, const void* pContext)
+		: CProcessingRequest(pSourcePixels, CSize(nWidth, nHeight), pTargetPixels, CSize(nWidth, nHeight), CPoint(0, 0), CSize(nWidth, nHeight)) {
+		SourceStride = nSourceStride;
+		TargetStride = nTargetStride;
+		ConvertRow = pConvertRow;
+		Context = pContext;
+	}
+
+	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		for (int j = offsetY; j < offsetY + sizeY; j++) {
+			ConvertRow((const uint8*)SourcePixels + (ptrdiff_t)SourceStride * j, (uint8*)TargetPixels + (ptrdiff_t)TargetStride * j,
+				ClippedTargetSize.cx, Context);
+		}
+		return true;
+	}
+
+	int SourceStride;
+	int TargetStride;
+	ConvertRowFunction ConvertRow;
+	const void* Context;
+};
+
+static void ConvertRows(const void* pSource, int nSourceStride, void* pTarget, int nTargetStride, int nWidth, int nHeight,
+	ConvertRowFunction pConvertRow, const void* pContext = NULL) {
+	CRequestConvertRows request(pSource, nSourceStride, pTarget, nTargetStride, nWidth, nHeight, pConvertRow, pContext);
+	CProcessingThreadPool::This().Process(&request);
+}
+
+static bool SupportsSSSE3() {
+	return Helpers::ProbeCPU() >= Helpers::CPU_AVX2;
+}
+
 void* CBasicProcessing::Convert8bppTo32bppDIB(int nWidth, int nHeight, const void* pDIBPixels, const uint8* pPalette) {
 	if (pDIBPixels == NULL || pPalette == NULL) {
 		return NULL;
 	}
-	int nPaddedWidthS = Helpers::DoPadding(nWidth, 4);
-	int nPadS = nPaddedWidthS - nWidth;
 	uint32* pNewDIB = new(std::nothrow) uint32[nWidth * nHeight];
 	if (pNewDIB == NULL) return NULL;
-	uint32* pTargetDIB = pNewDIB;
-	const uint8* pSourceDIB = (uint8*)pDIBPixels;
-	for (int j = 0; j < nHeight; j++) {
-		for (int i = 0; i < nWidth; i++) {
-			*pTargetDIB++ = pPalette[4 * *pSourceDIB] + pPalette[4 * *pSourceDIB + 1] * 256 + pPalette[4 * *pSourceDIB + 2] * 65536 + ALPHA_OPAQUE;
-			pSourceDIB ++;
-		}
-		pSourceDIB += nPadS;
+	uint32 palette[256];
+	for (int i = 0; i < 256; i++) {
+		palette[i] = pPalette[4 * i] + pPalette[4 * i + 1] * 256 + pPalette[4 * i + 2] * 65536 + ALPHA_OPAQUE;
 	}
+	ConvertRows(pDIBPixels, Helpers::DoPadding(nWidth, 4), pNewDIB, nWidth * 4, nWidth, nHeight, ConvertRow8bppPalette, palette);
 	return pNewDIB;
 }
 
@@ -737,56 +1134,25 @@ void CBasicProcessing::Convert32bppTo24bppDIB(int nWidth, int nHeight, void* pDI
 	if (pDIBTarget == NULL || pDIBSource == NULL) {
 		return;
 	}
-	int nPaddedWidth = Helpers::DoPadding(nWidth*3, 4);
-	int nPad = nPaddedWidth - nWidth*3;
-	uint8* pTargetDIB = (uint8*)pDIBTarget;
-	for (int j = 0; j < nHeight; j++) {
-		const uint8* pSourceDIB;
-		if (bFlip) {
-			pSourceDIB = (uint8*)pDIBSource + (nHeight - 1 - j)*nWidth*4;
-		} else {
-			pSourceDIB = (uint8*)pDIBSource + j*nWidth*4;
-		}
-		for (int i = 0; i < nWidth; i++) {
-			*pTargetDIB++ = pSourceDIB[0];
-			*pTargetDIB++ = pSourceDIB[1];
-			*pTargetDIB++ = pSourceDIB[2];
-			pSourceDIB += 4;
-		}
-		pTargetDIB += nPad;
-	}
+	const uint8* pSource = bFlip ? (const uint8*)pDIBSource + (nHeight - 1) * nWidth * 4 : (const uint8*)pDIBSource;
+	ConvertRows(pSource, bFlip ? -nWidth * 4 : nWidth * 4, pDIBTarget, Helpers::DoPadding(nWidth * 3, 4), nWidth, nHeight,
+		SupportsSSSE3() ? ConvertRow32To24bpp_SSSE3 : ConvertRow32To24bpp);
 }
 
 void* CBasicProcessing::Convert1To4Channels(int nWidth, int nHeight, const void* pPixels) {
 	if (pPixels == NULL) {
 		return NULL;
 	}
-	int nPadSrc = Helpers::DoPadding(nWidth, 4) - nWidth;
 	uint32* pNewDIB = new(std::nothrow) uint32[nWidth * nHeight];
 	if (pNewDIB == NULL) return NULL;
-	uint32* pTarget = pNewDIB;
-	const uint8* pSource = (uint8*)pPixels;
-	for (int j = 0; j < nHeight; j++) {
-		for (int i = 0; i < nWidth; i++) {
-			*pTarget++ = *pSource + *pSource * 256 + *pSource * 65536 + ALPHA_OPAQUE;
-			pSource++;
-		}
-		pSource += nPadSrc;
-	}
+	ConvertRows(pPixels, Helpers::DoPadding(nWidth, 4), pNewDIB, nWidth * 4, nWidth, nHeight, ConvertRow1To4Channels);
 	return pNewDIB;
 }
 
 void* CBasicProcessing::Convert16bppGrayTo32bppDIB(int nWidth, int nHeight, const int16* pPixels) {
 	uint32* pNewDIB = new(std::nothrow) uint32[nWidth * nHeight];
 	if (pNewDIB == NULL) return NULL;
-	uint32* pTarget = pNewDIB;
-	const int16* pSource = pPixels;
-	for (int j = 0; j < nHeight; j++) {
-		for (int i = 0; i < nWidth; i++) {
-			int nSourceValue = *pSource++ >> 6; // from 14 to 8 bits
-			*pTarget++ = nSourceValue + nSourceValue * 256 + nSourceValue * 65536 + ALPHA_OPAQUE;
-		}
-	}
+	ConvertRows(pPixels, nWidth * sizeof(int16), pNewDIB, nWidth * 4, nWidth, nHeight, ConvertRow16bppGray);
 	return pNewDIB;
 }
 
@@ -795,18 +1161,10 @@ void* CBasicProcessing::Convert3To4Channels(int nWidth, int nHeight, const void*
 	if (pIJLPixels == NULL) {
 		return NULL;
 	}
-	int nPadSrc = Helpers::DoPadding(nWidth*3, 4) - nWidth*3;
 	uint32* pNewDIB = new(std::nothrow) uint32[nWidth * nHeight];
 	if (pNewDIB == NULL) return NULL;
-	uint32* pTarget = pNewDIB;
-	const uint8* pSource = (uint8*)pIJLPixels;
-	for (int j = 0; j < nHeight; j++) {
-		for (int i = 0; i < nWidth; i++) {
-			*pTarget++ = pSource[0] + pSource[1] * 256 + pSource[2] * 65536 + ALPHA_OPAQUE;
-			pSource += 3;
-		}
-		pSource += nPadSrc;
-	}
+	ConvertRows(pIJLPixels, Helpers::DoPadding(nWidth * 3, 4), pNewDIB, nWidth * 4, nWidth, nHeight,
+		SupportsSSSE3() ? ConvertRow3To4Channels_SSSE3 : ConvertRow3To4Channels);
 	return pNewDIB;
 }
 
@@ -816,17 +1174,17 @@ void* CBasicProcessing::ConvertGdiplus32bppRGB(int nWidth, int nHeight, int nStr
 	}
 	uint32* pNewDIB = new(std::nothrow) uint32[nWidth * nHeight];
 	if (pNewDIB == NULL) return NULL;
-	uint32* pTgt = pNewDIB;
-	const uint8* pSrc = (const uint8*)pGdiplusPixels;
-	for (int j = 0; j < nHeight; j++) {
-		for (int i = 0; i < nWidth; i++)
-			pTgt[i] = ((uint32*)pSrc)[i] | ALPHA_OPAQUE;
-		pTgt += nWidth;
-		pSrc += nStride;
-	}
+	ConvertRows(pGdiplusPixels, nStride, pNewDIB, nWidth * 4, nWidth, nHeight, ConvertRowSetAlpha);
 	return pNewDIB;
 }
 
+void CBasicProcessing::ConvertRGBAToBGRA(int nWidth, int nHeight, int nStride, const void* pSource, void* pTarget) {
+	if (pSource == NULL || pTarget == NULL) {
+		return;
+	}
+	ConvertRows(pSource, nStride, pTarget, nWidth * 4, nWidth, nHeight, ConvertRowRGBAToBGRA);
+}
+
 void* CBasicProcessing::CopyRect32bpp(void* pTarget, const void* pSource,  CSize targetSize, CRect targetRect,
 									  CSize sourceSize, CRect sourceRect) {
 	if (pSource == NULL || sourceRect.Size() != targetRect.Size() || 
@@ -839,18 +1197,15 @@ void* CBasicProcessing::CopyRect32bpp(void* pTarget, const void* pSource,  CSize
 	uint32* pSourceDIB = (uint32*)pSource;
 	uint32* pTargetDIB = (uint32*)pTarget;
 	if (pTargetDIB == NULL) {
-		pTargetDIB = new(std::nothrow) uint32[targetSize.cx * targetSize.cy];
+		pTargetDIB = (uint32*)CBufferPool::This().Allocate((size_t)targetSize.cx * targetSize.cy * sizeof(uint32));
 		if (pTargetDIB == NULL) return NULL;
 		pTarget = pTargetDIB;
 	}
 
 	pTargetDIB += (targetRect.top * targetSize.cx) + targetRect.left;
 	pSourceDIB += (sourceRect.top * sourceSize.cx) + sourceRect.left;
-	for (int y = 0; y < sourceRect.Height(); y++) {
-		memcpy(pTargetDIB, pSourceDIB, sourceRect.Width()*sizeof(uint32));
-		pTargetDIB += targetSize.cx;
-		pSourceDIB += sourceSize.cx;
-	}
+	CRequestCopyRect request(pSourceDIB, sourceSize.cx, pTargetDIB, targetSize.cx, sourceRect.Size(), false);
+	CProcessingThreadPool::This().Process(&request);
 
 	return pTarget;
 }
@@ -860,8 +1215,46 @@ void* CBasicProcessing::Crop32bpp(int nWidth, int nHeight, const void* pDIBPixel
 		return NULL;
 	}
 
-	return CopyRect32bpp(NULL, pDIBPixels, cropRect.Size(), CRect(0, 0, cropRect.Width(), cropRect.Height()),
-		CSize(nWidth, nHeight), cropRect);
+	if (cropRect.left < 0 || cropRect.top < 0 || cropRect.right > nWidth || cropRect.bottom > nHeight) {
+		return NULL;
+	}
+
+	// not allocated from the buffer pool, the cropped image replaces the original image
+	uint32* pTarget = new(std::nothrow) uint32[cropRect.Width() * cropRect.Height()];
+	if (pTarget == NULL) return NULL;
+	// the cropped image of a large image is not read again soon, thus it is written bypassing the caches
+	bool bNonTemporal = (size_t)cropRect.Width() * cropRect.Height() * sizeof(uint32) >= NON_TEMPORAL_COPY_MIN_BYTES &&
+		Helpers::ProbeCPU() >= Helpers::CPU_SSE;
+	CRequestCopyRect request((const uint32*)pDIBPixels + cropRect.top * nWidth + cropRect.left, nWidth,
+		pTarget, cropRect.Width(), cropRect.Size(), bNonTemporal);
+	CProcessingThreadPool::This().Process(&request);
+	return pTarget;
+}
+
+static void CopyRect32bpp_Core(uint32* pTarget, int nTargetStride, const uint32* pSource, int nSourceStride,
+	CSize rectSize, bool bNonTemporal) {
+	for (int j = 0; j < rectSize.cy; j++) {
+		if (bNonTemporal) {
+			// streaming stores need 16 byte aligned targets
+			int i = 0;
+			for (; i < rectSize.cx && ((PTR_INTEGRAL_TYPE)(pTarget + i) & 15) != 0; i++) {
+				pTarget[i] = pSource[i];
+			}
+			for (; i + 4 <= rectSize.cx; i += 4) {
+				_mm_stream_si128((__m128i*)(pTarget + i), _mm_loadu_si128((const __m128i*)(pSource + i)));
+			}
+			for (; i < rectSize.cx; i++) {
+				pTarget[i] = pSource[i];
+			}
+		} else {
+			memcpy(pTarget, pSource, rectSize.cx * sizeof(uint32));
+		}
+		pTarget += nTargetStride;
+		pSource += nSourceStride;
+	}
+	if (bNonTemporal) {
+		_mm_sfence();
+	}
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -875,11 +1268,11 @@ void* CBasicProcessing::PointSample(CSize fullTargetSize, CPoint fullTargetOffse
 		fullTargetOffset.x < 0 || fullTargetOffset.x < 0 ||
 		clippedTargetSize.cx + fullTargetOffset.x > fullTargetSize.cx ||
 		clippedTargetSize.cy + fullTargetOffset.y > fullTargetSize.cy ||
-		pPixels == NULL || (nChannels != 3 && nChannels != 4)) {
+		pPixels == NULL || (nChannels != 1 && nChannels != 3 && nChannels != 4)) {
 		return NULL;
 	}
 
-	uint8* pDIB = new(std::nothrow) uint8[clippedTargetSize.cx*4 * clippedTargetSize.cy];
+	uint8* pDIB = (uint8*)CBufferPool::This().Allocate((size_t)clippedTargetSize.cx*4 * clippedTargetSize.cy);
 	if (pDIB == NULL) return NULL;
 
 	uint32 nIncrementX, nIncrementY;
@@ -912,6 +1305,11 @@ void* CBasicProcessing::PointSample(CSize fullTargetSize, CPoint fullTargetOffse
 				pDst[d+3] = 0xFF;
 				nCurX += nIncrementX;
 			}
+		} else if (nChannels == 1) {
+			for (int i = 0; i < clippedTargetSize.cx; i++) {
+				((uint32*)pDst)[i] = pSrc[nCurX >> 16] * 0x010101 + ALPHA_OPAQUE;
+				nCurX += nIncrementX;
+			}
 		} else {
 			for (int i = 0; i < clippedTargetSize.cx; i++) {
 				uint32 sx = nCurX >> 16; 
@@ -932,21 +1330,10 @@ static void RotateInplace(double& dX, double& dY, double dAngle) {
 	dY = dYr;
 }
 
-void* CBasicProcessing::PointSampleWithRotation(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, 
-	CSize sourceSize, double dRotation, const void* pPixels, int nChannels, COLORREF backColor) {
-	if (fullTargetSize.cx < 1 || fullTargetSize.cy < 1 ||
-		clippedTargetSize.cx < 1 || clippedTargetSize.cy < 1 ||
-		fullTargetOffset.x < 0 || fullTargetOffset.x < 0 ||
-		clippedTargetSize.cx + fullTargetOffset.x > fullTargetSize.cx ||
-		clippedTargetSize.cy + fullTargetOffset.y > fullTargetSize.cy ||
-		pPixels == NULL || (nChannels != 3 && nChannels != 4)) {
-		return NULL;
-	}
-
-	uint8* pDIB = new(std::nothrow) uint8[clippedTargetSize.cx*4 * clippedTargetSize.cy];
-	if (pDIB == NULL) return NULL;
-
-	uint32 nBackColor = (GetRValue(backColor) << 16) + (GetGValue(backColor) << 8) + GetBValue(backColor) + ALPHA_OPAQUE;
+// Calculates the source position of the target pixel at fullTargetOffset (nX, nY) and the source position increments for one
+// target pixel in x-direction (nIncrementX1, nIncrementY1) and in y-direction (nIncrementX2, nIncrementY2), all in 16.16 fixed point
+static void CalculateRotationMapping(CSize fullTargetSize, CPoint fullTargetOffset, CSize sourceSize, double dRotation,
+	int32& nX, int32& nY, int32& nIncrementX1, int32& nIncrementY1, int32& nIncrementX2, int32& nIncrementY2) {
 	double dFirstX = -(sourceSize.cx - 1) * 0.5;
 	double dFirstY = -(sourceSize.cy - 1) * 0.5;
 	double dIncX1 = dFirstX + ((fullTargetSize.cx == 1) ? 0 : (double)(sourceSize.cx)/(fullTargetSize.cx - 1));
@@ -963,16 +1350,35 @@ void* CBasicProcessing::PointSampleWithRotation(CSize fullTargetSize, CPoint ful
 
 	int32 nFirstX = Helpers::RoundToInt(65536 * (dFirstX + (sourceSize.cx - 1) * 0.5));
 	int32 nFirstY = Helpers::RoundToInt(65536 * (dFirstY + (sourceSize.cy - 1) * 0.5));
-	int32 nIncrementX1 = Helpers::RoundToInt(65536 * dIncX1);
-	int32 nIncrementY1 = Helpers::RoundToInt(65536 * dIncY1);
-	int32 nIncrementX2 = Helpers::RoundToInt(65536 * dIncX2);
-	int32 nIncrementY2 = Helpers::RoundToInt(65536 * dIncY2);
+	nIncrementX1 = Helpers::RoundToInt(65536 * dIncX1);
+	nIncrementY1 = Helpers::RoundToInt(65536 * dIncY1);
+	nIncrementX2 = Helpers::RoundToInt(65536 * dIncX2);
+	nIncrementY2 = Helpers::RoundToInt(65536 * dIncY2);
+	nX = nFirstX + fullTargetOffset.x * nIncrementX1 + fullTargetOffset.y * nIncrementX2;
+	nY = nFirstY + fullTargetOffset.x * nIncrementY1 + fullTargetOffset.y * nIncrementY2;
+}
+
+void* CBasicProcessing::PointSampleWithRotation(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, 
+	CSize sourceSize, double dRotation, const void* pPixels, int nChannels, COLORREF backColor) {
+	if (fullTargetSize.cx < 1 || fullTargetSize.cy < 1 ||
+		clippedTargetSize.cx < 1 || clippedTargetSize.cy < 1 ||
+		fullTargetOffset.x < 0 || fullTargetOffset.x < 0 ||
+		clippedTargetSize.cx + fullTargetOffset.x > fullTargetSize.cx ||
+		clippedTargetSize.cy + fullTargetOffset.y > fullTargetSize.cy ||
+		pPixels == NULL || (nChannels != 3 && nChannels != 4)) {
+		return NULL;
+	}
+
+	uint8* pDIB = (uint8*)CBufferPool::This().Allocate((size_t)clippedTargetSize.cx*4 * clippedTargetSize.cy);
+	if (pDIB == NULL) return NULL;
+
+	uint32 nBackColor = (GetRValue(backColor) << 16) + (GetGValue(backColor) << 8) + GetBValue(backColor) + ALPHA_OPAQUE;
+	int32 nX, nY, nIncrementX1, nIncrementY1, nIncrementX2, nIncrementY2;
+	CalculateRotationMapping(fullTargetSize, fullTargetOffset, sourceSize, dRotation, nX, nY, nIncrementX1, nIncrementY1, nIncrementX2, nIncrementY2);
 
 	int nPaddedSourceWidth = Helpers::DoPadding(sourceSize.cx * nChannels, 4);
 	const uint8* pSrc = NULL;
 	uint8* pDst = pDIB;
-	int32 nX = nFirstX + fullTargetOffset.x * nIncrementX1 + fullTargetOffset.y * nIncrementX2;
-	int32 nY = nFirstY + fullTargetOffset.x * nIncrementY1 + fullTargetOffset.y * nIncrementY2;
 	for (int j = 0; j < clippedTargetSize.cy; j++) {
 		int nCurX = nX;
 		int nCurY = nY;
@@ -1094,7 +1500,7 @@ void* CBasicProcessing::PointSampleTrapezoid(CSize fullTargetSize, const CTrapez
 		return NULL;
 	}
 
-	uint8* pDIB = new(std::nothrow) uint8[clippedTargetSize.cx*4 * clippedTargetSize.cy];
+	uint8* pDIB = (uint8*)CBufferPool::This().Allocate((size_t)clippedTargetSize.cx*4 * clippedTargetSize.cy);
 	if (pDIB == NULL) return NULL;
 
 	int* pTableY = CalculateTrapezoidYIntersectionTable(fullTargetTrapezoid, clippedTargetSize.cy, sourceSize.cy, fullTargetSize.cy, fullTargetOffset.y);
@@ -1151,6 +1557,202 @@ void* CBasicProcessing::PointSampleTrapezoid(CSize fullTargetSize, const CTrapez
 	return pDIB;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Bilinear sampling with rotation and trapezoid mapping, used for the interactive preview
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+// Bilinear interpolation of the pixel at source position nX, nY (16.16 fixed point) into a 32 bit pixel.
+// The weights have 7 bits precision. The neighbours are clamped to the image border, (nX >> 16, nY >> 16) must be inside the image.
+template<int nChannels>
+static inline uint32 InterpolateBilinear(const uint8* pPixels, int nPaddedSourceWidth, CSize sourceSize, int32 nX, int32 nY) {
+	int nX0 = nX >> 16;
+	int nY0 = nY >> 16;
+	int nX1 = min(nX0 + 1, sourceSize.cx - 1);
+	int nY1 = min(nY0 + 1, sourceSize.cy - 1);
+	int32 nWeightX = (nX >> 9) & 127;
+	int32 nWeightY = (nY >> 9) & 127;
+	const uint8* pTop = pPixels + nPaddedSourceWidth * nY0;
+	const uint8* pBottom = pPixels + nPaddedSourceWidth * nY1;
+	uint32 nResult = 0;
+	for (int c = 0; c < nChannels; c++) {
+		int32 nTop = pTop[nX0 * nChannels + c] * (128 - nWeightX) + pTop[nX1 * nChannels + c] * nWeightX;
+		int32 nBottom = pBottom[nX0 * nChannels + c] * (128 - nWeightX) + pBottom[nX1 * nChannels + c] * nWeightX;
+		nResult |= (uint32)((nTop * (128 - nWeightY) + nBottom * nWeightY + 8192) >> 14) << (8 * c);
+	}
+	return (nChannels == 1) ? nResult * 0x010101 + ALPHA_OPAQUE : (nChannels == 3) ? (nResult | ALPHA_OPAQUE) : nResult;
+}
+
+// SSE2 implementation of InterpolateBilinear(), the result is identical.
+// Reads 8 bytes from two source rows, thus (nX >> 16) must be smaller than sourceSize.cx - 2 for 3 channels
+// respectively sourceSize.cx - 1 for 4 channels and (nY >> 16) must be smaller than sourceSize.cy - 1.
+template<int nChannels>
+static inline uint32 InterpolateBilinear_SSE(const uint8* pPixels, int nPaddedSourceWidth, int32 nX, int32 nY) {
+	const __m128i zero = _mm_setzero_si128();
+	int32 nWeightX = (nX >> 9) & 127;
+	int32 nWeightY = (nY >> 9) & 127;
+	__m128i weightsX = _mm_set1_epi32((128 - nWeightX) | (nWeightX << 16));
+	__m128i weightsY = _mm_set1_epi32((128 - nWeightY) | (nWeightY << 16));
+	const uint8* pTop = pPixels + nPaddedSourceWidth * (nY >> 16) + (nX >> 16) * nChannels;
+	__m128i top = _mm_loadl_epi64((const __m128i*)pTop);
+	__m128i bottom = _mm_loadl_epi64((const __m128i*)(pTop + nPaddedSourceWidth));
+	// interleave the left and right pixel channelwise (B0 B1 G0 G1 R0 R1 A0 A1) and weight them
+	top = _mm_unpacklo_epi8(_mm_unpacklo_epi8(top, _mm_srli_si128(top, nChannels)), zero);
+	bottom = _mm_unpacklo_epi8(_mm_unpacklo_epi8(bottom, _mm_srli_si128(bottom, nChannels)), zero);
+	__m128i horizontal = _mm_packs_epi32(_mm_madd_epi16(top, weightsX), _mm_madd_epi16(bottom, weightsX));
+	// same for the top and bottom values
+	__m128i vertical = _mm_unpacklo_epi16(horizontal, _mm_srli_si128(horizontal, 8));
+	__m128i result = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(vertical, weightsY), _mm_set1_epi32(8192)), 14);
+	result = _mm_packus_epi16(_mm_packs_epi32(result, zero), zero);
+	uint32 nResult = (uint32)_mm_cvtsi128_si32(result);
+	return (nChannels == 3) ? (nResult | ALPHA_OPAQUE) : nResult;
+}
+
+// Applies the LUTs and the LDC to one row sampled by BilinearSample_Core(). The LDC map is interpolated at the source position
+// of each pixel and not at the target position, so that it stays aligned to the image content when rotating or mapping to a trapezoid.
+static void ApplyLDCAtSourcePosition(uint32* pPixels, int nNumPixels, const CBilinearRowMapping& rowMapping, CSize sourceSize,
+	const CBasicProcessing::Corrections& corrections, const int32* pMulLUT) {
+	CSize ldcMapSize = corrections.LDCMapSize;
+	double dScaleX = (sourceSize.cx == 1) ? 0.0 : (double)(ldcMapSize.cx - 1)/(sourceSize.cx - 1);
+	double dScaleY = (sourceSize.cy == 1) ? 0.0 : (double)(ldcMapSize.cy - 1)/(sourceSize.cy - 1);
+	int32 nMapX = Helpers::RoundToInt(rowMapping.X * dScaleX);
+	int32 nMapY = Helpers::RoundToInt(rowMapping.Y * dScaleY);
+	int32 nMapIncrementX = Helpers::RoundToInt(rowMapping.IncrementX * dScaleX);
+	int32 nMapIncrementY = Helpers::RoundToInt(rowMapping.IncrementY * dScaleY);
+	// the last row and column of the map are only used as right respectively bottom neighbour
+	int32 nMaxMapX = max(0, ((ldcMapSize.cx - 1) << 16) - 1);
+	int32 nMaxMapY = max(0, ((ldcMapSize.cy - 1) << 16) - 1);
+	for (int i = 0; i < nNumPixels; i++) {
+		int32 nMaskValue = InterpolateLDCMask(corrections.LDCMap, ldcMapSize.cx, max(0, min(nMaxMapX, nMapX)), max(0, min(nMaxMapY, nMapY)));
+		pPixels[i] = ApplyLUTsAndLDCToPixel(pPixels[i], nMaskValue, corrections.SatLUTs, corrections.LUT, pMulLUT);
+		nMapX += nMapIncrementX;
+		nMapY += nMapIncrementY;
+	}
+}
+
+template<int nChannels>
+static void BilinearSample_Core(const CBilinearRowMapping* pRowMappings, CSize dibSize, CSize sourceSize,
+	const void* pSourcePixels, uint32 nBackColor, bool bUseSSE, const CBasicProcessing::Corrections* pCorrections, uint32* pTarget) {
+	const uint8* pPixels = (const uint8*)pSourcePixels;
+	int nPaddedSourceWidth = Helpers::DoPadding(sourceSize.cx * nChannels, 4);
+	// in this area the SSE implementation can read all neighbours without clamping, there is no SSE implementation for one channel
+	int nMaxInnerX = sourceSize.cx - ((nChannels == 3) ? 3 : 2);
+	bUseSSE = bUseSSE && nChannels != 1;
+	int nMaxInnerY = sourceSize.cy - 2;
+	bool bLDC = pCorrections != NULL && pCorrections->LDCMap != NULL;
+	const int32* pMulLUT = bLDC ? CreateMulLUT(pCorrections->BlackPt, pCorrections->WhitePt, pCorrections->BlackPtSteepness) : NULL;
+	for (int j = 0; j < dibSize.cy; j++) {
+		const CBilinearRowMapping& rowMapping = pRowMappings[j];
+		uint32* pDst = pTarget + dibSize.cx * j;
+		int32 nX = rowMapping.X;
+		int32 nY = rowMapping.Y;
+		for (int i = 0; i < dibSize.cx; i++) {
+			int nX0 = nX >> 16;
+			int nY0 = nY >> 16;
+			if (nX0 < 0 || nX0 >= sourceSize.cx || nY0 < 0 || nY0 >= sourceSize.cy) {
+				pDst[i] = nBackColor;
+			} else if (bUseSSE && nX0 <= nMaxInnerX && nY0 <= nMaxInnerY) {
+				pDst[i] = InterpolateBilinear_SSE<nChannels>(pPixels, nPaddedSourceWidth, nX, nY);
+			} else {
+				pDst[i] = InterpolateBilinear<nChannels>(pPixels, nPaddedSourceWidth, sourceSize, nX, nY);
+			}
+			nX += rowMapping.IncrementX;
+			nY += rowMapping.IncrementY;
+		}
+		// apply the corrections while the row is in the cache
+		if (bLDC) {
+			ApplyLDCAtSourcePosition(pDst, dibSize.cx, rowMapping, sourceSize, *pCorrections, pMulLUT);
+		} else if (pCorrections != NULL) {
+			ApplyCorrections32bpp_Core(dibSize, CPoint(0, 0), CSize(dibSize.cx, 1), pDst, *pCorrections);
+		}
+	}
+	delete[] pMulLUT;
+}
+
+static void* BilinearSample(CSize clippedTargetSize, const CBilinearRowMapping* pRowMappings, CSize sourceSize, const void* pPixels,
+	int nChannels, COLORREF backColor, bool bUseSSE, const CBasicProcessing::Corrections* pCorrections) {
+	uint32* pDIB = (uint32*)CBufferPool::This().Allocate((size_t)clippedTargetSize.cx*4 * clippedTargetSize.cy);
+	if (pDIB == NULL) return NULL;
+
+	uint32 nBackColor = (GetRValue(backColor) << 16) + (GetGValue(backColor) << 8) + GetBValue(backColor) + ALPHA_OPAQUE;
+	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
+	CRequestBilinearSample request(pPixels, sourceSize, pDIB, clippedTargetSize, pRowMappings, nChannels, nBackColor, bUseSSE, pCorrections);
+	if (!threadPool.Process(&request)) {
+		CBufferPool::This().Free(pDIB);
+		return NULL;
+	}
+	return pDIB;
+}
+
+void* CBasicProcessing::BilinearSampleWithRotation(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, 
+	CSize sourceSize, double dRotation, const void* pPixels, int nChannels, COLORREF backColor, bool bUseSSE,
+	const Corrections* pCorrections) {
+	if (fullTargetSize.cx < 1 || fullTargetSize.cy < 1 ||
+		clippedTargetSize.cx < 1 || clippedTargetSize.cy < 1 ||
+		fullTargetOffset.x < 0 || fullTargetOffset.y < 0 ||
+		clippedTargetSize.cx + fullTargetOffset.x > fullTargetSize.cx ||
+		clippedTargetSize.cy + fullTargetOffset.y > fullTargetSize.cy ||
+		pPixels == NULL || (nChannels != 1 && nChannels != 3 && nChannels != 4)) {
+		return NULL;
+	}
+
+	CBilinearRowMapping* pRowMappings = new(std::nothrow) CBilinearRowMapping[clippedTargetSize.cy];
+	if (pRowMappings == NULL) return NULL;
+
+	int32 nX, nY, nIncrementX1, nIncrementY1, nIncrementX2, nIncrementY2;
+	CalculateRotationMapping(fullTargetSize, fullTargetOffset, sourceSize, dRotation, nX, nY, nIncrementX1, nIncrementY1, nIncrementX2, nIncrementY2);
+	for (int j = 0; j < clippedTargetSize.cy; j++) {
+		pRowMappings[j].X = nX;
+		pRowMappings[j].Y = nY;
+		pRowMappings[j].IncrementX = nIncrementX1;
+		pRowMappings[j].IncrementY = nIncrementY1;
+		nX += nIncrementX2;
+		nY += nIncrementY2;
+	}
+
+	void* pDIB = BilinearSample(clippedTargetSize, pRowMappings, sourceSize, pPixels, nChannels, backColor, bUseSSE, pCorrections);
+	delete[] pRowMappings;
+	return pDIB;
+}
+
+void* CBasicProcessing::BilinearSampleTrapezoid(CSize fullTargetSize, const CTrapezoid& fullTargetTrapezoid, CPoint fullTargetOffset, CSize clippedTargetSize, 
+	CSize sourceSize, const void* pPixels, int nChannels, COLORREF backColor, bool bUseSSE, const Corrections* pCorrections) {
+	if (fullTargetSize.cx < 1 || fullTargetSize.cy < 1 ||
+		(fullTargetTrapezoid.x1e - fullTargetTrapezoid.x1s) <= 0  ||
+		(fullTargetTrapezoid.x2e - fullTargetTrapezoid.x2s) <= 0  ||
+		clippedTargetSize.cx < 1 || clippedTargetSize.cy < 1 ||
+		fullTargetOffset.x < 0 || fullTargetOffset.y < 0 ||
+		clippedTargetSize.cx + fullTargetOffset.x > fullTargetSize.cx ||
+		clippedTargetSize.cy + fullTargetOffset.y > fullTargetSize.cy ||
+		pPixels == NULL || (nChannels != 1 && nChannels != 3 && nChannels != 4)) {
+		return NULL;
+	}
+
+	CBilinearRowMapping* pRowMappings = new(std::nothrow) CBilinearRowMapping[clippedTargetSize.cy];
+	if (pRowMappings == NULL) return NULL;
+
+	// same mapping as in PointSampleTrapezoid()
+	int* pTableY = CalculateTrapezoidYIntersectionTable(fullTargetTrapezoid, clippedTargetSize.cy, sourceSize.cy, fullTargetSize.cy, fullTargetOffset.y);
+	float fIncrementTx1 = ((float)(fullTargetTrapezoid.x2s - fullTargetTrapezoid.x1s))/fullTargetTrapezoid.Height();
+	float fIncrementTx2 = ((float)(fullTargetTrapezoid.x2e - fullTargetTrapezoid.x1e))/fullTargetTrapezoid.Height();
+	float fTx1 = (fullTargetTrapezoid.x1s - fullTargetTrapezoid.x2s)*0.5f + fullTargetOffset.y*fIncrementTx1;
+	float fTx2 = (fullTargetTrapezoid.x1s - fullTargetTrapezoid.x2s)*0.5f + fullTargetTrapezoid.x1e - fullTargetTrapezoid.x1s + fullTargetOffset.y*fIncrementTx2;
+	int nSourceSizeXFP16 = sourceSize.cx << 16;
+	for (int j = 0; j < clippedTargetSize.cy; j++) {
+		int nIncrementX = (int)(nSourceSizeXFP16/(fTx2 - fTx1 + 1)) + 1;
+		pRowMappings[j].X = (int)((fullTargetOffset.x - fTx1)*nIncrementX);
+		pRowMappings[j].Y = pTableY[j];
+		pRowMappings[j].IncrementX = nIncrementX;
+		pRowMappings[j].IncrementY = 0;
+		fTx1 += fIncrementTx1;
+		fTx2 += fIncrementTx2;
+	}
+	delete[] pTableY;
+
+	void* pDIB = BilinearSample(clippedTargetSize, pRowMappings, sourceSize, pPixels, nChannels, backColor, bUseSSE, pCorrections);
+	delete[] pRowMappings;
+	return pDIB;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 // High quality rotation using bicubic sampling
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -1158,6 +1760,7 @@ void* CBasicProcessing::PointSampleTrapezoid(CSize fullTargetSize, const CTrapez
 #define NUM_KERNELS_LOG2 6
 #define NUM_KERNELS_BICUBIC 65
 #define FP_HALF 8192
+#define ROTATION_TILE_WIDTH 64
 
 // Bicubic resampling of one pixel at pSource (in 3 or 4 channel format) into one destination pixel in 32 bit format
 // The fractional part of the pixel position is given in .16 fixed point format
@@ -1243,8 +1846,81 @@ static void InterpolateBicubicBorder(const uint8* pSource, uint8* pDest, int16*
 	if (nChannels == 3) *pDest = 0xFF;
 }
 
+// SSE2 version of InterpolateBicubic(), all channels of the pixel are processed in parallel. Same result as the C++ version.
+// Loads 16 bytes starting at the pixel left of pSource in each of the four rows, thus for 3 channel images also the
+// pixels at x + 3 and x + 4 must be inside the image.
+template<int nChannels>
+static inline uint32 InterpolateBicubic_SSE(const uint8* pSource, const int16* pKernels, int32 nFracX, int32 nFracY, int nPaddedSourceWidth) {
+	const int16* pKernelX = &(pKernels[4*(nFracX >> (16 - NUM_KERNELS_LOG2))]);
+	const int16* pKernelY = &(pKernels[4*(nFracY >> (16 - NUM_KERNELS_LOG2))]);
+	__m128i zero = _mm_setzero_si128();
+	__m128i rounding = _mm_set1_epi32(FP_HALF);
+	__m128i kernelX01 = _mm_set1_epi32((uint16)pKernelX[0] | ((uint32)(uint16)pKernelX[1] << 16));
+	__m128i kernelX23 = _mm_set1_epi32((uint16)pKernelX[2] | ((uint32)(uint16)pKernelX[3] << 16));
+	__m128i kernelY01 = _mm_set1_epi32((uint16)pKernelY[0] | ((uint32)(uint16)pKernelY[1] << 16));
+	__m128i kernelY23 = _mm_set1_epi32((uint16)pKernelY[2] | ((uint32)(uint16)pKernelY[3] << 16));
+
+	// filter in x-direction, one row sum per channel and row
+	__m128i rowSums[4];
+	const uint8* pSrc = pSource - nPaddedSourceWidth - nChannels;
+	for (int r = 0; r < 4; r++) {
+		__m128i row = _mm_loadu_si128((const __m128i*)pSrc);
+		// interleave the channels of pixel 0 and 1 respectively pixel 2 and 3: c0p0, c0p1, c1p0, c1p1, ...
+		__m128i pixels01 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(row, _mm_srli_si128(row, nChannels)), zero);
+		__m128i pixels23 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_srli_si128(row, 2 * nChannels), _mm_srli_si128(row, 3 * nChannels)), zero);
+		__m128i sum = _mm_add_epi32(_mm_madd_epi16(pixels01, kernelX01), _mm_madd_epi16(pixels23, kernelX23));
+		rowSums[r] = _mm_srai_epi32(_mm_add_epi32(sum, rounding), 14);
+		pSrc += nPaddedSourceWidth;
+	}
+
+	// filter in y-direction, the row sums are interleaved in the same way as the pixels above
+	__m128i rows01 = _mm_packs_epi32(rowSums[0], rowSums[1]);
+	rows01 = _mm_unpacklo_epi16(rows01, _mm_srli_si128(rows01, 8));
+	__m128i rows23 = _mm_packs_epi32(rowSums[2], rowSums[3]);
+	rows23 = _mm_unpacklo_epi16(rows23, _mm_srli_si128(rows23, 8));
+	__m128i sum = _mm_add_epi32(_mm_madd_epi16(rows01, kernelY01), _mm_madd_epi16(rows23, kernelY23));
+	sum = _mm_srai_epi32(_mm_add_epi32(sum, rounding), 14);
+	sum = _mm_packs_epi32(sum, sum);
+	uint32 nPixel = (uint32)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+	return (nChannels == 3) ? (nPixel | ALPHA_OPAQUE) : nPixel;
+}
+
+// Rotation of nCount target pixels of a row. The first target pixel is at source position (nCurX, nCurY), the source
+// position is incremented by (nIncrementX, nIncrementY) per target pixel. All positions are in 16.16 fixed point format.
+template<int nChannels, bool bUseSSE>
+static void RotateRowHQ(uint32* pDst, int nCount, int32 nCurX, int32 nCurY, int32 nIncrementX, int32 nIncrementY,
+						CSize sourceSize, const uint8* pSourcePixels, int nPaddedSourceWidth, int16* pKernels, uint32 nBackColor) {
+	int nMaxXSSE = sourceSize.cx - ((nChannels == 3) ? 4 : 2);
+	for (int i = 0; i < nCount; i++) {
+		int32 nCurRealX = nCurX >> 16;
+		int32 nCurRealY = nCurY >> 16;
+		int32 nFracX = nCurX & 0xFFFF;
+		int32 nFracY = nCurY & 0xFFFF;
+		if (nCurRealX >= -1 && nCurRealX <= sourceSize.cx && nCurRealY >= -1 && nCurRealY <= sourceSize.cy) {
+			const uint8* pSrc = pSourcePixels + nPaddedSourceWidth * nCurRealY + nCurRealX * nChannels;
+			if (nCurRealX > 0 && nCurRealX < sourceSize.cx - 2 && nCurRealY > 0 && nCurRealY < sourceSize.cy - 2) {
+				if (bUseSSE && nCurRealX < nMaxXSSE) {
+					pDst[i] = InterpolateBicubic_SSE<nChannels>(pSrc, pKernels, nFracX, nFracY, nPaddedSourceWidth);
+				} else {
+					InterpolateBicubic(pSrc, (uint8*)(pDst + i), pKernels, nFracX, nFracY, nPaddedSourceWidth, nChannels);
+				}
+			} else {
+				int nXFrom = (nCurRealX > 0) ? -1 : -nCurRealX;
+				int nXTo = (nCurRealX < sourceSize.cx - 2) ? 2 : sourceSize.cx - nCurRealX - 1;
+				int nYFrom = (nCurRealY > 0) ? -1 : -nCurRealY;
+				int nYTo = (nCurRealY < sourceSize.cy - 2) ? 2 : sourceSize.cy - nCurRealY - 1;
+				InterpolateBicubicBorder(pSrc, (uint8*)(pDst + i), pKernels, nFracX, nFracY, nXFrom, nXTo, nYFrom, nYTo, nPaddedSourceWidth, nChannels, nBackColor);
+			}
+		} else {
+			pDst[i] = nBackColor;
+		}
+		nCurX += nIncrementX;
+		nCurY += nIncrementY;
+	}
+}
+
 void* RotateHQ_Core(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize, 
-									  const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor){
+									  const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor, bool bUseSSE) {
 
 	double dFirstX = -(sourceSize.cx - 1) * 0.5;
 	double dFirstY = -(sourceSize.cy - 1) * 0.5;
@@ -1270,46 +1946,37 @@ void* RotateHQ_Core(CPoint targetOffset, CSize targetSize, double dRotation, CSi
 	int16* pKernels = new int16[NUM_KERNELS_BICUBIC * 4];
 	CResizeFilter::GetBicubicFilterKernels(NUM_KERNELS_BICUBIC, pKernels);
 
+	void (*pRotateRow)(uint32*, int, int32, int32, int32, int32, CSize, const uint8*, int, int16*, uint32);
+	if (nChannels == 3) {
+		pRotateRow = bUseSSE ? RotateRowHQ<3, true> : RotateRowHQ<3, false>;
+	} else {
+		pRotateRow = bUseSSE ? RotateRowHQ<4, true> : RotateRowHQ<4, false>;
+	}
+
 	uint32 nBackColor = (GetRValue(backColor) << 16) + (GetGValue(backColor) << 8) + GetBValue(backColor) + ALPHA_OPAQUE;
 	int nPaddedSourceWidth = Helpers::DoPadding(sourceSize.cx * nChannels, 4);
-	const uint8* pSrc = NULL;
-	uint8* pDst = (uint8*)pTargetPixels;
-	int32 nX = nFirstX + targetOffset.x * nIncrementX1 + targetOffset.y * nIncrementX2;
-	int32 nY = nFirstY + targetOffset.x * nIncrementY1 + targetOffset.y * nIncrementY2;
-	for (int j = 0; j < targetSize.cy; j++) {
-		int nCurX = nX;
-		int nCurY = nY;
-		for (int i = 0; i < targetSize.cx; i++) {
-			int32 nCurRealX = nCurX >> 16;
-			int32 nCurRealY = nCurY >> 16;
-			int32 nFracX = nCurX & 0xFFFF;
-			int32 nFracY = nCurY & 0xFFFF;
-			if (nCurRealX >= -1 && nCurRealX <= sourceSize.cx && nCurRealY >= -1 && nCurRealY <= sourceSize.cy) {
-				pSrc = (uint8*)pSourcePixels + nPaddedSourceWidth * nCurRealY + nCurRealX * nChannels;
-				if (nCurRealX > 0 && nCurRealX < sourceSize.cx - 2 && nCurRealY > 0 && nCurRealY < sourceSize.cy - 2) {
-					InterpolateBicubic(pSrc, pDst + i*4, pKernels, nFracX, nFracY, nPaddedSourceWidth, nChannels);
-				} else {
-					int nXFrom = (nCurRealX > 0) ? -1 : -nCurRealX;
-					int nXTo = (nCurRealX < sourceSize.cx - 2) ? 2 : sourceSize.cx - nCurRealX - 1;
-					int nYFrom = (nCurRealY > 0) ? -1 : -nCurRealY;
-					int nYTo = (nCurRealY < sourceSize.cy - 2) ? 2 : sourceSize.cy - nCurRealY - 1;
-					InterpolateBicubicBorder(pSrc, pDst + i*4, pKernels, nFracX, nFracY, nXFrom, nXTo, nYFrom, nYTo, nPaddedSourceWidth, nChannels, nBackColor);
-				}
-			} else {
-				*((uint32*)pDst + i) = nBackColor;
-			}
-			nCurX += nIncrementX1;
-			nCurY += nIncrementY1;
+
+	// The target is processed in columns of ROTATION_TILE_WIDTH pixels. The source pixels of a rotated row are on a
+	// diagonal, when processing full rows they are no longer in the cache when the next row needs them.
+	for (int nTileX = 0; nTileX < targetSize.cx; nTileX += ROTATION_TILE_WIDTH) {
+		int nTileWidth = min(ROTATION_TILE_WIDTH, targetSize.cx - nTileX);
+		uint32* pDst = (uint32*)pTargetPixels + nTileX;
+		int32 nX = nFirstX + (targetOffset.x + nTileX) * nIncrementX1 + targetOffset.y * nIncrementX2;
+		int32 nY = nFirstY + (targetOffset.x + nTileX) * nIncrementY1 + targetOffset.y * nIncrementY2;
+		for (int j = 0; j < targetSize.cy; j++) {
+			pRotateRow(pDst, nTileWidth, nX, nY, nIncrementX1, nIncrementY1, sourceSize, (const uint8*)pSourcePixels,
+				nPaddedSourceWidth, pKernels, nBackColor);
+			pDst += targetSize.cx;
+			nX += nIncrementX2;
+			nY += nIncrementY2;
 		}
-		pDst += targetSize.cx*4;
-		nX += nIncrementX2;
-		nY += nIncrementY2;
 	}
 	delete[] pKernels;
 	return pTargetPixels;
 }
 
-void* CBasicProcessing::RotateHQ(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize, const void* pSourcePixels, int nChannels, COLORREF backColor) {
+void* CBasicProcessing::RotateHQ(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize, const void* pSourcePixels, int nChannels, 
+								 COLORREF backColor, bool bUseSSE) {
 	 if (pSourcePixels == NULL || (nChannels != 3 && nChannels != 4)) {
 		return NULL;
 	}
@@ -1318,7 +1985,7 @@ void* CBasicProcessing::RotateHQ(CPoint targetOffset, CSize targetSize, double d
 	if (pTargetPixels == NULL) return NULL;
 
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
-	CRequestRotate request(pSourcePixels, targetOffset, targetSize, dRotation, sourceSize, pTargetPixels, nChannels, backColor);
+	CRequestRotate request(pSourcePixels, targetOffset, targetSize, dRotation, sourceSize, pTargetPixels, nChannels, backColor, bUseSSE);
 	bool bSuccess = threadPool.Process(&request);
 
 	return bSuccess ? pTargetPixels : NULL;
@@ -1328,11 +1995,13 @@ void* CBasicProcessing::RotateHQ(CPoint targetOffset, CSize targetSize, double d
 // High quality trapezoid correction using bicubic sampling
 /////////////////////////////////////////////////////////////////////////////////////////////
 
-static inline void Get4Pixels16(const uint16* pSrc, uint16 dest[4], int nFrom, int nTo, uint32 nFill) {
-	int nC = -3;
+// The rows interpolated in y-direction contain the channels of the source pixels (3 or 4) in 8.7 fixed point format
+
+static inline void Get4Pixels16(const uint16* pSrc, uint16 dest[4], int nFrom, int nTo, int nChannels, uint32 nFill) {
+	int nC = -nChannels;
 	for (int i = 0; i < 4; i++) {
 		dest[i] = (i >= nFrom + 1 && i <= nTo + 1) ? pSrc[nC] : (uint16)nFill;
-		nC += 3;
+		nC += nChannels;
 	}
 }
 
@@ -1340,31 +2009,49 @@ static inline void Get4Pixels16(const uint16* pSrc, uint16 dest[4], int nFrom, i
 // Interpolates only in x-direction
 // The fractional part of the pixel position is given in .16 fixed point format
 // pKernels contains NUM_KERNELS_BICUBIC precalculated bicubic filter kernels each of length 4, applied with offset -1 to the source pixels
-static void InterpolateBicubicX(const uint16* pSource, uint8* pDest, int16* pKernels, int32 nFracX) {
+static void InterpolateBicubicX(const uint16* pSource, uint8* pDest, int16* pKernels, int32 nFracX, int nChannels) {
 	int16* pKernelX = &(pKernels[4*(nFracX >> (16 - NUM_KERNELS_LOG2))]);
+	int nChannels2 = nChannels * 2;
 	for (int i = 0; i < 3; i++) {
-		int32 nSum = pSource[-3] * pKernelX[0] + pSource[0] * pKernelX[1] + pSource[3] * pKernelX[2] + pSource[6] * pKernelX[3] + FP_HALF;
-		nSum = nSum >> 22;
+		int32 nSum = pSource[-nChannels] * pKernelX[0] + pSource[0] * pKernelX[1] + pSource[nChannels] * pKernelX[2] + pSource[nChannels2] * pKernelX[3] + FP_HALF;
+		nSum = nSum >> 21;
 		*pDest++ = min(255, max(0, nSum));
 		pSource++;
 	}
 	*pDest = 0XFF;
 }
 
-// Same as method above but with border handling, assuming that the filter kernels are only evaluated from nXFrom to nXTo
+// SSE2 version of the method above, same result. Reads 8 values starting at the pixel left of pSource and at the pixel right of it.
+template<int nChannels>
+static inline uint32 InterpolateBicubicX_SSE(const uint16* pSource, const int16* pKernels, int32 nFracX) {
+	const int16* pKernelX = &(pKernels[4*(nFracX >> (16 - NUM_KERNELS_LOG2))]);
+	__m128i kernelX01 = _mm_set1_epi32((uint16)pKernelX[0] | ((uint32)(uint16)pKernelX[1] << 16));
+	__m128i kernelX23 = _mm_set1_epi32((uint16)pKernelX[2] | ((uint32)(uint16)pKernelX[3] << 16));
+	__m128i pixels01 = _mm_loadu_si128((const __m128i*)(pSource - nChannels));
+	__m128i pixels23 = _mm_loadu_si128((const __m128i*)(pSource + nChannels));
+	// interleave the channels of pixel 0 and 1 respectively pixel 2 and 3: c0p0, c0p1, c1p0, c1p1, ...
+	pixels01 = _mm_unpacklo_epi16(pixels01, _mm_srli_si128(pixels01, 2 * nChannels));
+	pixels23 = _mm_unpacklo_epi16(pixels23, _mm_srli_si128(pixels23, 2 * nChannels));
+	__m128i sum = _mm_add_epi32(_mm_madd_epi16(pixels01, kernelX01), _mm_madd_epi16(pixels23, kernelX23));
+	sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(FP_HALF)), 21);
+	sum = _mm_packs_epi32(sum, sum);
+	return (uint32)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum)) | ALPHA_OPAQUE;
+}
+
+// Same as InterpolateBicubicX() but with border handling, assuming that the filter kernels are only evaluated from nXFrom to nXTo
 // Pixels that are outside this range are assumed to have value nBackColor
 static void InterpolateBicubicBorderX(const uint16* pSource, uint8* pDest, int16* pKernels, 
-									  int32 nFracX, int nXFrom, int nXTo, uint32 nBackColor) {
+									  int32 nFracX, int nXFrom, int nXTo, int nChannels, uint32 nBackColor) {
 	int16* pKernelX = &(pKernels[4*(nFracX >> (16 - NUM_KERNELS_LOG2))]);
 	uint32 nBackColorShifted = nBackColor;
 	for (int i = 0; i < 3; i++) {
-		uint32 nFill = (nBackColorShifted & 0xFF) << 8;
+		uint32 nFill = (nBackColorShifted & 0xFF) << 7;
 		nBackColorShifted = nBackColorShifted >> 8;
 
 		uint16 pixels[4];
-		Get4Pixels16(pSource, pixels, nXFrom, nXTo, nFill); 
+		Get4Pixels16(pSource, pixels, nXFrom, nXTo, nChannels, nFill); 
 		int32 nSum = pixels[0] * pKernelX[0] + pixels[1] * pKernelX[1] + pixels[2] * pKernelX[2] + pixels[3] * pKernelX[3] + FP_HALF;
-		nSum = nSum >> 22;
+		nSum = nSum >> 21;
 
 		*pDest++ = min(255, max(0, nSum));
 		pSource++;
@@ -1372,35 +2059,78 @@ static void InterpolateBicubicBorderX(const uint16* pSource, uint8* pDest, int16
 	*pDest = 0xFF;
 }
 
-// Bicubic interpolation in y of one line in the image
-static void InterpolateBicubicY(const uint8* pSourcePixels, int nChannelsSource, int nPaddedSourceWidth, uint16* pTarget, int nPixelsPerLine, 
+// Bicubic interpolation in y of one line in the image, nCount is the number of channel values (pixels * channels)
+static void InterpolateBicubicY(const uint8* pSourcePixels, int nPaddedSourceWidth, uint16* pTarget, int nCount, 
 								const int16* pKernels, 
-								int nCurY, int nCurYFrac, int nSizeY) {
+								int nCurY, int nCurYFrac, int nSizeY, bool bUseSSE) {
+	int i = 0;
 	if (nCurY > 0 && nCurY < nSizeY - 2) {
 		const int16* pKernelY = &(pKernels[4*(nCurYFrac >> (16 - NUM_KERNELS_LOG2))]);
 		int nPaddedSourceWidth2 = nPaddedSourceWidth * 2;
-		for (int i = 0; i < nPixelsPerLine; i++) {
-			for (int c = 0; c < 3; c++) {
-				int32 nSum = pSourcePixels[-nPaddedSourceWidth + c] * pKernelY[0] + pSourcePixels[c] * pKernelY[1] + 
-					pSourcePixels[nPaddedSourceWidth + c] * pKernelY[2] + pSourcePixels[nPaddedSourceWidth2 + c] * pKernelY[3] + FP_HALF;
-				nSum = nSum >> 6;
-				*pTarget++ = min(65535, max(0, nSum));
+		if (bUseSSE) {
+			__m128i zero = _mm_setzero_si128();
+			__m128i rounding = _mm_set1_epi32(FP_HALF);
+			__m128i kernelY01 = _mm_set1_epi32((uint16)pKernelY[0] | ((uint32)(uint16)pKernelY[1] << 16));
+			__m128i kernelY23 = _mm_set1_epi32((uint16)pKernelY[2] | ((uint32)(uint16)pKernelY[3] << 16));
+			for (; i <= nCount - 8; i += 8) {
+				const uint8* pSrc = pSourcePixels + i;
+				__m128i row0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pSrc - nPaddedSourceWidth)), zero);
+				__m128i row1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)pSrc), zero);
+				__m128i row2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pSrc + nPaddedSourceWidth)), zero);
+				__m128i row3 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pSrc + nPaddedSourceWidth2)), zero);
+				__m128i sumLo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(row0, row1), kernelY01),
+					_mm_madd_epi16(_mm_unpacklo_epi16(row2, row3), kernelY23));
+				__m128i sumHi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(row0, row1), kernelY01),
+					_mm_madd_epi16(_mm_unpackhi_epi16(row2, row3), kernelY23));
+				sumLo = _mm_srai_epi32(_mm_add_epi32(sumLo, rounding), 7);
+				sumHi = _mm_srai_epi32(_mm_add_epi32(sumHi, rounding), 7);
+				_mm_storeu_si128((__m128i*)(pTarget + i), _mm_max_epi16(_mm_packs_epi32(sumLo, sumHi), zero));
 			}
-			pSourcePixels += nChannelsSource;
+		}
+		for (; i < nCount; i++) {
+			int32 nSum = pSourcePixels[i - nPaddedSourceWidth] * pKernelY[0] + pSourcePixels[i] * pKernelY[1] + 
+				pSourcePixels[i + nPaddedSourceWidth] * pKernelY[2] + pSourcePixels[i + nPaddedSourceWidth2] * pKernelY[3] + FP_HALF;
+			nSum = nSum >> 7;
+			pTarget[i] = min(32767, max(0, nSum));
 		}
 	} else {
 		// border handling...there is none ;-) just copy the line and hope that nobody will realize it
-		for (int i = 0; i < nPixelsPerLine; i++) {
-			for (int c = 0; c < 3; c++) {
-				*pTarget++ = (uint16)(pSourcePixels[c] << 8);
+		for (; i < nCount; i++) {
+			pTarget[i] = (uint16)(pSourcePixels[i] << 7);
+		}
+	}
+}
+
+// Interpolation in x-direction of nCount target pixels, see TrapezoidHQ_Core()
+template<int nChannels, bool bUseSSE>
+static void TrapezoidRowHQ(uint32* pDst, int nCount, int nCurX, int nIncrementX, int nSourceWidth, const uint16* pLine,
+						   int16* pKernels, uint32 nBackColor) {
+	for (int i = 0; i < nCount; i++) {
+		int nCurXInt = nCurX >> 16;
+		int nCurXFrac = nCurX & 0xFFFF;
+		if (nCurXInt >= -1 && nCurXInt <= nSourceWidth) {
+			const uint16* pSourceLineStart = pLine + nCurXInt*nChannels;
+			if (nCurXInt > 0 && nCurXInt < nSourceWidth - 2) {
+				if (bUseSSE) {
+					pDst[i] = InterpolateBicubicX_SSE<nChannels>(pSourceLineStart, pKernels, nCurXFrac);
+				} else {
+					InterpolateBicubicX(pSourceLineStart, (uint8*)(pDst + i), pKernels, nCurXFrac, nChannels);
+				}
+			} else {
+				int nXFrom = (nCurXInt > 0) ? -1 : -nCurXInt;
+				int nXTo = (nCurXInt < nSourceWidth - 2) ? 2 : nSourceWidth - nCurXInt - 1;
+				InterpolateBicubicBorderX(pSourceLineStart, (uint8*)(pDst + i), pKernels, nCurXFrac, nXFrom, nXTo, nChannels, nBackColor);
 			}
-			pSourcePixels += nChannelsSource;
+		} else {
+			pDst[i] = nBackColor;
 		}
+
+		nCurX += nIncrementX;
 	}
 }
 
 void* TrapezoidHQ_Core(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize, 
-										 const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor) {
+										 const void* pSourcePixels, void* pTargetPixels, int nChannels, COLORREF backColor, bool bUseSSE) {
 
 	float fTx1 = (float)trapezoid.x1s;
 	float fTx2 = (float)trapezoid.x1e;
@@ -1409,58 +2139,48 @@ void* TrapezoidHQ_Core(CPoint targetOffset, CSize targetSize, const CTrapezoid&
 
 	uint32 nBackColor = (GetRValue(backColor) << 16) + (GetGValue(backColor) << 8) + GetBValue(backColor) + ALPHA_OPAQUE;
 	int nPaddedSourceWidth = Helpers::DoPadding(sourceSize.cx * nChannels, 4);
-	uint8* pDst = (uint8*)pTargetPixels;
+	uint32* pDst = (uint32*)pTargetPixels;
 	fTx1 = fTx1 + targetOffset.y*fIncrementTx1;
 	fTx2 = fTx2 + targetOffset.y*fIncrementTx2;
 	int nSourceSizeXFP16 = (sourceSize.cx - 1) << 16;
 
 	int* pTableY = CalculateTrapezoidYIntersectionTable(trapezoid, targetSize.cy, sourceSize.cy, trapezoid.Height() + 1, targetOffset.y);
-	uint16* pLine = new uint16[sourceSize.cx * 3];
+	uint16* pLine = new uint16[sourceSize.cx * nChannels + 8]; // InterpolateBicubicX_SSE() reads beyond the last pixel
 	
 	int16* pKernels = new int16[NUM_KERNELS_BICUBIC * 4];
 	CResizeFilter::GetBicubicFilterKernels(NUM_KERNELS_BICUBIC, pKernels);
 
+	void (*pTrapezoidRow)(uint32*, int, int, int, int, const uint16*, int16*, uint32);
+	if (nChannels == 3) {
+		pTrapezoidRow = bUseSSE ? TrapezoidRowHQ<3, true> : TrapezoidRowHQ<3, false>;
+	} else {
+		pTrapezoidRow = bUseSSE ? TrapezoidRowHQ<4, true> : TrapezoidRowHQ<4, false>;
+	}
+
 	for (int j = 0; j < targetSize.cy; j++) {
 		float fTxDiffInv = 1.0f/(fTx2 - fTx1);
 		int nIncrementX = (int)(nSourceSizeXFP16 * fTxDiffInv);
 		int nStartX = (int)(nSourceSizeXFP16 * (targetOffset.x - fTx1) * fTxDiffInv);
-		int nCurX = nStartX;
 		int nCurY = pTableY[j] >> 16;
 		int nCurYFrac = pTableY[j] & 0xFFFF;
-		InterpolateBicubicY((uint8*)pSourcePixels + nPaddedSourceWidth * nCurY, nChannels, nPaddedSourceWidth, pLine, sourceSize.cx,
-			pKernels, nCurY, nCurYFrac, trapezoid.Height() + 1);
-		for (int i = 0; i < targetSize.cx; i++) {
-			int nCurXInt = nCurX >> 16;
-			int nCurXFrac = nCurX & 0xFFFF;
-			if (nCurXInt >= -1 && nCurXInt <= sourceSize.cx) {
-				const uint16* pSourceLineStart = pLine + nCurXInt*3;
-				if (nCurXInt > 0 && nCurXInt < sourceSize.cx - 2) {
-					InterpolateBicubicX(pSourceLineStart, pDst + i*4, pKernels, nCurXFrac);
-				} else {
-					int nXFrom = (nCurXInt > 0) ? -1 : -nCurXInt;
-					int nXTo = (nCurXInt < sourceSize.cx - 2) ? 2 : sourceSize.cx - nCurXInt - 1;
-					InterpolateBicubicBorderX(pSourceLineStart, pDst + i*4, pKernels, nCurXFrac, nXFrom, nXTo, nBackColor);
-				}
-			} else {
-				*((uint32*)pDst + i) = nBackColor;
-			}
-
-			nCurX += nIncrementX;
-		}
+		InterpolateBicubicY((uint8*)pSourcePixels + nPaddedSourceWidth * nCurY, nPaddedSourceWidth, pLine, sourceSize.cx * nChannels,
+			pKernels, nCurY, nCurYFrac, trapezoid.Height() + 1, bUseSSE);
+		pTrapezoidRow(pDst, targetSize.cx, nStartX, nIncrementX, sourceSize.cx, pLine, pKernels, nBackColor);
 
-		pDst += targetSize.cx*4;
+		pDst += targetSize.cx;
 		fTx1 += fIncrementTx1;
 		fTx2 += fIncrementTx2;
 	}
 
 	delete[] pTableY;
 	delete[] pLine;
+	delete[] pKernels;
 
 	return pTargetPixels;
 }
 
 void* CBasicProcessing::TrapezoidHQ(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize, 
-									const void* pSourcePixels, int nChannels, COLORREF backColor) {
+									const void* pSourcePixels, int nChannels, COLORREF backColor, bool bUseSSE) {
 	 if (pSourcePixels == NULL || (nChannels != 3 && nChannels != 4)) {
 		return NULL;
 	}
@@ -1469,7 +2189,7 @@ void* CBasicProcessing::TrapezoidHQ(CPoint targetOffset, CSize targetSize, const
 	if (pTargetPixels == NULL) return NULL;
 
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
-	CRequestTrapezoid request(pSourcePixels, targetOffset, targetSize, trapezoid, sourceSize, pTargetPixels, nChannels, backColor);
+	CRequestTrapezoid request(pSourcePixels, targetOffset, targetSize, trapezoid, sourceSize, pTargetPixels, nChannels, backColor, bUseSSE);
 	bool bSuccess = threadPool.Process(&request);
 
 	return bSuccess ? pTargetPixels : NULL;
@@ -1479,11 +2199,103 @@ void* CBasicProcessing::TrapezoidHQ(CPoint targetOffset, CSize targetSize, const
 // Helper methods for high quality resizing (C++ implementation)
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+// Filters one pixel (B, G and R) with a kernel of nFilterLen elements, or nLen elements if nFilterLen is 0.
+// With a compile time kernel length, the loop is completely unrolled by the compiler.
+template<int nSourceBytesPerPixel, int nFilterLen>
+inline static void FilterPixel(const int16* pKernel, int nLen, const uint8* pSourcePixel, uint8* pTargetPixel) {
+	const int FP_05 = 255; // rounding correction because in filter 1.0 is 16383 but we shift by 14 what is a division by 16384
+	// a single channel source is filtered into all three channels
+	const int nOffsetGreen = (nSourceBytesPerPixel == 1) ? 0 : 1;
+	const int nOffsetRed = (nSourceBytesPerPixel == 1) ? 0 : 2;
+	const int nNumElements = (nFilterLen > 0) ? nFilterLen : nLen;
+	int nPixelValue1 = 0;
+	int nPixelValue2 = 0;
+	int nPixelValue3 = 0;
+	for (int n = 0; n < nNumElements; n++) {
+		nPixelValue1 += pKernel[n] * pSourcePixel[0];
+		nPixelValue2 += pKernel[n] * pSourcePixel[nOffsetGreen];
+		nPixelValue3 += pKernel[n] * pSourcePixel[nOffsetRed];
+		pSourcePixel += nSourceBytesPerPixel;
+	}
+	nPixelValue1 = (nPixelValue1 + FP_05) >> 14;
+	nPixelValue2 = (nPixelValue2 + FP_05) >> 14;
+	nPixelValue3 = (nPixelValue3 + FP_05) >> 14;
+
+	pTargetPixel[0] = (uint8)max(0, min(255, nPixelValue1));
+	pTargetPixel[1] = (uint8)max(0, min(255, nPixelValue2));
+	pTargetPixel[2] = (uint8)max(0, min(255, nPixelValue3));
+	pTargetPixel[3] = 0xFF;
+}
+
+// See ApplyFilter(), nFilterLen is the length of the kernels or 0 if not known at compile time.
+// Kernels with another length (border handling kernels) are processed with the generic loop.
+template<int nSourceBytesPerPixel, int nFilterLen>
+static void ApplyFilter_Core(int nSourceWidth, int nTargetWidth, int nHeight,
+							 int nStartX_FP, int nStartY, int nIncrementX_FP,
+							 const FilterKernelBlock& filter,
+							 int nFilterOffset,
+							 const uint8* pSource, uint8* pTarget) {
+	// width of new image is (after rotation) : nHeight
+	// height of new image is (after rotation) : nTargetWidth
+	
+	int nPaddedSourceWidth = Helpers::DoPadding(nSourceWidth * nSourceBytesPerPixel, 4);
+	for (int j = 0; j < nHeight; j++) {
+		const uint8* pSourcePixelLine = pSource + nPaddedSourceWidth * (j + nStartY);
+		uint8* pTargetPixel = pTarget + 4*j;
+		uint32 nX = nStartX_FP;
+		for (int i = 0; i < nTargetWidth; i++) {
+			uint32 nXSourceInt = nX >> 16;
+			FilterKernel* pKernel = filter.Indices[i + nFilterOffset];
+			const uint8* pSourcePixel = pSourcePixelLine + nSourceBytesPerPixel*(nXSourceInt - pKernel->FilterOffset);
+			if (nFilterLen > 0 && pKernel->FilterLen == nFilterLen) {
+				FilterPixel<nSourceBytesPerPixel, nFilterLen>(pKernel->Kernel, nFilterLen, pSourcePixel, pTargetPixel);
+			} else {
+				FilterPixel<nSourceBytesPerPixel, 0>(pKernel->Kernel, pKernel->FilterLen, pSourcePixel, pTargetPixel);
+			}
+			// rotate: go to next row in target - width of target is nHeight
+			pTargetPixel += nHeight*4;
+			nX += nIncrementX_FP;
+		}
+	}
+}
+
+// Selects the specialization of ApplyFilter_Core() for the kernel length nFilterLen
+template<int nSourceBytesPerPixel>
+static void ApplyFilter_Dispatch(int nFilterLen, int nSourceWidth, int nTargetWidth, int nHeight,
+								 int nStartX_FP, int nStartY, int nIncrementX_FP,
+								 const FilterKernelBlock& filter,
+								 int nFilterOffset,
+								 const uint8* pSource, uint8* pTarget) {
+	switch (nFilterLen) {
+		case 3:
+			ApplyFilter_Core<nSourceBytesPerPixel, 3>(nSourceWidth, nTargetWidth, nHeight, nStartX_FP, nStartY, nIncrementX_FP, filter, nFilterOffset, pSource, pTarget);
+			break;
+		case 4:
+			ApplyFilter_Core<nSourceBytesPerPixel, 4>(nSourceWidth, nTargetWidth, nHeight, nStartX_FP, nStartY, nIncrementX_FP, filter, nFilterOffset, pSource, pTarget);
+			break;
+		case 5:
+			ApplyFilter_Core<nSourceBytesPerPixel, 5>(nSourceWidth, nTargetWidth, nHeight, nStartX_FP, nStartY, nIncrementX_FP, filter, nFilterOffset, pSource, pTarget);
+			break;
+		case 6:
+			ApplyFilter_Core<nSourceBytesPerPixel, 6>(nSourceWidth, nTargetWidth, nHeight, nStartX_FP, nStartY, nIncrementX_FP, filter, nFilterOffset, pSource, pTarget);
+			break;
+		case 7:
+			ApplyFilter_Core<nSourceBytesPerPixel, 7>(nSourceWidth, nTargetWidth, nHeight, nStartX_FP, nStartY, nIncrementX_FP, filter, nFilterOffset, pSource, pTarget);
+			break;
+		case 8:
+			ApplyFilter_Core<nSourceBytesPerPixel, 8>(nSourceWidth, nTargetWidth, nHeight, nStartX_FP, nStartY, nIncrementX_FP, filter, nFilterOffset, pSource, pTarget);
+			break;
+		default:
+			ApplyFilter_Core<nSourceBytesPerPixel, 0>(nSourceWidth, nTargetWidth, nHeight, nStartX_FP, nStartY, nIncrementX_FP, filter, nFilterOffset, pSource, pTarget);
+			break;
+	}
+}
+
 // Apply filtering in x-direction and rotate
 // nSourceWidth: Width of the image in pSource in pixels
 // nTargetWidth: Target width of the image after filtering.
 // nHeight: Height of the target image in pixels
-// nSourceBytesPerPixel: 3 or 4, the target will always have 4 bytes per pixel
+// nSourceBytesPerPixel: 1, 3 or 4, the target will always have 4 bytes per pixel
 // nStartX_FP: 16.16 fixed point number, start of filtering in source image
 // nStartY: First row to filter in source image (Offset, not in FP format)
 // nIncrementX_FP: 16.16 fixed point number, increment in x-direction in source image
@@ -1498,48 +2310,18 @@ static uint8* ApplyFilter(int nSourceWidth, int nTargetWidth, int nHeight,
 						  int nFilterOffset,
 						  const uint8* pSource) {
 
-	uint8* pTarget = new(std::nothrow) uint8[nTargetWidth*4*nHeight];
+	uint8* pTarget = (uint8*)CBufferPool::This().Allocate((size_t)nTargetWidth*4*nHeight);
 	if (pTarget == NULL) return NULL;
 
-	// width of new image is (after rotation) : nHeight
-	// height of new image is (after rotation) : nTargetWidth
-	
-	int nPaddedSourceWidth = Helpers::DoPadding(nSourceWidth * nSourceBytesPerPixel, 4);
-	const uint8* pSourcePixelLine = NULL;
-	uint8* pTargetPixelLine = NULL;
-	const int FP_05 = 255; // rounding correction because in filter 1.0 is 16383 but we shift by 14 what is a division by 16384
-	for (int j = 0; j < nHeight; j++) {
-		pSourcePixelLine = ((uint8*) pSource) + nPaddedSourceWidth * (j + nStartY);
-		pTargetPixelLine = pTarget + 4*j;
-		uint8* pTargetPixel = pTargetPixelLine;
-		uint32 nX = nStartX_FP;
-		for (int i = 0; i < nTargetWidth; i++) {
-			uint32 nXSourceInt = nX >> 16;
-			FilterKernel* pKernel = filter.Indices[i + nFilterOffset];
-			const uint8* pSourcePixel = pSourcePixelLine + nSourceBytesPerPixel*(nXSourceInt - pKernel->FilterOffset);
-			int nPixelValue1 = 0;
-			int nPixelValue2 = 0;
-			int nPixelValue3 = 0;
-			for (int n = 0; n < pKernel->FilterLen; n++) {
-				nPixelValue1 += pKernel->Kernel[n] * pSourcePixel[0];
-				nPixelValue2 += pKernel->Kernel[n] * pSourcePixel[1];
-				nPixelValue3 += pKernel->Kernel[n] * pSourcePixel[2];
-				pSourcePixel += nSourceBytesPerPixel;
-			}
-			nPixelValue1 = (nPixelValue1 + FP_05) >> 14;
-			nPixelValue2 = (nPixelValue2 + FP_05) >> 14;
-			nPixelValue3 = (nPixelValue3 + FP_05) >> 14;
-
-			*pTargetPixel++ = (uint8)max(0, min(255, nPixelValue1));
-			*pTargetPixel++ = (uint8)max(0, min(255, nPixelValue2));
-			*pTargetPixel++ = (uint8)max(0, min(255, nPixelValue3));
-			*pTargetPixel++ = 0xFF;
-			// rotate: go to next row in target - width of target is nHeight
-			pTargetPixel = pTargetPixel - 4 + nHeight*4;
-			nX += nIncrementX_FP;
-		}
+	// the filter loop is specialized for the number of channels and the kernel length
+	int nFilterLen = GetMaxFilterLen(filter, nFilterOffset, nTargetWidth);
+	if (nSourceBytesPerPixel == 1) {
+		ApplyFilter_Dispatch<1>(nFilterLen, nSourceWidth, nTargetWidth, nHeight, nStartX_FP, nStartY, nIncrementX_FP, filter, nFilterOffset, pSource, pTarget);
+	} else if (nSourceBytesPerPixel == 3) {
+		ApplyFilter_Dispatch<3>(nFilterLen, nSourceWidth, nTargetWidth, nHeight, nStartX_FP, nStartY, nIncrementX_FP, filter, nFilterOffset, pSource, pTarget);
+	} else {
+		ApplyFilter_Dispatch<4>(nFilterLen, nSourceWidth, nTargetWidth, nHeight, nStartX_FP, nStartY, nIncrementX_FP, filter, nFilterOffset, pSource, pTarget);
 	}
-
 	return pTarget;
 }
 
@@ -1597,25 +2379,29 @@ int16* CBasicProcessing::GaussFilter16bpp1Channel(CSize fullSize, CPoint offset,
 
 	// Gauss filter x-direction
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
-	int16* pIntermediate = new(std::nothrow) int16[rect.cx * rect.cy];
+	CBufferPool& bufferPool = CBufferPool::This();
+	int16* pIntermediate = (int16*)bufferPool.Allocate((size_t)rect.cx * rect.cy * sizeof(int16));
 	if (pIntermediate == NULL) return NULL;
 	CRequestGauss requestX(pPixels, fullSize, offset, rect, dRadius, pIntermediate);
 	if (!threadPool.Process(&requestX)) {
-		delete[] pIntermediate;
+		bufferPool.Free(pIntermediate);
 		return NULL;
 	}
 
 	// Gauss filter y-direction
-	int16* pTargetPixels = new(std::nothrow) int16[rect.cx * rect.cy];
+	int16* pTargetPixels = (int16*)bufferPool.Allocate((size_t)rect.cx * rect.cy * sizeof(int16));
 	if (pTargetPixels == NULL) {
-		delete[] pIntermediate;
+		bufferPool.Free(pIntermediate);
 		return NULL;
 	}
 	CRequestGauss requestY(pIntermediate, CSize(rect.cy, rect.cx), CPoint(0, 0), CSize(rect.cy, rect.cx), dRadius, pTargetPixels);
 	bool bSuccess = threadPool.Process(&requestY);
-	delete[] pIntermediate;
-
-	return bSuccess ? pTargetPixels : NULL;
+	bufferPool.Free(pIntermediate);
+	if (!bSuccess) {
+		bufferPool.Free(pTargetPixels);
+		return NULL;
+	}
+	return pTargetPixels;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -1666,7 +2452,7 @@ void* CBasicProcessing::SampleUp_HQ(CSize fullTargetSize, CPoint fullTargetOffse
 			4, nStartY, 0, nIncrementY,
 			kernelsY, nFilterOffsetY, pTemp);
 
-	delete[] pTemp;
+	CBufferPool::This().Free(pTemp);
 
 	return pDIB;
 }
@@ -1717,7 +2503,7 @@ void* CBasicProcessing::SampleDown_HQ(CSize fullTargetSize, CPoint fullTargetOff
 			4, nStartY, 0, nIncrementY,
 			kernelsY, nFilterOffsetY, pTemp);
 
-	delete[] pTemp;
+	CBufferPool::This().Free(pTemp);
 
 	return pDIB;
 }
@@ -1859,7 +2645,7 @@ static void* RotateToDIB(const CXMMImage* pSourceImg, int simdPixelsPerRegister,
 
 	const int16* pSource = (const int16*) pSourceImg->AlignedPtr();
 	if (pTarget == NULL) {
-		pTarget = new(std::nothrow) uint8[pSourceImg->GetHeight() * 4 * Helpers::DoPadding(pSourceImg->GetWidth(), simdPixelsPerRegister)];
+		pTarget = (uint8*)CBufferPool::This().Allocate((size_t)pSourceImg->GetHeight() * 4 * Helpers::DoPadding(pSourceImg->GetWidth(), simdPixelsPerRegister));
 		if (pTarget == NULL) return NULL;
 	}
 
@@ -1886,7 +2672,115 @@ static void* RotateToDIB(const CXMMImage* pSourceImg, int simdPixelsPerRegister,
 // High quality filtering (SSE implementation)
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+// Filters one row of nNumberOfBlocksX blocks of 8 pixels in y direction, with a kernel of nFilterLen elements
+// or filterLen elements if nFilterLen is 0. With a compile time kernel length, the loop is completely unrolled.
+// Returns the destination pointer after the filtered blocks.
+template<int nFilterLen>
+inline static __m128i* FilterRow_SSE(const __m128i* pSourceRow, const __m128i* pFilterStart, int filterLen,
+	int nChannelLenBytes, int nNumberOfBlocksX, __m128i xmm0, __m128i* pDestination) {
+
+	const int nNumElements = (nFilterLen > 0) ? nFilterLen : filterLen;
+	__m128i xmm1;
+	__m128i xmm2;
+	__m128i xmm3;
+	__m128i xmm4;
+	__m128i xmm5;
+	__m128i xmm6;
+	__m128i xmm7;
+
+	for (int x = 0; x < nNumberOfBlocksX; x++) {
+		const __m128i* pSource = pSourceRow;
+		const __m128i* pFilter = pFilterStart;
+		xmm4 = _mm_setzero_si128();
+		xmm5 = _mm_setzero_si128();
+		xmm6 = _mm_setzero_si128();
+		for (int i = 0; i < nNumElements; i++) {
+			xmm7 = *pFilter;
+
+			// the pixel data RED channel
+			xmm2 = *pSource;
+			xmm2 = _mm_add_epi16(xmm2, xmm2);
+			xmm2 = _mm_mulhi_epi16(xmm2, xmm7);
+			xmm2 = _mm_add_epi16(xmm2, xmm2);
+			xmm4 = _mm_adds_epi16(xmm4, xmm2);
+			pSource = (__m128i*)((uint8*)pSource + nChannelLenBytes);
+
+			// the pixel data GREEN channel
+			xmm3 = *pSource;
+			xmm3 = _mm_add_epi16(xmm3, xmm3);
+			xmm3 = _mm_mulhi_epi16(xmm3, xmm7);
+			xmm3 = _mm_add_epi16(xmm3, xmm3);
+			xmm5 = _mm_adds_epi16(xmm5, xmm3);
+			pSource = (__m128i*)((uint8*)pSource + nChannelLenBytes);
+
+			// the pixel data BLUE channel
+			xmm2 = *pSource;
+			xmm2 = _mm_add_epi16(xmm2, xmm2);
+			xmm2 = _mm_mulhi_epi16(xmm2, xmm7);
+			xmm2 = _mm_add_epi16(xmm2, xmm2);
+			xmm6 = _mm_adds_epi16(xmm6, xmm2);
+			pSource = (__m128i*)((uint8*)pSource + nChannelLenBytes);
+
+			pFilter++;
+		}
+
+		// limit to range 0 (in xmm1), 16383-42 (in xmm0)
+		xmm4 = _mm_min_epi16(xmm4, xmm0);
+		xmm5 = _mm_min_epi16(xmm5, xmm0);
+		xmm6 = _mm_min_epi16(xmm6, xmm0);
+
+		xmm1 = _mm_setzero_si128();
+
+		xmm4 = _mm_max_epi16(xmm4, xmm1);
+		xmm5 = _mm_max_epi16(xmm5, xmm1);
+		xmm6 = _mm_max_epi16(xmm6, xmm1);
+
+		// store result in blocks
+		*pDestination++ = xmm4;
+		*pDestination++ = xmm5;
+		*pDestination++ = xmm6;
+
+		pSourceRow++;
+	}
+	return pDestination;
+}
+
 #ifdef _WIN64
+// See ApplyFilter_SSE(), nFilterLen is the length of the kernels or 0 if not known at compile time.
+// Rows with kernels of another length (border handling kernels) are processed with the generic loop.
+template<int nFilterLen>
+static void ApplyFilter_SSE_Core(int nTargetHeight, int nStartY_FP, int nIncrementY_FP,
+	const XMMFilterKernelBlock& filter, int nFilterOffset,
+	const uint8* pSourceStart, int nChannelLenBytes, int nNumberOfBlocksX, CXMMImage* pTargetImg) {
+
+	int nCurY = nStartY_FP;
+	int nRowLenBytes = nChannelLenBytes * 3;
+	XMMFilterKernel** pKernelIndexStart = filter.Indices;
+
+	DECLARE_ALIGNED_DQWORD(ONE_XMM, 16383 - 42); // 1.0 in fixed point notation, minus rounding correction
+
+	__m128i xmm0 = *((__m128i*)ONE_XMM);
+	__m128i* pDestination = (__m128i*)pTargetImg->AlignedPtr();
+
+	for (int y = 0; y < nTargetHeight; y++) {
+		uint32 nCurYInt = (uint32)nCurY >> 16; // integer part of Y
+		int filterIndex = y + nFilterOffset;
+		XMMFilterKernel* pKernel = pKernelIndexStart[filterIndex];
+		int filterLen = pKernel->FilterLen;
+		int filterOffset = pKernel->FilterOffset;
+		const __m128i* pFilterStart = (__m128i*)&(pKernel->Kernel);
+		const __m128i* pSourceRow = (const __m128i*)(pSourceStart + ((int)nCurYInt - filterOffset) * nRowLenBytes);
+
+		if (nFilterLen > 0 && filterLen == nFilterLen) {
+			pDestination = FilterRow_SSE<nFilterLen>(pSourceRow, pFilterStart, nFilterLen, nChannelLenBytes, nNumberOfBlocksX, xmm0, pDestination);
+		} else {
+			pDestination = FilterRow_SSE<0>(pSourceRow, pFilterStart, filterLen, nChannelLenBytes, nNumberOfBlocksX, xmm0, pDestination);
+		}
+
+		nCurY += nIncrementY_FP;
+	};
+}
+
 // Apply filter in y direction in SSE
 // No inline assembly is supported in 64 bit mode, thus intrinsics are used instead.
 // nSourceHeight: Height of source image, only here to match interface of C++ implementation
@@ -1916,92 +2810,34 @@ static CXMMImage* ApplyFilter_SSE(int nSourceHeight, int nTargetHeight, int nWid
 		return NULL;
 	}
 
-	int nCurY = nStartY_FP;
 	int nChannelLenBytes = pSourceImg->GetPaddedWidth() * sizeof(short);
-	int nRowLenBytes = nChannelLenBytes * 3;
 	int nNumberOfBlocksX = (nEndXAligned - nStartXAligned) >> 3;
 	const uint8* pSourceStart = (const uint8*)pSourceImg->AlignedPtr() + nStartXAligned * sizeof(short);
-	XMMFilterKernel** pKernelIndexStart = filter.Indices;
-
-	DECLARE_ALIGNED_DQWORD(ONE_XMM, 16383 - 42); // 1.0 in fixed point notation, minus rounding correction
-
-	__m128i xmm0 = *((__m128i*)ONE_XMM);
-	__m128i xmm1 = _mm_setzero_si128();
-	__m128i xmm2;
-	__m128i xmm3;
-	__m128i xmm4 = _mm_setzero_si128();
-	__m128i xmm5 = _mm_setzero_si128();
-	__m128i xmm6 = _mm_setzero_si128();
-	__m128i xmm7;
-
-	__m128i* pDestination = (__m128i*)tempImage->AlignedPtr();
-
-	for (int y = 0; y < nTargetHeight; y++) {
-		uint32 nCurYInt = (uint32)nCurY >> 16; // integer part of Y
-		int filterIndex = y + nFilterOffset;
-		XMMFilterKernel* pKernel = pKernelIndexStart[filterIndex];
-		int filterLen = pKernel->FilterLen;
-		int filterOffset = pKernel->FilterOffset;
-		const __m128i* pFilterStart = (__m128i*)&(pKernel->Kernel);
-		const __m128i* pSourceRow = (const __m128i*)(pSourceStart + ((int)nCurYInt - filterOffset) * nRowLenBytes);
-
-		for (int x = 0; x < nNumberOfBlocksX; x++) {
-			const __m128i* pSource = pSourceRow;
-			const __m128i* pFilter = pFilterStart;
-			xmm4 = _mm_setzero_si128();
-			xmm5 = _mm_setzero_si128();
-			xmm6 = _mm_setzero_si128();
-			for (int i = 0; i < filterLen; i++) {
-				xmm7 = *pFilter;
-
-				// the pixel data RED channel
-				xmm2 = *pSource;
-				xmm2 = _mm_add_epi16(xmm2, xmm2);
-				xmm2 = _mm_mulhi_epi16(xmm2, xmm7);
-				xmm2 = _mm_add_epi16(xmm2, xmm2);
-				xmm4 = _mm_adds_epi16(xmm4, xmm2);
-				pSource = (__m128i*)((uint8*)pSource + nChannelLenBytes);
-
-				// the pixel data GREEN channel
-				xmm3 = *pSource;
-				xmm3 = _mm_add_epi16(xmm3, xmm3);
-				xmm3 = _mm_mulhi_epi16(xmm3, xmm7);
-				xmm3 = _mm_add_epi16(xmm3, xmm3);
-				xmm5 = _mm_adds_epi16(xmm5, xmm3);
-				pSource = (__m128i*)((uint8*)pSource + nChannelLenBytes);
-
-				// the pixel data BLUE channel
-				xmm2 = *pSource;
-				xmm2 = _mm_add_epi16(xmm2, xmm2);
-				xmm2 = _mm_mulhi_epi16(xmm2, xmm7);
-				xmm2 = _mm_add_epi16(xmm2, xmm2);
-				xmm6 = _mm_adds_epi16(xmm6, xmm2);
-				pSource = (__m128i*)((uint8*)pSource + nChannelLenBytes);
-
-				pFilter++;
-			}
-
-			// limit to range 0 (in xmm1), 16383-42 (in xmm0)
-			xmm4 = _mm_min_epi16(xmm4, xmm0);
-			xmm5 = _mm_min_epi16(xmm5, xmm0);
-			xmm6 = _mm_min_epi16(xmm6, xmm0);
-
-			xmm1 = _mm_setzero_si128();
-
-			xmm4 = _mm_max_epi16(xmm4, xmm1);
-			xmm5 = _mm_max_epi16(xmm5, xmm1);
-			xmm6 = _mm_max_epi16(xmm6, xmm1);
 
-			// store result in blocks
-			*pDestination++ = xmm4;
-			*pDestination++ = xmm5;
-			*pDestination++ = xmm6;
-
-			pSourceRow++;
-		};
-
-		nCurY += nIncrementY_FP;
-	};
+	// the filter loop is specialized for the kernel length
+	switch (GetMaxFilterLen(filter, nFilterOffset, nTargetHeight)) {
+		case 3:
+			ApplyFilter_SSE_Core<3>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		case 4:
+			ApplyFilter_SSE_Core<4>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		case 5:
+			ApplyFilter_SSE_Core<5>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		case 6:
+			ApplyFilter_SSE_Core<6>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		case 7:
+			ApplyFilter_SSE_Core<7>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		case 8:
+			ApplyFilter_SSE_Core<8>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+		default:
+			ApplyFilter_SSE_Core<0>(nTargetHeight, nStartY_FP, nIncrementY_FP, filter, nFilterOffset, pSourceStart, nChannelLenBytes, nNumberOfBlocksX, tempImage);
+			break;
+	}
 
 	return tempImage;
 }
@@ -2325,17 +3161,183 @@ FilterKernelLoop:
 #endif
 
 /////////////////////////////////////////////////////////////////////////////////////////////
-// High quality down- and up-sampling (SIMD implementation)
+// High quality downsampling (tiled SSE implementation)
 /////////////////////////////////////////////////////////////////////////////////////////////
 
-void* SampleDown_HQ_MMX_SSE_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
+// The tiled implementation filters the source rows of a strip in x direction directly into a tile of target columns,
+// then the tile in y direction directly into the DIB. Contrary to the implementation above, the intermediate
+// images are never rotated, the source pixels are read once and the DIB is written once.
+// The tile width is chosen so that the intermediate tile fits into the L2 cache.
+static const int TILED_RESAMPLING_TILE_BYTES = 256 * 1024;
+static const int TILED_RESAMPLING_MIN_TILE_WIDTH = 64;
+
+// A target column of the filter in x direction
+struct CFilterColumn {
+	int SourcePos; // first source pixel the kernel is applied to
+	int FilterLen;
+	const int16* Kernel; // 16 elements, padded with zeros
+};
+
+// Converts nWidth pixels of a 32, 24 or 8 bpp row to the line interleaved 14 bit format of CXMMImage.
+// pTempRow must have space for nWidth 32 bpp pixels, it is used for 24 bpp rows.
+static void ConvertRowToPlanes(const uint8* pSource, int nChannels, int nWidth, int16* pTarget, int nPlaneLen, uint8* pTempRow) {
+	int16* pBlue = pTarget;
+	int16* pGreen = pTarget + nPlaneLen;
+	int16* pRed = pTarget + 2 * nPlaneLen;
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+	if (nChannels == 1) {
+		for (; i + 8 <= nWidth; i += 8) {
+			__m128i gray = _mm_slli_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pSource + i)), zero), 6);
+			_mm_storeu_si128((__m128i*)(pBlue + i), gray);
+			_mm_storeu_si128((__m128i*)(pGreen + i), gray);
+			_mm_storeu_si128((__m128i*)(pRed + i), gray);
+		}
+		for (; i < nWidth; i++) {
+			pBlue[i] = pGreen[i] = pRed[i] = (int16)(pSource[i] << 6);
+		}
+		return;
+	}
+	if (nChannels == 3) {
+		if (SupportsSSSE3()) {
+			ConvertRow3To4Channels_SSSE3(pSource, pTempRow, nWidth, NULL);
+		} else {
+			ConvertRow3To4Channels(pSource, pTempRow, nWidth, NULL);
+		}
+		pSource = pTempRow;
+	}
+	for (; i + 8 <= nWidth; i += 8) {
+		__m128i pixels0 = _mm_loadu_si128((const __m128i*)(pSource + i * 4));
+		__m128i pixels1 = _mm_loadu_si128((const __m128i*)(pSource + i * 4 + 16));
+		// deinterleave BGRA to BBBBBBBB GGGGGGGG RRRRRRRR AAAAAAAA
+		__m128i t0 = _mm_unpacklo_epi8(pixels0, pixels1);
+		__m128i t1 = _mm_unpackhi_epi8(pixels0, pixels1);
+		__m128i t2 = _mm_unpacklo_epi8(t0, t1);
+		__m128i t3 = _mm_unpackhi_epi8(t0, t1);
+		__m128i blueGreen = _mm_unpacklo_epi8(t2, t3);
+		__m128i redAlpha = _mm_unpackhi_epi8(t2, t3);
+		_mm_storeu_si128((__m128i*)(pBlue + i), _mm_slli_epi16(_mm_unpacklo_epi8(blueGreen, zero), 6));
+		_mm_storeu_si128((__m128i*)(pGreen + i), _mm_slli_epi16(_mm_unpackhi_epi8(blueGreen, zero), 6));
+		_mm_storeu_si128((__m128i*)(pRed + i), _mm_slli_epi16(_mm_unpacklo_epi8(redAlpha, zero), 6));
+	}
+	for (; i < nWidth; i++) {
+		pBlue[i] = (int16)(pSource[i * 4] << 6);
+		pGreen[i] = (int16)(pSource[i * 4 + 1] << 6);
+		pRed[i] = (int16)(pSource[i * 4 + 2] << 6);
+	}
+}
+
+// Sums the four 32 bit elements of each of the four arguments, returns (sum(a), sum(b), sum(c), sum(d))
+inline static __m128i HorizontalSum4(__m128i a, __m128i b, __m128i c, __m128i d) {
+	__m128i ab = _mm_add_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+	__m128i cd = _mm_add_epi32(_mm_unpacklo_epi32(c, d), _mm_unpackhi_epi32(c, d));
+	return _mm_add_epi32(_mm_unpacklo_epi64(ab, cd), _mm_unpackhi_epi64(ab, cd));
+}
+
+// Applies the kernel to the source pixels starting at pSource, the result is the sum of the four 32 bit elements
+template<bool bLongKernels>
+inline static __m128i FilterPixelX_SSE(const int16* pSource, const int16* pKernel) {
+	__m128i sum = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)pSource), _mm_load_si128((const __m128i*)pKernel));
+	if (bLongKernels) {
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(pSource + 8)), _mm_load_si128((const __m128i*)(pKernel + 8))));
+	}
+	return sum;
+}
+
+// Filters a line interleaved row in x direction into nNumPixels (multiple of 8) target pixels.
+// Each target pixel reads 8 (16 for long kernels) contiguous source pixels, thus no gather is needed. The source planes
+// must be readable up to 16 pixels after the last source position.
+template<bool bLongKernels>
+static void FilterRowX_SSE(const int16* pSource, int nSourcePlaneLen, const CFilterColumn* pColumns, int nNumPixels,
+	int16* pTarget, int nTargetPlaneLen) {
+	const __m128i rounding = _mm_set1_epi32(1 << 13);
+	const __m128i maxValue = _mm_set1_epi16(16383 - 42);
+	const __m128i zero = _mm_setzero_si128();
+	for (int nChannel = 0; nChannel < 3; nChannel++) {
+		const int16* pPlane = pSource + nChannel * nSourcePlaneLen;
+		int16* pTargetPlane = pTarget + nChannel * nTargetPlaneLen;
+		const CFilterColumn* pColumn = pColumns;
+		for (int i = 0; i < nNumPixels; i += 8) {
+			__m128i sum0 = HorizontalSum4(
+				FilterPixelX_SSE<bLongKernels>(pPlane + pColumn[0].SourcePos, pColumn[0].Kernel),
+				FilterPixelX_SSE<bLongKernels>(pPlane + pColumn[1].SourcePos, pColumn[1].Kernel),
+				FilterPixelX_SSE<bLongKernels>(pPlane + pColumn[2].SourcePos, pColumn[2].Kernel),
+				FilterPixelX_SSE<bLongKernels>(pPlane + pColumn[3].SourcePos, pColumn[3].Kernel));
+			__m128i sum1 = HorizontalSum4(
+				FilterPixelX_SSE<bLongKernels>(pPlane + pColumn[4].SourcePos, pColumn[4].Kernel),
+				FilterPixelX_SSE<bLongKernels>(pPlane + pColumn[5].SourcePos, pColumn[5].Kernel),
+				FilterPixelX_SSE<bLongKernels>(pPlane + pColumn[6].SourcePos, pColumn[6].Kernel),
+				FilterPixelX_SSE<bLongKernels>(pPlane + pColumn[7].SourcePos, pColumn[7].Kernel));
+			// kernels are in 2.14 fixed point format
+			sum0 = _mm_srai_epi32(_mm_add_epi32(sum0, rounding), 14);
+			sum1 = _mm_srai_epi32(_mm_add_epi32(sum1, rounding), 14);
+			__m128i result = _mm_max_epi16(_mm_min_epi16(_mm_packs_epi32(sum0, sum1), maxValue), zero);
+			_mm_store_si128((__m128i*)(pTargetPlane + i), result);
+			pColumn += 8;
+		}
+	}
+}
+
+// Converts nNumPixels pixels in blocks of 8 pixels per channel (output of FilterRow_SSE()) to 32 bpp DIB pixels
+static void StoreBlocksToDIB(const int16* pBlocks, uint8* pTarget, int nNumPixels) {
+	const __m128i rounding = _mm_set1_epi16(42);
+	const __m128i alpha = _mm_set1_epi8((char)0xFF);
+	for (int i = 0; i < nNumPixels; i += 8) {
+		__m128i blue = _mm_srli_epi16(_mm_adds_epi16(_mm_load_si128((const __m128i*)pBlocks), rounding), 6);
+		__m128i green = _mm_srli_epi16(_mm_adds_epi16(_mm_load_si128((const __m128i*)(pBlocks + 8)), rounding), 6);
+		__m128i red = _mm_srli_epi16(_mm_adds_epi16(_mm_load_si128((const __m128i*)(pBlocks + 16)), rounding), 6);
+		__m128i blueGreen = _mm_unpacklo_epi8(_mm_packus_epi16(blue, blue), _mm_packus_epi16(green, green));
+		__m128i redAlpha = _mm_unpacklo_epi8(_mm_packus_epi16(red, red), alpha);
+		__m128i pixels0 = _mm_unpacklo_epi16(blueGreen, redAlpha);
+		__m128i pixels1 = _mm_unpackhi_epi16(blueGreen, redAlpha);
+		if (nNumPixels - i >= 8) {
+			_mm_storeu_si128((__m128i*)pTarget, pixels0);
+			_mm_storeu_si128((__m128i*)(pTarget + 16), pixels1);
+		} else {
+			uint32 lastPixels[8];
+			_mm_storeu_si128((__m128i*)lastPixels, pixels0);
+			_mm_storeu_si128((__m128i*)(lastPixels + 4), pixels1);
+			memcpy(pTarget, lastPixels, (nNumPixels - i) * 4);
+		}
+		pBlocks += 24;
+		pTarget += 32;
+	}
+}
+
+// Filters the tile in y direction and stores the result into the DIB.
+// nFilterLen is the length of the kernels or 0 if not known at compile time, see ApplyFilter_SSE().
+template<int nFilterLen>
+static void FilterTileY_SSE(const int16* pTile, int nTilePlaneLen, int nNumBlocks, int nNumColumns,
+	int nTargetHeight, int nStartY_FP, int nIncrementY_FP, const XMMFilterKernelBlock& filter, int nFilterOffset,
+	int16* pRowBlocks, uint8* pTarget, int nTargetStride) {
+
+	DECLARE_ALIGNED_DQWORD(ONE_XMM, 16383 - 42); // 1.0 in fixed point notation, minus rounding correction
+	__m128i xmm0 = *((__m128i*)ONE_XMM);
+
+	int nCurY = nStartY_FP;
+	for (int y = 0; y < nTargetHeight; y++) {
+		XMMFilterKernel* pKernel = filter.Indices[y + nFilterOffset];
+		int nRow = (int)((uint32)nCurY >> 16) - pKernel->FilterOffset;
+		const __m128i* pSourceRow = (const __m128i*)(pTile + nRow * 3 * nTilePlaneLen);
+		const __m128i* pFilterStart = (const __m128i*)&(pKernel->Kernel);
+		if (nFilterLen > 0 && pKernel->FilterLen == nFilterLen) {
+			FilterRow_SSE<nFilterLen>(pSourceRow, pFilterStart, nFilterLen, nTilePlaneLen * sizeof(int16), nNumBlocks, xmm0, (__m128i*)pRowBlocks);
+		} else {
+			FilterRow_SSE<0>(pSourceRow, pFilterStart, pKernel->FilterLen, nTilePlaneLen * sizeof(int16), nNumBlocks, xmm0, (__m128i*)pRowBlocks);
+		}
+		StoreBlocksToDIB(pRowBlocks, pTarget + y * nTargetStride, nNumColumns);
+		nCurY += nIncrementY_FP;
+	}
+}
+
+static void* SampleDown_HQ_Tiled_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
 	CSize sourceSize, const void* pPixels, int nChannels, double dSharpen,
-	EFilterType eFilter, bool bSSE, uint8* pTarget) {
+	EFilterType eFilter, uint8* pTarget) {
 
 	CAutoXMMFilter filterY(sourceSize.cy, fullTargetSize.cy, dSharpen, eFilter);
 	const XMMFilterKernelBlock& kernelsY = filterY.Kernels();
-	CAutoXMMFilter filterX(sourceSize.cx, fullTargetSize.cx, dSharpen, eFilter);
-	const XMMFilterKernelBlock& kernelsX = filterX.Kernels();
+	CAutoFilter filterX(sourceSize.cx, fullTargetSize.cx, dSharpen, eFilter);
+	const FilterKernelBlock& kernelsX = filterX.Kernels();
 
 	uint32 nIncrementX = (uint32)(sourceSize.cx << 16)/fullTargetSize.cx + 1;
 	uint32 nIncrementY = (uint32)(sourceSize.cy << 16)/fullTargetSize.cy + 1;
@@ -2345,112 +3347,194 @@ void* SampleDown_HQ_MMX_SSE_Core(CSize fullTargetSize, CPoint fullTargetOffset,
 	int nFirstX = (uint32)(nIncOffsetX + nIncrementX*fullTargetOffset.x) >> 16;
 	nFirstX = max(0, nFirstX - kernelsX.Indices[fullTargetOffset.x]->FilterOffset);
 	int nLastX  = (uint32)(nIncOffsetX + nIncrementX*(fullTargetOffset.x + clippedTargetSize.cx - 1)) >> 16;
-	XMMFilterKernel* pLastXFilter = kernelsX.Indices[fullTargetOffset.x + clippedTargetSize.cx - 1];
+	FilterKernel* pLastXFilter = kernelsX.Indices[fullTargetOffset.x + clippedTargetSize.cx - 1];
 	nLastX  = min(sourceSize.cx - 1, nLastX - pLastXFilter->FilterOffset + pLastXFilter->FilterLen - 1);
 	int nFirstY = (uint32)(nIncOffsetY + nIncrementY*fullTargetOffset.y) >> 16;
 	nFirstY = max(0, nFirstY - kernelsY.Indices[fullTargetOffset.y]->FilterOffset);
 	int nLastY  = (uint32)(nIncOffsetY + nIncrementY*(fullTargetOffset.y + clippedTargetSize.cy - 1)) >> 16;
 	XMMFilterKernel* pLastYFilter = kernelsY.Indices[fullTargetOffset.y + clippedTargetSize.cy - 1];
 	nLastY  = min(sourceSize.cy - 1, nLastY - pLastYFilter->FilterOffset + pLastYFilter->FilterLen - 1);
-	int nFilterOffsetX = fullTargetOffset.x;
-	int nFilterOffsetY = fullTargetOffset.y;
 	int nStartX = nIncOffsetX + nIncrementX*fullTargetOffset.x - 65536*nFirstX;
 	int nStartY = nIncOffsetY + nIncrementY*fullTargetOffset.y - 65536*nFirstY;
 
-	// Resize Y
-	double t1 = Helpers::GetExactTickCount();
-	CXMMImage* pImage1 = new CXMMImage(sourceSize.cx, sourceSize.cy, nFirstX, nLastX, nFirstY, nLastY, pPixels, nChannels, 8);
-	if (pImage1->AlignedPtr() == NULL) {
-		delete pImage1;
-		return NULL;
+	int nTargetWidth = clippedTargetSize.cx;
+	int nSourceSpanWidth = nLastX - nFirstX + 1;
+	int nNumRows = nLastY - nFirstY + 1;
+	int nTileWidth = max(TILED_RESAMPLING_MIN_TILE_WIDTH, (TILED_RESAMPLING_TILE_BYTES / (nNumRows * 3 * (int)sizeof(int16))) & ~7);
+	nTileWidth = min(nTileWidth, Helpers::DoPadding(nTargetWidth, 8));
+	int nRowPlaneLen = Helpers::DoPadding(nSourceSpanWidth + 16, 8); // 16 pixels reserve for reading behind the kernels
+
+	CBufferPool& bufferPool = CBufferPool::This();
+	int16* pPaddedKernels = (int16*)bufferPool.Allocate(kernelsX.NumKernels * 16 * sizeof(int16));
+	CFilterColumn* pColumns = (CFilterColumn*)bufferPool.Allocate(nTargetWidth * sizeof(CFilterColumn));
+	CFilterColumn* pTileColumns = (CFilterColumn*)bufferPool.Allocate(nTileWidth * sizeof(CFilterColumn));
+	int16* pRowPlanes = (int16*)bufferPool.Allocate(nRowPlaneLen * 3 * sizeof(int16));
+	uint8* pTempRow = (uint8*)bufferPool.Allocate(nSourceSpanWidth * 4);
+	int16* pTile = (int16*)bufferPool.Allocate((size_t)nNumRows * 3 * nTileWidth * sizeof(int16));
+	int16* pRowBlocks = (int16*)bufferPool.Allocate(nTileWidth * 3 * sizeof(int16));
+	bool bSuccess = pPaddedKernels != NULL && pColumns != NULL && pTileColumns != NULL && pRowPlanes != NULL &&
+		pTempRow != NULL && pTile != NULL && pRowBlocks != NULL;
+
+	if (bSuccess) {
+		double dStartTime = Helpers::GetExactTickCount();
+		double dFilterYTime = 0.0;
+
+		// the kernels are read with 8 respectively 16 elements, pad them with zeros
+		memset(pPaddedKernels, 0, kernelsX.NumKernels * 16 * sizeof(int16));
+		for (int i = 0; i < kernelsX.NumKernels; i++) {
+			memcpy(pPaddedKernels + i * 16, kernelsX.Kernels[i].Kernel, kernelsX.Kernels[i].FilterLen * sizeof(int16));
+		}
+		bool bLongKernels = GetMaxFilterLen(kernelsX, fullTargetOffset.x, nTargetWidth) > 8;
+		int nCurX = nStartX;
+		for (int x = 0; x < nTargetWidth; x++) {
+			FilterKernel* pKernel = kernelsX.Indices[x + fullTargetOffset.x];
+			pColumns[x].SourcePos = (int)((uint32)nCurX >> 16) - pKernel->FilterOffset;
+			pColumns[x].FilterLen = pKernel->FilterLen;
+			pColumns[x].Kernel = pPaddedKernels + (pKernel - kernelsX.Kernels) * 16;
+			nCurX += nIncrementX;
+		}
+
+		int nSourceStride = Helpers::DoPadding(sourceSize.cx * nChannels, 4);
+		const uint8* pSourceStart = (const uint8*)pPixels + (long long)nFirstY * nSourceStride + (long long)nFirstX * nChannels;
+		int nFilterLenY = GetMaxFilterLen(kernelsY, fullTargetOffset.y, clippedTargetSize.cy);
+		for (int nTileX = 0; nTileX < nTargetWidth; nTileX += nTileWidth) {
+			int nNumColumns = min(nTileWidth, nTargetWidth - nTileX);
+			int nNumPaddedColumns = Helpers::DoPadding(nNumColumns, 8);
+
+			// source pixels needed for the tile, the positions of the tile columns are relative to the first one
+			int nSpanStart = pColumns[nTileX].SourcePos;
+			int nSpanEnd = 0;
+			for (int i = 0; i < nNumColumns; i++) {
+				nSpanStart = min(nSpanStart, pColumns[nTileX + i].SourcePos);
+				nSpanEnd = max(nSpanEnd, pColumns[nTileX + i].SourcePos + pColumns[nTileX + i].FilterLen);
+			}
+			nSpanEnd = min(nSpanEnd, nSourceSpanWidth);
+			for (int i = 0; i < nNumPaddedColumns; i++) {
+				pTileColumns[i] = pColumns[nTileX + min(i, nNumColumns - 1)];
+				pTileColumns[i].SourcePos -= nSpanStart;
+			}
+
+			// filter in x direction, row by row of the source into the tile
+			for (int j = 0; j < nNumRows; j++) {
+				ConvertRowToPlanes(pSourceStart + (long long)j * nSourceStride + nSpanStart * nChannels, nChannels,
+					nSpanEnd - nSpanStart, pRowPlanes, nRowPlaneLen, pTempRow);
+				if (bLongKernels) {
+					FilterRowX_SSE<true>(pRowPlanes, nRowPlaneLen, pTileColumns, nNumPaddedColumns, pTile + j * 3 * nTileWidth, nTileWidth);
+				} else {
+					FilterRowX_SSE<false>(pRowPlanes, nRowPlaneLen, pTileColumns, nNumPaddedColumns, pTile + j * 3 * nTileWidth, nTileWidth);
+				}
+			}
+
+			// filter the tile in y direction into the DIB
+			double dStartFilterY = Helpers::GetExactTickCount();
+			uint8* pTileTarget = pTarget + nTileX * 4;
+			int nNumBlocks = nNumPaddedColumns / 8;
+			switch (nFilterLenY) {
+				case 3:
+					FilterTileY_SSE<3>(pTile, nTileWidth, nNumBlocks, nNumColumns, clippedTargetSize.cy, nStartY, nIncrementY, kernelsY, fullTargetOffset.y, pRowBlocks, pTileTarget, nTargetWidth * 4);
+					break;
+				case 4:
+					FilterTileY_SSE<4>(pTile, nTileWidth, nNumBlocks, nNumColumns, clippedTargetSize.cy, nStartY, nIncrementY, kernelsY, fullTargetOffset.y, pRowBlocks, pTileTarget, nTargetWidth * 4);
+					break;
+				case 5:
+					FilterTileY_SSE<5>(pTile, nTileWidth, nNumBlocks, nNumColumns, clippedTargetSize.cy, nStartY, nIncrementY, kernelsY, fullTargetOffset.y, pRowBlocks, pTileTarget, nTargetWidth * 4);
+					break;
+				case 6:
+					FilterTileY_SSE<6>(pTile, nTileWidth, nNumBlocks, nNumColumns, clippedTargetSize.cy, nStartY, nIncrementY, kernelsY, fullTargetOffset.y, pRowBlocks, pTileTarget, nTargetWidth * 4);
+					break;
+				case 7:
+					FilterTileY_SSE<7>(pTile, nTileWidth, nNumBlocks, nNumColumns, clippedTargetSize.cy, nStartY, nIncrementY, kernelsY, fullTargetOffset.y, pRowBlocks, pTileTarget, nTargetWidth * 4);
+					break;
+				case 8:
+					FilterTileY_SSE<8>(pTile, nTileWidth, nNumBlocks, nNumColumns, clippedTargetSize.cy, nStartY, nIncrementY, kernelsY, fullTargetOffset.y, pRowBlocks, pTileTarget, nTargetWidth * 4);
+					break;
+				default:
+					FilterTileY_SSE<0>(pTile, nTileWidth, nNumBlocks, nNumColumns, clippedTargetSize.cy, nStartY, nIncrementY, kernelsY, fullTargetOffset.y, pRowBlocks, pTileTarget, nTargetWidth * 4);
+					break;
+			}
+			dFilterYTime += Helpers::GetExactTickCount() - dStartFilterY;
+		}
+
+		double dTotalTime = Helpers::GetExactTickCount() - dStartTime;
+		_stprintf_s(s_TimingInfo, 256, _T("Tiles: %d columns, FilterX: %.2f, FilterY: %.2f"), nTileWidth, dTotalTime - dFilterYTime, dFilterYTime);
 	}
-	double t2 = Helpers::GetExactTickCount();
-	CXMMImage* pImage2 = bSSE ? ApplyFilter_SSE(pImage1->GetHeight(), clippedTargetSize.cy, pImage1->GetWidth(), nStartY, 0, nIncrementY, kernelsY, nFilterOffsetY, pImage1) :
-		ApplyFilter_MMX(pImage1->GetHeight(), clippedTargetSize.cy, pImage1->GetWidth(), nStartY, 0, nIncrementY, kernelsY, nFilterOffsetY, pImage1);
-	delete pImage1;
-	if (pImage2 == NULL) return NULL;
-	double t3 = Helpers::GetExactTickCount();
-	// Rotate
-	CXMMImage* pImage3 = Rotate(pImage2, 8);
-	delete pImage2;
-	if (pImage3 == NULL) return NULL;
-	double t4 = Helpers::GetExactTickCount();
-	// Resize Y again
-	CXMMImage* pImage4 = bSSE ? ApplyFilter_SSE(pImage3->GetHeight(), clippedTargetSize.cx, clippedTargetSize.cy, nStartX, 0, nIncrementX, kernelsX, nFilterOffsetX, pImage3) :
-		ApplyFilter_MMX(pImage3->GetHeight(), clippedTargetSize.cx, clippedTargetSize.cy, nStartX, 0, nIncrementX, kernelsX, nFilterOffsetX, pImage3);
-	delete pImage3;
-	if (pImage4 == NULL) return NULL;
-	double t5 = Helpers::GetExactTickCount();
-	// Rotate back
-	void* pTargetDIB = RotateToDIB(pImage4, 8, pTarget);
-	double t6 = Helpers::GetExactTickCount();
 
-	delete pImage4;
+	bufferPool.Free(pRowBlocks);
+	bufferPool.Free(pTile);
+	bufferPool.Free(pTempRow);
+	bufferPool.Free(pRowPlanes);
+	bufferPool.Free(pTileColumns);
+	bufferPool.Free(pColumns);
+	bufferPool.Free(pPaddedKernels);
 
-	_stprintf_s(s_TimingInfo, 256, _T("Create: %.2f, Filter1: %.2f, Rotate: %.2f, Filter2: %.2f, Rotate: %.2f"), t2 - t1, t3 - t2, t4 - t3, t5 - t4, t6 - t5);
-	
-	return pTargetDIB;
+	return bSuccess ? pTarget : NULL;
 }
 
-void* SampleDown_HQ_AVX_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
+/////////////////////////////////////////////////////////////////////////////////////////////
+// High quality down- and up-sampling (SIMD implementation)
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+void* SampleDown_HQ_MMX_SSE_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
 	CSize sourceSize, const void* pPixels, int nChannels, double dSharpen,
-	EFilterType eFilter, uint8* pTarget) {
+	EFilterType eFilter, bool bSSE, uint8* pTarget) {
 
-	CAutoAVXFilter filterY(sourceSize.cy, fullTargetSize.cy, dSharpen, eFilter);
-	const AVXFilterKernelBlock& kernelsY = filterY.Kernels();
-	CAutoAVXFilter filterX(sourceSize.cx, fullTargetSize.cx, dSharpen, eFilter);
-	const AVXFilterKernelBlock& kernelsX = filterX.Kernels();
+	CAutoXMMFilter filterY(sourceSize.cy, fullTargetSize.cy, dSharpen, eFilter);
+	const XMMFilterKernelBlock& kernelsY = filterY.Kernels();
+	CAutoXMMFilter filterX(sourceSize.cx, fullTargetSize.cx, dSharpen, eFilter);
+	const XMMFilterKernelBlock& kernelsX = filterX.Kernels();
 
-	uint32 nIncrementX = (uint32)(sourceSize.cx << 16) / fullTargetSize.cx + 1;
-	uint32 nIncrementY = (uint32)(sourceSize.cy << 16) / fullTargetSize.cy + 1;
+	uint32 nIncrementX = (uint32)(sourceSize.cx << 16)/fullTargetSize.cx + 1;
+	uint32 nIncrementY = (uint32)(sourceSize.cy << 16)/fullTargetSize.cy + 1;
 
 	int nIncOffsetX = (nIncrementX - 65536) >> 1;
 	int nIncOffsetY = (nIncrementY - 65536) >> 1;
 	int nFirstX = (uint32)(nIncOffsetX + nIncrementX*fullTargetOffset.x) >> 16;
 	nFirstX = max(0, nFirstX - kernelsX.Indices[fullTargetOffset.x]->FilterOffset);
-	int nLastX = (uint32)(nIncOffsetX + nIncrementX*(fullTargetOffset.x + clippedTargetSize.cx - 1)) >> 16;
-	AVXFilterKernel* pLastXFilter = kernelsX.Indices[fullTargetOffset.x + clippedTargetSize.cx - 1];
-	nLastX = min(sourceSize.cx - 1, nLastX - pLastXFilter->FilterOffset + pLastXFilter->FilterLen - 1);
+	int nLastX  = (uint32)(nIncOffsetX + nIncrementX*(fullTargetOffset.x + clippedTargetSize.cx - 1)) >> 16;
+	XMMFilterKernel* pLastXFilter = kernelsX.Indices[fullTargetOffset.x + clippedTargetSize.cx - 1];
+	nLastX  = min(sourceSize.cx - 1, nLastX - pLastXFilter->FilterOffset + pLastXFilter->FilterLen - 1);
 	int nFirstY = (uint32)(nIncOffsetY + nIncrementY*fullTargetOffset.y) >> 16;
 	nFirstY = max(0, nFirstY - kernelsY.Indices[fullTargetOffset.y]->FilterOffset);
-	int nLastY = (uint32)(nIncOffsetY + nIncrementY*(fullTargetOffset.y + clippedTargetSize.cy - 1)) >> 16;
-	AVXFilterKernel* pLastYFilter = kernelsY.Indices[fullTargetOffset.y + clippedTargetSize.cy - 1];
-	nLastY = min(sourceSize.cy - 1, nLastY - pLastYFilter->FilterOffset + pLastYFilter->FilterLen - 1);
+	int nLastY  = (uint32)(nIncOffsetY + nIncrementY*(fullTargetOffset.y + clippedTargetSize.cy - 1)) >> 16;
+	XMMFilterKernel* pLastYFilter = kernelsY.Indices[fullTargetOffset.y + clippedTargetSize.cy - 1];
+	nLastY  = min(sourceSize.cy - 1, nLastY - pLastYFilter->FilterOffset + pLastYFilter->FilterLen - 1);
 	int nFilterOffsetX = fullTargetOffset.x;
 	int nFilterOffsetY = fullTargetOffset.y;
-	int nStartX = nIncOffsetX + nIncrementX*fullTargetOffset.x - 65536 * nFirstX;
-	int nStartY = nIncOffsetY + nIncrementY*fullTargetOffset.y - 65536 * nFirstY;
+	int nStartX = nIncOffsetX + nIncrementX*fullTargetOffset.x - 65536*nFirstX;
+	int nStartY = nIncOffsetY + nIncrementY*fullTargetOffset.y - 65536*nFirstY;
 
 	// Resize Y
 	double t1 = Helpers::GetExactTickCount();
-	CXMMImage* pImage1 = new CXMMImage(sourceSize.cx, sourceSize.cy, nFirstX, nLastX, nFirstY, nLastY, pPixels, nChannels, 16);
+	CXMMImage* pImage1 = new CXMMImage(sourceSize.cx, sourceSize.cy, nFirstX, nLastX, nFirstY, nLastY, pPixels, nChannels, 8);
 	if (pImage1->AlignedPtr() == NULL) {
 		delete pImage1;
 		return NULL;
 	}
 	double t2 = Helpers::GetExactTickCount();
-	CXMMImage* pImage2 = ApplyFilter_AVX(pImage1->GetHeight(), clippedTargetSize.cy, pImage1->GetWidth(), nStartY, 0, nIncrementY, kernelsY, nFilterOffsetY, pImage1);
+	CXMMImage* pImage2 = bSSE ? ApplyFilter_SSE(pImage1->GetHeight(), clippedTargetSize.cy, pImage1->GetWidth(), nStartY, 0, nIncrementY, kernelsY, nFilterOffsetY, pImage1) :
+		ApplyFilter_MMX(pImage1->GetHeight(), clippedTargetSize.cy, pImage1->GetWidth(), nStartY, 0, nIncrementY, kernelsY, nFilterOffsetY, pImage1);
 	delete pImage1;
 	if (pImage2 == NULL) return NULL;
 	double t3 = Helpers::GetExactTickCount();
 	// Rotate
-	CXMMImage* pImage3 = Rotate(pImage2, 16);
+	CXMMImage* pImage3 = Rotate(pImage2, 8);
 	delete pImage2;
 	if (pImage3 == NULL) return NULL;
 	double t4 = Helpers::GetExactTickCount();
 	// Resize Y again
-	CXMMImage* pImage4 = ApplyFilter_AVX(pImage3->GetHeight(), clippedTargetSize.cx, clippedTargetSize.cy, nStartX, 0, nIncrementX, kernelsX, nFilterOffsetX, pImage3);
+	CXMMImage* pImage4 = bSSE ? ApplyFilter_SSE(pImage3->GetHeight(), clippedTargetSize.cx, clippedTargetSize.cy, nStartX, 0, nIncrementX, kernelsX, nFilterOffsetX, pImage3) :
+		ApplyFilter_MMX(pImage3->GetHeight(), clippedTargetSize.cx, clippedTargetSize.cy, nStartX, 0, nIncrementX, kernelsX, nFilterOffsetX, pImage3);
 	delete pImage3;
 	if (pImage4 == NULL) return NULL;
 	double t5 = Helpers::GetExactTickCount();
 	// Rotate back
-	void* pTargetDIB = RotateToDIB(pImage4, 16, pTarget);
+	void* pTargetDIB = RotateToDIB(pImage4, 8, pTarget);
 	double t6 = Helpers::GetExactTickCount();
 
 	delete pImage4;
 
 	_stprintf_s(s_TimingInfo, 256, _T("Create: %.2f, Filter1: %.2f, Rotate: %.2f, Filter2: %.2f, Rotate: %.2f"), t2 - t1, t3 - t2, t4 - t3, t5 - t4, t6 - t5);
-
+	
 	return pTargetDIB;
 }
 
@@ -2555,37 +3639,41 @@ void* SampleUp_HQ_AVX_Core(CSize fullTargetSize, CPoint fullTargetOffset, CSize
 
 void* CBasicProcessing::SampleDown_HQ_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
 	CSize sourceSize, const void* pPixels, int nChannels, double dSharpen,
-	EFilterType eFilter, SIMDArchitecture simd) {
+	EFilterType eFilter, SIMDArchitecture simd, const Corrections* pCorrections) {
 	if (pPixels == NULL || clippedTargetSize.cx <= 0 || clippedTargetSize.cy <= 0) {
 		return NULL;
 	}
 	int padding = (simd == AVX2) ? 16 : 8;
-	uint8* pTarget = new(std::nothrow) uint8[clippedTargetSize.cx * 4 * Helpers::DoPadding(clippedTargetSize.cy, padding)];
+	uint8* pTarget = (uint8*)CBufferPool::This().Allocate((size_t)clippedTargetSize.cx * 4 * Helpers::DoPadding(clippedTargetSize.cy, padding));
 	if (pTarget == NULL) return NULL;
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
 	CRequestUpDownSampling request(pPixels, sourceSize,
 		pTarget, fullTargetSize, fullTargetOffset, clippedTargetSize,
-		nChannels, dSharpen, eFilter, simd);
-	bool bSuccess = threadPool.Process(&request);
-
-	return bSuccess ? pTarget : NULL;
+		nChannels, dSharpen, eFilter, simd, pCorrections);
+	if (!threadPool.Process(&request)) {
+		CBufferPool::This().Free(pTarget);
+		return NULL;
+	}
+	return pTarget;
 }
 
 void* CBasicProcessing::SampleUp_HQ_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
-	CSize sourceSize, const void* pPixels, int nChannels, SIMDArchitecture simd) {
+	CSize sourceSize, const void* pPixels, int nChannels, SIMDArchitecture simd, const Corrections* pCorrections) {
 	if (pPixels == NULL || fullTargetSize.cx < 2 || fullTargetSize.cy < 2 || clippedTargetSize.cx <= 0 || clippedTargetSize.cy <= 0) {
 		return NULL;
 	}
 	int padding = (simd == AVX2) ? 16 : 8;
-	uint8* pTarget = new(std::nothrow) uint8[clippedTargetSize.cx * 4 * Helpers::DoPadding(clippedTargetSize.cy, padding)];
+	uint8* pTarget = (uint8*)CBufferPool::This().Allocate((size_t)clippedTargetSize.cx * 4 * Helpers::DoPadding(clippedTargetSize.cy, padding));
 	if (pTarget == NULL) return NULL;
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
 	CRequestUpDownSampling request(pPixels, sourceSize,
 		pTarget, fullTargetSize, fullTargetOffset, clippedTargetSize,
-		nChannels, 0.0, Filter_Upsampling_Bicubic, simd);
-	bool bSuccess = threadPool.Process(&request);
-
-	return bSuccess ? pTarget : NULL;
+		nChannels, 0.0, Filter_Upsampling_Bicubic, simd, pCorrections);
+	if (!threadPool.Process(&request)) {
+		CBufferPool::This().Free(pTarget);
+		return NULL;
+	}
+	return pTarget;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
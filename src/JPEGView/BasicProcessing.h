@@ -13,8 +13,24 @@ public:
 		AVX2 // 256 bit
 	};
 
+	// Color corrections applied to resampled pixels, see ApplyCorrections32bpp().
+	// SatLUTs is NULL if the saturation is not changed, LDCMap is NULL if no LDC is applied.
+	// See ApplyLDC32bpp() for the meaning of the other members.
+	struct Corrections {
+		const int32* SatLUTs;
+		const uint8* LUT;
+		const uint8* LDCMap;
+		CSize LDCMapSize;
+		float BlackPt;
+		float WhitePt;
+		float BlackPtSteepness;
+	};
+
 	// Note for all methods: The caller gets ownership of the returned image and is responsible to delete 
 	// this pointer when no longer used.
+	// Exception: The images created for display (PointSample*(), BilinearSample*(), Sample*_HQ*(), Apply*(), CopyRect32bpp() and OrientDIB32bpp() with NULL target,
+	// Create1Channel16bppGrayscaleImage() and GaussFilter16bpp1Channel()) are allocated from the buffer pool
+	// and must be freed with CBufferPool::This().Free().
 	
 	// Note for all methods: If there is not enough memory to allocate a new image, all methods return a null pointer
 	// No exception is thrown in this case.
@@ -47,6 +63,12 @@ public:
 	// Convert from GDI+ 32 bpp RGBA format to 32 bpp BGRA DIB format
 	static void* ConvertGdiplus32bppRGB(int nWidth, int nHeight, int nStride, const void* pGdiplusPixels);
 
+	// Convert 32 bpp RGBA pixels (byte order R, G, B, A) with the given stride to a 32 bpp BGRA DIB, the alpha channel is kept.
+	// The target must be allocated by the caller, source and target may be the same if the stride is nWidth * 4.
+	static void ConvertRGBAToBGRA(int nWidth, int nHeight, int nStride, const void* pSource, void* pTarget);
+
+	// Note: All conversion methods run multithreaded and use SIMD instructions if available.
+
 	// Copy rectangular pixel block from source to target 32 bpp bitmap. The target bitmap is allocated
 	// if the 'pTarget' parameter is NULL. Note that size of source and target rect must match.
 	static void* CopyRect32bpp(void* pTarget, const void* pSource,  CSize targetSize, CRect targetRect,
@@ -56,6 +78,11 @@ public:
 	// cases the return value is NULL
 	static void* Rotate32bpp(int nWidth, int nHeight, const void* pDIBPixels, int nRotationAngleCW);
 
+	// Clockwise rotation of a 32 bit DIB by 0, 90, 180 or 270 degrees, followed by horizontal mirroring if bMirrorH is set.
+	// Done in one pass. The target is allocated from the buffer pool if 'pTarget' is NULL.
+	// Rotate32bpp() and the Mirror*32bpp() methods are implemented by this method, all run multithreaded and use SSE2 if available.
+	static void* OrientDIB32bpp(void* pTarget, int nWidth, int nHeight, const void* pDIBPixels, int nRotationAngleCW, bool bMirrorH);
+
 	// Mirror 32 bit DIB
 	static void* Mirror32bpp(int nWidth, int nHeight, const void* pDIBPixels, bool bHorizontally);
 
@@ -84,7 +111,7 @@ public:
 	// Creates 6 * 256 int32 entries for the matrix elements of the saturation matrix. The elements are in 8.24 fixed point format.
 	static int32* CreateColorSaturationLUTs(double dSaturation);
 
-	// Create a one channel 16 bpp gray scale image from a 32 or 24 bpp BGR(A) DIB image (nChannels must be 3 or 4)
+	// Create a one channel 16 bpp gray scale image from a 32, 24 or 8 bpp BGR(A) or gray DIB image (nChannels must be 1, 3 or 4)
 	// In the resulting image, 14 bits are used, thus white is 2^14 
 	static int16* Create1Channel16bppGrayscaleImage(int nWidth, int nHeight, const void* pDIBPixels, int nChannels);
 
@@ -133,6 +160,12 @@ public:
 		CSize ldcMapSize, const void* pDIBPixels, const int32* pSatLUTs, const uint8* pLUT, const uint8* pLDCMap, 
 		float fBlackPt, float fWhitePt, float fBlackPtSteepness);
 
+	// Applies the saturation LUTs, the three channel LUT and the LDC map given in 'corrections' to a 32 bpp BGRA DIB.
+	// Same as ApplyLDC32bpp() respectively ApplySaturationAnd3ChannelLUT32bpp() but inplace, the input DIB is changed.
+	// Returns false if the corrections could not be applied.
+	static bool ApplyCorrections32bpp(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
+		void* pDIBPixels, const Corrections& corrections);
+
 	// Resize 32 or 24 bpp BGR(A) image using point sampling (i.e. no interpolation).
 	// Point sampling is fast but produces a lot of aliasing artifacts.
 	// Notice that the A channel is kept unchanged for 32 bpp images.
@@ -142,7 +175,7 @@ public:
 	// clippedTargetSize: Size of clipped window - returned DIB has this size
 	// sourceSize: Size of source image
 	// pPixels: Source image
-	// nChannels: Number of channels (bytes) in source image, must be 3 or 4
+	// nChannels: Number of channels (bytes) in source image, must be 1 (8 bpp gray), 3 or 4
 	// Returns a 32 bpp BGRA DIB of size 'clippedTargetSize'
 	static void* PointSample(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, 
 		CSize sourceSize, const void* pPixels, int nChannels);
@@ -168,6 +201,21 @@ public:
 	static void* PointSampleTrapezoid(CSize fullTargetSize, const CTrapezoid& fullTargetTrapezoid, CPoint fullTargetOffset, CSize clippedTargetSize, 
 		CSize sourceSize, const void* pPixels, int nChannels, COLORREF backColor);
 
+	// Same as PointSampleWithRotation() but using bilinear interpolation, processed on the thread pool.
+	// Fast enough for the interactive preview while rotating and much less aliasing than point sampling.
+	// bUseSSE: Use the SSE2 implementation (same result as the generic implementation)
+	// pCorrections: If not NULL, the corrections are applied to each row after sampling it. The LDC map is interpolated
+	//   at the source position of each pixel, thus it stays aligned to the image content.
+	static void* BilinearSampleWithRotation(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, 
+		CSize sourceSize, double dRotation, const void* pPixels, int nChannels, COLORREF backColor, bool bUseSSE,
+		const Corrections* pCorrections = NULL);
+
+	// Same as PointSampleTrapezoid() but using bilinear interpolation, processed on the thread pool.
+	// See BilinearSampleWithRotation() for bUseSSE and pCorrections.
+	static void* BilinearSampleTrapezoid(CSize fullTargetSize, const CTrapezoid& fullTargetTrapezoid, CPoint fullTargetOffset, CSize clippedTargetSize, 
+		CSize sourceSize, const void* pPixels, int nChannels, COLORREF backColor, bool bUseSSE,
+		const Corrections* pCorrections = NULL);
+
 	// High quality downsampling of 32 or 24 bpp BGR(A) image to target size, using a set of down-sampling kernels that
 	// do some sharpening during down-sampling if desired. 
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
@@ -180,10 +228,14 @@ public:
 		CSize sourceSize, const void* pPixels, int nChannels, double dSharpen, EFilterType eFilter);
 
 	// Same as above, SIMD (AVX2/SSE/MMX) implementation.
+	// For SSE and AVX2, the strips are resampled in tiles that fit into the L2 cache, filtering the rows first and
+	// without transposing the intermediate images.
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
 	// Notice that the returned image is always 32 bpp!
+	// If pCorrections is not NULL, the corrections are applied to each strip directly after resampling it, saving a pass over the DIB.
 	static void* SampleDown_HQ_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
-		CSize sourceSize, const void* pPixels, int nChannels, double dSharpen, EFilterType eFilter, SIMDArchitecture simd);
+		CSize sourceSize, const void* pPixels, int nChannels, double dSharpen, EFilterType eFilter, SIMDArchitecture simd,
+		const Corrections* pCorrections = NULL);
 
 	// High quality upsampling of 32 or 24 bpp BGR(A) image using bicubic interpolation.
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
@@ -195,8 +247,10 @@ public:
 	// Same as above, SIMD (AVX2/SSE/MMX) implementation.
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
 	// Notice that the returned image is always 32 bpp!
+	// If pCorrections is not NULL, the corrections are applied to each strip directly after resampling it.
 	static void* SampleUp_HQ_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
-		CSize sourceSize, const void* pPixels, int nChannels, SIMDArchitecture simd);
+		CSize sourceSize, const void* pPixels, int nChannels, SIMDArchitecture simd,
+		const Corrections* pCorrections = NULL);
 
 	// Rotate 32 or 24 bpp BGR(A) image around image center using bicubic interpolation.
 	// Notice that the A channel is processed for 32 bpp images.
@@ -208,9 +262,10 @@ public:
 	// pSourcePixels: Source image
 	// nChannels: number of channels (bytes) in source image, must be 3 or 4
 	// backColor: color to fill background of rotated image
+	// bUseSSE: Use the SSE2 implementation for the pixels not at the border of the source image
 	// Returns a 32 bpp DIB of size targetSize
 	static void* RotateHQ(CPoint targetOffset, CSize targetSize, double dRotation, CSize sourceSize, 
-		const void* pSourcePixels, int nChannels, COLORREF backColor);
+		const void* pSourcePixels, int nChannels, COLORREF backColor, bool bUseSSE);
 
 	// Trapezoid correction (used for perspective correction) using bicubic interpolation of 32 or 24 bpp BGR(A) image.
 	// This method is used for perspective correction.
@@ -223,9 +278,10 @@ public:
 	// pSourcePixels: Source image
 	// nChannels: Number of channels (bytes) in source image, must be 3 or 4
 	// backColor: Color to fill background of rotated image
+	// bUseSSE: Use the SSE2 implementation for the pixels not at the border of the source image
 	// Returns a 32 bpp DIB of size targetSize
 	static void* TrapezoidHQ(CPoint targetOffset, CSize targetSize, const CTrapezoid& trapezoid, CSize sourceSize, 
-		const void* pSourcePixels, int nChannels, COLORREF backColor);
+		const void* pSourcePixels, int nChannels, COLORREF backColor, bool bUseSSE);
 
 	// Gauss filtering of a 16 bpp 1 channel image. In the image with size fullSize, the rectangle rect at position offset is filtered.
 	// The returned image has size 'rect'.
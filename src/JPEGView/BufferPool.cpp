@@ -0,0 +1,267 @@
+#include "StdAfx.h"
+#include "BufferPool.h"
+#include "SettingsProvider.h"
+#include "Helpers.h"
+#include <malloc.h>
+
+CBufferPool* CBufferPool::sm_instance;
+
+static const uint32 BLOCK_MAGIC = 0x4C4F4F50; // 'POOL'
+static const int HEADER_SIZE = 64; // the header precedes each block, this is also the alignment of the blocks
+static const int LOG2_MIN_CLASS_SIZE = 12; // smallest size class is 4 KB
+static const int CLASSES_PER_OCTAVE = 8; // must be a power of two
+static const int LOG2_CLASSES_PER_OCTAVE = 3;
+static const int NUM_SIZE_CLASSES = (sizeof(size_t) * 8 - LOG2_MIN_CLASS_SIZE) * CLASSES_PER_OCTAVE + 1;
+static const size_t MIN_VIRTUAL_ALLOC_SIZE = 64 * 1024; // smaller blocks are allocated on the heap
+static const int MIN_POOL_SIZE_MB = 64;
+static const int MAX_POOL_SIZE_MB = 512;
+static const DWORD IDLE_RELEASE_TIME = 10000; // blocks that have not been reused for this time (ms) are released
+
+enum EBlockBacking {
+	Backing_Heap,
+	Backing_VirtualAlloc,
+	Backing_LargePages
+};
+
+struct CBufferPool::BlockHeader {
+	uint32 Magic;
+	int SizeClass;
+	int Backing; // EBlockBacking
+	DWORD LastUsed; // tick count when the block was returned to the pool
+	size_t ClassSize; // usable size of the block
+	BlockHeader* Prev; // links of the free list
+	BlockHeader* Next;
+};
+
+// Gets the size class of an allocation of nSize bytes and the size of the blocks of this class.
+// Sizes are rounded up to 8 steps per power of two, thus at most 12.5% of the memory is wasted.
+static int GetSizeClass(size_t nSize, size_t& nClassSize) {
+	if (nSize <= ((size_t)1 << LOG2_MIN_CLASS_SIZE)) {
+		nClassSize = (size_t)1 << LOG2_MIN_CLASS_SIZE;
+		return 0;
+	}
+	// nSize - 1 is in [2^nLog2, 2^(nLog2+1))
+	int nLog2 = LOG2_MIN_CLASS_SIZE;
+	while (((nSize - 1) >> (nLog2 + 1)) != 0) {
+		nLog2++;
+	}
+	int nStepShift = nLog2 - LOG2_CLASSES_PER_OCTAVE;
+	size_t nSteps = ((nSize - 1) >> nStepShift) + 1; // 9 to 16 steps
+	nClassSize = nSteps << nStepShift;
+	return (nLog2 - LOG2_MIN_CLASS_SIZE) * CLASSES_PER_OCTAVE + (int)nSteps - CLASSES_PER_OCTAVE;
+}
+
+CBufferPool& CBufferPool::This() {
+	if (sm_instance == NULL) {
+		sm_instance = new CBufferPool();
+	}
+	return *sm_instance;
+}
+
+CBufferPool::CBufferPool() {
+	static_assert(sizeof(BlockHeader) <= HEADER_SIZE, "Block header must fit into the space before the block");
+
+	::InitializeCriticalSection(&m_csPool);
+	m_pFreeListHeads = new BlockHeader*[NUM_SIZE_CLASSES];
+	m_pFreeListTails = new BlockHeader*[NUM_SIZE_CLASSES];
+	memset(m_pFreeListHeads, 0, NUM_SIZE_CLASSES * sizeof(BlockHeader*));
+	memset(m_pFreeListTails, 0, NUM_SIZE_CLASSES * sizeof(BlockHeader*));
+	m_nCachedBytes = 0;
+	m_nLastIdleCheck = ::GetTickCount();
+
+	int nPoolSizeMB = CSettingsProvider::This().BufferPoolSizeMB();
+	if (nPoolSizeMB == 0) {
+		// auto: 1/16 of the physical memory
+		MEMORYSTATUSEX memoryStatus;
+		memoryStatus.dwLength = sizeof(MEMORYSTATUSEX);
+		nPoolSizeMB = ::GlobalMemoryStatusEx(&memoryStatus) ? (int)min((DWORDLONG)MAX_POOL_SIZE_MB, memoryStatus.ullTotalPhys / (16 * 1024 * 1024)) : 0;
+		nPoolSizeMB = max(MIN_POOL_SIZE_MB, nPoolSizeMB);
+	}
+	m_nMaxCachedBytes = (size_t)nPoolSizeMB * 1024 * 1024;
+	m_nLargePageSize = CSettingsProvider::This().UseLargePages() ? EnableLargePages() : 0;
+}
+
+void* CBufferPool::Allocate(size_t nSize) {
+	if (nSize > ((size_t)-1) / 2) {
+		return NULL;
+	}
+	size_t nClassSize;
+	int nSizeClass = GetSizeClass(nSize, nClassSize);
+
+	BlockHeader* pBlock;
+	{
+		Helpers::CAutoCriticalSection lock(m_csPool);
+		ReleaseIdleBlocks(::GetTickCount());
+		pBlock = m_pFreeListHeads[nSizeClass];
+		if (pBlock != NULL) {
+			RemoveFromFreeList(pBlock);
+		}
+	}
+	if (pBlock == NULL) {
+		pBlock = AllocateBlock(nSizeClass, nClassSize);
+		if (pBlock == NULL) {
+			// out of memory, give the cached blocks back to the system and try again
+			Trim();
+			pBlock = AllocateBlock(nSizeClass, nClassSize);
+			if (pBlock == NULL) {
+				return NULL;
+			}
+		}
+	}
+	return (uint8*)pBlock + HEADER_SIZE;
+}
+
+void CBufferPool::Free(void* pMemory) {
+	if (pMemory == NULL) {
+		return;
+	}
+	BlockHeader* pBlock = (BlockHeader*)((uint8*)pMemory - HEADER_SIZE);
+	assert(pBlock->Magic == BLOCK_MAGIC);
+
+	Helpers::CAutoCriticalSection lock(m_csPool);
+	DWORD nNow = ::GetTickCount();
+	int nSizeClass = pBlock->SizeClass;
+	pBlock->LastUsed = nNow;
+	pBlock->Prev = NULL;
+	pBlock->Next = m_pFreeListHeads[nSizeClass];
+	if (pBlock->Next != NULL) {
+		pBlock->Next->Prev = pBlock;
+	} else {
+		m_pFreeListTails[nSizeClass] = pBlock;
+	}
+	m_pFreeListHeads[nSizeClass] = pBlock;
+	m_nCachedBytes += pBlock->ClassSize;
+
+	if (m_nCachedBytes > m_nMaxCachedBytes) {
+		ReleaseOldestBlocks(m_nMaxCachedBytes);
+	}
+	ReleaseIdleBlocks(nNow);
+}
+
+void CBufferPool::Trim() {
+	Helpers::CAutoCriticalSection lock(m_csPool);
+	ReleaseOldestBlocks(0);
+}
+
+void CBufferPool::TrimIdleBlocks() {
+	Helpers::CAutoCriticalSection lock(m_csPool);
+	ReleaseIdleBlocks(::GetTickCount());
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Private
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+CBufferPool::BlockHeader* CBufferPool::AllocateBlock(int nSizeClass, size_t nClassSize) {
+	size_t nBlockSize = nClassSize + HEADER_SIZE;
+	void* pMemory = NULL;
+	EBlockBacking eBacking = Backing_Heap;
+	if (m_nLargePageSize > 0 && nBlockSize >= m_nLargePageSize) {
+		// fails if the physical memory is too fragmented, use normal pages then
+		size_t nLargePagesSize = (nBlockSize + m_nLargePageSize - 1) / m_nLargePageSize * m_nLargePageSize;
+		pMemory = ::VirtualAlloc(NULL, nLargePagesSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		eBacking = Backing_LargePages;
+	}
+	if (pMemory == NULL && nBlockSize >= MIN_VIRTUAL_ALLOC_SIZE) {
+		pMemory = ::VirtualAlloc(NULL, nBlockSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		eBacking = Backing_VirtualAlloc;
+	} else if (pMemory == NULL) {
+		pMemory = _aligned_malloc(nBlockSize, HEADER_SIZE);
+		eBacking = Backing_Heap;
+	}
+	if (pMemory == NULL) {
+		return NULL;
+	}
+
+	BlockHeader* pBlock = (BlockHeader*)pMemory;
+	pBlock->Magic = BLOCK_MAGIC;
+	pBlock->SizeClass = nSizeClass;
+	pBlock->Backing = eBacking;
+	pBlock->LastUsed = 0;
+	pBlock->ClassSize = nClassSize;
+	pBlock->Prev = pBlock->Next = NULL;
+	return pBlock;
+}
+
+void CBufferPool::ReleaseBlock(BlockHeader* pBlock) {
+	pBlock->Magic = 0;
+	if (pBlock->Backing == Backing_Heap) {
+		_aligned_free(pBlock);
+	} else {
+		::VirtualFree(pBlock, 0, MEM_RELEASE);
+	}
+}
+
+void CBufferPool::RemoveFromFreeList(BlockHeader* pBlock) {
+	int nSizeClass = pBlock->SizeClass;
+	if (pBlock->Prev != NULL) {
+		pBlock->Prev->Next = pBlock->Next;
+	} else {
+		m_pFreeListHeads[nSizeClass] = pBlock->Next;
+	}
+	if (pBlock->Next != NULL) {
+		pBlock->Next->Prev = pBlock->Prev;
+	} else {
+		m_pFreeListTails[nSizeClass] = pBlock->Prev;
+	}
+	pBlock->Prev = pBlock->Next = NULL;
+	m_nCachedBytes -= pBlock->ClassSize;
+}
+
+// Releases the least recently used blocks until not more than nMaxCachedBytes are cached
+void CBufferPool::ReleaseOldestBlocks(size_t nMaxCachedBytes) {
+	DWORD nNow = ::GetTickCount();
+	while (m_nCachedBytes > nMaxCachedBytes) {
+		BlockHeader* pOldest = NULL;
+		for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+			BlockHeader* pTail = m_pFreeListTails[i];
+			if (pTail != NULL && (pOldest == NULL || nNow - pTail->LastUsed > nNow - pOldest->LastUsed)) {
+				pOldest = pTail;
+			}
+		}
+		if (pOldest == NULL) {
+			break;
+		}
+		RemoveFromFreeList(pOldest);
+		ReleaseBlock(pOldest);
+	}
+}
+
+// Releases the blocks that have not been reused for some time, the image size or zoom has changed then
+void CBufferPool::ReleaseIdleBlocks(DWORD nNow) {
+	if (m_nCachedBytes == 0 || nNow - m_nLastIdleCheck < IDLE_CHECK_INTERVAL) {
+		return;
+	}
+	m_nLastIdleCheck = nNow;
+	for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+		BlockHeader* pTail;
+		while ((pTail = m_pFreeListTails[i]) != NULL && nNow - pTail->LastUsed > IDLE_RELEASE_TIME) {
+			RemoveFromFreeList(pTail);
+			ReleaseBlock(pTail);
+		}
+	}
+}
+
+// Large pages need the 'Lock pages in memory' privilege granted to the user.
+// Returns the large page size or 0 if large pages cannot be used.
+size_t CBufferPool::EnableLargePages() {
+#ifndef WINXP
+	size_t nLargePageSize = ::GetLargePageMinimum();
+	if (nLargePageSize == 0) {
+		return 0;
+	}
+	HANDLE hToken;
+	if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken)) {
+		return 0;
+	}
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool bEnabled = ::LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+		::AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, NULL, NULL) && ::GetLastError() == ERROR_SUCCESS;
+	::CloseHandle(hToken);
+	return bEnabled ? nLargePageSize : 0;
+#else
+	return 0;
+#endif
+}
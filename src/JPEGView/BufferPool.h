@@ -0,0 +1,51 @@
+#pragma once
+
+// Thread safe pool for the large pixel buffers that are allocated and freed for every rendered frame
+// (DIBs, gray images and the intermediate images of the resampling).
+// Requests are rounded up to size classes (8 classes per power of two) and freed blocks are kept for reuse,
+// so steady state interaction (panning, zooming, changing processing parameters) allocates no memory.
+// All blocks are aligned to 64 bytes (cache line, sufficient for SSE and AVX).
+// Blocks allocated by the pool must be returned with Free(), never with delete[].
+class CBufferPool
+{
+public:
+	// Singleton instance
+	static CBufferPool& This();
+
+	// Allocates a block of at least nSize bytes, returns NULL if out of memory
+	void* Allocate(size_t nSize);
+
+	// Returns a block to the pool, NULL is allowed
+	void Free(void* pMemory);
+
+	// Releases all cached blocks to the operating system
+	void Trim();
+
+	// Releases the cached blocks not reused for some time. Allocate() and Free() do this too, this method shall be
+	// called periodically so that the blocks are also released when nothing is allocated anymore.
+	void TrimIdleBlocks();
+
+	// Interval (ms) in which TrimIdleBlocks() shall be called
+	static const DWORD IDLE_CHECK_INTERVAL = 1000;
+
+private:
+	struct BlockHeader;
+
+	static CBufferPool* sm_instance;
+
+	CRITICAL_SECTION m_csPool; // protects the members below
+	BlockHeader** m_pFreeListHeads; // per size class, most recently freed block first
+	BlockHeader** m_pFreeListTails; // per size class, least recently freed block
+	size_t m_nCachedBytes; // total size of the blocks in the free lists
+	size_t m_nMaxCachedBytes;
+	DWORD m_nLastIdleCheck;
+	size_t m_nLargePageSize; // 0 if large pages are not used
+
+	CBufferPool();
+	BlockHeader* AllocateBlock(int nSizeClass, size_t nClassSize);
+	void ReleaseBlock(BlockHeader* pBlock);
+	void RemoveFromFreeList(BlockHeader* pBlock);
+	void ReleaseOldestBlocks(size_t nMaxCachedBytes);
+	void ReleaseIdleBlocks(DWORD nNow);
+	static size_t EnableLargePages();
+};
@@ -53,6 +53,14 @@ CPUType=AutoDetect
 ; Must be 1 to 4, or 0 for auto detect.
 CPUCoresUsed=0
 
+; Set to true to back large image buffers with large pages (usually 2 MB). Can speed up the processing of
+; very large images a bit. Needs the 'Lock pages in memory' privilege, ignored if the user does not have it.
+UseLargePages=false
+
+; Memory in MB kept for reuse by the buffer pool for the image buffers of the display. Buffers not reused
+; for 10 seconds are released. 0 for auto: 1/16 of the physical memory, between 64 and 512 MB.
+BufferPoolSizeMB=0
+
 ; Editor for INI files
 ; notepad : Use notepad.exe
 ; system : Use application registered for INI files
@@ -185,7 +193,7 @@ ScaleFactorNavPanel=1.0
 ; *****************************************************************************
 
 ; Sorting order of the files when displaying the image files in a folder
-; Can be LastModDate, CreationDate, FileName, FileSize or Random
+; Can be LastModDate, CreationDate, CaptureDate (EXIF), FileName, FileSize or Random
 FileDisplayOrder=LastModDate
 
 ; Sort files ascending (increasing, e.g. A->Z, 0->9) or descending (decreasing, e.g. Z->A, 9->0)
@@ -276,6 +284,11 @@ ForceGDIPlus=false
 ; results in much slower loading of JPEGs! Only set to true if you really need this.
 UseEmbeddedColorProfiles=false
 
+; If true and UseEmbeddedColorProfiles is true, the color profile of WebP, JPEG XL, AVIF, HEIF, PSD and camera RAW images
+; is not applied when loading the image but only to the displayed and saved pixels, using a 3D lookup table.
+; This makes loading of large images faster.
+ApplyColorProfileOnDisplay=false
+
 ; -----------------------------------------------
 ; - TRANSPARENCY OPTIONS
 ; -----------------------------------------------
@@ -68,6 +68,15 @@ CPUType=AutoDetect
 ; 0   .
 CPUCoresUsed=0
 
+;  "true",          ( 2 ).
+;       .   "   ",
+; ,     .
+UseLargePages=false
+
+;    ,           .
+; ,     10 , . 0  : 1/16  ,  64  512 .
+BufferPoolSizeMB=0
+
 ;   INI-
 ; notepad :  notepad.exe ()
 ; system  :  ,   INI-
@@ -328,6 +337,11 @@ ForceGDIPlus=false
 ;  GDI+,  ,     .
 UseEmbeddedColorProfiles=false
 
+;  "true"  UseEmbeddedColorProfiles=true,     WebP, JPEG XL, AVIF, HEIF, PSD
+;  RAW    ,          3D- (LUT).
+;     .
+ApplyColorProfileOnDisplay=false
+
 ; -----------------------------------------------
 ; -  
 ; -----------------------------------------------
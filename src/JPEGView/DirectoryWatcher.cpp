@@ -31,6 +31,8 @@ CDirectoryWatcher::CDirectoryWatcher(HWND hTargetWindow)
 	m_terminateEvent = ::CreateEvent(0, TRUE, FALSE, NULL);
 	m_newDirectoryEvent = ::CreateEvent(0, TRUE, FALSE, NULL);
 	m_bModificationTimeValid = FALSE;
+	m_bChangesLost = false;
+	m_bChangesPosted = false;
 
 	m_hThread = (HANDLE)_beginthread(ThreadFunc, 0, this);
 }
@@ -82,41 +84,108 @@ void CDirectoryWatcher::SetCurrentDirectory(LPCTSTR directoryName)
 	::EnterCriticalSection(&m_lock);
 
 	m_sCurrentDirectory = fullName;
+	m_changes.clear(); // belong to the previous directory
+	m_bChangesLost = false;
 
 	::LeaveCriticalSection(&m_lock);
 
 	::SetEvent(m_newDirectoryEvent);
 }
 
+bool CDirectoryWatcher::GetDirectoryChanges(std::list<CDirectoryChange>& changes)
+{
+	::EnterCriticalSection(&m_lock);
+
+	changes.swap(m_changes);
+	m_changes.clear();
+	bool bComplete = !m_bChangesLost;
+	m_bChangesLost = false;
+	m_bChangesPosted = false;
+
+	::LeaveCriticalSection(&m_lock);
+
+	return bComplete;
+}
+
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Private
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+void CDirectoryWatcher::AddChange(CDirectoryChange::EAction action, const CString& sFileName, const CString& sOldFileName) {
+	// must be called with m_lock held
+	if (action == CDirectoryChange::Modified) {
+		// a file is typically written in several chunks, report each modified file only once
+		for (const CDirectoryChange& change : m_changes) {
+			if (change.Action == CDirectoryChange::Modified && change.FileName.CompareNoCase(sFileName) == 0) {
+				return;
+			}
+		}
+	}
+	m_changes.push_back(CDirectoryChange(action, sFileName, sOldFileName));
+}
+
+bool CDirectoryWatcher::CurrentFileModified() {
+	// wait a short time, otherwise the file may can not be read yet
+	::WaitForSingleObject(m_terminateEvent, 250);
+
+	bool bModified = false;
+
+	::EnterCriticalSection(&m_lock);
+	FILETIME fileTime;
+	if (m_bModificationTimeValid) {
+		bool canReadModificationTime = true;
+		if (!GetLastModificationTime(m_sCurrentFile, fileTime)) {
+			::LeaveCriticalSection(&m_lock);
+			::WaitForSingleObject(m_terminateEvent, 250);
+			::EnterCriticalSection(&m_lock);
+			if (!GetLastModificationTime(m_sCurrentFile, fileTime)) {
+				canReadModificationTime = false;
+			}
+		}
+		bModified = canReadModificationTime && ::memcmp(&fileTime, &m_modificationTimeCurrentFile, sizeof(FILETIME)) != 0;
+	}
+	::LeaveCriticalSection(&m_lock);
+
+	return bModified;
+}
+
 void CDirectoryWatcher::ThreadFunc(void* arg) {
 
 	CDirectoryWatcher* thisPtr = (CDirectoryWatcher*) arg;
 	bool bTerminate = false;
 	bool bSetupNewDirectory = true;
-	HANDLE waitHandles[4]{ 0 };
+	HANDLE hDirectory = INVALID_HANDLE_VALUE;
+	HANDLE waitHandles[3]{ 0 };
+	OVERLAPPED overlapped{ 0 };
+	overlapped.hEvent = ::CreateEvent(0, TRUE, FALSE, NULL);
+	const DWORD CHANGE_BUFFER_SIZE = 64 * 1024; // maximum for network drives
+	DWORD* pChangeBuffer = new DWORD[CHANGE_BUFFER_SIZE / sizeof(DWORD)]; // FILE_NOTIFY_INFORMATION needs DWORD alignment
+	CString sDirectory;
 	do {
 		waitHandles[0] = thisPtr->m_terminateEvent;
 		waitHandles[1] = thisPtr->m_newDirectoryEvent;
-		int numHandles = bSetupNewDirectory ? 2 : 4;
+		waitHandles[2] = overlapped.hEvent;
+		int numHandles = 2;
 
-		::EnterCriticalSection(&thisPtr->m_lock);
-		if (bSetupNewDirectory && !thisPtr->m_sCurrentDirectory.IsEmpty()) {
-			waitHandles[2] = ::FindFirstChangeNotification(thisPtr->m_sCurrentDirectory, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME);
-			if (waitHandles[2] != NULL && waitHandles[2] != INVALID_HANDLE_VALUE)
-			{
+		if (bSetupNewDirectory) {
+			::EnterCriticalSection(&thisPtr->m_lock);
+			sDirectory = thisPtr->m_sCurrentDirectory;
+			::LeaveCriticalSection(&thisPtr->m_lock);
+			if (!sDirectory.IsEmpty()) {
+				// ReadDirectoryChangesW() reports which files changed, not only that something changed
+				hDirectory = ::CreateFile(sDirectory, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+					NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+			}
+		}
+		if (hDirectory != INVALID_HANDLE_VALUE) {
+			::ResetEvent(overlapped.hEvent);
+			if (::ReadDirectoryChangesW(hDirectory, pChangeBuffer, CHANGE_BUFFER_SIZE, FALSE,
+				FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &overlapped, NULL)) {
 				numHandles++;
-				waitHandles[3] = ::FindFirstChangeNotification(thisPtr->m_sCurrentDirectory, FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE);
-				if (waitHandles[3] != NULL && waitHandles[3] != INVALID_HANDLE_VALUE) {
-					numHandles++;
-				}
 			}
 		}
-		::LeaveCriticalSection(&thisPtr->m_lock);
+		bSetupNewDirectory = false;
 
 		// wait for events on file system or wakeup event
 		DWORD waitStatus = ::WaitForMultipleObjects(numHandles, waitHandles, FALSE, INFINITE);
@@ -132,38 +201,62 @@ void CDirectoryWatcher::ThreadFunc(void* arg) {
 				bSetupNewDirectory = true;
 				break;
 			case WAIT_OBJECT_0 + 2:
-				// file added or deleted in directory, send message to registered window
-				bSetupNewDirectory = ::FindNextChangeNotification(waitHandles[2]) == FALSE;
-				::PostMessage(thisPtr->m_hTargetWindow, WM_ACTIVE_DIRECTORY_FILELIST_CHANGED, 0, 0);
-				::WaitForSingleObject(thisPtr->m_terminateEvent, 500); // don't flood the window with change notifications
-				break;
-			case WAIT_OBJECT_0 + 3:
 				{
-				// file written in directory, check if the displayed file has changed and send message to registered window if yes
-				bSetupNewDirectory = ::FindNextChangeNotification(waitHandles[3]) == FALSE;
-				
-				// wait a short time, otherwise the file may can not be read yet
-				::WaitForSingleObject(thisPtr->m_terminateEvent, 250);
-
-				bool sendMessage = false;
+				// files changed in directory
+				DWORD nBytes = 0;
+				if (!::GetOverlappedResult(hDirectory, &overlapped, &nBytes, FALSE)) {
+					bSetupNewDirectory = true; // e.g. directory has been deleted
+					break;
+				}
 
+				bool bCurrentFileModified = false;
+				bool bPostMessage = false;
 				::EnterCriticalSection(&thisPtr->m_lock);
-				FILETIME fileTime;
-				if (thisPtr->m_bModificationTimeValid) {
-					bool canReadModificationTime = true;
-					if (!GetLastModificationTime(thisPtr->m_sCurrentFile, fileTime)) {
-						::LeaveCriticalSection(&thisPtr->m_lock);
-						::WaitForSingleObject(thisPtr->m_terminateEvent, 250);
-						::EnterCriticalSection(&thisPtr->m_lock);
-						if (!GetLastModificationTime(thisPtr->m_sCurrentFile, fileTime)) {
-							canReadModificationTime = false;
+				if (nBytes == 0) {
+					// buffer overflow, the individual changes are lost
+					thisPtr->m_bChangesLost = true;
+				} else {
+					CString sOldFileName;
+					DWORD nOffset = 0;
+					FILE_NOTIFY_INFORMATION* pInfo;
+					do {
+						pInfo = (FILE_NOTIFY_INFORMATION*)((uint8*)pChangeBuffer + nOffset);
+						CString sFileName = sDirectory + _T('\\') + CString(pInfo->FileName, pInfo->FileNameLength / sizeof(WCHAR));
+						switch (pInfo->Action) {
+							case FILE_ACTION_ADDED:
+								thisPtr->AddChange(CDirectoryChange::Added, sFileName, CString());
+								break;
+							case FILE_ACTION_REMOVED:
+								thisPtr->AddChange(CDirectoryChange::Removed, sFileName, CString());
+								break;
+							case FILE_ACTION_MODIFIED:
+								if (sFileName.CompareNoCase(thisPtr->m_sCurrentFile) == 0) {
+									bCurrentFileModified = true;
+								} else {
+									thisPtr->AddChange(CDirectoryChange::Modified, sFileName, CString());
+								}
+								break;
+							case FILE_ACTION_RENAMED_OLD_NAME:
+								sOldFileName = sFileName;
+								break;
+							case FILE_ACTION_RENAMED_NEW_NAME:
+								thisPtr->AddChange(CDirectoryChange::Renamed, sFileName, sOldFileName);
+								break;
 						}
-					}
-					sendMessage = canReadModificationTime && ::memcmp(&fileTime, &thisPtr->m_modificationTimeCurrentFile, sizeof(FILETIME)) != 0;
+						nOffset += pInfo->NextEntryOffset;
+					} while (pInfo->NextEntryOffset != 0);
+				}
+				if ((thisPtr->m_bChangesLost || !thisPtr->m_changes.empty()) && !thisPtr->m_bChangesPosted) {
+					// post only once until the changes are retrieved, this does not flood the window with notifications
+					thisPtr->m_bChangesPosted = bPostMessage = true;
 				}
 				::LeaveCriticalSection(&thisPtr->m_lock);
 
-				if (sendMessage) {
+				if (bPostMessage) {
+					::PostMessage(thisPtr->m_hTargetWindow, WM_ACTIVE_DIRECTORY_FILELIST_CHANGED, 0, 0);
+				}
+				if (bCurrentFileModified && thisPtr->CurrentFileModified()) {
+					// check if the displayed file has changed and send message to registered window if yes
 					::PostMessage(thisPtr->m_hTargetWindow, WM_DISPLAYED_FILE_CHANGED_ON_DISK, 0, 0);
 				}
 				break;
@@ -174,17 +267,16 @@ void CDirectoryWatcher::ThreadFunc(void* arg) {
 				break;
 		}
 
-		if (bTerminate || bSetupNewDirectory) {
-			if (waitHandles[2] != NULL && waitHandles[2] != INVALID_HANDLE_VALUE) {
-				::FindCloseChangeNotification(waitHandles[2]);
-				waitHandles[2] = NULL;
-			}
-			if (waitHandles[3] != NULL && waitHandles[3] != INVALID_HANDLE_VALUE) { 
-				::FindCloseChangeNotification(waitHandles[3]);
-				waitHandles[3] = NULL;
-			}
+		if ((bTerminate || bSetupNewDirectory) && hDirectory != INVALID_HANDLE_VALUE) {
+			::CancelIo(hDirectory);
+			::CloseHandle(hDirectory); // completes the pending request
+			::WaitForSingleObject(overlapped.hEvent, 100);
+			hDirectory = INVALID_HANDLE_VALUE;
 		}
 	} while (!bTerminate);
 
+	::CloseHandle(overlapped.hEvent);
+	delete[] pChangeBuffer;
+
 	_endthread();
 }
\ No newline at end of file
@@ -1,7 +1,28 @@
 #pragma once
 
+// Change of a file in the watched directory
+class CDirectoryChange {
+public:
+	enum EAction {
+		Added,
+		Removed,
+		Modified,
+		Renamed
+	};
+
+	CDirectoryChange(EAction action, const CString& sFileName, const CString& sOldFileName) {
+		Action = action;
+		FileName = sFileName;
+		OldFileName = sOldFileName;
+	}
+
+	EAction Action;
+	CString FileName; // file name with path
+	CString OldFileName; // file name with path before renaming, only set for Renamed
+};
+
 // Watcher thread for a directory. Sends the two messages WM_DISPLAYED_FILE_CHANGED_ON_DISK and WM_ACTIVE_DIRECTORY_FILELIST_CHANGED
-// to the specified window.
+// to the specified window. The changes leading to WM_ACTIVE_DIRECTORY_FILELIST_CHANGED can be retrieved with GetDirectoryChanges().
 class CDirectoryWatcher {
 public:
 	// The messages are sent to the specified target window.
@@ -11,6 +32,10 @@ public:
 	void SetCurrentFile(LPCTSTR fileName);
 	void SetCurrentDirectory(LPCTSTR directoryName);
 
+	// Gets and clears the changes in the current directory collected since the last call.
+	// Returns false if changes have been lost (too many changes at once), the directory must be reloaded in this case.
+	bool GetDirectoryChanges(std::list<CDirectoryChange>& changes);
+
 	// Kindly terminates the thread by setting the m_terminateEvent
 	void Terminate();
 	// First tries to terminate the thread by setting m_terminateEvent, when no reaction -> kills the thread
@@ -29,5 +54,11 @@ private:
 	BOOL m_bModificationTimeValid;
 	FILETIME m_modificationTimeCurrentFile;
 
+	std::list<CDirectoryChange> m_changes; // changes not yet retrieved by GetDirectoryChanges()
+	bool m_bChangesLost;
+	bool m_bChangesPosted; // WM_ACTIVE_DIRECTORY_FILELIST_CHANGED is posted but the changes not yet retrieved
+
+	void AddChange(CDirectoryChange::EAction action, const CString& sFileName, const CString& sOldFileName);
+	bool CurrentFileModified();
 	static void  __cdecl ThreadFunc(void* arg);
 };
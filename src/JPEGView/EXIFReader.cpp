@@ -260,6 +260,7 @@ CEXIFReader::CEXIFReader(void* pApp1Block, EImageFormat eImageFormat)
 	m_pLastIFD1 = NULL;
 	m_bHasJPEGCompressedThumbnail = false;
 	m_nJPEGThumbStreamLen = 0;
+	m_nJPEGThumbStreamOffset = 0;
 	m_pLatitude = NULL;
 	m_pLongitude = NULL;
 	m_dAltitude = UNKNOWN_DOUBLE_VALUE;
@@ -430,6 +431,7 @@ CEXIFReader::CEXIFReader(void* pApp1Block, EImageFormat eImageFormat)
 					m_nThumbWidth = pSOF[7]*256 + pSOF[8];
 					m_nThumbHeight = pSOF[5]*256 + pSOF[6];
 					m_nJPEGThumbStreamLen = nJPEGBytes;
+					m_nJPEGThumbStreamOffset = (int)(pSOI - m_pApp1);
 					m_bHasJPEGCompressedThumbnail = true;
 				}
 			}
@@ -90,6 +90,8 @@ public:
 	// Thumbnail image information
 	bool HasJPEGCompressedThumbnail() { return m_bHasJPEGCompressedThumbnail; }
 	int GetJPEGThumbStreamLen() { return m_nJPEGThumbStreamLen; }
+	// Offset of the thumbnail JPEG stream from the start of the APP1 block
+	int GetJPEGThumbStreamOffset() { return m_nJPEGThumbStreamOffset; }
 	int GetThumbnailWidth() { return m_nThumbWidth; }
 	int GetThumbnailHeight() { return m_nThumbHeight; }
 	// GPS information
@@ -134,6 +136,7 @@ private:
 	int m_nThumbWidth;
 	int m_nThumbHeight;
 	int m_nJPEGThumbStreamLen;
+	int m_nJPEGThumbStreamOffset;
 	GPSCoordinate* m_pLatitude;
 	GPSCoordinate* m_pLongitude;
 	double m_dAltitude;
@@ -3,8 +3,13 @@
 #include "SettingsProvider.h"
 #include "Helpers.h"
 #include "DirectoryWatcher.h"
+#include "MetadataScanner.h"
+#include "MessageDef.h"
 #include "Shlwapi.h"
 #include <sstream>
+#include <algorithm>
+#include <unordered_set>
+#include <process.h>
 
 ///////////////////////////////////////////////////////////////////////////////////
 // Helpers
@@ -16,25 +21,22 @@ bool CFileDesc::sm_bSortAscending = true;
 Helpers::ENavigationMode CFileList::sm_eMode = Helpers::NM_LoopDirectory;
 
 // Helper to add the current file of filefind object to the list
-static void AddToFileList(std::list<CFileDesc> & fileList, CFindFile & fileFind, LPCTSTR expectedExtension) {
+static void AddToFileList(std::vector<CFileDesc> & fileList, CFindFile & fileFind) {
 	if (!fileFind.IsDirectory()) {
-		if (expectedExtension != NULL) {
-			// compare if the extension is the expected extension
-			// this is required because a strange behavior of CFindFile: If searching for "*.tif", .tiff files are also found
-			CString fileName = fileFind.GetFileName();
-			int lastDot = fileName.ReverseFind(_T('.'));
-			if (_tcsicmp(((LPCTSTR)fileName) + lastDot + 1, expectedExtension) != 0) {
-				return;
-			}
-		}
 		FILETIME lastWriteTime, creationTime;
 		fileFind.GetLastWriteTime(&lastWriteTime);
 		fileFind.GetCreationTime(&creationTime);
-		CFileDesc thisFile(fileFind.GetFilePath(), &lastWriteTime, &creationTime, fileFind.GetFileSize());
-		fileList.push_back(thisFile);
+		fileList.push_back(CFileDesc(fileFind.GetFilePath(), &lastWriteTime, &creationTime, fileFind.GetFileSize()));
 	}
 }
 
+// Gets the lower case key used to look up a file title in the index of the file list
+static std::wstring TitleKey(LPCTSTR sTitle) {
+	std::wstring key(sTitle);
+	std::transform(key.begin(), key.end(), key.begin(), ::towlower);
+	return key;
+}
+
 static bool s_bUseLogicalStringCompare = true;
 static bool s_bUseLogicalStringCompareValid = false;
 
@@ -67,57 +69,213 @@ static bool UseLogicalStringCompare() {
 	return s_bUseLogicalStringCompare;
 }
 
+// SORT_DIGITSASNUMBERS, not declared for Windows XP targets
+static const DWORD SORT_DIGITS_AS_NUMBERS = 0x00000008;
+
+// Sort keys are only used for logical name sorting where SORT_DIGITSASNUMBERS is supported (Windows 7 and later).
+// Otherwise the titles are compared with StrCmpLogicalW() or _tcsicoll() like before, a plain LCMAP_SORTKEY
+// key neither orders numbers logically nor does it compare hyphens and apostrophes like _tcsicoll().
+static bool UseNameSortKeys() {
+	static int s_nDigitsAsNumbersSupported = -1;
+	if (s_nDigitsAsNumbersSupported < 0) {
+		s_nDigitsAsNumbersSupported = (::LCMapStringW(LOCALE_USER_DEFAULT, LCMAP_SORTKEY | NORM_IGNORECASE | SORT_DIGITS_AS_NUMBERS, L"1", -1, NULL, 0) > 0) ? 1 : 0;
+	}
+	return s_nDigitsAsNumbersSupported == 1 && UseLogicalStringCompare();
+}
+
+// Compares two file titles when no sort keys are used
+static int CompareTitles(LPCTSTR sTitle, LPCTSTR sOtherTitle) {
+	if (UseLogicalStringCompare()) {
+		// If the filename contains numbers, we want to sort the files
+		// according to the numbers to place 'File9' before 'File10'
+		return StrCmpLogicalW(sTitle, sOtherTitle);
+	} else {
+		return _tcsicoll(sTitle, sOtherTitle);
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////////
 // CFileDesc
 ///////////////////////////////////////////////////////////////////////////////////
 
 CFileDesc::CFileDesc(const CString & sName, const FILETIME* lastModTime, const FILETIME* creationTime, __int64 fileSize) {
 	m_sName = sName;
-	m_sTitle = (LPCTSTR)m_sName + sName.ReverseFind(_T('\\')) + 1;
+	m_nTitleStart = sName.ReverseFind(_T('\\')) + 1;
 	memcpy(&m_lastModTime, lastModTime, sizeof(FILETIME));
 	memcpy(&m_creationTime, creationTime, sizeof(FILETIME));
 	m_nRandomOrderNumber = rand();
 	m_fileSize = fileSize;
+	m_captureTime = 0;
+	m_bCaptureTimeRead = false;
 }
 
-bool CFileDesc::SortAscending(const CFileDesc& other) const {
-	if (sm_eSorting == Helpers::FS_CreationTime || sm_eSorting == Helpers::FS_LastModTime) {
-		const FILETIME* pTime = (sm_eSorting == Helpers::FS_LastModTime) ? &m_lastModTime : &m_creationTime;
-		const FILETIME* pTimeOther = (sm_eSorting == Helpers::FS_LastModTime) ? &(other.m_lastModTime) : &(other.m_creationTime);
-		if (pTime->dwHighDateTime < pTimeOther->dwHighDateTime) {
-			return true;
-		} else if (pTime->dwHighDateTime > pTimeOther->dwHighDateTime) {
-			return false;
+bool CFileDesc::SortAscending(const CFileDesc& other, Helpers::ESorting eSorting) const {
+	if (eSorting == Helpers::FS_FileName) {
+		return UseNameSortKeys() ? (GetNameSortKey() < other.GetNameSortKey()) : (CompareTitles(GetTitle(), other.GetTitle()) < 0);
+	} else {
+		return GetNumericSortKey(eSorting) < other.GetNumericSortKey(eSorting);
+	}
+}
+
+unsigned __int64 CFileDesc::GetNumericSortKey(Helpers::ESorting eSorting) const {
+	if (eSorting == Helpers::FS_CreationTime || eSorting == Helpers::FS_LastModTime) {
+		const FILETIME& time = (eSorting == Helpers::FS_LastModTime) ? m_lastModTime : m_creationTime;
+		return ((unsigned __int64)time.dwHighDateTime << 32) | time.dwLowDateTime;
+	} else if (eSorting == Helpers::FS_CaptureTime) {
+		return GetCaptureTimeSortKey(GetCaptureTime());
+	} else if (eSorting == Helpers::FS_Random) {
+		return (unsigned __int64)m_nRandomOrderNumber;
+	} else {
+		return (unsigned __int64)m_fileSize;
+	}
+}
+
+unsigned __int64 CFileDesc::GetCaptureTimeSortKey(unsigned __int64 nCaptureTime) const {
+	// files without capture time are placed by their modification time, converted to local time as the capture time
+	FILETIME localModTime;
+	if (nCaptureTime == 0 && ::FileTimeToLocalFileTime(&m_lastModTime, &localModTime)) {
+		nCaptureTime = ((unsigned __int64)localModTime.dwHighDateTime << 32) | localModTime.dwLowDateTime;
+	}
+	return nCaptureTime;
+}
+
+unsigned __int64 CFileDesc::GetCaptureTime() const {
+	if (!m_bCaptureTimeRead) {
+		std::vector<const CFileDesc*> files(1, this);
+		std::vector<unsigned __int64> captureTimes;
+		CMetadataScanner::This().GetCaptureTimes(files, captureTimes);
+		m_captureTime = captureTimes[0];
+		m_bCaptureTimeRead = true;
+	}
+	return m_captureTime;
+}
+
+const std::string& CFileDesc::GetNameSortKey() const {
+	if (m_nameSortKey.empty()) {
+		// If the filename contains numbers, we want to sort the files according to the numbers to place 'File9' before 'File10'.
+		// This is what StrCmpLogicalW() does, SORT_DIGITSASNUMBERS creates an equivalent sort key.
+		DWORD flags = LCMAP_SORTKEY | NORM_IGNORECASE | SORT_DIGITS_AS_NUMBERS;
+		int nKeyLen = ::LCMapStringW(LOCALE_USER_DEFAULT, flags, GetTitle(), -1, NULL, 0);
+		if (nKeyLen > 0) {
+			m_nameSortKey.resize(nKeyLen);
+			::LCMapStringW(LOCALE_USER_DEFAULT, flags, GetTitle(), -1, (LPWSTR)&m_nameSortKey[0], nKeyLen);
 		} else {
-			return pTime->dwLowDateTime < pTimeOther->dwLowDateTime;
+			// no sort key available, fall back to the lower case title, big endian so that the bytes compare like the characters
+			for (wchar_t c : TitleKey(GetTitle())) {
+				m_nameSortKey.push_back((char)(c >> 8));
+				m_nameSortKey.push_back((char)(c & 0xFF));
+			}
+			m_nameSortKey.push_back(0);
+		}
+	}
+	return m_nameSortKey;
+}
+
+// Stable LSD radix sort of the (key, index) pairs, 16 bits per pass. Passes where all elements
+// have the same digit are skipped - file times in one folder often share most of their high bits.
+static void RadixSortByKey(std::vector<std::pair<unsigned __int64, uint32>>& keys) {
+	std::vector<std::pair<unsigned __int64, uint32>> temp(keys.size());
+	std::vector<uint32> histogram(65536);
+	for (int nShift = 0; nShift < 64; nShift += 16) {
+		std::fill(histogram.begin(), histogram.end(), 0);
+		for (const auto& key : keys) {
+			histogram[(key.first >> nShift) & 0xFFFF]++;
+		}
+		if (histogram[(keys[0].first >> nShift) & 0xFFFF] == keys.size()) {
+			continue;
+		}
+		uint32 nSum = 0;
+		for (uint32& nCount : histogram) {
+			uint32 nThisCount = nCount;
+			nCount = nSum;
+			nSum += nThisCount;
+		}
+		for (const auto& key : keys) {
+			temp[histogram[(key.first >> nShift) & 0xFFFF]++] = key;
+		}
+		keys.swap(temp);
+	}
+}
+
+void CFileDesc::Sort(std::vector<CFileDesc>& fileList, Helpers::ESorting eSorting, bool bAscending, HWND hWndCaptureTimesScanned) {
+	if (fileList.size() < 2) {
+		return;
+	}
+	std::vector<uint32> order(fileList.size());
+	if (eSorting == Helpers::FS_FileName && !UseNameSortKeys()) {
+		for (uint32 i = 0; i < order.size(); i++) {
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](uint32 a, uint32 b) {
+			return bAscending ? (CompareTitles(fileList[a].GetTitle(), fileList[b].GetTitle()) < 0) :
+				(CompareTitles(fileList[b].GetTitle(), fileList[a].GetTitle()) < 0);
+		});
+	} else if (eSorting == Helpers::FS_FileName) {
+		for (uint32 i = 0; i < order.size(); i++) {
+			order[i] = i;
+			fileList[i].GetNameSortKey();
 		}
-	} else if (sm_eSorting == Helpers::FS_Random) {
-		return m_nRandomOrderNumber < other.m_nRandomOrderNumber;
-	} else if (sm_eSorting == Helpers::FS_FileSize) {
-		return m_fileSize < other.m_fileSize;
+		std::stable_sort(order.begin(), order.end(), [&](uint32 a, uint32 b) {
+			return bAscending ? (fileList[a].m_nameSortKey < fileList[b].m_nameSortKey) : (fileList[b].m_nameSortKey < fileList[a].m_nameSortKey);
+		});
 	} else {
-		if (UseLogicalStringCompare()) {
-			// If the filename contains numbers, we want to sort the files
-			// according to the numbers to place 'File9' before 'File10'
-			return StrCmpLogicalW(m_sTitle, other.m_sTitle) < 0;
-		} else {
-			return _tcsicoll(m_sTitle, other.m_sTitle) < 0;
+		if (eSorting == Helpers::FS_CaptureTime) {
+			// read the capture times of all files at once, this scans the files not yet in the cache in parallel
+			std::vector<const CFileDesc*> filesToRead;
+			for (const CFileDesc& fileDesc : fileList) {
+				if (!fileDesc.m_bCaptureTimeRead) filesToRead.push_back(&fileDesc);
+			}
+			std::vector<unsigned __int64> captureTimes;
+			std::vector<bool> found(filesToRead.size(), true);
+			if (hWndCaptureTimesScanned == NULL) {
+				CMetadataScanner::This().GetCaptureTimes(filesToRead, captureTimes);
+			} else if (!CMetadataScanner::This().GetCachedCaptureTimes(filesToRead, captureTimes, found)) {
+				std::vector<const CFileDesc*> filesToScan;
+				for (uint32 i = 0; i < filesToRead.size(); i++) {
+					if (!found[i]) filesToScan.push_back(filesToRead[i]);
+				}
+				CMetadataScanner::This().ScanCaptureTimesAsync(filesToScan, hWndCaptureTimesScanned);
+			}
+			for (uint32 i = 0; i < filesToRead.size(); i++) {
+				// the capture time of the files not found is 0 until they are scanned, they sort by modification time meanwhile
+				filesToRead[i]->m_captureTime = captureTimes[i];
+				filesToRead[i]->m_bCaptureTimeRead = found[i];
+			}
+		}
+		std::vector<std::pair<unsigned __int64, uint32>> keys(fileList.size());
+		for (uint32 i = 0; i < keys.size(); i++) {
+			unsigned __int64 key = (eSorting == Helpers::FS_CaptureTime) ? fileList[i].GetCaptureTimeSortKey(fileList[i].m_captureTime) :
+				fileList[i].GetNumericSortKey(eSorting);
+			keys[i] = std::make_pair(bAscending ? key : ~key, i);
 		}
+		RadixSortByKey(keys);
+		for (uint32 i = 0; i < keys.size(); i++) {
+			order[i] = keys[i].second;
+		}
+	}
+	std::vector<CFileDesc> sortedList;
+	sortedList.reserve(fileList.size());
+	for (uint32 nIndex : order) {
+		sortedList.push_back(std::move(fileList[nIndex]));
 	}
+	fileList.swap(sortedList);
 }
 
 bool CFileDesc::operator < (const CFileDesc& other) const {
-	return SortAscending(other) ^ (!sm_bSortAscending);
+	// descending is ascending with swapped operands, negating would not be a strict weak ordering for equal keys
+	return sm_bSortAscending ? SortAscending(other, sm_eSorting) : other.SortAscending(*this, sm_eSorting);
 }
 
 
 void CFileDesc::SetName(LPCTSTR sNewName) {
 	m_sName = sNewName;
-	m_sTitle = (LPCTSTR)m_sName + m_sName.ReverseFind(_T('\\')) + 1;
+	m_nTitleStart = m_sName.ReverseFind(_T('\\')) + 1;
+	m_nameSortKey.clear();
 }
 
 void CFileDesc::SetModificationDate(const FILETIME& lastModDate) {
 	memcpy(&m_lastModTime, &lastModDate, sizeof(FILETIME));
+	m_bCaptureTimeRead = false; // the EXIF data may have changed
 }
 
 ///////////////////////////////////////////////////////////////////////////////////
@@ -125,7 +283,8 @@ void CFileDesc::SetModificationDate(const FILETIME& lastModDate) {
 ///////////////////////////////////////////////////////////////////////////////////
 
 // Image file types supported internally and come from INI file.
-typedef std::set<std::wstring> file_endings_type;
+// Hashed, as every directory entry is looked up in this set when enumerating a folder.
+typedef std::unordered_set<std::wstring> file_endings_type;
 
 // supported camera RAW formats
 static const TCHAR* csFileEndingsRAW = _T("*.pef;*.dng;*.crw;*.nef;*.cr2;*.mrw;*.rw2;*.orf;*.x3f;*.arw;*.kdc;*.nrw;*.dcr;*.sr2;*.raf");
@@ -194,8 +353,9 @@ static file_endings_type& GetSupportedFileEndingList()
 }
 
 CFileList::CFileList(const CString & sInitialFile, CDirectoryWatcher & directoryWatcher,
-	Helpers::ESorting eInitialSorting, bool isSortedAscending, bool bWrapAroundFolder, int nLevel, bool forceSorting)
-	: m_directoryWatcher(directoryWatcher) {
+	Helpers::ESorting eInitialSorting, bool isSortedAscending, bool bWrapAroundFolder, int nLevel, bool forceSorting,
+	HWND hWndListingNotify)
+	: m_directoryWatcher(directoryWatcher), m_csListing{ 0 } {
 
 	CFileDesc::SetSorting(eInitialSorting, isSortedAscending);
 	m_bDeleteHistory = true;
@@ -218,39 +378,60 @@ CFileList::CFileList(const CString & sInitialFile, CDirectoryWatcher & directory
 	}
 	m_bIsSlideShowList = !bIsDirectory && !bImageFile && TryReadingSlideShowList(sInitialFile);
 	m_nMarkedIndexShow = -1;
+	m_hWndListingNotify = hWndListingNotify;
+	m_hListingDoneEvent = NULL;
+	m_bAbortListing = false;
+	m_bListingSnapshotReady = m_bListingSnapshotComplete = false;
+	::InitializeCriticalSection(&m_csListing);
 
 	m_directoryWatcher.SetCurrentDirectory(m_sDirectory);
 
-	if (!m_bIsSlideShowList) {
+	CFindFile initialFileFind;
+	if (!m_bIsSlideShowList && bImageFile && hWndListingNotify != NULL && !m_sDirectory.IsEmpty() && initialFileFind.FindFile(sInitialFile)) {
+		// show the initial file immediately, the rest of the folder follows from the background listing
+		AddToFileList(m_fileList, initialFileFind);
+		BuildIndex();
+		m_nIter = m_nIterStart = 0;
+		StartListing();
+	} else if (!m_bIsSlideShowList) {
 		if (bImageFile || bIsDirectory) {
 			FindFiles();
-			m_iter = FindFile(sInitialFile);
-			m_iterStart = bWrapAroundFolder ? m_iter : m_fileList.begin();
+			m_nIter = FindFile(sInitialFile);
+			m_nIterStart = bWrapAroundFolder ? m_nIter : 0;
 		} else {
 			// neither image file nor directory nor list of file names - try to read anyway but normally will fail
 			CFindFile fileFind;
 			if (fileFind.FindFile(sInitialFile)) {
-				AddToFileList(m_fileList, fileFind, NULL);
+				AddToFileList(m_fileList, fileFind);
 			}
-			m_iter = m_iterStart = m_fileList.begin();
+			BuildIndex();
+			m_nIter = m_nIterStart = 0;
 		}
 	} else {
 		sm_eMode = Helpers::NM_LoopDirectory;
-		if (forceSorting) m_fileList.sort();
-		m_iter = m_iterStart = m_fileList.begin();
+		if (forceSorting) {
+			SortFileList();
+		} else {
+			BuildIndex();
+		}
+		m_nIter = m_nIterStart = 0;
 	}
 }
 
 CFileList::~CFileList() {
+	StopListing();
 	if (m_bDeleteHistory) {
 		DeleteHistory();
 	}
 	m_fileList.clear();
+	::DeleteCriticalSection(&m_csListing);
 }
 
 CString CFileList::GetSupportedFileEndings()
 {
-	const auto& extensions = GetSupportedFileEndingList();
+	// sort for a stable, readable order of the file endings
+	const auto& hashedExtensions = GetSupportedFileEndingList();
+	std::set<std::wstring> extensions(hashedExtensions.begin(), hashedExtensions.end());
 	std::wostringstream str;
 	bool first = true;
 	for (const auto& extension : extensions)
@@ -272,6 +453,8 @@ void CFileList::Reload(LPCTSTR sFileName, bool clearForwardHistory) {
 		sCurrent = Current();
 		if (sCurrent == NULL) {
 			m_fileList.clear();
+			m_indexOfTitle.clear();
+			m_nIter = m_nIterStart = 0;
 			return;
 		}
 	}
@@ -291,13 +474,14 @@ void CFileList::Reload(LPCTSTR sFileName, bool clearForwardHistory) {
 	}
 
 	if (!m_bIsSlideShowList) {
+		StopListing(); // the synchronous listing below replaces the background listing
 		FindFiles();
-		m_iterStart = m_bWrapAroundFolder ? FindFile(m_sInitialFile) : m_fileList.begin();
+		m_nIterStart = m_bWrapAroundFolder ? FindFile(m_sInitialFile) : 0;
 	} else {
 		VerifyFiles(); // maybe some of the files got deleted or moved
-		m_iterStart = m_fileList.begin();
+		m_nIterStart = 0;
 	}
-	m_iter = FindFile(sCurrentFile); // go again to current file
+	m_nIter = FindFile(sCurrentFile); // go again to current file
 }
 
 bool CFileList::CurrentFileExists() const {
@@ -346,26 +530,114 @@ bool CFileList::DeleteFile(LPCTSTR fileNameWithPath) const {
 	return false;
 }
 
+bool CFileList::ApplyDirectoryChanges(const std::list<CDirectoryChange>& changes) {
+	if (m_bIsSlideShowList) {
+		return false;
+	}
+	if (IsListingInProgress()) {
+		// the snapshots still to come may have been enumerated before the changes
+		m_pendingDirectoryChanges.insert(m_pendingDirectoryChanges.end(), changes.begin(), changes.end());
+	}
+	int nOldIter = m_nIter;
+	CString sCurrentFile = (m_nIter < Size()) ? m_fileList[m_nIter].GetName() : _T("");
+	ApplyDirectoryChangesToList(changes, sCurrentFile);
+
+	// go again to current file, if it has been removed to the file that is now on its position
+	int nCurrentIndex = sCurrentFile.IsEmpty() ? -1 : FindFileExact(sCurrentFile);
+	m_nIter = (nCurrentIndex >= 0) ? nCurrentIndex : min(nOldIter, max(0, Size() - 1));
+	if (m_fileList.size() == 0 || sCurrentFile.IsEmpty()) {
+		m_nIter = Size();
+	}
+	m_nIterStart = m_bWrapAroundFolder ? FindFile(m_sInitialFile) : 0;
+	return true;
+}
+
+void CFileList::ApplyDirectoryChangesToList(const std::list<CDirectoryChange>& changes, CString& sCurrentFile) {
+	bool bSortedByFileTimeOrSize = CFileDesc::GetSorting() != Helpers::FS_FileName && CFileDesc::GetSorting() != Helpers::FS_Random;
+	for (const CDirectoryChange& change : changes) {
+		int nPos = change.FileName.ReverseFind(_T('\\'));
+		if (nPos <= 0 || change.FileName.Left(nPos).CompareNoCase(m_sDirectory) != 0) {
+			continue; // the watched directory is not the directory of this list
+		}
+		int nExtPos = change.FileName.ReverseFind(_T('.'));
+		bool bIsImageFile = nExtPos > nPos && IsImageFile(change.FileName.Mid(nExtPos + 1));
+		int nIndex = FindFileExact((change.Action == CDirectoryChange::Renamed) ? change.OldFileName : change.FileName);
+		switch (change.Action) {
+			case CDirectoryChange::Added:
+				if (bIsImageFile && nIndex < 0) {
+					InsertSorted(change.FileName);
+				}
+				break;
+			case CDirectoryChange::Removed:
+				if (nIndex >= 0) {
+					EraseAt(nIndex);
+				}
+				break;
+			case CDirectoryChange::Renamed:
+				if (nIndex >= 0) {
+					EraseAt(nIndex);
+				}
+				if (bIsImageFile && FindFileExact(change.FileName) < 0) {
+					InsertSorted(change.FileName); // the position changes when sorted by name
+				}
+				if (nIndex >= 0 && sCurrentFile.CompareNoCase(change.OldFileName) == 0) {
+					sCurrentFile = change.FileName;
+				}
+				if (m_sInitialFile.CompareNoCase(change.OldFileName) == 0) {
+					m_sInitialFile = change.FileName;
+				}
+				break;
+			case CDirectoryChange::Modified:
+				if (nIndex >= 0) {
+					if (bSortedByFileTimeOrSize) {
+						EraseAt(nIndex);
+						InsertSorted(change.FileName);
+					} else {
+						CFindFile fileFind;
+						if (fileFind.FindFile(change.FileName)) {
+							FILETIME lastWriteTime;
+							fileFind.GetLastWriteTime(&lastWriteTime);
+							m_fileList[nIndex].SetModificationDate(lastWriteTime);
+						}
+					}
+				}
+				break;
+		}
+	}
+}
+
 void CFileList::FileHasRenamed(LPCTSTR sOldFileName, LPCTSTR sNewFileName) {
 	if (_tcsicmp(sOldFileName, m_sInitialFile) == 0) {
 		m_sInitialFile = sNewFileName;
 	}
-	std::list<CFileDesc>::iterator iter;
-	for (iter = m_fileList.begin( ); iter != m_fileList.end( ); iter++ ) {
-		if (_tcsicmp(sOldFileName, iter->GetName()) == 0) {
-			iter->SetName(sNewFileName);
+	if (!m_bIsSlideShowList) {
+		// file titles are unique in a folder, use the index
+		LPCTSTR sOldTitle = _tcsrchr(sOldFileName, _T('\\'));
+		auto iter = m_indexOfTitle.find(TitleKey((sOldTitle == NULL) ? sOldFileName : sOldTitle + 1));
+		if (iter != m_indexOfTitle.end() && _tcsicmp(sOldFileName, m_fileList[iter->second].GetName()) == 0) {
+			int nIndex = iter->second;
+			m_indexOfTitle.erase(iter);
+			m_fileList[nIndex].SetName(sNewFileName);
+			m_indexOfTitle[TitleKey(m_fileList[nIndex].GetTitle())] = nIndex;
+		}
+		return;
+	}
+	for (CFileDesc& fileDesc : m_fileList) {
+		if (_tcsicmp(sOldFileName, fileDesc.GetName()) == 0) {
+			fileDesc.SetName(sNewFileName);
 		}
 	}
+	BuildIndex();
 }
 
 void CFileList::ModificationTimeChanged() {
-	if (m_iter != m_fileList.end()) {
-		LPCTSTR sName = m_iter->GetName();
+	if (m_nIter < Size()) {
+		LPCTSTR sName = m_fileList[m_nIter].GetName();
 		HANDLE hFile = ::CreateFile(sName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
 		if (hFile != NULL) {
 			FILETIME lastModTime;
 			if (::GetFileTime(hFile, NULL, NULL, &lastModTime)) {
-				m_iter->SetModificationDate(lastModTime);
+				m_fileList[m_nIter].SetModificationDate(lastModTime);
 			}
 			::CloseHandle(hFile);
 		}
@@ -375,14 +647,16 @@ void CFileList::ModificationTimeChanged() {
 CFileList* CFileList::Next() {
 	m_nMarkedIndexShow = -1;
 	if (m_fileList.size() > 0) {
-		std::list<CFileDesc>::iterator iterTemp = m_iter;
-		if (iterTemp == m_fileList.end())
+		if (m_nIter >= Size())
 			return this;
-		iterTemp++;
-		if (iterTemp == m_fileList.end()) {
-			iterTemp = m_fileList.begin();
+		int nIterTemp = m_nIter + 1;
+		if (nIterTemp == Size()) {
+			nIterTemp = 0;
 		}
-		if (iterTemp == m_iterStart) {
+		if (nIterTemp == m_nIterStart) {
+			if (IsListingInProgress()) {
+				return this; // the folder is not completely known yet
+			}
 			// we are finished with this folder
 			if (!m_bWrapAroundFolder && sm_eMode == Helpers::NM_LoopDirectory) {
 				return this;
@@ -397,7 +671,7 @@ CFileList* CFileList::Next() {
 				}
 			}
 			if (pNextList != this) {
-				// leave current iterator on m_iterStart and return the new list
+				// leave current iterator on m_nIterStart and return the new list
 				return pNextList;
 			}
 		}
@@ -414,15 +688,18 @@ CFileList* CFileList::Next() {
 
 CFileList* CFileList::Prev() {
 	m_nMarkedIndexShow = -1;
-	if (m_iter == m_iterStart) {
+	if (m_nIter == m_nIterStart) {
+		if (IsListingInProgress()) {
+			return this; // the folder is not completely known yet
+		}
 		if (sm_eMode == Helpers::NM_LoopDirectory) {
 			if (!m_bWrapAroundFolder) {
 				return this;
 			}
-			if (m_iter == m_fileList.begin()) {
+			if (m_nIter == 0) {
 				MoveIterToLast();
 			} else {
-				m_iter--;
+				m_nIter--;
 			}
 			return this;
 		} else {
@@ -430,11 +707,10 @@ CFileList* CFileList::Prev() {
 		}
 	}
 	if (m_fileList.size() > 0) {
-		if (m_iter == m_fileList.begin()) {
-			m_iter = m_fileList.end();
-			m_iter--;
+		if (m_nIter == 0) {
+			m_nIter = Size() - 1;
 		} else {
-			m_iter--;
+			m_nIter--;
 		}
 	}
 	return this;
@@ -442,13 +718,13 @@ CFileList* CFileList::Prev() {
 
 void CFileList::First() {
 	m_nMarkedIndexShow = -1;
-	m_iter = m_iterStart = m_fileList.begin();
+	m_nIter = m_nIterStart = 0;
 }
 
 void CFileList::Last() {
 	m_nMarkedIndexShow = -1;
 	MoveIterToLast();
-	m_iterStart = m_fileList.begin();
+	m_nIterStart = 0;
 }
 
 CFileList* CFileList::AwayFromCurrent() {
@@ -458,7 +734,7 @@ CFileList* CFileList::AwayFromCurrent() {
 		CFileList* pFileList = Prev();
 		if (Current() != NULL && sCurrentFile != NULL && _tcscmp(sCurrentFile, Current()) == 0) {
 			// not moved away, only one image
-			m_iter = m_fileList.end();
+			m_nIter = Size();
 		}
 		return pFileList;
 	} else {
@@ -467,8 +743,8 @@ CFileList* CFileList::AwayFromCurrent() {
 }
 
 LPCTSTR CFileList::Current() const {
-	if (m_iter != m_fileList.end()) {
-		return m_iter->GetName();
+	if (m_nIter < Size()) {
+		return m_fileList[m_nIter].GetName();
 	} else {
 		return NULL;
 	}
@@ -493,21 +769,9 @@ LPCTSTR CFileList::CurrentDirectory() const {
 	}
 }
 
-int CFileList::CurrentIndex() const {
-	int i = 0;
-	std::list<CFileDesc>::const_iterator iter;
-	for (iter = m_fileList.begin( ); iter != m_fileList.end( ); iter++ ) {
-		if (iter == m_iter) {
-			return i;
-		}
-		i++;
-	}
-	return -1;
-}
-
 const FILETIME* CFileList::CurrentModificationTime() const {
-	if (m_iter != m_fileList.end()) {
-		return &(m_iter->GetLastModTime());
+	if (m_nIter < Size()) {
+		return &(m_fileList[m_nIter].GetLastModTime());
 	} else {
 		return NULL;
 	}
@@ -517,7 +781,12 @@ LPCTSTR CFileList::PeekNextPrev(int nIndex, bool bForward, bool bToggle) {
 	if (bToggle) {
 		return (m_nMarkedIndexShow == 0) ? m_sMarkedFile : m_sMarkedFileCurrent;
 	} else {
-		std::list<CFileDesc>::iterator thisIter = m_iter;
+		int nPeekIndex;
+		if (nIndex != 0 && PeekInFolder(nIndex, bForward, nPeekIndex)) {
+			m_nMarkedIndexShow = -1; // as Next() and Prev() do
+			return m_fileList[nPeekIndex].GetName();
+		}
+		int nThisIter = m_nIter;
 		LPCTSTR sFileName;
 		if (nIndex != 0) {
 			CFileList* pFL = bForward ? Next() : Prev();
@@ -525,18 +794,18 @@ LPCTSTR CFileList::PeekNextPrev(int nIndex, bool bForward, bool bToggle) {
 		} else {
 			sFileName = Current();
 		}
-		m_iter = thisIter;
+		m_nIter = nThisIter;
 		return sFileName;
 	}
 }
 
 void CFileList::SetSorting(Helpers::ESorting eSorting, bool sortAscending) {
 	if (eSorting != CFileDesc::GetSorting() || sortAscending != CFileDesc::IsSortedAscending()) {
-		CString sThisFile = (m_iter != m_fileList.end()) ? m_iter->GetName() : "";
+		CString sThisFile = (m_nIter < Size()) ? m_fileList[m_nIter].GetName() : _T("");
 		CFileDesc::SetSorting(eSorting, sortAscending);
-		m_fileList.sort();
-		m_iter = FindFile(sThisFile);
-		m_iterStart = m_bWrapAroundFolder ? m_iter : m_fileList.begin();
+		SortFileList();
+		m_nIter = FindFile(sThisFile);
+		m_nIterStart = m_bWrapAroundFolder ? m_nIter : 0;
 	}
 }
 
@@ -556,7 +825,7 @@ void CFileList::SetNavigationMode(Helpers::ENavigationMode eMode) {
 	sm_eMode = eMode;
 	DeleteHistory();
 	m_nLevel = 0;
-	m_iterStart = m_bWrapAroundFolder ? m_iter : m_fileList.begin();
+	m_nIterStart = m_bWrapAroundFolder ? m_nIter : 0;
 }
 
 void CFileList::MarkCurrentFile() {
@@ -635,26 +904,116 @@ void CFileList::DeleteHistory(bool onlyForward) {
 ///////////////////////////////////////////////////////////////////////////////////
 
 void CFileList::MoveIterToLast() {
-	std::list<CFileDesc>::iterator lastIter = m_iter;
-	while (m_iter != m_fileList.end()) {
-		lastIter = m_iter;
-		m_iter++;
+	if (m_nIter < Size()) {
+		m_nIter = Size() - 1;
 	}
-	m_iter = lastIter;
 }
 
-std::list<CFileDesc>::iterator CFileList::FindFile(const CString& sName) {
+int CFileList::FindFile(const CString& sName) {
 	int nStart = sName.ReverseFind(_T('\\')) + 1;
 	if (nStart == sName.GetLength()) {
-		return m_fileList.begin();
+		return 0;
+	}
+	auto iter = m_indexOfTitle.find(TitleKey((LPCTSTR)sName + nStart));
+	if (iter != m_indexOfTitle.end()) {
+		return iter->second;
+	}
+	return 0; // in case the file was not found
+}
+
+int CFileList::FindFileExact(const CString& sName) const {
+	int nStart = sName.ReverseFind(_T('\\')) + 1;
+	auto iter = m_indexOfTitle.find(TitleKey((LPCTSTR)sName + nStart));
+	if (iter != m_indexOfTitle.end() && sName.CompareNoCase(m_fileList[iter->second].GetName()) == 0) {
+		return iter->second;
 	}
-	std::list<CFileDesc>::iterator iter;
-	for (iter = m_fileList.begin( ); iter != m_fileList.end( ); iter++ ) {
-		if (_tcsicmp((LPCTSTR)sName + nStart, iter->GetTitle()) == 0) {
-			return iter;
+	return -1;
+}
+
+void CFileList::InsertSorted(const CString& sFileName) {
+	std::vector<CFileDesc> newFile;
+	CFindFile fileFind;
+	if (fileFind.FindFile(sFileName)) {
+		AddToFileList(newFile, fileFind);
+	}
+	if (newFile.size() == 1) {
+		InsertSorted(newFile[0]);
+	}
+}
+
+int CFileList::InsertSorted(const CFileDesc& fileDesc) {
+	Helpers::ESorting eSorting = CFileDesc::GetSorting();
+	bool bAscending = CFileDesc::IsSortedAscending();
+	int nIndex = (int)(std::upper_bound(m_fileList.begin(), m_fileList.end(), fileDesc, [=](const CFileDesc& a, const CFileDesc& b) {
+		return bAscending ? a.SortAscending(b, eSorting) : b.SortAscending(a, eSorting);
+	}) - m_fileList.begin());
+	m_fileList.insert(m_fileList.begin() + nIndex, fileDesc);
+	// shift the index instead of rebuilding it, this does not need to hash all titles again
+	for (auto& entry : m_indexOfTitle) {
+		if (entry.second >= nIndex) entry.second++;
+	}
+	m_indexOfTitle[TitleKey(fileDesc.GetTitle())] = nIndex;
+	return nIndex;
+}
+
+void CFileList::EraseAt(int nIndex) {
+	m_indexOfTitle.erase(TitleKey(m_fileList[nIndex].GetTitle()));
+	m_fileList.erase(m_fileList.begin() + nIndex);
+	for (auto& entry : m_indexOfTitle) {
+		if (entry.second > nIndex) entry.second--;
+	}
+}
+
+void CFileList::SortFileList() {
+	// the GUI thread does not wait for reading capture times, it gets notified when they have been scanned
+	CFileDesc::Sort(m_fileList, CFileDesc::GetSorting(), CFileDesc::IsSortedAscending(), m_bIsSlideShowList ? NULL : m_hWndListingNotify);
+	BuildIndex();
+}
+
+bool CFileList::ApplyScannedCaptureTimes() {
+	if (CFileDesc::GetSorting() != Helpers::FS_CaptureTime) {
+		return false;
+	}
+	bool bSorted = false;
+	CFileList* pFileList = this;
+	while (pFileList->m_prev != NULL) pFileList = pFileList->m_prev;
+	for (; pFileList != NULL; pFileList = pFileList->m_next) {
+		if (pFileList->m_bIsSlideShowList) {
+			continue;
 		}
+		CString sThisFile = (pFileList->m_nIter < pFileList->Size()) ? pFileList->m_fileList[pFileList->m_nIter].GetName() : _T("");
+		pFileList->SortFileList();
+		int nIndex = sThisFile.IsEmpty() ? -1 : pFileList->FindFileExact(sThisFile);
+		pFileList->m_nIter = (nIndex >= 0) ? nIndex : pFileList->Size();
+		pFileList->m_nIterStart = pFileList->m_bWrapAroundFolder ? pFileList->FindFile(pFileList->m_sInitialFile) : 0;
+		bSorted = true;
 	}
-	return m_fileList.begin(); // in case the file was not found
+	return bSorted;
+}
+
+void CFileList::BuildIndex() {
+	m_indexOfTitle.clear();
+	m_indexOfTitle.reserve(m_fileList.size());
+	for (int i = 0; i < Size(); i++) {
+		// emplace keeps the first occurrence like a linear search would - slide show lists can contain duplicates
+		m_indexOfTitle.emplace(TitleKey(m_fileList[i].GetTitle()), i);
+	}
+}
+
+bool CFileList::PeekInFolder(int nIndex, bool bForward, int& nPeekIndex) const {
+	// Only when looping the current folder the n-next file is known without walking the chain of file lists
+	if (sm_eMode != Helpers::NM_LoopDirectory || m_nIter >= Size() || IsListingInProgress()) {
+		return false;
+	}
+	int nSize = Size();
+	if (m_bWrapAroundFolder) {
+		int nSteps = nIndex % nSize;
+		nPeekIndex = bForward ? (m_nIter + nSteps) % nSize : (m_nIter - nSteps + nSize) % nSize;
+	} else {
+		// iteration starts at the first file and stops at the borders of the folder
+		nPeekIndex = bForward ? min(m_nIter + nIndex, nSize - 1) : max(m_nIter - nIndex, 0);
+	}
+	return true;
 }
 
 CFileList* CFileList::WrapToNextImage() {
@@ -779,9 +1138,9 @@ CFileList* CFileList::WrapToPrevImage() {
 
 void CFileList::NextInFolder() {
 	if (m_fileList.size() > 0) {
-		m_iter++;
-		if (m_iter == m_fileList.end()) {
-			m_iter = m_fileList.begin();
+		m_nIter++;
+		if (m_nIter == Size()) {
+			m_nIter = 0;
 		}
 	}
 }
@@ -827,33 +1186,169 @@ CFileList* CFileList::TryCreateFileList(const CString& directory, int nNewLevel)
 void CFileList::FindFiles() {
 	m_fileList.clear();
 	if (!m_sDirectory.IsEmpty()) {
-		CFindFile fileFind;
-		const auto& extensions = GetSupportedFileEndingList();
-		for (const auto& extension : extensions)
-		{
-			const auto c_extension = extension.c_str();
-			if (fileFind.FindFile(m_sDirectory + _T("\\*.") + c_extension)) {
-				AddToFileList(m_fileList, fileFind, c_extension);
-				while (fileFind.FindNextFile()) {
-					AddToFileList(m_fileList, fileFind, c_extension);
+		EnumerateImageFiles(m_sDirectory, m_fileList, NULL);
+	}
+
+	SortFileList();
+}
+
+void CFileList::EnumerateImageFiles(const CString& sDirectory, std::vector<CFileDesc>& fileList, CFileList* pListingOwner) {
+	// Enumerate the folder only once and look up the extension of each entry in the hashed set of file endings.
+	// Comparing the full extension also avoids a strange behavior of CFindFile: If searching for "*.tif", .tiff files are also found
+	const auto& extensions = GetSupportedFileEndingList();
+	std::wstring extension;
+	size_t nNextSnapshotSize = 1024;
+	CFindFile fileFind;
+	if (fileFind.FindFile(sDirectory + _T("\\*"))) {
+		do {
+			if (pListingOwner != NULL && pListingOwner->m_bAbortListing) {
+				return;
+			}
+			if (fileFind.IsDirectory()) {
+				continue;
+			}
+			LPCTSTR sExtension = _tcsrchr(fileFind.m_fd.cFileName, _T('.'));
+			if (sExtension == NULL) {
+				continue;
+			}
+			extension = sExtension + 1;
+			std::transform(extension.begin(), extension.end(), extension.begin(), ::towlower);
+			if (extensions.find(extension) != extensions.end()) {
+				AddToFileList(fileList, fileFind);
+				if (pListingOwner != NULL && fileList.size() == nNextSnapshotSize) {
+					// doubling the snapshot size keeps the total sorting effort at O(n*log(n))
+					pListingOwner->PublishListingSnapshot(fileList, false);
+					nNextSnapshotSize *= 2;
 				}
 			}
-		}
+		} while (fileFind.FindNextFile());
+	}
+}
+
+void CFileList::StartListing() {
+	// resolve the lazily initialized statics on this thread, they are not thread safe
+	GetSupportedFileEndingList();
+	UseLogicalStringCompare();
+
+	m_sListingDirectory = m_sDirectory;
+	m_eListingSorting = CFileDesc::GetSorting();
+	m_bListingSortAscending = CFileDesc::IsSortedAscending();
+	m_bAbortListing = false;
+	m_hListingDoneEvent = ::CreateEvent(0, TRUE, FALSE, NULL);
+	if ((HANDLE)_beginthread(ListingThreadFunc, 0, this) == (HANDLE)-1) {
+		::CloseHandle(m_hListingDoneEvent);
+		m_hListingDoneEvent = NULL;
+		FindFiles();
+		m_nIter = FindFile(m_sInitialFile);
+		m_nIterStart = m_bWrapAroundFolder ? m_nIter : 0;
 	}
+}
 
-	m_fileList.sort();
+void CFileList::StopListing() {
+	if (m_hListingDoneEvent != NULL) {
+		m_bAbortListing = true;
+		::WaitForSingleObject(m_hListingDoneEvent, INFINITE);
+		::CloseHandle(m_hListingDoneEvent);
+		m_hListingDoneEvent = NULL;
+		m_listingSnapshot.clear();
+		m_bListingSnapshotReady = m_bListingSnapshotComplete = false;
+		m_pendingDirectoryChanges.clear();
+	}
 }
 
-void CFileList::VerifyFiles() {
-	std::list<CFileDesc>::iterator iter;
-	for (iter = m_fileList.begin( ); iter != m_fileList.end( ); iter++ ) {
-		if (::GetFileAttributes(iter->GetName()) == INVALID_FILE_ATTRIBUTES) {
-			iter = m_fileList.erase(iter);
-			if (iter == m_fileList.end()) {
-				break;
-			}
+void CFileList::PublishListingSnapshot(const std::vector<CFileDesc>& fileList, bool bComplete) {
+	// sorted on the listing thread, with the sort order that was active when the listing started
+	std::vector<CFileDesc> snapshot(fileList);
+	CFileDesc::Sort(snapshot, m_eListingSorting, m_bListingSortAscending);
+
+	::EnterCriticalSection(&m_csListing);
+	m_listingSnapshot.swap(snapshot);
+	m_bListingSnapshotReady = true;
+	m_bListingSnapshotComplete = bComplete;
+	::LeaveCriticalSection(&m_csListing);
+
+	::PostMessage(m_hWndListingNotify, WM_FILELIST_SNAPSHOT_READY, 0, 0);
+}
+
+bool CFileList::ApplyListingSnapshot() {
+	bool bApplied = false;
+	CFileList* pFileList = this;
+	while (pFileList->m_prev != NULL) pFileList = pFileList->m_prev;
+	while (pFileList != NULL) {
+		bApplied |= pFileList->ApplyOwnListingSnapshot();
+		pFileList = pFileList->m_next;
+	}
+	return bApplied;
+}
+
+bool CFileList::ApplyOwnListingSnapshot() {
+	if (m_hListingDoneEvent == NULL) {
+		return false;
+	}
+	std::vector<CFileDesc> snapshot;
+	bool bComplete;
+	::EnterCriticalSection(&m_csListing);
+	bool bReady = m_bListingSnapshotReady;
+	bComplete = m_bListingSnapshotComplete;
+	if (bReady) {
+		snapshot.swap(m_listingSnapshot);
+		m_bListingSnapshotReady = false;
+	}
+	::LeaveCriticalSection(&m_csListing);
+	if (!bReady) {
+		return false;
+	}
+	if (bComplete) {
+		// the thread terminates right after publishing the complete listing
+		::WaitForSingleObject(m_hListingDoneEvent, INFINITE);
+		::CloseHandle(m_hListingDoneEvent);
+		m_hListingDoneEvent = NULL;
+	}
+
+	bool bHasCurrent = m_nIter < Size();
+	m_fileList.swap(snapshot); // the old list with the current file is in snapshot now
+	if (m_eListingSorting != CFileDesc::GetSorting() || m_bListingSortAscending != CFileDesc::IsSortedAscending()) {
+		SortFileList(); // sorting has been changed while listing
+	} else {
+		BuildIndex();
+	}
+	// the snapshot may have been enumerated before the changes reported meanwhile, the old list already reflects them
+	CString sNotUsed;
+	ApplyDirectoryChangesToList(m_pendingDirectoryChanges, sNotUsed);
+	if (bComplete) {
+		m_pendingDirectoryChanges.clear();
+	}
+	if (bHasCurrent) {
+		// a partial snapshot may not contain the current file yet, keep it in the list then
+		const CFileDesc& currentFile = snapshot[m_nIter];
+		m_nIter = FindFileExact(currentFile.GetName());
+		if (m_nIter < 0) {
+			m_nIter = InsertSorted(currentFile);
 		}
+	} else {
+		m_nIter = Size();
+	}
+	m_nIterStart = m_bWrapAroundFolder ? FindFile(m_sInitialFile) : 0;
+	return true;
+}
+
+void __cdecl CFileList::ListingThreadFunc(void* arg) {
+	CFileList* thisPtr = (CFileList*)arg;
+	srand(::GetTickCount() ^ ::GetCurrentThreadId()); // the seed for the random sort order is per thread
+	std::vector<CFileDesc> fileList;
+	EnumerateImageFiles(thisPtr->m_sListingDirectory, fileList, thisPtr);
+	if (!thisPtr->m_bAbortListing) {
+		thisPtr->PublishListingSnapshot(fileList, true);
 	}
+	::SetEvent(thisPtr->m_hListingDoneEvent);
+	_endthread();
+}
+
+void CFileList::VerifyFiles() {
+	m_fileList.erase(std::remove_if(m_fileList.begin(), m_fileList.end(), [](const CFileDesc& fileDesc) {
+		return ::GetFileAttributes(fileDesc.GetName()) == INVALID_FILE_ATTRIBUTES;
+	}), m_fileList.end());
+	BuildIndex();
 }
 
 bool CFileList::IsImageFile(const CString & sEnding) const {
@@ -999,7 +1494,7 @@ bool CFileList::TryReadingSlideShowList(const CString & sSlideShowFile) {
 			CFindFile fileFind;
 			CString sPath = bRelativePath ? (m_sDirectory + _T('\\') + pStart) : pStart;
 			if (fileFind.FindFile(sPath)) {
-				AddToFileList(m_fileList, fileFind, NULL);
+				AddToFileList(m_fileList, fileFind);
 			}
 		}
 	} while (nTotalChars < nRealFileSizeChars);
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "Helpers.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
 
 class CDirectoryWatcher;
+class CDirectoryChange;
 
 // Entry in the file list, allowing sorting by different sort criteria
 class CFileDesc 
@@ -12,13 +16,31 @@ public:
 
 	// STL sort only needs this operator to order CFileDesc objects
 	bool operator < (const CFileDesc& other) const;
-	bool SortAscending(const CFileDesc& other) const;
+	bool SortAscending(const CFileDesc& other, Helpers::ESorting eSorting) const;
 
 	// Get and set the sorting method - the sorting method is global
 	static Helpers::ESorting GetSorting() { return sm_eSorting; }
 	static bool IsSortedAscending() { return sm_bSortAscending; }
 	static void SetSorting(Helpers::ESorting eSorting, bool bAscending) { sm_eSorting = eSorting; sm_bSortAscending = bAscending; }
 
+	// Sorts the file list by the given criterion. Instead of comparing the entries, the sort keys
+	// of the entries are compared (name sorting) respectively radix sorted (all other criterions).
+	// If hWndCaptureTimesScanned is not NULL, capture times not in the cache are not read when sorting by capture time.
+	// These files are sorted by their modification time and scanned in the background, the window gets the
+	// WM_CAPTURE_TIMES_SCANNED message when done and shall sort again.
+	static void Sort(std::vector<CFileDesc>& fileList, Helpers::ESorting eSorting, bool bAscending, HWND hWndCaptureTimesScanned = NULL);
+
+	// 64 bit sort key for sorting by modification time, creation time, capture time, file size or random order
+	unsigned __int64 GetNumericSortKey(Helpers::ESorting eSorting) const;
+	// Capture time of the image from the EXIF data as 64 bit FILETIME value in local time, 0 if not available.
+	// Read on first use, Sort() reads the capture times of all files in the list in parallel.
+	unsigned __int64 GetCaptureTime() const;
+	// Collation key for sorting by file title with numbers ordered logically, equivalent to StrCmpLogicalW().
+	// Computed on first use, the keys of two files compare with memcmp(). Only used when logical sorting
+	// is enabled in Windows and the OS supports SORT_DIGITSASNUMBERS, else the titles are compared directly.
+	const std::string& GetNameSortKey() const;
+	// Sort key for sorting by capture time, files without capture time are placed by their modification time
+	unsigned __int64 GetCaptureTimeSortKey(unsigned __int64 nCaptureTime) const;
 	// Full name of file
 	const CString& GetName() const { return m_sName; }
 
@@ -27,7 +49,7 @@ public:
 	void SetModificationDate(const FILETIME& lastModDate);
 
 	// File title (without path)
-	LPCTSTR GetTitle() const { return m_sTitle; }
+	LPCTSTR GetTitle() const { return (LPCTSTR)m_sName + m_nTitleStart; }
 
 	// Gets last modification time
 	const FILETIME& GetLastModTime() const { return m_lastModTime; }
@@ -43,11 +65,14 @@ private:
 	static bool sm_bSortAscending;
 
 	CString m_sName;
-	LPCTSTR m_sTitle;
+	int m_nTitleStart; // offset of the title in m_sName, a pointer would dangle when the vector relocates its elements
 	FILETIME m_lastModTime;
 	FILETIME m_creationTime;
 	int m_nRandomOrderNumber;
 	__int64 m_fileSize;
+	mutable std::string m_nameSortKey; // empty if not yet computed
+	mutable unsigned __int64 m_captureTime;
+	mutable bool m_bCaptureTimeRead;
 };
 
 
@@ -59,8 +84,12 @@ public:
 	// (must end with backslash in this case) or a text file containing file names to display.
 	// Supported text file encodings are ANSI, Unicode or UTF-8.
 	// nLevel is increased when recursively create lists for sub-folders
+	// If hWndListingNotify is not NULL and sInitialFile is an image file, the list initially only contains this file
+	// and the folder is enumerated in the background. WM_FILELIST_SNAPSHOT_READY is posted to the window
+	// whenever a new (partial or complete) snapshot of the folder is ready to be applied.
 	CFileList(const CString & sInitialFile, CDirectoryWatcher & directoryWatcher, 
-		Helpers::ESorting eInitialSorting, bool isSortedAscending, bool bWrapAroundFolder, int nLevel = 0, bool forceSorting = false);
+		Helpers::ESorting eInitialSorting, bool isSortedAscending, bool bWrapAroundFolder, int nLevel = 0, bool forceSorting = false,
+		HWND hWndListingNotify = NULL);
 	~CFileList();
 
 	// Gets a list of all supported file endings, separated by semicolon
@@ -69,6 +98,22 @@ public:
 	// Reload file list for given file, if NULL for current file
 	void Reload(LPCTSTR sFileName = NULL, bool clearForwardHistory = true);
 
+	// Sorts the list again when sorted by capture time, call when WM_CAPTURE_TIMES_SCANNED is received.
+	// Returns if the list has been sorted.
+	bool ApplyScannedCaptureTimes();
+
+	// Applies the latest snapshot of the background folder listing to this list and all lists chained to it.
+	// Call when WM_FILELIST_SNAPSHOT_READY is received. Returns if a snapshot has been applied.
+	bool ApplyListingSnapshot();
+
+	// Returns if the folder is still enumerated in the background. Navigation does not wrap at the folder borders meanwhile.
+	bool IsListingInProgress() const { return m_hListingDoneEvent != NULL; }
+
+	// Applies the changes reported by the directory watcher to the list without enumerating the folder again.
+	// Returns false if the changes cannot be applied incrementally, Reload() must be called in this case.
+	// While the folder is listed in the background, the changes are also applied to the snapshots of the listing.
+	bool ApplyDirectoryChanges(const std::list<CDirectoryChange>& changes);
+
 	// Tells the file list that a file has been renamed externally
 	void FileHasRenamed(LPCTSTR sOldFileName, LPCTSTR sNewFileName);
 
@@ -98,8 +143,8 @@ public:
 	LPCTSTR PeekNextPrev(int nIndex, bool bForward, bool bToggle);
 	// Number of files in file list (for current directory)
 	int Size() const { return (int)m_fileList.size(); }
-	// Index of current file in file list (zero based)
-	int CurrentIndex() const;
+	// Index of current file in file list (zero based), -1 if none
+	int CurrentIndex() const { return (m_nIter < Size()) ? m_nIter : -1; }
 
 	// Sets the sorting of the file list and resorts the list
 	void SetSorting(Helpers::ESorting eSorting, bool sortAscending);
@@ -120,9 +165,9 @@ public:
 	void ToggleBetweenMarkedAndCurrentFile();
 
 	// Sets a checkpoint on the current image
-	void SetCheckpoint() { m_iterCheckPoint = m_iter; }
+	void SetCheckpoint() { m_sCheckPointFile = (Current() != NULL) ? Current() : _T(""); }
 	// Check if we are now on another image since the last checkpoint was set
-	bool ChangedSinceCheckpoint() { return m_iterCheckPoint != m_iter; }
+	bool ChangedSinceCheckpoint() { return m_sCheckPointFile != ((Current() != NULL) ? Current() : _T("")); }
 
 	// Returns if the current file list is based on a slide show text file
 	bool IsSlideShowList() const { return m_bIsSlideShowList; }
@@ -140,7 +185,7 @@ public:
 	bool CanOpenCurrentFileForReading() const;
 
 	// Returns the raw file list of the current folder
-	std::list<CFileDesc> & GetFileList() { return m_fileList; }
+	std::vector<CFileDesc> & GetFileList() { return m_fileList; }
 
 	// delete the chain of CFileLists forward and backward and only leave the current node alive
 	void DeleteHistory(bool onlyForward = false);
@@ -157,10 +202,11 @@ private:
 	// filelists for several folders are chained
 	CFileList* m_next;
 	CFileList* m_prev;
-	std::list<CFileDesc> m_fileList;
-	std::list<CFileDesc>::iterator m_iter; // current position in m_fileList
-	std::list<CFileDesc>::iterator m_iterStart; // start of iteration in m_fileList
-	std::list<CFileDesc>::iterator m_iterCheckPoint;
+	std::vector<CFileDesc> m_fileList;
+	std::unordered_map<std::wstring, int> m_indexOfTitle; // lower case file title to index in m_fileList
+	int m_nIter; // current position in m_fileList, Size() if none
+	int m_nIterStart; // start of iteration in m_fileList
+	CString m_sCheckPointFile;
 
 	CString m_sMarkedFile;
 	CString m_sMarkedFileCurrent;
@@ -168,10 +214,31 @@ private:
 
 	CDirectoryWatcher & m_directoryWatcher;
 
+	// Background folder listing
+	HWND m_hWndListingNotify;
+	HANDLE m_hListingDoneEvent; // not NULL while the listing thread is running, signaled when it terminates
+	volatile bool m_bAbortListing;
+	CString m_sListingDirectory;
+	Helpers::ESorting m_eListingSorting;
+	bool m_bListingSortAscending;
+	CRITICAL_SECTION m_csListing; // protects the members below
+	std::vector<CFileDesc> m_listingSnapshot;
+	bool m_bListingSnapshotReady;
+	bool m_bListingSnapshotComplete;
+	std::list<CDirectoryChange> m_pendingDirectoryChanges; // changes reported while listing, applied again to each snapshot
+
 	void MoveIterToLast();
 	void NextInFolder();
 	CFileList* GotoFirstShown();
-	std::list<CFileDesc>::iterator FindFile(const CString& sName);
+	int FindFile(const CString& sName);
+	int FindFileExact(const CString& sName) const;
+	void InsertSorted(const CString& sFileName);
+	int InsertSorted(const CFileDesc& fileDesc);
+	void ApplyDirectoryChangesToList(const std::list<CDirectoryChange>& changes, CString& sCurrentFile);
+	void EraseAt(int nIndex);
+	void SortFileList();
+	void BuildIndex();
+	bool PeekInFolder(int nIndex, bool bForward, int& nPeekIndex) const;
 	CFileList* FindFileRecursively (const CString& sDirectory, const CString& sFindAfter, 
 		bool bSearchThisFolder, int nLevel, int nRecursion);
 	CFileList* TryCreateFileList(const CString& directory, int nNewLevel);
@@ -179,6 +246,12 @@ private:
 	CFileList* WrapToPrevImage();
 	void FindFiles();
 	void VerifyFiles();
+	void StartListing();
+	void StopListing();
+	bool ApplyOwnListingSnapshot();
+	void PublishListingSnapshot(const std::vector<CFileDesc>& fileList, bool bComplete);
+	static void EnumerateImageFiles(const CString& sDirectory, std::vector<CFileDesc>& fileList, CFileList* pListingOwner);
+	static void __cdecl ListingThreadFunc(void* arg);
 	bool IsImageFile(const CString & sEnding) const;
 	bool TryReadingSlideShowList(const CString & sSlideShowFile);
 };
@@ -3,6 +3,7 @@
 #include "HEIFWrapper.h"
 #include "MaxImageDef.h"
 #include "ICCProfileTransform.h"
+#include "BasicProcessing.h"
 
 void * HeifReader::ReadImage(int &width,
 					   int &height,
@@ -51,18 +52,8 @@ void * HeifReader::ReadImage(int &width,
 	}
 	std::vector<uint8_t> iccp = image.get_raw_color_profile();
 	void* transform = ICCProfileTransform::CreateTransform(iccp.data(), iccp.size(), ICCProfileTransform::FORMAT_RGBA);
-	size_t i, j;
 	if (!ICCProfileTransform::DoTransform(transform, data, pPixelData, width, height, stride=stride)) {
-		unsigned int* o = (unsigned int*)pPixelData;
-		for (i = 0; i < height; i++) {
-			unsigned int* p = (unsigned int*)(data + i * stride);
-			for (j = 0; j < width; j++) {
-				// RGBA -> BGRA conversion
-				*o = _rotr(_byteswap_ulong(*p), 8);
-				p++;
-				o++;
-			}
-		}
+		CBasicProcessing::ConvertRGBAToBGRA(width, height, stride, data, pPixelData);
 	}
 	ICCProfileTransform::DeleteTransform(transform);
 
@@ -784,6 +784,66 @@ EImageFormat GetImageFormat(LPCTSTR sFileName) {
 	return IF_Unknown;
 }
 
+EImageFormat GetImageFormat(const void* pHeader, int nHeaderSize, LPCTSTR sFileName) {
+	if (nHeaderSize < 2) {
+		return IF_Unknown;
+	}
+	unsigned char header[16] = { 0 };
+	memcpy(header, pHeader, min(nHeaderSize, (int)sizeof(header)));
+
+	if (header[0] == 0x42 && header[1] == 0x4d) {
+		return IF_WindowsBMP;
+	} else if (header[0] == 0xff && header[1] == 0xd8) {
+		return IF_JPEG;
+	} else if (header[0] == 0x89 && header[1] == 'P' && header[2] == 'N' && header[3] == 'G' &&
+		header[4] == 0x0d && header[5] == 0x0a && header[6] == 0x1a && header[7] == 0x0a) {
+		return IF_PNG;
+	} else if (header[0] == 'G' && header[1] == 'I' && header[2] == 'F' && header[3] == '8' &&
+		(header[4] == '7' || header[4] == '9') && header[5] == 'a') {
+		return IF_GIF;
+	} else if (header[0] == 'R' && header[1] == 'I' && header[2] == 'F' && header[3] == 'F' &&
+		header[8] == 'W' && header[9] == 'E' && header[10] == 'B' && header[11] == 'P') {
+		return IF_WEBP;
+	} else if ((header[0] == 0xff && header[1] == 0x0a) ||
+		memcmp(header, "\x00\x00\x00\x0cJXL\x20\x0d\x0a\x87\x0a", 12) == 0) {
+		return IF_JXL;
+	} else if (!memcmp(header+4, "ftyp", 4)) {
+		// https://github.com/strukturag/libheif/issues/83
+		// https://github.com/strukturag/libheif/blob/ce1e4586b6222588c5afcd60c7ba9caa86bcc58c/libheif/heif.h#L602-L805
+
+		// AV1: avif, avis
+		if (!memcmp(header+8, "avi", 3))
+			return IF_AVIF;
+		// H265: heic, heix, hevc, hevx, heim, heis, hevm, hevs
+		if (!memcmp(header+8, "hei", 3) || !memcmp(header+8, "hev", 3))
+			return IF_HEIF;
+		// Canon CR3
+		if (!memcmp(header+8, "crx ", 4))
+			return IF_CameraRAW;
+	} else if (header[0] == 'q' && header[1] == 'o' && header[2] == 'i' && header[3] == 'f') {
+		return IF_QOI;
+	} else if (header[0] == '8' && header[1] == 'B' && header[2] == 'P' && header[3] == 'S') {
+		return IF_PSD;
+	}
+
+	// default fallback if no matches based on magic bytes
+	EImageFormat eImageFormat = GetImageFormat(sFileName);
+
+	if (eImageFormat != IF_Unknown) {
+		return eImageFormat;
+	} else if (!memcmp(header+4, "ftyp", 4)) {
+		// Unspecified encoding (possibly AVIF or HEIF): mif1, mif2, msf1, miaf, 1pic
+		return IF_AVIF;
+	} else if (!memcmp(header, "II*\0", 4) || !memcmp(header, "MM\0*", 4)) {
+		// Must be checked after file extension to avoid classifying RAW as TIFF
+		// A few RAW image formats use TIFF as the container
+		// ex: CR2 - http://lclevy.free.fr/cr2/#key_info
+		// ex: DNG - https://www.adobe.com/creativecloud/file-types/image/raw/dng-file.html#dng
+		return IF_TIFF;
+	}
+	return IF_Unknown;
+}
+
 // Returns the short form of the path (including the file name)
 CString GetShortFilePath(LPCTSTR sPath) {
 	TCHAR shortPath[MAX_PATH];
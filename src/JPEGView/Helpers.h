@@ -24,7 +24,8 @@ namespace Helpers {
 		FS_CreationTime,
 		FS_FileName,
 		FS_Random,
-		FS_FileSize
+		FS_FileSize,
+		FS_CaptureTime
 	};
 
 	// Navigation mode over directories
@@ -248,6 +249,10 @@ namespace Helpers {
 	// Gets the image format given a file name (uses the file extension)
 	EImageFormat GetImageFormat(LPCTSTR sFileName);
 
+	// Gets the image format from the magic bytes in the first (up to 16) bytes of the file,
+	// uses the file extension if the magic bytes are not conclusive
+	EImageFormat GetImageFormat(const void* pHeader, int nHeaderSize, LPCTSTR sFileName);
+
 	// Returns the short form of the path (including the short form of the file name)
 	CString GetShortFilePath(LPCTSTR sPath);
 
@@ -315,6 +315,8 @@ namespace HelpersGUI {
 			sText += CNLS::GetString(_T("Last modification date/time"));
 		}  else if (eFileSorting == Helpers::FS_FileSize) {
 			sText += CNLS::GetString(_T("File size"));
+		} else if (eFileSorting == Helpers::FS_CaptureTime) {
+			sText += CNLS::GetString(_T("Capture date"));
 		}else if (eFileSorting == Helpers::FS_Random) {
 			sText += CNLS::GetString(_T("Random"));
 		} else {
@@ -2,6 +2,7 @@
 #include "HistogramCorr.h"
 #include "JPEGImage.h"
 #include "Helpers.h"
+#include "ProcessingThreadPool.h"
 #include <math.h>
 
 float CHistogramCorr::sm_ContrastCorrectionStrength = 0.5f;
@@ -36,10 +37,12 @@ CHistogram::CHistogram(const CJPEGImage & image, bool bUseOrigPixels)
 	int nWidth, nHeight, nChannels;
 	const uint8* pSourcePixels;
 	if (bUseOrigPixels || image.DIBPixels() == NULL) {
-		nWidth = image.OrigWidth();
-		nHeight = image.OrigHeight();
+		// the histogram does not depend on the orientation, use the original pixels as stored
+		CSize storedSize = image.StoredOrigSize();
+		nWidth = storedSize.cx;
+		nHeight = storedSize.cy;
 		nChannels = image.OriginalChannels();
-		pSourcePixels = (const uint8*)image.OriginalPixels();
+		pSourcePixels = (const uint8*)image.StoredOriginalPixels();
 	} else {
 		nWidth = image.DIBWidth();
 		nHeight = image.DIBHeight();
@@ -54,7 +57,15 @@ CHistogram::CHistogram(const CJPEGImage & image, bool bUseOrigPixels)
 	int nLineSize = Helpers::DoPadding(nWidth * nChannels, 4);
 	for (int j = 0; j < nLines; j++) {
 		const uint8* pSrc = pSourcePixels + nLineSize*j*nGrid;
-		if (nChannels == 3) {
+		if (nChannels == 1) {
+			for (int i = 0; i < nPixPerLine; i++) {
+				m_ChannelB[pSrc[0]]++; m_nBMean += pSrc[0];
+				m_ChannelG[pSrc[0]]++; m_nGMean += pSrc[0];
+				m_ChannelR[pSrc[0]]++; m_nRMean += pSrc[0];
+				m_ChannelGrey[pSrc[0]]++;
+				pSrc += nGrid;
+			}
+		} else if (nChannels == 3) {
 			for (int i = 0; i < nPixPerLine; i++) {
 				m_ChannelB[pSrc[0]]++; m_nBMean += pSrc[0];
 				m_ChannelG[pSrc[1]]++; m_nGMean += pSrc[1];
@@ -118,6 +129,124 @@ CHistogram::CHistogram(const int* pChannelB, const int* pChannelG, const int* pC
 	m_bUseOrigPixels = true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////
+// CTileHistograms class
+///////////////////////////////////////////////////////////////////////////////////
+
+static const int MAX_TILES_PER_DIMENSION = 32;
+static const int MAX_TILE_HISTOGRAM_VALUES = 4000000;
+static const int TILE_HISTOGRAM_SIZE = 4 * 256; // B, G, R, grey
+
+CTileHistograms::CTileHistograms(const void* pPixels, int nWidth, int nHeight, int nChannels) {
+	m_pPixels = (const uint8*)pPixels;
+	m_nChannels = nChannels;
+	m_nLineSize = Helpers::DoPadding(nWidth * nChannels, 4);
+	m_nStep = max(1, (int)ceil(sqrt((double)nWidth * nHeight / MAX_TILE_HISTOGRAM_VALUES)));
+	m_nSamplesX = (nWidth + m_nStep - 1) / m_nStep;
+	m_nSamplesY = (nHeight + m_nStep - 1) / m_nStep;
+	m_nTileSizeX = (m_nSamplesX + MAX_TILES_PER_DIMENSION - 1) / MAX_TILES_PER_DIMENSION;
+	m_nTileSizeY = (m_nSamplesY + MAX_TILES_PER_DIMENSION - 1) / MAX_TILES_PER_DIMENSION;
+	m_nTilesX = (m_nSamplesX + m_nTileSizeX - 1) / m_nTileSizeX;
+	m_nTilesY = (m_nSamplesY + m_nTileSizeY - 1) / m_nTileSizeY;
+	m_pHistograms = new(std::nothrow) int[m_nTilesX * m_nTilesY * TILE_HISTOGRAM_SIZE];
+	if (m_pHistograms != NULL) {
+		memset(m_pHistograms, 0, m_nTilesX * m_nTilesY * TILE_HISTOGRAM_SIZE * sizeof(int));
+		CProcessingThreadPool::This().ParallelFor(0, m_nTilesY, this, BuildTileRow);
+	}
+}
+
+CTileHistograms::~CTileHistograms() {
+	delete[] m_pHistograms;
+	m_pHistograms = NULL;
+}
+
+CHistogram* CTileHistograms::CreateHistogram(const CRect& rect) const {
+	if (m_pHistograms == NULL) {
+		return NULL;
+	}
+	// range of the used pixels in the rectangle
+	int nStartX = (max(0, rect.left) + m_nStep - 1) / m_nStep;
+	int nEndX = min(m_nSamplesX, (max(0, rect.right) + m_nStep - 1) / m_nStep);
+	int nStartY = (max(0, rect.top) + m_nStep - 1) / m_nStep;
+	int nEndY = min(m_nSamplesY, (max(0, rect.bottom) + m_nStep - 1) / m_nStep);
+	if (nStartX >= nEndX || nStartY >= nEndY) {
+		return NULL;
+	}
+
+	// range of the tiles fully inside the rectangle, the last tile can be smaller than the others
+	int nTileStartX = (nStartX + m_nTileSizeX - 1) / m_nTileSizeX;
+	int nTileEndX = (nEndX == m_nSamplesX) ? m_nTilesX : nEndX / m_nTileSizeX;
+	int nTileStartY = (nStartY + m_nTileSizeY - 1) / m_nTileSizeY;
+	int nTileEndY = (nEndY == m_nSamplesY) ? m_nTilesY : nEndY / m_nTileSizeY;
+
+	int histogram[TILE_HISTOGRAM_SIZE] { 0 };
+	if (nTileStartX >= nTileEndX || nTileStartY >= nTileEndY) {
+		// small rectangle, no full tile inside
+		AddSamples(nStartX, nEndX, nStartY, nEndY, histogram);
+	} else {
+		for (int nTileY = nTileStartY; nTileY < nTileEndY; nTileY++) {
+			const int* pTile = m_pHistograms + (nTileY * m_nTilesX + nTileStartX) * TILE_HISTOGRAM_SIZE;
+			for (int nTileX = nTileStartX; nTileX < nTileEndX; nTileX++) {
+				for (int i = 0; i < TILE_HISTOGRAM_SIZE; i++) {
+					histogram[i] += pTile[i];
+				}
+				pTile += TILE_HISTOGRAM_SIZE;
+			}
+		}
+		// border strips: above and below the full tiles over the whole width, left and right of the full tiles
+		int nInnerStartX = nTileStartX * m_nTileSizeX;
+		int nInnerEndX = min(m_nSamplesX, nTileEndX * m_nTileSizeX);
+		int nInnerStartY = nTileStartY * m_nTileSizeY;
+		int nInnerEndY = min(m_nSamplesY, nTileEndY * m_nTileSizeY);
+		AddSamples(nStartX, nEndX, nStartY, nInnerStartY, histogram);
+		AddSamples(nStartX, nEndX, nInnerEndY, nEndY, histogram);
+		AddSamples(nStartX, nInnerStartX, nInnerStartY, nInnerEndY, histogram);
+		AddSamples(nInnerEndX, nEndX, nInnerStartY, nInnerEndY, histogram);
+	}
+
+	return new CHistogram(histogram, histogram + 256, histogram + 512, histogram + 768);
+}
+
+void CTileHistograms::BuildTileRow(void* pContext, int nTileRow, int /* nThreadIndex */) {
+	const CTileHistograms* pThis = (const CTileHistograms*)pContext;
+	int nStartY = nTileRow * pThis->m_nTileSizeY;
+	int nEndY = min(pThis->m_nSamplesY, nStartY + pThis->m_nTileSizeY);
+	int* pTile = pThis->m_pHistograms + nTileRow * pThis->m_nTilesX * TILE_HISTOGRAM_SIZE;
+	for (int nStartX = 0; nStartX < pThis->m_nSamplesX; nStartX += pThis->m_nTileSizeX) {
+		pThis->AddSamples(nStartX, min(pThis->m_nSamplesX, nStartX + pThis->m_nTileSizeX), nStartY, nEndY, pTile);
+		pTile += TILE_HISTOGRAM_SIZE;
+	}
+}
+
+// Adds the used pixels in the given range (in used pixels) to the B, G, R and grey histograms in pHistogram
+void CTileHistograms::AddSamples(int nStartX, int nEndX, int nStartY, int nEndY, int* pHistogram) const {
+	int* pChannelB = pHistogram;
+	int* pChannelG = pHistogram + 256;
+	int* pChannelR = pHistogram + 512;
+	int* pChannelGrey = pHistogram + 768;
+	int nIncrement = m_nStep * m_nChannels;
+	for (int j = nStartY; j < nEndY; j++) {
+		const uint8* pSrc = m_pPixels + (size_t)m_nLineSize * j * m_nStep + nStartX * nIncrement;
+		if (m_nChannels == 1) {
+			for (int i = nStartX; i < nEndX; i++) {
+				pChannelB[pSrc[0]]++;
+				pChannelG[pSrc[0]]++;
+				pChannelR[pSrc[0]]++;
+				pChannelGrey[pSrc[0]]++;
+				pSrc += nIncrement;
+			}
+		} else {
+			for (int i = nStartX; i < nEndX; i++) {
+				pChannelB[pSrc[0]]++;
+				pChannelG[pSrc[1]]++;
+				pChannelR[pSrc[2]]++;
+				pChannelGrey[(pSrc[0]*128 + pSrc[1]*640 + pSrc[2]*256) >> 10]++;
+				pSrc += nIncrement;
+			}
+		}
+	}
+}
+
 // Gets relative area of a part of the histogram, 1.0 is full histogram area
 static float GetHistogramArea(const int* pHistogram, int nTotalValues, float fStart, float fEnd) {
 	int nStart = (int)(fStart*255 + 0.5f);
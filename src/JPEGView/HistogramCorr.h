@@ -47,6 +47,34 @@ private:
 	float m_fNightshot;
 };
 
+// Histograms of a grid of tiles of an image (at most 32 x 32 tiles), built once on the original pixels.
+// The histogram of any rectangle is assembled from the histograms of the tiles fully inside the rectangle
+// and the pixels of the partially covered tiles along its border.
+// For large images only every n-th pixel in both directions is used, bounding the number of values to 4 million.
+class CTileHistograms {
+public:
+	// pPixels are the pixels of a 1, 3 or 4 channel image, rows are padded to 4 bytes
+	CTileHistograms(const void* pPixels, int nWidth, int nHeight, int nChannels);
+	~CTileHistograms();
+
+	// Creates the histogram of the given rectangle of the image. Returns NULL if the rectangle contains
+	// none of the used pixels or if out of memory. The caller gets ownership of the returned histogram.
+	CHistogram* CreateHistogram(const CRect& rect) const;
+
+private:
+	const uint8* m_pPixels;
+	int m_nChannels;
+	int m_nLineSize;
+	int m_nStep; // distance of the used pixels in x and y
+	int m_nSamplesX, m_nSamplesY; // number of used pixels in x and y
+	int m_nTileSizeX, m_nTileSizeY; // size of the tiles in used pixels
+	int m_nTilesX, m_nTilesY;
+	int* m_pHistograms; // B, G, R and grey histogram of each tile, NULL if out of memory
+
+	static void BuildTileRow(void* pContext, int nTileRow, int nThreadIndex);
+	void AddSamples(int nStartX, int nEndX, int nStartY, int nEndY, int* pHistogram) const;
+};
+
 // Automatic contrast correction by histogram analysis
 class CHistogramCorr
 {
@@ -2,6 +2,14 @@
 
 #include "ICCProfileTransform.h"
 #include "SettingsProvider.h"
+#include "ProcessingThreadPool.h"
+#include <vector>
+#include <emmintrin.h>
+
+// Number of grid nodes per axis of the 3D LUT, node k corresponds to the input value k * 255 / (LUT3D_GRID - 1)
+#define LUT3D_GRID 33
+#define LUT3D_NUM_NODES (LUT3D_GRID * LUT3D_GRID * LUT3D_GRID)
+#define LUT3D_ROWS_PER_BLOCK 32
 
 
 #ifndef WINXP
@@ -11,6 +19,224 @@
 #include "lcms2.h"
 #define TYPE_LabA_8 (COLORSPACE_SH(PT_Lab)|EXTRA_SH(1)|CHANNELS_SH(3)|BYTES_SH(1))
 
+#define TRANSFORM_ROWS_PER_BLOCK 32
+
+// Cache of the created transforms, the images of a folder typically share the same embedded profile.
+// Transforms in use (created and not yet deleted) are never removed from the cache.
+// The Lab transforms are cached with an empty profile.
+class CTransformCache {
+public:
+	struct Entry {
+		std::vector<unsigned char> Profile;
+		ICCProfileTransform::PixelFormat Format;
+		cmsHTRANSFORM Transform;
+		int RefCount;
+		unsigned int LastUse;
+		std::vector<uint8> LUT3D; // the transform compiled to a 3D LUT, empty if not yet needed
+	};
+
+	CTransformCache() {
+		::InitializeCriticalSection(&CriticalSection);
+		UseCounter = 0;
+	}
+	~CTransformCache() {
+		::DeleteCriticalSection(&CriticalSection);
+	}
+
+	// Returns the cached transform for the profile and adds a reference, NULL if not cached
+	void* Find(const void* profile, unsigned int size, ICCProfileTransform::PixelFormat format) {
+		for (std::list<Entry>::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
+			if (iter->Format == format && iter->Profile.size() == size && (size == 0 || memcmp(&iter->Profile[0], profile, size) == 0)) {
+				iter->RefCount++;
+				iter->LastUse = ++UseCounter;
+				return iter->Transform;
+			}
+		}
+		return NULL;
+	}
+
+	// Adds the new transform with one reference, transforms not in use are removed if the cache is full
+	void* Add(const void* profile, unsigned int size, ICCProfileTransform::PixelFormat format, cmsHTRANSFORM transform) {
+		if (transform == NULL) {
+			return NULL;
+		}
+		while (Entries.size() >= MAX_ENTRIES) {
+			std::list<Entry>::iterator oldest = Entries.end();
+			for (std::list<Entry>::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
+				if (iter->RefCount == 0 && (oldest == Entries.end() || iter->LastUse < oldest->LastUse)) {
+					oldest = iter;
+				}
+			}
+			if (oldest == Entries.end()) {
+				break; // all in use
+			}
+			cmsDeleteTransform(oldest->Transform);
+			Entries.erase(oldest);
+		}
+		Entry entry;
+		entry.Profile.assign((const unsigned char*)profile, (const unsigned char*)profile + size);
+		entry.Format = format;
+		entry.Transform = transform;
+		entry.RefCount = 1;
+		entry.LastUse = ++UseCounter;
+		Entries.push_back(entry);
+		return transform;
+	}
+
+	// Returns the cache entry of the transform, NULL if the transform is not cached
+	Entry* FindEntry(void* transform) {
+		for (std::list<Entry>::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
+			if (iter->Transform == transform) {
+				return &(*iter);
+			}
+		}
+		return NULL;
+	}
+
+	// Removes a reference to the transform, returns false if the transform is not cached
+	bool Release(void* transform) {
+		for (std::list<Entry>::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
+			if (iter->Transform == transform) {
+				iter->RefCount--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	CRITICAL_SECTION CriticalSection; // protects the members below
+	std::list<Entry> Entries;
+	unsigned int UseCounter;
+
+private:
+	static const unsigned int MAX_ENTRIES = 8;
+};
+
+static CTransformCache s_transformCache;
+
+// Rows of an image to transform in blocks of rows on the processing thread pool
+struct CTransformRows {
+	void* Transform;
+	const uint8* Input;
+	uint8* Output;
+	unsigned int Width, Height;
+	unsigned int InputStride, OutputStride;
+};
+
+static void TransformRowBlock(void* pContext, int nBlock, int /* nThreadIndex */) {
+	CTransformRows& rows = *(CTransformRows*)pContext;
+	unsigned int nFirstRow = nBlock * TRANSFORM_ROWS_PER_BLOCK;
+	unsigned int nNumRows = min(rows.Height - nFirstRow, TRANSFORM_ROWS_PER_BLOCK);
+	cmsDoTransformLineStride(rows.Transform, rows.Input + (size_t)nFirstRow * rows.InputStride, rows.Output + (size_t)nFirstRow * rows.OutputStride,
+		rows.Width, nNumRows, rows.InputStride, rows.OutputStride, rows.InputStride * nNumRows, rows.OutputStride * nNumRows);
+}
+
+// State of the deferred transform of the calling thread, see BeginDeferredTransform()
+static __declspec(thread) bool s_bDeferTransform = false;
+static __declspec(thread) uint8* s_pDeferredLUT = NULL;
+static __declspec(thread) void* s_pDeferredTransform = NULL; // a reference is held on the transform
+
+// Compiles the transform into a 3D LUT with BGR0 nodes, the node index is (r * LUT3D_GRID + g) * LUT3D_GRID + b
+static bool CompileLUT3D(void* transform, std::vector<uint8>& lut) {
+	cmsUInt32Number inFormat = cmsGetTransformInputFormat(transform);
+	int nInChannels = (inFormat == TYPE_BGRA_8 || inFormat == TYPE_RGBA_8) ? 4 : 3;
+	bool bInBGR = (inFormat == TYPE_BGRA_8 || inFormat == TYPE_BGR_8);
+	int nOutChannels = (cmsGetTransformOutputFormat(transform) == TYPE_BGRA_8) ? 4 : 3;
+
+	std::vector<uint8> input(LUT3D_NUM_NODES * nInChannels);
+	std::vector<uint8> output(LUT3D_NUM_NODES * nOutChannels);
+	uint8* pIn = &input[0];
+	for (int r = 0; r < LUT3D_GRID; r++) {
+		for (int g = 0; g < LUT3D_GRID; g++) {
+			for (int b = 0; b < LUT3D_GRID; b++) {
+				uint8 nR = (uint8)((r * 255 + (LUT3D_GRID - 1) / 2) / (LUT3D_GRID - 1));
+				uint8 nG = (uint8)((g * 255 + (LUT3D_GRID - 1) / 2) / (LUT3D_GRID - 1));
+				uint8 nB = (uint8)((b * 255 + (LUT3D_GRID - 1) / 2) / (LUT3D_GRID - 1));
+				pIn[0] = bInBGR ? nB : nR;
+				pIn[1] = nG;
+				pIn[2] = bInBGR ? nR : nB;
+				if (nInChannels == 4) pIn[3] = 0xFF;
+				pIn += nInChannels;
+			}
+		}
+	}
+	cmsDoTransform(transform, &input[0], &output[0], LUT3D_NUM_NODES);
+
+	lut.resize(LUT3D_NUM_NODES * 4);
+	for (int i = 0; i < LUT3D_NUM_NODES; i++) {
+		lut[i * 4] = output[i * nOutChannels];
+		lut[i * 4 + 1] = output[i * nOutChannels + 1];
+		lut[i * 4 + 2] = output[i * nOutChannels + 2];
+		lut[i * 4 + 3] = 0;
+	}
+	return true;
+}
+
+// Gets if a 4 channel image has pixels that are not fully opaque
+static bool HasTransparentPixels(const uint8* pPixels, unsigned int width, unsigned int height, unsigned int stride) {
+	for (unsigned int j = 0; j < height; j++) {
+		const uint8* pAlpha = pPixels + (size_t)j * stride + 3;
+		for (unsigned int i = 0; i < width; i++) {
+			if (*pAlpha != 0xFF) {
+				return true;
+			}
+			pAlpha += 4;
+		}
+	}
+	return false;
+}
+
+void ICCProfileTransform::BeginDeferredTransform() {
+	s_bDeferTransform = true;
+	delete[] s_pDeferredLUT;
+	s_pDeferredLUT = NULL;
+	DeleteTransform(s_pDeferredTransform);
+	s_pDeferredTransform = NULL;
+}
+
+uint8* ICCProfileTransform::EndDeferredTransform(void*& transform) {
+	uint8* pLUT = s_pDeferredLUT;
+	transform = s_pDeferredTransform;
+	s_bDeferTransform = false;
+	s_pDeferredLUT = NULL;
+	s_pDeferredTransform = NULL;
+	return pLUT;
+}
+
+bool ICCProfileTransform::TransformBGR0Pixels(void* transform, void* pPixels, unsigned int numPixels) {
+	if (transform == NULL || pPixels == NULL || numPixels == 0)
+		return false;
+	cmsUInt32Number inFormat = cmsGetTransformInputFormat(transform);
+	if (inFormat != TYPE_BGRA_8 && inFormat != TYPE_RGBA_8 && inFormat != TYPE_BGR_8 && inFormat != TYPE_RGB_8)
+		return false;
+	int nInChannels = (inFormat == TYPE_BGRA_8 || inFormat == TYPE_RGBA_8) ? 4 : 3;
+	bool bInBGR = (inFormat == TYPE_BGRA_8 || inFormat == TYPE_BGR_8);
+	int nOutChannels = (cmsGetTransformOutputFormat(transform) == TYPE_BGRA_8) ? 4 : 3;
+
+	std::vector<uint8> input((size_t)numPixels * nInChannels);
+	std::vector<uint8> output((size_t)numPixels * nOutChannels);
+	uint8* pBGR0 = (uint8*)pPixels;
+	uint8* pIn = &input[0];
+	for (unsigned int i = 0; i < numPixels; i++) {
+		pIn[0] = bInBGR ? pBGR0[0] : pBGR0[2];
+		pIn[1] = pBGR0[1];
+		pIn[2] = bInBGR ? pBGR0[2] : pBGR0[0];
+		if (nInChannels == 4) pIn[3] = 0xFF;
+		pIn += nInChannels;
+		pBGR0 += 4;
+	}
+	cmsDoTransform(transform, &input[0], &output[0], numPixels);
+	pBGR0 = (uint8*)pPixels;
+	const uint8* pOut = &output[0];
+	for (unsigned int i = 0; i < numPixels; i++) {
+		pBGR0[0] = pOut[0];
+		pBGR0[1] = pOut[1];
+		pBGR0[2] = pOut[2];
+		pOut += nOutChannels;
+		pBGR0 += 4;
+	}
+	return true;
+}
 
 void* ICCProfileTransform::sRGBProfile = NULL;
 
@@ -18,6 +244,10 @@ void* ICCProfileTransform::CreateTransform(const void* profile, unsigned int siz
 {
 	if (profile == NULL || size == 0)
 		return NULL; // No ICC Profile
+	Helpers::CAutoCriticalSection lock(s_transformCache.CriticalSection);
+	void* cachedTransform = s_transformCache.Find(profile, size, format);
+	if (cachedTransform != NULL)
+		return cachedTransform;
 	if (sRGBProfile == NULL) {
 		try {
 			sRGBProfile = cmsCreate_sRGBProfile();
@@ -55,7 +285,7 @@ void* ICCProfileTransform::CreateTransform(const void* profile, unsigned int siz
 	}
 	cmsHTRANSFORM transform = cmsCreateTransform(hInProfile, inFormat, sRGBProfile, outFormat, INTENT_RELATIVE_COLORIMETRIC, flags);
 	cmsCloseProfile(hInProfile);
-	return transform;
+	return s_transformCache.Add(profile, size, format, transform);
 }
 
 bool ICCProfileTransform::DoTransform(void* transform, const void* inputBuffer, void* outputBuffer, unsigned int width, unsigned int height, unsigned int stride)
@@ -81,17 +311,49 @@ bool ICCProfileTransform::DoTransform(void* transform, const void* inputBuffer,
 	}
 	if (stride == 0)
 		stride = width * nchannels;
-	cmsDoTransformLineStride(transform, inputBuffer, outputBuffer, width, height, stride, Helpers::DoPadding(width * nchannels, 4), stride * height, Helpers::DoPadding(width * nchannels, 4) * height);
+	// Images with transparency are blended onto the background color after loading, this must be done in sRGB
+	if (s_bDeferTransform && inFormat != TYPE_LabA_8 && inFormat != TYPE_Lab_8 &&
+		(nchannels == 3 || !HasTransparentPixels((const uint8*)inputBuffer, width, height, stride))) {
+		// Leave the pixels untouched, the LUT is applied to the displayed pixels only
+		Helpers::CAutoCriticalSection lock(s_transformCache.CriticalSection);
+		std::vector<uint8> lut;
+		CTransformCache::Entry* pEntry = s_transformCache.FindEntry(transform);
+		std::vector<uint8>& lutRef = (pEntry != NULL) ? pEntry->LUT3D : lut;
+		if (lutRef.empty()) {
+			CompileLUT3D(transform, lutRef);
+		}
+		delete[] s_pDeferredLUT;
+		s_pDeferredLUT = CopyLUT3D(&lutRef[0]);
+		// the transform is kept for the exact transformation of the image statistics, see TransformBGR0Pixels()
+		if (pEntry != NULL && s_pDeferredTransform != transform) {
+			if (s_pDeferredTransform != NULL) {
+				s_transformCache.Release(s_pDeferredTransform);
+			}
+			pEntry->RefCount++;
+			s_pDeferredTransform = transform;
+		}
+		return false;
+	}
+	// The transform is applied on blocks of rows in parallel, lcms2 transforms can be used by several threads at the same time
+	CTransformRows rows = { transform, (const uint8*)inputBuffer, (uint8*)outputBuffer, width, height, stride, (unsigned int)Helpers::DoPadding(width * nchannels, 4) };
+	CProcessingThreadPool::This().ParallelFor(0, (height + TRANSFORM_ROWS_PER_BLOCK - 1) / TRANSFORM_ROWS_PER_BLOCK, &rows, TransformRowBlock);
 	return true;
 }
 
 void ICCProfileTransform::DeleteTransform(void* transform)
 {
-	if (transform != NULL)
+	if (transform == NULL)
+		return;
+	Helpers::CAutoCriticalSection lock(s_transformCache.CriticalSection);
+	if (!s_transformCache.Release(transform))
 		cmsDeleteTransform(transform);
 }
 
 void* ICCProfileTransform::CreateLabTransform(PixelFormat format) {
+	Helpers::CAutoCriticalSection lock(s_transformCache.CriticalSection);
+	void* cachedTransform = s_transformCache.Find(NULL, 0, format);
+	if (cachedTransform != NULL)
+		return cachedTransform;
 	cmsHTRANSFORM transform = NULL;
 	cmsHPROFILE hLabProfile = NULL;
 	try {
@@ -122,7 +384,7 @@ void* ICCProfileTransform::CreateLabTransform(PixelFormat format) {
 	}
 	transform = cmsCreateTransform(hLabProfile, inFormat, sRGBProfile, outFormat, INTENT_RELATIVE_COLORIMETRIC, flags);
 	cmsCloseProfile(hLabProfile);
-	return transform;
+	return s_transformCache.Add(NULL, 0, format, transform);
 }
 
 #else
@@ -143,4 +405,113 @@ void* ICCProfileTransform::CreateLabTransform(PixelFormat /* format */) {
 	return NULL;
 }
 
+void ICCProfileTransform::BeginDeferredTransform() { }
+
+uint8* ICCProfileTransform::EndDeferredTransform(void*& transform) {
+	transform = NULL;
+	return NULL;
+}
+
+bool ICCProfileTransform::TransformBGR0Pixels(void* /* transform */, void* /* pPixels */, unsigned int /* numPixels */) {
+	return false;
+}
+
 #endif
+
+// Grid index and interpolation weight (0..256) for each 8 bit channel value
+struct CLUT3DIndexTable {
+	uint16 Index[256];
+	uint16 Fraction[256];
+
+	CLUT3DIndexTable() {
+		for (int i = 0; i < 256; i++) {
+			int nPos = i * (LUT3D_GRID - 1) * 256 / 255;
+			int nIndex = min(LUT3D_GRID - 2, nPos >> 8);
+			Index[i] = (uint16)nIndex;
+			Fraction[i] = (uint16)(nPos - (nIndex << 8));
+		}
+	}
+};
+
+static const CLUT3DIndexTable s_lutIndexTable;
+
+struct CLUT3DRows {
+	const uint32* LUT;
+	uint32* Pixels;
+	int Width, Height;
+};
+
+// Tetrahedral interpolation of one BGRA pixel, the four weights sum up to 256
+static inline uint32 InterpolateLUT3D(const uint32* pLUT, uint32 nPixel) {
+	const int cnStrideR = LUT3D_GRID * LUT3D_GRID;
+	const int cnStrideG = LUT3D_GRID;
+	const int cnStrideB = 1;
+	int nB = nPixel & 0xFF, nG = (nPixel >> 8) & 0xFF, nR = (nPixel >> 16) & 0xFF;
+	int fR = s_lutIndexTable.Fraction[nR], fG = s_lutIndexTable.Fraction[nG], fB = s_lutIndexTable.Fraction[nB];
+	const uint32* pBase = pLUT + (s_lutIndexTable.Index[nR] * LUT3D_GRID + s_lutIndexTable.Index[nG]) * LUT3D_GRID + s_lutIndexTable.Index[nB];
+
+	// The unit cube is split into six tetrahedra along its diagonal, select the one containing the pixel
+	int nOffset1, nOffset2, w0, w1, w2, w3;
+	if (fR >= fG) {
+		if (fG >= fB) {
+			nOffset1 = cnStrideR; nOffset2 = cnStrideR + cnStrideG;
+			w0 = 256 - fR; w1 = fR - fG; w2 = fG - fB; w3 = fB;
+		} else if (fR >= fB) {
+			nOffset1 = cnStrideR; nOffset2 = cnStrideR + cnStrideB;
+			w0 = 256 - fR; w1 = fR - fB; w2 = fB - fG; w3 = fG;
+		} else {
+			nOffset1 = cnStrideB; nOffset2 = cnStrideR + cnStrideB;
+			w0 = 256 - fB; w1 = fB - fR; w2 = fR - fG; w3 = fG;
+		}
+	} else {
+		if (fR >= fB) {
+			nOffset1 = cnStrideG; nOffset2 = cnStrideR + cnStrideG;
+			w0 = 256 - fG; w1 = fG - fR; w2 = fR - fB; w3 = fB;
+		} else if (fG >= fB) {
+			nOffset1 = cnStrideG; nOffset2 = cnStrideG + cnStrideB;
+			w0 = 256 - fG; w1 = fG - fB; w2 = fB - fR; w3 = fR;
+		} else {
+			nOffset1 = cnStrideB; nOffset2 = cnStrideG + cnStrideB;
+			w0 = 256 - fB; w1 = fB - fG; w2 = fG - fR; w3 = fR;
+		}
+	}
+
+	// Nodes 0 and 1 are weighted in the low, nodes 2 and 3 in the high half, the products fit into 16 bits
+	__m128i zero = _mm_setzero_si128();
+	__m128i nodes = _mm_set_epi32(pBase[cnStrideR + cnStrideG + cnStrideB], pBase[nOffset2], pBase[nOffset1], pBase[0]);
+	__m128i weights01 = _mm_set_epi16(w1, w1, w1, w1, w0, w0, w0, w0);
+	__m128i weights23 = _mm_set_epi16(w3, w3, w3, w3, w2, w2, w2, w2);
+	__m128i sum = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(nodes, zero), weights01), _mm_mullo_epi16(_mm_unpackhi_epi8(nodes, zero), weights23));
+	sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+	sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+	uint32 nResult = (uint32)_mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+	return (nResult & 0x00FFFFFF) | (nPixel & 0xFF000000);
+}
+
+static void ApplyLUT3DRowBlock(void* pContext, int nBlock, int /* nThreadIndex */) {
+	CLUT3DRows& rows = *(CLUT3DRows*)pContext;
+	int nFirstRow = nBlock * LUT3D_ROWS_PER_BLOCK;
+	int nLastRow = min(rows.Height, nFirstRow + LUT3D_ROWS_PER_BLOCK);
+	for (int y = nFirstRow; y < nLastRow; y++) {
+		uint32* pRow = rows.Pixels + (size_t)y * rows.Width;
+		for (int x = 0; x < rows.Width; x++) {
+			pRow[x] = InterpolateLUT3D(rows.LUT, pRow[x]);
+		}
+	}
+}
+
+void ICCProfileTransform::ApplyLUT3D(const uint8* lut, void* pPixels, int width, int height) {
+	if (lut == NULL || pPixels == NULL || width <= 0 || height <= 0)
+		return;
+	CLUT3DRows rows = { (const uint32*)lut, (uint32*)pPixels, width, height };
+	CProcessingThreadPool::This().ParallelFor(0, (height + LUT3D_ROWS_PER_BLOCK - 1) / LUT3D_ROWS_PER_BLOCK, &rows, ApplyLUT3DRowBlock);
+}
+
+uint8* ICCProfileTransform::CopyLUT3D(const uint8* lut) {
+	if (lut == NULL)
+		return NULL;
+	uint8* pCopy = new(std::nothrow) uint8[LUT3D_NUM_NODES * 4];
+	if (pCopy != NULL)
+		memcpy(pCopy, lut, LUT3D_NUM_NODES * 4);
+	return pCopy;
+}
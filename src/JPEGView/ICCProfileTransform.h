@@ -13,13 +13,15 @@ public:
 	};
 
 	// Create a transform from given ICC Profile to standard sRGB color space.
+	// Transforms are cached, creating a transform for a profile already used before returns the cached transform.
 	static void* CreateTransform(
 		const void* profile, // pointer to ICC profile
 		unsigned int size, // size of ICC profile in bytes
 		PixelFormat format // format of input pixels
 	);
 
-	// Apply color transform to image. Returns true on success, false otherwise.
+	// Apply color transform to image, multithreaded. Returns true on success, false otherwise.
+	// Also returns false without touching the pixels if the transform is deferred, see BeginDeferredTransform().
 	static bool DoTransform(
 		void* transform, // ICCP transform
 		const void* inputBuffer, // 4-byte BGRA or RGBA input depending on transform pixel format
@@ -29,11 +31,33 @@ public:
 		unsigned int stride=0 // number of bytes per row of pixels in the input, only needed if not equal to width * 4
 	);
 
-	// Free memory associated with the given transform
+	// Release the given transform, it is kept in the cache for reuse
 	static void DeleteTransform(void* transform);
 
 	static void* CreateLabTransform(PixelFormat format);
 
+	// Starts deferring the color transforms of RGB images done by DoTransform() on the calling thread.
+	// While deferred, DoTransform() leaves the pixels in the color space of the profile and returns false,
+	// instead the transform is compiled into a 3D lookup table that is later applied to the displayed pixels only.
+	// Images with transparent pixels are transformed immediately as they are blended onto the background color.
+	static void BeginDeferredTransform();
+
+	// Ends deferring transforms on the calling thread. Returns the 3D LUT of the deferred transform or NULL if no
+	// transform was deferred. The LUT must be freed by the caller with delete[].
+	// The deferred transform itself is returned in transform (NULL if none), the caller must release it with DeleteTransform().
+	static uint8* EndDeferredTransform(void*& transform);
+
+	// Apply the color transform exactly (without 3D LUT) in-place to 32 bpp BGR0 pixels, single threaded.
+	// For few pixels only, e.g. the samples the image statistics are taken from. Returns true on success, false otherwise.
+	static bool TransformBGR0Pixels(void* transform, void* pPixels, unsigned int numPixels);
+
+	// Apply a 3D LUT returned by EndDeferredTransform() in-place to a 32 bpp BGRA image, multithreaded.
+	// Uses tetrahedral interpolation, the alpha channel is not modified.
+	static void ApplyLUT3D(const uint8* lut, void* pPixels, int width, int height);
+
+	// Creates a copy of the given 3D LUT, returns NULL if lut is NULL
+	static uint8* CopyLUT3D(const uint8* lut);
+
 private:
 	static void* sRGBProfile;
 };
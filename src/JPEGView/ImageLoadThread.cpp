@@ -22,6 +22,8 @@
 #include "QOIWrapper.h"
 #include "PSDWrapper.h"
 #include "MaxImageDef.h"
+#include "ICCProfileTransform.h"
+#include "MetadataScanner.h"
 
 
 using namespace Gdiplus;
@@ -42,61 +44,7 @@ static EImageFormat GetImageFormat(LPCTSTR sFileName) {
 	unsigned char header[16];
 	int nSize = (int)fread((void*)header, 1, 16, fptr);
 	fclose(fptr);
-	if (nSize < 2) {
-		return IF_Unknown;
-	}
-
-	if (header[0] == 0x42 && header[1] == 0x4d) {
-		return IF_WindowsBMP;
-	} else if (header[0] == 0xff && header[1] == 0xd8) {
-		return IF_JPEG;
-	} else if (header[0] == 0x89 && header[1] == 'P' && header[2] == 'N' && header[3] == 'G' &&
-		header[4] == 0x0d && header[5] == 0x0a && header[6] == 0x1a && header[7] == 0x0a) {
-		return IF_PNG;
-	} else if (header[0] == 'G' && header[1] == 'I' && header[2] == 'F' && header[3] == '8' &&
-		(header[4] == '7' || header[4] == '9') && header[5] == 'a') {
-		return IF_GIF;
-	} else if (header[0] == 'R' && header[1] == 'I' && header[2] == 'F' && header[3] == 'F' &&
-		header[8] == 'W' && header[9] == 'E' && header[10] == 'B' && header[11] == 'P') {
-		return IF_WEBP;
-	} else if ((header[0] == 0xff && header[1] == 0x0a) ||
-		memcmp(header, "\x00\x00\x00\x0cJXL\x20\x0d\x0a\x87\x0a", 12) == 0) {
-		return IF_JXL;
-	} else if (!memcmp(header+4, "ftyp", 4)) {
-		// https://github.com/strukturag/libheif/issues/83
-		// https://github.com/strukturag/libheif/blob/ce1e4586b6222588c5afcd60c7ba9caa86bcc58c/libheif/heif.h#L602-L805
-
-		// AV1: avif, avis
-		if (!memcmp(header+8, "avi", 3))
-			return IF_AVIF;
-		// H265: heic, heix, hevc, hevx, heim, heis, hevm, hevs
-		if (!memcmp(header+8, "hei", 3) || !memcmp(header+8, "hev", 3))
-			return IF_HEIF;
-		// Canon CR3
-		if (!memcmp(header+8, "crx ", 4))
-			return IF_CameraRAW;
-	} else if (header[0] == 'q' && header[1] == 'o' && header[2] == 'i' && header[3] == 'f') {
-		return IF_QOI;
-	} else if (header[0] == '8' && header[1] == 'B' && header[2] == 'P' && header[3] == 'S') {
-		return IF_PSD;
-	}
-
-	// default fallback if no matches based on magic bytes
-	EImageFormat eImageFormat = Helpers::GetImageFormat(sFileName);
-
-	if (eImageFormat != IF_Unknown) {
-		return eImageFormat;
-	} else if (!memcmp(header+4, "ftyp", 4)) {
-		// Unspecified encoding (possibly AVIF or HEIF): mif1, mif2, msf1, miaf, 1pic
-		return IF_AVIF;
-	} else if (!memcmp(header, "II*\0", 4) || !memcmp(header, "MM\0*", 4)) {
-		// Must be checked after file extension to avoid classifying RAW as TIFF
-		// A few RAW image formats use TIFF as the container
-		// ex: CR2 - http://lclevy.free.fr/cr2/#key_info
-		// ex: DNG - https://www.adobe.com/creativecloud/file-types/image/raw/dng-file.html#dng
-		return IF_TIFF;
-	}
-	return IF_Unknown;
+	return Helpers::GetImageFormat(header, nSize, sFileName);
 }
 
 static EImageFormat GetBitmapFormat(Gdiplus::Bitmap * pBitmap) {
@@ -229,8 +177,9 @@ CImageLoadThread::~CImageLoadThread(void) {
 	DeleteCachedAvifDecoder();
 }
 
-int CImageLoadThread::AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished) {
-	CRequest* pRequest = new CRequest(strFileName, nFrameIndex, targetWnd, processParams, eventFinished);
+int CImageLoadThread::AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished,
+								unsigned __int64 nMaxDecodedSize) {
+	CRequest* pRequest = new CRequest(strFileName, nFrameIndex, targetWnd, processParams, eventFinished, nMaxDecodedSize);
 
 	ProcessAsync(pRequest);
 
@@ -242,6 +191,7 @@ CImageData CImageLoadThread::GetLoadedImage(int nHandle) {
 	CJPEGImage* imageFound = NULL;
 	bool bFailedMemory = false;
 	bool bFailedException = false;
+	bool bSkippedOverBudget = false;
 	std::list<CRequestBase*>::iterator iter;
 	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
 		CRequest* pRequest = (CRequest*)(*iter);
@@ -249,12 +199,13 @@ CImageData CImageLoadThread::GetLoadedImage(int nHandle) {
 			imageFound = pRequest->Image;
 			bFailedMemory = pRequest->OutOfMemory;
 			bFailedException = pRequest->ExceptionError;
+			bSkippedOverBudget = pRequest->SkippedOverBudget;
 			// only mark as deleted
 			pRequest->Deleted = true;
 			break;
 		}
 	}
-	return CImageData(imageFound, bFailedMemory, bFailedException);
+	return CImageData(imageFound, bFailedMemory, bFailedException, bSkippedOverBudget);
 }
 
 void CImageLoadThread::ReleaseFile(LPCTSTR strFileName) {
@@ -289,7 +240,20 @@ void CImageLoadThread::ProcessRequest(CRequestBase& request) {
 	}
 
 	CRequest& rq = (CRequest&)request;
+	if (rq.MaxDecodedSize > 0) {
+		// Probing the headers is fast compared to decoding but still needs file access, therefore it is done here and not by the caller
+		CImageHeaderInfo info;
+		if (CMetadataScanner::ProbeImage(rq.FileName, info) && (unsigned __int64)info.Width * info.Height * 4 > rq.MaxDecodedSize) {
+			rq.SkippedOverBudget = true;
+			return;
+		}
+	}
 	double dStartTime = Helpers::GetExactTickCount(); 
+	// When the color profile is applied on display, the decoders keep the pixels in the color space of the profile
+	bool bDeferColorTransform = CSettingsProvider::This().UseEmbeddedColorProfiles() && CSettingsProvider::This().ApplyColorProfileOnDisplay();
+	if (bDeferColorTransform) {
+		ICCProfileTransform::BeginDeferredTransform();
+	}
 	// Get image format and read the image
 	switch (GetImageFormat(rq.FileName)) {
 		case IF_JPEG :
@@ -395,6 +359,16 @@ void CImageLoadThread::ProcessRequest(CRequestBase& request) {
 			ProcessReadGDIPlusRequest(&rq);
 			break;
 	}
+	if (bDeferColorTransform) {
+		void* pColorTransform;
+		uint8* pColorLUT3D = ICCProfileTransform::EndDeferredTransform(pColorTransform);
+		if (rq.Image != NULL) {
+			rq.Image->SetColorLUT3D(pColorLUT3D, pColorTransform);
+		} else {
+			delete[] pColorLUT3D;
+			ICCProfileTransform::DeleteTransform(pColorTransform);
+		}
+	}
 	// then process the image if read was successful
 	if (rq.Image != NULL) {
 		rq.Image->SetLoadTickCount(Helpers::GetExactTickCount() - dStartTime); 
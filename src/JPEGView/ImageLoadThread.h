@@ -17,11 +17,14 @@ public:
 	bool IsRequestFailedOutOfMemory;
 	// True if the request failed due to an unhandled exception
 	bool IsRequestFailedException;
+	// True if the image has not been loaded because it exceeds the memory budget of the request
+	bool IsRequestSkippedOverBudget;
 
-	CImageData(CJPEGImage* pImage, bool isRequestFailedOutOfMemory, bool isRequestFailedException) {
+	CImageData(CJPEGImage* pImage, bool isRequestFailedOutOfMemory, bool isRequestFailedException, bool isRequestSkippedOverBudget) {
 		Image = pImage;
 		IsRequestFailedOutOfMemory = isRequestFailedOutOfMemory;
 		IsRequestFailedException = isRequestFailedException;
+		IsRequestSkippedOverBudget = isRequestSkippedOverBudget;
 	}
 };
 
@@ -38,7 +41,10 @@ public:
 	// received or the event has been signaled.
 	// The file to load is given by its filename (with path) and the frame index (for multiframe images). The
 	// frame index needs to be zero when the image only has one frame.
-	int AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished);
+	// If nMaxDecodedSize is not zero, images that need more bytes decoded (as probed from the file headers) are not loaded,
+	// the request finishes with CImageData::IsRequestSkippedOverBudget set. Used for read ahead.
+	int AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished,
+		unsigned __int64 nMaxDecodedSize = 0);
 
 	// Get loaded image, CImageData::Image is null if not (yet) available - use handle returned by AsyncLoad().
 	// Call after having received the WM_IMAGE_LOAD_COMPLETED message to retrieve the loaded image.
@@ -56,7 +62,8 @@ private:
 	// Request for loading an image
 	class CRequest : public CRequestBase {
 	public:
-		CRequest(LPCTSTR strFileName, int nFrameIndex, HWND wndTarget, const CProcessParams& processParams, HANDLE eventFinished) 
+		CRequest(LPCTSTR strFileName, int nFrameIndex, HWND wndTarget, const CProcessParams& processParams, HANDLE eventFinished,
+			unsigned __int64 nMaxDecodedSize)
 			: CRequestBase(eventFinished), ProcessParams(processParams) {
 			FileName = strFileName;
 			FrameIndex = nFrameIndex;
@@ -65,6 +72,8 @@ private:
 			Image = NULL;
 			OutOfMemory = false;
 			ExceptionError = false;
+			MaxDecodedSize = nMaxDecodedSize;
+			SkippedOverBudget = false;
 		}
 
 		CString FileName;
@@ -75,6 +84,8 @@ private:
 		CProcessParams ProcessParams;
 		bool OutOfMemory;  // load caused an out of memory condition
 		bool ExceptionError;  // an unhandled exception caused the load to fail
+		unsigned __int64 MaxDecodedSize; // 0 for no limit
+		bool SkippedOverBudget; // not loaded because the decoded image exceeds MaxDecodedSize
 	};
 
 	// Request to release image file
@@ -10,6 +10,9 @@
 #include "EXIFReader.h"
 #include "RawMetadata.h"
 #include "MaxImageDef.h"
+#include "ICCProfileTransform.h"
+#include "BufferPool.h"
+#include "ProcessingThreadPool.h"
 #include "libjpeg-turbo\include\turbojpeg.h"
 #include <math.h>
 #include <assert.h>
@@ -18,6 +21,11 @@
 // undefine this flag to investigate which optimization might cause that particular failure (TODO)
 #define AVX_SSE_FREEZE_FALLBACK
 
+// The overscan margin around the visible area is 1/OVERSCAN_MARGIN_DIVISOR of the visible size in each direction
+#define OVERSCAN_MARGIN_DIVISOR 4
+// Number of rows of the overscan section resampled between the checks for cancellation
+#define OVERSCAN_BAND_HEIGHT 256
+
 ///////////////////////////////////////////////////////////////////////////////////
 // Static helpers
 ///////////////////////////////////////////////////////////////////////////////////
@@ -68,13 +76,10 @@ CJPEGImage::CJPEGImage(int nWidth, int nHeight, void* pPixels, void* pEXIFData,
 	: m_rotationParams{ 0 },
 	m_fColorCorrectionFactorsNull{ 0 }
 {
-	if (nChannels == 3 || nChannels == 4) {
+	if (nChannels == 1 || nChannels == 3 || nChannels == 4) {
+		// gray and 24 bpp images are kept as they are, they are only expanded to 32 bpp when needed
 		m_pOrigPixels = pPixels;
 		m_nOriginalChannels = nChannels;
-	} else if (nChannels == 1) {
-		m_pOrigPixels = CBasicProcessing::Convert1To4Channels(nWidth, nHeight, pPixels);
-		delete[] pPixels;
-		m_nOriginalChannels = 4;
 	} else {
 		assert(false);
 		m_pOrigPixels = NULL;
@@ -96,6 +101,7 @@ CJPEGImage::CJPEGImage(int nWidth, int nHeight, void* pPixels, void* pEXIFData,
 	m_pRawMetadata = pRawMetadata;
 
 	m_nPixelHash = nJPEGHash;
+	m_bPixelHashFromLDC = nJPEGHash == 0;
 	m_eImageFormat = eImageFormat;
 	m_bIsAnimation = bIsAnimation;
 	m_nFrameIndex = nFrameIndex;
@@ -108,7 +114,13 @@ CJPEGImage::CJPEGImage(int nWidth, int nHeight, void* pPixels, void* pEXIFData,
 	m_pDIBPixels = NULL;
 	m_pDIBPixelsLUTProcessed = NULL;
 	m_pLastDIB = NULL;
+	m_pOverscanRequest = NULL;
+	m_panDirection = CPoint(0, 0);
 	m_pThumbnail = NULL;
+	m_pColorLUT3D = NULL;
+	m_pColorTransform = NULL;
+	m_bKeepUnprocessedDIB = false;
+	m_bProcessingParamsChanged = false;
 	m_pHistogramThumbnail = NULL;
 	m_pGrayImage = NULL;
 	m_pSmoothGrayImage = NULL;
@@ -130,11 +142,14 @@ CJPEGImage::CJPEGImage(int nWidth, int nHeight, void* pPixels, void* pEXIFData,
 	m_bUnsharpMaskParamsValid = false;
 	m_bIsThumbnailImage = bIsThumbnailImage;
 	m_pCachedProcessedHistogram = NULL;
+	m_pTileHistograms = NULL;
 
 	m_bCropped = false;
 	m_bIsDestructivelyProcessed = false;
 	m_bIsProcessedNoParamDB = false;
 	m_bRotationByEXIF = false;
+	m_nPendingRotation = 0;
+	m_bPendingMirror = false;
 	m_bFirstReprocessing = true;
 	m_dLastOpTickCount = 0;
 	m_dLoadTickCount = 0;
@@ -159,15 +174,16 @@ CJPEGImage::CJPEGImage(int nWidth, int nHeight, void* pPixels, void* pEXIFData,
 }
 
 CJPEGImage::~CJPEGImage(void) {
+	DiscardOverscan();
 	delete[] m_pOrigPixels;
 	m_pOrigPixels = NULL;
-	delete[] m_pDIBPixels;
+	CBufferPool::This().Free(m_pDIBPixels);
 	m_pDIBPixels = NULL;
-	delete[] m_pDIBPixelsLUTProcessed;
+	CBufferPool::This().Free(m_pDIBPixelsLUTProcessed);
 	m_pDIBPixelsLUTProcessed = NULL;
-	delete[] m_pGrayImage;
+	CBufferPool::This().Free(m_pGrayImage);
 	m_pGrayImage = NULL;
-	delete[] m_pSmoothGrayImage;
+	CBufferPool::This().Free(m_pSmoothGrayImage);
 	m_pSmoothGrayImage = NULL;
 	delete[] m_pLUTAllChannels;
 	m_pLUTAllChannels = NULL;
@@ -186,10 +202,16 @@ CJPEGImage::~CJPEGImage(void) {
 	m_pDimRects = NULL;
 	delete m_pThumbnail;
 	m_pThumbnail = NULL;
+	delete[] m_pColorLUT3D;
+	m_pColorLUT3D = NULL;
+	ICCProfileTransform::DeleteTransform(m_pColorTransform);
+	m_pColorTransform = NULL;
 	delete m_pHistogramThumbnail;
 	m_pHistogramThumbnail = NULL;
 	delete m_pCachedProcessedHistogram;
 	m_pCachedProcessedHistogram = NULL;
+	delete m_pTileHistograms;
+	m_pTileHistograms = NULL;
 	delete m_pRawMetadata;
 	m_pRawMetadata = NULL;
 }
@@ -292,13 +314,17 @@ const CHistogram* CJPEGImage::GetHistogramOfProcessedDIB(const CImageProcessingP
 }
 
 void CJPEGImage::FreeUnsharpMaskResources() {
-	delete[] m_pGrayImage;
+	CBufferPool::This().Free(m_pGrayImage);
 	m_pGrayImage = NULL;
-	delete[] m_pSmoothGrayImage;
+	CBufferPool::This().Free(m_pSmoothGrayImage);
 	m_pSmoothGrayImage = NULL;
 }
 
 bool CJPEGImage::ApplyUnsharpMaskToOriginalPixels(const CUnsharpMaskParams & unsharpMaskParams) {
+	// unsharp masking is only implemented for 24 and 32 bpp
+	if ((m_nOriginalChannels == 1 && !ConvertSrcTo4Channels()) || !ApplyPendingOrientation()) {
+		return false;
+	}
 	InvalidateAllCachedPixelData();
 
 	double dStartTime = Helpers::GetExactTickCount();
@@ -312,9 +338,9 @@ bool CJPEGImage::ApplyUnsharpMaskToOriginalPixels(const CUnsharpMaskParams & uns
 			bSuccess = NULL != CBasicProcessing::UnsharpMask(CSize(m_nOrigWidth, m_nOrigHeight), CPoint(0,0), CSize(m_nOrigWidth, m_nOrigHeight), 
 				unsharpMaskParams.Amount, unsharpMaskParams.Threshold, pGray, pSmoothed, m_pOrigPixels, m_pOrigPixels, m_nOriginalChannels);
 		}
-		delete[] pSmoothed;
+		CBufferPool::This().Free(pSmoothed);
 	}
-	delete[] pGray;
+	CBufferPool::This().Free(pGray);
 
 	m_dUnsharpMaskTickCount = Helpers::GetExactTickCount() - dStartTime;
 
@@ -325,12 +351,17 @@ bool CJPEGImage::ApplyUnsharpMaskToOriginalPixels(const CUnsharpMaskParams & uns
 }
 
 bool CJPEGImage::RotateOriginalPixels(double dRotation, bool bAutoCrop, bool bKeepAspectRatio) {
+	// bicubic rotation is only implemented for 24 and 32 bpp
+	if ((m_nOriginalChannels == 1 && !ConvertSrcTo4Channels()) || !ApplyPendingOrientation()) {
+		return false;
+	}
 	InvalidateAllCachedPixelData();
 
 	CPoint offset;
 	CSize newSize = GetSizeAfterFreeRotation(CSize(m_nOrigWidth, m_nOrigHeight), dRotation, bAutoCrop, bKeepAspectRatio, offset);
 	void* pRotatedPixels = CBasicProcessing::RotateHQ(offset, newSize, dRotation,
-		CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
+		CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground(),
+		CSettingsProvider::This().AlgorithmImplementation() >= Helpers::CPU_SSE);
 	if (pRotatedPixels == NULL) return false;
 	delete[] m_pOrigPixels;
 
@@ -348,6 +379,10 @@ bool CJPEGImage::RotateOriginalPixels(double dRotation, bool bAutoCrop, bool bKe
 }
 
 bool CJPEGImage::TrapezoidOriginalPixels(const CTrapezoid& trapezoid, bool bAutoCrop, bool bKeepAspectRatio) {
+	// bicubic trapezoid correction is only implemented for 24 and 32 bpp
+	if ((m_nOriginalChannels == 1 && !ConvertSrcTo4Channels()) || !ApplyPendingOrientation()) {
+		return false;
+	}
 	InvalidateAllCachedPixelData();
 
 	int nXStart, nXEnd;
@@ -374,7 +409,8 @@ bool CJPEGImage::TrapezoidOriginalPixels(const CTrapezoid& trapezoid, bool bAuto
 
 	CSize newSize(nXEnd - nXStart + 1, nYEnd - nYStart + 1);
 	void* pTransformedPixels = CBasicProcessing::TrapezoidHQ(CPoint(nXStart, nYStart), newSize, trapezoid, 
-		CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
+		CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground(),
+		CSettingsProvider::This().AlgorithmImplementation() >= Helpers::CPU_SSE);
 	if (pTransformedPixels == NULL) return false;
 	delete[] m_pOrigPixels;
 
@@ -402,6 +438,9 @@ bool CJPEGImage::ResizeOriginalPixels(EResizeFilter filter, CSize newSize) {
 	if (newWidth == m_nOrigWidth && newHeight == m_nOrigHeight) {
 		return true;
 	}
+	if (!ApplyPendingOrientation()) {
+		return false;
+	}
 
 	InvalidateAllCachedPixelData();
 
@@ -426,16 +465,28 @@ bool CJPEGImage::ResizeOriginalPixels(EResizeFilter filter, CSize newSize) {
 		}
 		void* pOldPixels = pResizedPixels;
 		pResizedPixels = InternalResize(pResizedPixels, channels, usedFilter, CSize(currentWidth, currentHeight), CSize(oldWidth, oldHeight));
+		if (pOldPixels != m_pOrigPixels) {
+			CBufferPool::This().Free(pOldPixels);
+		}
 		if (pResizedPixels == NULL)
 			return false;
-		delete[] pOldPixels;
 		channels = 4;
 	}
 
+	// the resampled image is allocated from the buffer pool, the original pixels are not
+	void* pNewOriginalPixels = new(std::nothrow) uint32[newWidth * newHeight];
+	if (pNewOriginalPixels != NULL) {
+		memcpy(pNewOriginalPixels, pResizedPixels, newWidth * newHeight * 4);
+	}
+	CBufferPool::This().Free(pResizedPixels);
+	if (pNewOriginalPixels == NULL)
+		return false;
+	delete[] m_pOrigPixels;
+
 	m_nOrigWidth = newWidth;
 	m_nOrigHeight = newHeight;
 	m_nOriginalChannels = 4;
-	m_pOrigPixels = pResizedPixels;
+	m_pOrigPixels = pNewOriginalPixels;
 	MarkAsDestructivelyProcessed();
 	m_bIsProcessedNoParamDB = true;
 
@@ -462,7 +513,7 @@ void CJPEGImage::ResampleWithPan(void* & pDIBPixels, void* & pDIBPixelsLUTProces
 		// the LUT processed pixels cannot be used and the original pixels are not available -
 		// full recreation of DIBs is needed
 		if (!bCanUseLUTProcDIB && pDIBPixels == NULL) {
-			delete[] pDIBPixelsLUTProcessed; pDIBPixelsLUTProcessed = NULL;
+			CBufferPool::This().Free(pDIBPixelsLUTProcessed); pDIBPixelsLUTProcessed = NULL;
 			return;
 		}
 
@@ -472,7 +523,7 @@ void CJPEGImage::ResampleWithPan(void* & pDIBPixels, void* & pDIBPixelsLUTProces
 			NULL;
 
 		// get rid of original DIB, will we recreated automatically when needed
-		delete[] pDIBPixels; pDIBPixels = NULL;
+		CBufferPool::This().Free(pDIBPixels); pDIBPixels = NULL;
 
 		// Copy the reusable part of processed DIB pixels
 		void* pPannedPixelsLUTProcessed = bCanUseLUTProcDIB ? 
@@ -480,11 +531,11 @@ void CJPEGImage::ResampleWithPan(void* & pDIBPixels, void* & pDIBPixelsLUTProces
 			NULL;
 
 		// Delete old LUT processed DIB, we copied the part that can be reused to a new DIB (pPannedPixelsLUTProcessed)
-		delete[] pDIBPixelsLUTProcessed; pDIBPixelsLUTProcessed = NULL;
+		CBufferPool::This().Free(pDIBPixelsLUTProcessed); pDIBPixelsLUTProcessed = NULL;
 
 		if (targetRect.top > 0) {
 			CSize clipSize(clippingSize.cx, targetRect.top);
-			void* pTop = Resample(fullTargetSize, clipSize, targetOffset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
+			void* pTop = ResampleOrCopyOverscan(fullTargetSize, clipSize, targetOffset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
 			
 			if (!bCanUseLUTProcDIB) {
 				CBasicProcessing::CopyRect32bpp(pPannedPixels, pTop,
@@ -496,15 +547,15 @@ void CJPEGImage::ResampleWithPan(void* & pDIBPixels, void* & pDIBPixelsLUTProces
 				CBasicProcessing::CopyRect32bpp(pPannedPixelsLUTProcessed, pTopProc,
 					clippingSize, CRect(CPoint(0, 0), clipSize),
 					clipSize, CRect(CPoint(0, 0), clipSize));
-				delete[] pTopProc;
+				CBufferPool::This().Free(pTopProc);
 			}
 
-			delete[] pTop;
+			CBufferPool::This().Free(pTop);
 		}
 		if (targetRect.bottom < clippingSize.cy) {
 			CSize clipSize(clippingSize.cx, clippingSize.cy -  targetRect.bottom);
 			CPoint offset(targetOffset.x, targetOffset.y + targetRect.bottom);
-			void* pBottom = Resample(fullTargetSize, clipSize, offset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
+			void* pBottom = ResampleOrCopyOverscan(fullTargetSize, clipSize, offset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
 			
 			if (!bCanUseLUTProcDIB) {
 				CBasicProcessing::CopyRect32bpp(pPannedPixels, pBottom,
@@ -516,14 +567,14 @@ void CJPEGImage::ResampleWithPan(void* & pDIBPixels, void* & pDIBPixelsLUTProces
 				CBasicProcessing::CopyRect32bpp(pPannedPixelsLUTProcessed, pBottomProc,
 					clippingSize, CRect(CPoint(0, targetRect.bottom), clipSize),
 					clipSize, CRect(CPoint(0, 0), clipSize));
-				delete[] pBottomProc;
+				CBufferPool::This().Free(pBottomProc);
 			}
 
-			delete[] pBottom;
+			CBufferPool::This().Free(pBottom);
 		}
 		if (targetRect.left > 0) {
 			CSize clipSize(targetRect.left, clippingSize.cy);
-			void* pLeft = Resample(fullTargetSize, clipSize, targetOffset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
+			void* pLeft = ResampleOrCopyOverscan(fullTargetSize, clipSize, targetOffset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
 			
 			if (!bCanUseLUTProcDIB) {
 				CBasicProcessing::CopyRect32bpp(pPannedPixels, pLeft,
@@ -535,15 +586,15 @@ void CJPEGImage::ResampleWithPan(void* & pDIBPixels, void* & pDIBPixelsLUTProces
 				CBasicProcessing::CopyRect32bpp(pPannedPixelsLUTProcessed, pLeftProc,
 					clippingSize, CRect(CPoint(0, 0), clipSize),
 					clipSize, CRect(CPoint(0, 0), clipSize));
-				delete[] pLeftProc;
+				CBufferPool::This().Free(pLeftProc);
 			}
 
-			delete[] pLeft;
+			CBufferPool::This().Free(pLeft);
 		}
 		if (targetRect.right < clippingSize.cx) {
 			CSize clipSize(clippingSize.cx -  targetRect.right, clippingSize.cy);
 			CPoint offset(targetOffset.x + targetRect.right, targetOffset.y);
-			void* pRight = Resample(fullTargetSize, clipSize, offset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
+			void* pRight = ResampleOrCopyOverscan(fullTargetSize, clipSize, offset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
 			
 			if (!bCanUseLUTProcDIB) {
 				CBasicProcessing::CopyRect32bpp(pPannedPixels, pRight,
@@ -555,22 +606,153 @@ void CJPEGImage::ResampleWithPan(void* & pDIBPixels, void* & pDIBPixelsLUTProces
 				CBasicProcessing::CopyRect32bpp(pPannedPixelsLUTProcessed, pRigthProc,
 					clippingSize, CRect(CPoint(targetRect.right, 0), clipSize),
 					clipSize, CRect(CPoint(0, 0), clipSize));
-				delete[] pRigthProc;
+				CBufferPool::This().Free(pRigthProc);
 			}
 
-			delete[] pRight;
+			CBufferPool::This().Free(pRight);
 		}
 		pDIBPixels = pPannedPixels;
 		pDIBPixelsLUTProcessed = pPannedPixelsLUTProcessed;
 		return;
 	}
 
-	delete[] pDIBPixels; pDIBPixels = NULL;
-	delete[] pDIBPixelsLUTProcessed; pDIBPixelsLUTProcessed = NULL;
+	CBufferPool::This().Free(pDIBPixels); pDIBPixels = NULL;
+	CBufferPool::This().Free(pDIBPixelsLUTProcessed); pDIBPixelsLUTProcessed = NULL;
+}
+
+void* CJPEGImage::ResampleOrCopyOverscan(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, 
+										 EProcessingFlags eProcFlags, double dSharpen, double dRotation, EResizeType eResizeType) {
+	CRect rect(targetOffset, clippingSize);
+	if (m_overscan.Pixels != NULL && fabs(dRotation) <= 1e-6 && m_overscan.HasSameParameters(fullTargetSize, eProcFlags, dSharpen) &&
+		m_overscan.Contains(rect)) {
+		rect.OffsetRect(-m_overscan.Rect.left, -m_overscan.Rect.top);
+		return CBasicProcessing::CopyRect32bpp(NULL, m_overscan.Pixels, clippingSize, CRect(CPoint(0, 0), clippingSize),
+			m_overscan.Rect.Size(), rect);
+	}
+	return Resample(fullTargetSize, clippingSize, targetOffset, eProcFlags, dSharpen, dRotation, eResizeType);
+}
+
+void CJPEGImage::AdoptOverscan() {
+	if (m_pOverscanRequest == NULL || ::WaitForSingleObject(m_pOverscanRequest->EventFinished, 0) != WAIT_OBJECT_0) {
+		return;
+	}
+	if (m_pOverscanRequest->Section.Pixels != NULL) {
+		CBufferPool::This().Free(m_overscan.Pixels);
+		m_overscan = m_pOverscanRequest->Section;
+	}
+	::CloseHandle(m_pOverscanRequest->EventFinished);
+	m_pOverscanRequest->Deleted = true; // the overscan thread deletes the request
+	m_pOverscanRequest = NULL;
+}
+
+void CJPEGImage::UpdateOverscan(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, EProcessingFlags eProcFlags, double dSharpen) {
+	if (m_pOverscanRequest != NULL && m_pOverscanRequest->Cancel) {
+		DiscardOverscan(); // cancelled because the parameters changed, waits only for the band being resampled
+	}
+	if (m_pOverscanRequest != NULL) {
+		return; // one section at a time, checked again with the next pan
+	}
+	if (m_overscan.Pixels != NULL && !m_overscan.HasSameParameters(fullTargetSize, eProcFlags, dSharpen)) {
+		CBufferPool::This().Free(m_overscan.Pixels);
+		m_overscan.Pixels = NULL;
+	}
+
+	CRect fullTargetRect(CPoint(0, 0), fullTargetSize);
+	CRect visibleRect(targetOffset, clippingSize);
+	CSize margin(clippingSize.cx / OVERSCAN_MARGIN_DIVISOR, clippingSize.cy / OVERSCAN_MARGIN_DIVISOR);
+
+	// resample a new section when less than half of the margin is left in one direction
+	CRect minRect = visibleRect;
+	minRect.InflateRect(margin.cx / 2, margin.cy / 2);
+	minRect.IntersectRect(minRect, fullTargetRect);
+	if (m_overscan.Pixels != NULL && m_overscan.Contains(minRect)) {
+		return;
+	}
+
+	// the margin is three times as large in the direction of the last pan as in the opposite direction
+	CRect sectionRect = visibleRect;
+	sectionRect.InflateRect(margin);
+	sectionRect.OffsetRect(m_panDirection.x * margin.cx / 2, m_panDirection.y * margin.cy / 2);
+	sectionRect.IntersectRect(sectionRect, fullTargetRect);
+	if (sectionRect == visibleRect) {
+		return; // the whole image is visible in the panning directions
+	}
+
+	m_pOverscanRequest = new COverscanRequest(this, COverscanSection(fullTargetSize, sectionRect, eProcFlags, dSharpen), m_overscan);
+	COverscanThread::This().ProcessAsync(m_pOverscanRequest);
+}
+
+void CJPEGImage::DiscardOverscan() {
+	if (m_pOverscanRequest != NULL) {
+		m_pOverscanRequest->Cancel = true;
+		::WaitForSingleObject(m_pOverscanRequest->EventFinished, INFINITE);
+		CBufferPool::This().Free(m_pOverscanRequest->Section.Pixels);
+		::CloseHandle(m_pOverscanRequest->EventFinished);
+		m_pOverscanRequest->Deleted = true;
+		m_pOverscanRequest = NULL;
+	}
+	CBufferPool::This().Free(m_overscan.Pixels);
+	m_overscan.Pixels = NULL;
+}
+
+void CJPEGImage::ResampleOverscanSection(COverscanRequest& request) {
+	const COverscanSection& section = request.Section;
+	const COverscanSection& reusedSection = request.ReusedSection;
+	CSize sectionSize = section.Rect.Size();
+	void* pPixels = CBufferPool::This().Allocate(sectionSize.cx * sectionSize.cy * 4);
+	if (pPixels == NULL) {
+		return;
+	}
+	EResizeType eResizeType = GetResizeType(section.FullTargetSize, CSize(m_nOrigWidth, m_nOrigHeight));
+
+	// resampled in bands to react on cancellation in time
+	for (int nBandTop = section.Rect.top; nBandTop < section.Rect.bottom; nBandTop += OVERSCAN_BAND_HEIGHT) {
+		if (request.Cancel) {
+			CBufferPool::This().Free(pPixels);
+			return;
+		}
+		CRect bandRect(section.Rect.left, nBandTop, section.Rect.right, min(section.Rect.bottom, nBandTop + OVERSCAN_BAND_HEIGHT));
+		CRect reusedRect;
+		bool bSuccess;
+		if (reusedSection.Pixels != NULL && reusedRect.IntersectRect(bandRect, reusedSection.Rect)) {
+			// copy where the previous section overlaps, resample the rest
+			CRect targetRect = reusedRect, sourceRect = reusedRect;
+			targetRect.OffsetRect(-section.Rect.left, -section.Rect.top);
+			sourceRect.OffsetRect(-reusedSection.Rect.left, -reusedSection.Rect.top);
+			CBasicProcessing::CopyRect32bpp(pPixels, reusedSection.Pixels, sectionSize, targetRect, reusedSection.Rect.Size(), sourceRect);
+			bSuccess = ResampleOverscanRect(section, pPixels, CRect(bandRect.left, bandRect.top, bandRect.right, reusedRect.top), eResizeType) &&
+				ResampleOverscanRect(section, pPixels, CRect(bandRect.left, reusedRect.bottom, bandRect.right, bandRect.bottom), eResizeType) &&
+				ResampleOverscanRect(section, pPixels, CRect(bandRect.left, reusedRect.top, reusedRect.left, reusedRect.bottom), eResizeType) &&
+				ResampleOverscanRect(section, pPixels, CRect(reusedRect.right, reusedRect.top, bandRect.right, reusedRect.bottom), eResizeType);
+		} else {
+			bSuccess = ResampleOverscanRect(section, pPixels, bandRect, eResizeType);
+		}
+		if (!bSuccess) {
+			CBufferPool::This().Free(pPixels);
+			return;
+		}
+	}
+	request.Section.Pixels = pPixels;
+}
+
+bool CJPEGImage::ResampleOverscanRect(const COverscanSection& section, void* pSectionPixels, CRect rect, EResizeType eResizeType) {
+	if (rect.IsRectEmpty()) {
+		return true;
+	}
+	void* pDIB = Resample(section.FullTargetSize, rect.Size(), rect.TopLeft(), section.ProcFlags, section.Sharpen, 0.0, eResizeType);
+	if (pDIB == NULL) {
+		return false;
+	}
+	CRect targetRect = rect;
+	targetRect.OffsetRect(-section.Rect.left, -section.Rect.top);
+	CBasicProcessing::CopyRect32bpp(pSectionPixels, pDIB, section.Rect.Size(), targetRect, rect.Size(), CRect(CPoint(0, 0), rect.Size()));
+	CBufferPool::This().Free(pDIB);
+	return true;
 }
 
 void* CJPEGImage::Resample(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, 
-						  EProcessingFlags eProcFlags, double dSharpen, double dRotation, EResizeType eResizeType) {
+						  EProcessingFlags eProcFlags, double dSharpen, double dRotation, EResizeType eResizeType,
+						  const CBasicProcessing::Corrections* pCorrections) {
 
 	Helpers::CPUType cpu = CSettingsProvider::This().AlgorithmImplementation();
 	// NOTE: Hacky workaround... there is probably a very obscure bug in the AVX2 implementation
@@ -600,35 +782,87 @@ void* CJPEGImage::Resample(CSize fullTargetSize, CSize clippingSize, CPoint targ
 
 	if (fullTargetSize.cx > 65535 || fullTargetSize.cy > 65535) return NULL;
 
+	// A pending rotation and mirroring (see Rotate()) is applied to the resampled pixels, the original pixels are sampled
+	// in their stored orientation. The interactive rotation and trapezoid previews need the oriented original pixels.
+	bool bHasRotation = fabs(dRotation) > 1e-3;
+	if ((bHasRotation || m_bTrapezoidValid) && !ApplyPendingOrientation()) {
+		return NULL;
+	}
+	bool bOrient = m_nPendingRotation != 0 || m_bPendingMirror;
+	CSize origSize = StoredOrigSize();
+	CSize sampleFullSize = fullTargetSize;
+	CSize sampleClippingSize = clippingSize;
+	CPoint sampleOffset = targetOffset;
+	if (bOrient) {
+		CPoint corner1 = ToStoredOrientation(targetOffset, fullTargetSize);
+		CPoint corner2 = ToStoredOrientation(targetOffset + clippingSize - CSize(1, 1), fullTargetSize);
+		if (m_nPendingRotation == 90 || m_nPendingRotation == 270) {
+			sampleFullSize = CSize(fullTargetSize.cy, fullTargetSize.cx);
+			sampleClippingSize = CSize(clippingSize.cy, clippingSize.cx);
+		}
+		sampleOffset = CPoint(min(corner1.x, corner2.x), min(corner1.y, corner2.y));
+	}
+
+	// the corrections cannot be applied while resampling if the color profile must be applied first,
+	// the local density correction not if the resampled pixels are oriented afterwards
+	const CBasicProcessing::Corrections* pResampleCorrections = (m_pColorLUT3D == NULL) ? pCorrections : NULL;
+	if (bOrient && pResampleCorrections != NULL && pResampleCorrections->LDCMap != NULL) {
+		pResampleCorrections = NULL;
+	}
+	bool bCorrectionsApplied = false;
+	void* pDIB;
 	if (GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling) && 
 		!(eResizeType == NoResize && (filter == Filter_Downsampling_Best_Quality || filter == Filter_Downsampling_No_Aliasing))) {
 		if (SupportsSIMD(cpu)) {
 			if (eResizeType == UpSample) {
-				return CBasicProcessing::SampleUp_HQ_SIMD(fullTargetSize, targetOffset, clippingSize, 
-					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, ToSIMDArchitecture(cpu));
+				pDIB = CBasicProcessing::SampleUp_HQ_SIMD(sampleFullSize, sampleOffset, sampleClippingSize, 
+					origSize, m_pOrigPixels, m_nOriginalChannels, ToSIMDArchitecture(cpu), pResampleCorrections);
 			} else {
-				return CBasicProcessing::SampleDown_HQ_SIMD(fullTargetSize, targetOffset, clippingSize,
-					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, dSharpen, filter, ToSIMDArchitecture(cpu));
+				pDIB = CBasicProcessing::SampleDown_HQ_SIMD(sampleFullSize, sampleOffset, sampleClippingSize,
+					origSize, m_pOrigPixels, m_nOriginalChannels, dSharpen, filter, ToSIMDArchitecture(cpu), pResampleCorrections);
 			}
+			bCorrectionsApplied = pResampleCorrections != NULL;
 		} else {
 			if (eResizeType == UpSample) {
-				return CBasicProcessing::SampleUp_HQ(fullTargetSize, targetOffset, clippingSize, 
-					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels);
+				pDIB = CBasicProcessing::SampleUp_HQ(sampleFullSize, sampleOffset, sampleClippingSize, 
+					origSize, m_pOrigPixels, m_nOriginalChannels);
 			} else {
-				return CBasicProcessing::SampleDown_HQ(fullTargetSize, targetOffset, clippingSize, 
-					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, dSharpen, filter);
+				pDIB = CBasicProcessing::SampleDown_HQ(sampleFullSize, sampleOffset, sampleClippingSize, 
+					origSize, m_pOrigPixels, m_nOriginalChannels, dSharpen, filter);
 			}
 		}
 	} else {
-		bool bHasRotation = fabs(dRotation) > 1e-3;
-		if (bHasRotation) {
-			return CBasicProcessing::PointSampleWithRotation(fullTargetSize, targetOffset, clippingSize, 
-				CSize(m_nOrigWidth, m_nOrigHeight), dRotation, m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
+		// interactive rotation and trapezoid preview
+		if (m_bTrapezoidValid) {
+			pDIB = CBasicProcessing::BilinearSampleTrapezoid(sampleFullSize, m_trapezoid, sampleOffset, sampleClippingSize, 
+				origSize, m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground(),
+				cpu >= Helpers::CPU_SSE, pResampleCorrections);
+			bCorrectionsApplied = pResampleCorrections != NULL;
+		} else if (bHasRotation) {
+			pDIB = CBasicProcessing::BilinearSampleWithRotation(sampleFullSize, sampleOffset, sampleClippingSize, 
+				origSize, dRotation, m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground(),
+				cpu >= Helpers::CPU_SSE, pResampleCorrections);
+			bCorrectionsApplied = pResampleCorrections != NULL;
 		} else {
-			return CBasicProcessing::PointSample(fullTargetSize, targetOffset, clippingSize, 
-				CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels);
+			pDIB = CBasicProcessing::PointSample(sampleFullSize, sampleOffset, sampleClippingSize, 
+				origSize, m_pOrigPixels, m_nOriginalChannels);
 		}
 	}
+
+	if (pDIB != NULL && bOrient) {
+		void* pOrientedDIB = CBasicProcessing::OrientDIB32bpp(NULL, sampleClippingSize.cx, sampleClippingSize.cy, pDIB, m_nPendingRotation, m_bPendingMirror);
+		CBufferPool::This().Free(pDIB);
+		pDIB = pOrientedDIB;
+	}
+
+	// Deferred color management: transform only the resampled pixels to sRGB
+	if (pDIB != NULL && m_pColorLUT3D != NULL) {
+		ICCProfileTransform::ApplyLUT3D(m_pColorLUT3D, pDIB, clippingSize.cx, clippingSize.cy);
+	}
+	if (pDIB != NULL && pCorrections != NULL && !bCorrectionsApplied) {
+		CBasicProcessing::ApplyCorrections32bpp(fullTargetSize, targetOffset, clippingSize, pDIB, *pCorrections);
+	}
+	return pDIB;
 }
 
 void* CJPEGImage::InternalResize(void* pixels, int channels, EResizeFilter filter, CSize targetSize, CSize sourceSize) {
@@ -684,16 +918,18 @@ bool CJPEGImage::VerifyRotation(const CRotationParams& rotationParams) {
 bool CJPEGImage::Rotate(int nRotation) {
 	double dStartTickCount = Helpers::GetExactTickCount();
 
-	// Rotation can only be done in 32 bpp
-	if (!ConvertSrcTo4Channels()) {
+	if (nRotation != 90 && nRotation != 180 && nRotation != 270) {
 		return false;
 	}
 
-	InvalidateAllCachedPixelData();
-	void* pNewOriginalPixels = CBasicProcessing::Rotate32bpp(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels, nRotation);
-	if (pNewOriginalPixels == NULL) return false;
-	delete[] m_pOrigPixels;
-	m_pOrigPixels = pNewOriginalPixels;
+	// The original pixels are not rotated, the resampling samples them in the rotated orientation.
+	// Rotating after mirroring is the same as mirroring after rotating in the other direction.
+	// The point samples of the LDC are rotated with the image instead of sampling the original pixels again.
+	if (m_pLDC != NULL && m_bLDCOwned) {
+		m_pLDC->Rotate(nRotation);
+	}
+	InvalidateAllCachedPixelData(true);
+	m_nPendingRotation = (m_nPendingRotation + (m_bPendingMirror ? 360 - nRotation : nRotation)) % 360;
 	if (nRotation != 180) {
 		// swap width and height
 		int nTemp = m_nOrigWidth;
@@ -709,16 +945,15 @@ bool CJPEGImage::Rotate(int nRotation) {
 bool CJPEGImage::Mirror(bool bHorizontally) {
 	double dStartTickCount = Helpers::GetExactTickCount();
 
-	// Rotation can only be done in 32 bpp
-	if (!ConvertSrcTo4Channels()) {
-		return false;
+	// Like rotation, mirroring is applied while resampling. Mirroring vertically is rotating by 180 degrees and mirroring horizontally.
+	if (m_pLDC != NULL && m_bLDCOwned) {
+		m_pLDC->Mirror(bHorizontally);
+	}
+	InvalidateAllCachedPixelData(true);
+	m_bPendingMirror = !m_bPendingMirror;
+	if (!bHorizontally) {
+		m_nPendingRotation = (m_nPendingRotation + 180) % 360;
 	}
-
-	InvalidateAllCachedPixelData();
-	void* pNewOriginalPixels = CBasicProcessing::Mirror32bpp(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels, bHorizontally);
-	if (pNewOriginalPixels == NULL) return false;
-	delete[] m_pOrigPixels;
-	m_pOrigPixels = pNewOriginalPixels;
 	MarkAsDestructivelyProcessed();
 	m_bIsProcessedNoParamDB = true;
 
@@ -727,8 +962,8 @@ bool CJPEGImage::Mirror(bool bHorizontally) {
 }
 
 bool CJPEGImage::Crop(CRect cropRect) {
-	// Cropping can only be done in 32 bpp
-	if (!ConvertSrcTo4Channels()) {
+	// Cropping can only be done in 32 bpp, the crop rectangle is in the orientation of the image
+	if (!ConvertSrcTo4Channels() || !ApplyPendingOrientation()) {
 		return false;
 	}
 
@@ -770,7 +1005,7 @@ void CJPEGImage::SetDimRects(const CDimRect* dimRects, int numberOfRects) {
 			}
 		} else {
 			// force to recreate processed DIB on next access
-			delete[] m_pDIBPixelsLUTProcessed;
+			CBufferPool::This().Free(m_pDIBPixelsLUTProcessed);
 			m_pDIBPixelsLUTProcessed = NULL;
 			m_pLastDIB = NULL;
 		}
@@ -789,7 +1024,7 @@ void CJPEGImage::SetDimRects(const CDimRect* dimRects, int numberOfRects) {
 void CJPEGImage::EnableDimming(bool bEnable) {
 	if (bEnable != m_bEnableDimming && m_pDimRects != NULL) {
 		m_bEnableDimming = bEnable;
-		delete[] m_pDIBPixelsLUTProcessed;
+		CBufferPool::This().Free(m_pDIBPixelsLUTProcessed);
 		m_pDIBPixelsLUTProcessed = NULL;
 		m_pLastDIB = NULL;
 	}
@@ -803,7 +1038,8 @@ void* CJPEGImage::DIBPixelsLastProcessed(bool bGenerateDIBIfNeeded) {
 }
 
 void CJPEGImage::VerifyDIBPixelsCreated() {
-	if (m_pDIBPixels == NULL) {
+	// the unprocessed DIB is not needed if the processing parameters are not expected to change
+	if (m_pDIBPixels == NULL && (m_bKeepUnprocessedDIB || m_bProcessingParamsChanged)) {
 		EResizeType eResizeType = GetResizeType(m_FullTargetSize, CSize(m_nOrigWidth, m_nOrigHeight));
 		m_pDIBPixels = Resample(m_FullTargetSize, m_ClippingSize, m_TargetOffset, m_eProcFlags, m_imageProcParams.Sharpen, m_dRotationLQ, eResizeType);
 	}
@@ -938,8 +1174,15 @@ void* CJPEGImage::GetDIBInternal(CSize fullTargetSize, CSize clippingSize, CPoin
 	if (pTrapezoid != NULL && GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling)) {
 		assert(false);
 	}
-	if (fabs(dRotation) > 1e-6 || pTrapezoid != NULL) {
-		eProcFlags = SetProcessingFlag(eProcFlags, PFLAG_LDC, false); // not supported during rotation or trapezoid processing with low quality
+
+	// the overscan thread resamples without trapezoid, it must be finished before the trapezoid is set below
+	if (pTrapezoid != NULL) {
+		DiscardOverscan();
+	}
+	AdoptOverscan();
+	// a section resampled for another zoom or resampling quality is of no use anymore, stop it as soon as possible
+	if (m_pOverscanRequest != NULL && !m_pOverscanRequest->Section.HasSameParameters(fullTargetSize, eProcFlags, imageProcParams.Sharpen)) {
+		m_pOverscanRequest->Cancel = true;
 	}
 
 	// Check if resampling due to bHighQualityResampling parameter change is needed
@@ -957,6 +1200,10 @@ void* CJPEGImage::GetDIBInternal(CSize fullTargetSize, CSize clippingSize, CPoin
 
 	// the geometrical parameters must be set before calling ApplyCorrectionLUT()
 	CRect oldClippingRect = CRect(m_TargetOffset, m_ClippingSize);
+	if (!bTargetSizeChanged && targetOffset != oldClippingRect.TopLeft()) {
+		int nPanX = targetOffset.x - oldClippingRect.left, nPanY = targetOffset.y - oldClippingRect.top;
+		m_panDirection = CPoint((nPanX > 0) - (nPanX < 0), (nPanY > 0) - (nPanY < 0));
+	}
 	m_FullTargetSize = fullTargetSize;
 	m_ClippingSize = clippingSize;
 	m_TargetOffset = targetOffset;
@@ -968,8 +1215,8 @@ void* CJPEGImage::GetDIBInternal(CSize fullTargetSize, CSize clippingSize, CPoin
 	double dStartTickCount = Helpers::GetExactTickCount();
 
 	if (bShowGridChanged) {
-		delete[] m_pDIBPixels; m_pDIBPixels = NULL;
-		delete[] m_pDIBPixelsLUTProcessed; m_pDIBPixelsLUTProcessed = NULL;
+		CBufferPool::This().Free(m_pDIBPixels); m_pDIBPixels = NULL;
+		CBufferPool::This().Free(m_pDIBPixelsLUTProcessed); m_pDIBPixelsLUTProcessed = NULL;
 		m_pLastDIB = NULL;
 	}
 
@@ -984,42 +1231,47 @@ void* CJPEGImage::GetDIBInternal(CSize fullTargetSize, CSize clippingSize, CPoin
 		pDIB = ApplyCorrectionLUTandLDC(imageProcParams, eProcFlags, m_pDIBPixelsLUTProcessed, 
 			fullTargetSize, targetOffset, (pDIBUnsharpMasked != NULL) ? pDIBUnsharpMasked : m_pDIBPixels, clippingSize, 
 			bMustResampleGeometry, false, pDIBUnsharpMasked != NULL, bParametersChanged);
+		// further changes are likely now, the unprocessed DIB is kept so that they need not resample
+		m_bProcessingParamsChanged = m_bProcessingParamsChanged || bParametersChanged;
 	}
 	// ApplyCorrectionLUTandLDC() could have failed, then recreate the DIBs
 	if (pDIB == NULL) {
-		// if the image is reprocessed more than once, it is worth to convert the original to 4 channels
-		// as this is faster for further processing
-		if (!m_bFirstReprocessing) {
-			ConvertSrcTo4Channels();
-		}
-
 		bParametersChanged = true;
 
 		assert(pDIBUnsharpMasked == NULL);
 
-		// If we only pan, we can resample far more efficiently by only calculating the newly visible areas
+		// If we only pan, we can resample far more efficiently by only calculating the newly visible areas.
+		// Not with rotation and LDC, the LDC would not be aligned to the image in the newly visible areas.
 		bool bPanningOnly = !m_bFirstReprocessing && !bMustResampleProcessings && !bTargetSizeChanged && !bMustResampleQuality && 
-			!bMustResampleRotation && !bShowGrid && pTrapezoid == NULL;
+			!bMustResampleRotation && !bShowGrid && pTrapezoid == NULL && (fabs(dRotation) <= 1e-6 || !GetProcessingFlag(eProcFlags, PFLAG_LDC));
 		m_bFirstReprocessing = false;
 		if (bPanningOnly && pUnsharpMaskParams == NULL) {
 			ResampleWithPan(m_pDIBPixels, m_pDIBPixelsLUTProcessed, fullTargetSize, clippingSize, targetOffset, 
 				oldClippingRect, eProcFlags, imageProcParams, dRotation, eResizeType);
-			delete[] m_pGrayImage; m_pGrayImage = NULL;
-			delete[] m_pSmoothGrayImage; m_pSmoothGrayImage = NULL;
+			CBufferPool::This().Free(m_pGrayImage); m_pGrayImage = NULL;
+			CBufferPool::This().Free(m_pSmoothGrayImage); m_pSmoothGrayImage = NULL;
 		} else {
-			delete[] m_pDIBPixelsLUTProcessed; m_pDIBPixelsLUTProcessed = NULL;
-			delete[] m_pDIBPixels; m_pDIBPixels = NULL;
-			delete[] m_pGrayImage; m_pGrayImage = NULL;
-			delete[] m_pSmoothGrayImage; m_pSmoothGrayImage = NULL;
+			CBufferPool::This().Free(m_pDIBPixelsLUTProcessed); m_pDIBPixelsLUTProcessed = NULL;
+			CBufferPool::This().Free(m_pDIBPixels); m_pDIBPixels = NULL;
+			CBufferPool::This().Free(m_pGrayImage); m_pGrayImage = NULL;
+			CBufferPool::This().Free(m_pSmoothGrayImage); m_pSmoothGrayImage = NULL;
 		}
 
 		// both DIBs are NULL, do normal resampling
 		if (m_pDIBPixels == NULL && m_pDIBPixelsLUTProcessed == NULL) {
-			if (pTrapezoid == NULL) {
+			// LUTs and LDC are applied while resampling if the unprocessed DIB is not needed later on.
+			// When rotating or mapping to a trapezoid, the LDC must always be applied while resampling to be aligned to the image.
+			bool bLDCAtSourcePosition = (fabs(dRotation) > 1e-6 || pTrapezoid != NULL) && GetProcessingFlag(eProcFlags, PFLAG_LDC);
+			bool bKeepUnprocessedDIB = m_bKeepUnprocessedDIB || m_bProcessingParamsChanged;
+			bool bApplyCorrectionsWhileResampling = (!bKeepUnprocessedDIB || bLDCAtSourcePosition) && pUnsharpMaskParams == NULL;
+			if (bApplyCorrectionsWhileResampling) {
+				bool bNotUsed;
+				pDIB = ApplyCorrectionLUTandLDC(imageProcParams, eProcFlags, m_pDIBPixelsLUTProcessed, fullTargetSize, 
+					targetOffset, NULL, clippingSize, bMustResampleGeometry, false, false, bNotUsed, true);
+			}
+			if (pDIB == NULL) {
+				// the trapezoid has been stored in m_trapezoid above
 				m_pDIBPixels = Resample(fullTargetSize, clippingSize, targetOffset, eProcFlags, imageProcParams.Sharpen, dRotation, eResizeType);
-			} else {
-				m_pDIBPixels = CBasicProcessing::PointSampleTrapezoid(fullTargetSize, *pTrapezoid, targetOffset, clippingSize, 
-					CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, CSettingsProvider::This().ColorBackground());
 			}
 		}
 
@@ -1054,9 +1306,15 @@ void* CJPEGImage::GetDIBInternal(CSize fullTargetSize, CSize clippingSize, CPoin
 	}
 	m_eProcFlags = eProcFlags;
 
+	// prepare the pixels around the visible area in the background, the next pans copy them instead of resampling.
+	// Only for the displayed image, not for the images processed on the read ahead thread.
+	if (pDIB != NULL && pTrapezoid == NULL && fabs(dRotation) <= 1e-6 && !m_bIsAnimation && CProcessingThreadPool::This().IsGUIThread()) {
+		UpdateOverscan(fullTargetSize, clippingSize, targetOffset, eProcFlags, imageProcParams.Sharpen);
+	}
+
 	m_pLastDIB = pDIB;
 	if (m_pDIBPixelsLUTProcessed != pDIBUnsharpMasked) {
-		delete[] pDIBUnsharpMasked;
+		CBufferPool::This().Free(pDIBUnsharpMasked);
 	}
 
 	return pDIB;
@@ -1065,7 +1323,7 @@ void* CJPEGImage::GetDIBInternal(CSize fullTargetSize, CSize clippingSize, CPoin
 void* CJPEGImage::ApplyUnsharpMask(const CUnsharpMaskParams * pUnsharpMaskParams, bool bNoChangesLDCandLUT) {
 	bool bThisUnsharpMaskValid = pUnsharpMaskParams != NULL;
 	if (bThisUnsharpMaskValid != m_bUnsharpMaskParamsValid) {
-		delete[] m_pDIBPixelsLUTProcessed;
+		CBufferPool::This().Free(m_pDIBPixelsLUTProcessed);
 		m_pDIBPixelsLUTProcessed = NULL;
 	}
 	bool bAmountChanged = true;
@@ -1076,7 +1334,7 @@ void* CJPEGImage::ApplyUnsharpMask(const CUnsharpMaskParams * pUnsharpMaskParams
 		bRadiusChanged = fabs(pUnsharpMaskParams->Radius - m_unsharpMaskParams.Radius) > 1e-4;
 		bThresholdChanged = fabs(pUnsharpMaskParams->Threshold - m_unsharpMaskParams.Threshold) > 1e-4;
 		if (bAmountChanged || bRadiusChanged || bThresholdChanged) {
-			delete[] m_pDIBPixelsLUTProcessed;
+			CBufferPool::This().Free(m_pDIBPixelsLUTProcessed);
 			m_pDIBPixelsLUTProcessed = NULL;
 		}
 	}
@@ -1087,7 +1345,7 @@ void* CJPEGImage::ApplyUnsharpMask(const CUnsharpMaskParams * pUnsharpMaskParams
 		return NULL; // nothing changed, we can reuse m_pDIBPixelsLUTProcessed later on
 	}
 	if (bRadiusChanged) {
-		delete[] m_pSmoothGrayImage;
+		CBufferPool::This().Free(m_pSmoothGrayImage);
 		m_pSmoothGrayImage = NULL;
 	}
 	if (m_pGrayImage == NULL) {
@@ -1101,7 +1359,7 @@ void* CJPEGImage::ApplyUnsharpMask(const CUnsharpMaskParams * pUnsharpMaskParams
 		return NULL;
 	}
 
-	uint32* pNewImage = new(std::nothrow) uint32[m_ClippingSize.cx * m_ClippingSize.cy];
+	uint32* pNewImage = (uint32*)CBufferPool::This().Allocate((size_t)m_ClippingSize.cx * m_ClippingSize.cy * sizeof(uint32));
 	return (pNewImage == NULL) ? NULL : CBasicProcessing::UnsharpMask(m_ClippingSize, CPoint(0,0), m_ClippingSize, 
 		pUnsharpMaskParams->Amount, pUnsharpMaskParams->Threshold, m_pGrayImage, m_pSmoothGrayImage, m_pDIBPixels, pNewImage, 4);
 }
@@ -1109,7 +1367,8 @@ void* CJPEGImage::ApplyUnsharpMask(const CUnsharpMaskParams * pUnsharpMaskParams
 void* CJPEGImage::ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageProcParams, EProcessingFlags eProcFlags,
 										   void * & pCachedTargetDIB, CSize fullTargetSize, CPoint targetOffset, 
 										   void * pSourceDIB, CSize dibSize,
-										   bool bGeometryChanged, bool bOnlyCheck, bool bCanTakeOwnershipOfSourceDIB, bool &bParametersChanged) {
+										   bool bGeometryChanged, bool bOnlyCheck, bool bCanTakeOwnershipOfSourceDIB, bool &bParametersChanged,
+										   bool bResampleSource) {
 
 	bool bAutoContrast = GetProcessingFlag(eProcFlags, PFLAG_AutoContrast);
 	bool bAutoContrastOld = GetProcessingFlag(m_eProcFlags, PFLAG_AutoContrast);
@@ -1155,7 +1414,7 @@ void* CJPEGImage::ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageP
 		return NULL;
 	}
 
-	if (pSourceDIB == NULL) {
+	if (bResampleSource ? (bNoLUTsApplied && !bLDC) : (pSourceDIB == NULL)) {
 		return NULL;
 	}
 
@@ -1183,8 +1442,11 @@ void* CJPEGImage::ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageP
 	bool bSpecialHistogram = false;
 	if (bMustUse3ChannelLUT) {
 		if (bAutoContrast && bAutoContrastSection && m_bLDCOwned && (!bAutoContrastSectionOld || bCorrectionFactorChanged || bColorCastCorrChanged)) {
-			pHistogram = new CHistogram(*this, false);
-			bSpecialHistogram = true;
+			const CHistogram* pSectionHistogram = CreateSectionHistogram();
+			if (pSectionHistogram != NULL) {
+				pHistogram = pSectionHistogram;
+				bSpecialHistogram = true;
+			}
 			delete[] m_pLUTRGB;
 			m_pLUTRGB = NULL;
 		}
@@ -1213,7 +1475,7 @@ void* CJPEGImage::ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageP
 		m_pSaturationLUTs = NULL;
 	}
 	
-	delete[] pCachedTargetDIB;
+	CBufferPool::This().Free(pCachedTargetDIB);
 	pCachedTargetDIB = NULL;
 	if (bSpecialHistogram) {
 		delete pHistogram;
@@ -1222,7 +1484,15 @@ void* CJPEGImage::ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageP
 	if (!bNoLUTsApplied || bLDC) {
 		// LUT or/and LDC --> apply correction
 		uint8* pLUT = CHistogramCorr::CombineLUTs(m_pLUTAllChannels, m_pLUTRGB);
-		if (bLDC) {
+		// the LDC map is aligned to the source image, with rotation or trapezoid it must be applied while resampling
+		bool bLDCAtSourcePosition = bLDC && pSourceDIB == m_pDIBPixels && (fabs(m_dRotationLQ) > 1e-6 || m_bTrapezoidValid);
+		if (bResampleSource || bLDCAtSourcePosition) {
+			CBasicProcessing::Corrections corrections = { bMustUseSaturationLUTs ? m_pSaturationLUTs : NULL, pLUT,
+				bLDC ? m_pLDC->GetLDCMap() : NULL, m_pLDC->GetLDCMapSize(),
+				m_pLDC->GetBlackPt(), m_pLDC->GetWhitePt(), (float)imageProcParams.LightenShadowSteepness };
+			pCachedTargetDIB = Resample(fullTargetSize, dibSize, targetOffset, eProcFlags, imageProcParams.Sharpen, m_dRotationLQ,
+				GetResizeType(fullTargetSize, CSize(m_nOrigWidth, m_nOrigHeight)), &corrections);
+		} else if (bLDC) {
 			pCachedTargetDIB = CBasicProcessing::ApplyLDC32bpp(fullTargetSize, targetOffset, dibSize, m_pLDC->GetLDCMapSize(),
 				pSourceDIB, bMustUseSaturationLUTs ? m_pSaturationLUTs : NULL, pLUT, m_pLDC->GetLDCMap(),
 				m_pLDC->GetBlackPt(), m_pLDC->GetWhitePt(), (float)imageProcParams.LightenShadowSteepness);
@@ -1242,7 +1512,7 @@ void* CJPEGImage::ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageP
 		return pSourceDIB;
 	} else {
 		// no LUTs, no LDC but dimming --> make copy of original pixels
-		pCachedTargetDIB = new(std::nothrow) uint32[dibSize.cx*dibSize.cy];
+		pCachedTargetDIB = CBufferPool::This().Allocate((size_t)dibSize.cx*dibSize.cy*sizeof(uint32));
 		if (pCachedTargetDIB != NULL) {
 			memcpy(pCachedTargetDIB, pSourceDIB, dibSize.cx*dibSize.cy*4);
 		}
@@ -1261,19 +1531,102 @@ void* CJPEGImage::ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageP
 	return pCachedTargetDIB;
 }
 
+CHistogram* CJPEGImage::CreateSectionHistogram() {
+	if (m_FullTargetSize.cx <= 0 || m_FullTargetSize.cy <= 0 || m_pOrigPixels == NULL) {
+		return NULL;
+	}
+	if (m_pTileHistograms == NULL) {
+		CSize storedSize = StoredOrigSize();
+		m_pTileHistograms = new CTileHistograms(m_pOrigPixels, storedSize.cx, storedSize.cy, m_nOriginalChannels);
+	}
+
+	// visible section in the original image, the full target size is the size of the zoomed original image
+	double dScaleX = (double)m_nOrigWidth / m_FullTargetSize.cx;
+	double dScaleY = (double)m_nOrigHeight / m_FullTargetSize.cy;
+	int nLeft = max(0, (int)(m_TargetOffset.x * dScaleX));
+	int nTop = max(0, (int)(m_TargetOffset.y * dScaleY));
+	int nRight = min(m_nOrigWidth, (int)ceil((m_TargetOffset.x + m_ClippingSize.cx) * dScaleX));
+	int nBottom = min(m_nOrigHeight, (int)ceil((m_TargetOffset.y + m_ClippingSize.cy) * dScaleY));
+	if (nLeft >= nRight || nTop >= nBottom) {
+		return NULL;
+	}
+
+	// the tile histograms are calculated on the original pixels as stored
+	CSize origSize(m_nOrigWidth, m_nOrigHeight);
+	CPoint topLeft = ToStoredOrientation(CPoint(nLeft, nTop), origSize);
+	CPoint bottomRight = ToStoredOrientation(CPoint(nRight - 1, nBottom - 1), origSize);
+	CRect storedRect(min(topLeft.x, bottomRight.x), min(topLeft.y, bottomRight.y), 
+		max(topLeft.x, bottomRight.x) + 1, max(topLeft.y, bottomRight.y) + 1);
+	return m_pTileHistograms->CreateHistogram(storedRect);
+}
+
 bool CJPEGImage::ConvertSrcTo4Channels() {
-	if (m_nOriginalChannels == 3) {
-		void* pNewOriginalPixels = CBasicProcessing::Convert3To4Channels(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels);
+	if (m_nOriginalChannels == 1 || m_nOriginalChannels == 3) {
+		DiscardOverscan(); // the overscan thread may read the original pixels
+		CSize storedSize = StoredOrigSize();
+		void* pNewOriginalPixels = (m_nOriginalChannels == 1) ?
+			CBasicProcessing::Convert1To4Channels(storedSize.cx, storedSize.cy, m_pOrigPixels) :
+			CBasicProcessing::Convert3To4Channels(storedSize.cx, storedSize.cy, m_pOrigPixels);
 		if (pNewOriginalPixels != NULL) {
 			delete[] m_pOrigPixels;
 			m_pOrigPixels = pNewOriginalPixels;
 			m_nOriginalChannels = 4;
+			delete m_pTileHistograms; // refers to the replaced pixels
+			m_pTileHistograms = NULL;
 		}
 		return pNewOriginalPixels != NULL;
 	}
 	return true;
 }
 
+bool CJPEGImage::ApplyPendingOrientation() {
+	if (m_nPendingRotation == 0 && !m_bPendingMirror) {
+		return true;
+	}
+	if (!ConvertSrcTo4Channels()) {
+		return false;
+	}
+	DiscardOverscan(); // resampled in the pending orientation
+	CSize storedSize = StoredOrigSize();
+	void* pNewOriginalPixels = new(std::nothrow) uint32[storedSize.cx * storedSize.cy];
+	if (pNewOriginalPixels == NULL) {
+		return false;
+	}
+	CBasicProcessing::OrientDIB32bpp(pNewOriginalPixels, storedSize.cx, storedSize.cy, m_pOrigPixels, m_nPendingRotation, m_bPendingMirror);
+	delete[] m_pOrigPixels;
+	m_pOrigPixels = pNewOriginalPixels;
+	delete m_pTileHistograms; // refers to the replaced pixels
+	m_pTileHistograms = NULL;
+	m_nPendingRotation = 0;
+	m_bPendingMirror = false;
+	return true;
+}
+
+CSize CJPEGImage::StoredOrigSize() const {
+	return (m_nPendingRotation == 90 || m_nPendingRotation == 270) ? CSize(m_nOrigHeight, m_nOrigWidth) : CSize(m_nOrigWidth, m_nOrigHeight);
+}
+
+CPoint CJPEGImage::ToStoredOrientation(CPoint pt, CSize size) const {
+	// undo the mirroring, then the rotation
+	int nX = m_bPendingMirror ? size.cx - 1 - pt.x : pt.x;
+	int nY = pt.y;
+	bool bSwapWH = m_nPendingRotation == 90 || m_nPendingRotation == 270;
+	int nStoredWidth = bSwapWH ? size.cy : size.cx;
+	int nStoredHeight = bSwapWH ? size.cx : size.cy;
+	switch (m_nPendingRotation) {
+		case 90: return CPoint(nY, nStoredHeight - 1 - nX);
+		case 180: return CPoint(nStoredWidth - 1 - nX, nStoredHeight - 1 - nY);
+		case 270: return CPoint(nStoredWidth - 1 - nY, nX);
+		default: return CPoint(nX, nY);
+	}
+}
+
+int CJPEGImage::OriginalPixelOffset(int nX, int nY) const {
+	CPoint storedPos = ToStoredOrientation(CPoint(nX, nY), CSize(m_nOrigWidth, m_nOrigHeight));
+	int nStoredLineSize = Helpers::DoPadding(StoredOrigSize().cx * m_nOriginalChannels, 4);
+	return nStoredLineSize * storedPos.y + storedPos.x * m_nOriginalChannels;
+}
+
 EProcessingFlags CJPEGImage::GetProcFlagsIncludeExcludeFolders(LPCTSTR sFileName, EProcessingFlags procFlags) const {
 	EProcessingFlags eFlags = procFlags;
 	CSettingsProvider& sp = CSettingsProvider::This();
@@ -1453,17 +1806,24 @@ void CJPEGImage::MarkAsDestructivelyProcessed() {
 	m_rotationParams.Flags = RFLAG_None;
 }
 
-void CJPEGImage::InvalidateAllCachedPixelData() {
+void CJPEGImage::InvalidateAllCachedPixelData(bool bOnlyOrientationChanged) {
+	DiscardOverscan();
 	m_pLastDIB = NULL;
-	if (m_bLDCOwned) delete m_pLDC; // LDC mask must be recalculated!
-	m_pLDC = NULL;
-	delete[] m_pDIBPixels; 
+	if (!bOnlyOrientationChanged || !m_bLDCOwned) {
+		if (m_bLDCOwned) delete m_pLDC; // LDC mask must be recalculated!
+		m_pLDC = NULL;
+	}
+	if (!bOnlyOrientationChanged) {
+		delete m_pTileHistograms;
+		m_pTileHistograms = NULL;
+	}
+	CBufferPool::This().Free(m_pDIBPixels); 
 	m_pDIBPixels = NULL;
-	delete[] m_pDIBPixelsLUTProcessed; 
+	CBufferPool::This().Free(m_pDIBPixelsLUTProcessed); 
 	m_pDIBPixelsLUTProcessed = NULL;
-	delete[] m_pGrayImage;
+	CBufferPool::This().Free(m_pGrayImage);
 	m_pGrayImage = NULL;
-	delete[] m_pSmoothGrayImage;
+	CBufferPool::This().Free(m_pSmoothGrayImage);
 	m_pSmoothGrayImage = NULL;
 	delete m_pThumbnail;
 	m_pThumbnail = NULL;
@@ -1472,17 +1832,41 @@ void CJPEGImage::InvalidateAllCachedPixelData() {
 	m_ClippingSize = CSize(0, 0);
 }
 
+void CJPEGImage::SetColorLUT3D(uint8* pLUT, void* pColorTransform) {
+	DiscardOverscan();
+	bool bLDCSampledWithLUT = m_pColorLUT3D != NULL || m_pColorTransform != NULL;
+	delete[] m_pColorLUT3D;
+	m_pColorLUT3D = pLUT;
+	ICCProfileTransform::DeleteTransform(m_pColorTransform);
+	m_pColorTransform = pColorTransform;
+	if (m_pLDC != NULL && m_bLDCOwned) {
+		if (bLDCSampledWithLUT) {
+			delete m_pLDC;
+			m_pLDC = new CLocalDensityCorr(*this, true);
+		} else {
+			m_pLDC->ApplyColorTransform(pColorTransform, pLUT);
+		}
+		if (m_bPixelHashFromLDC) {
+			m_nPixelHash = m_pLDC->GetPixelHash();
+		}
+		m_fLightenShadowFactor = (1.0f - m_pLDC->GetHistogram()->IsNightShot())*(1.0f - m_pLDC->IsSunset());
+	}
+}
+
 CJPEGImage* CJPEGImage::CreateThumbnailImage() {
 	if (m_pLDC == NULL) {
 		m_pLDC = new CLocalDensityCorr(*this, true);
 	}
 	void* pPixels = NULL;
 	int nWidth, nHeight;
-	if (m_nOrigWidth*m_nOrigHeight < 120000) {
+	bool bFromLDC = false;
+	if (m_nOrigWidth*m_nOrigHeight < 120000 && ApplyPendingOrientation()) {
 		// take a copy of the original pixels
 		nWidth = m_nOrigWidth;
 		nHeight = m_nOrigHeight;
-		if (m_nOriginalChannels == 3) {
+		if (m_nOriginalChannels == 1) {
+			pPixels = CBasicProcessing::Convert1To4Channels(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels);
+		} else if (m_nOriginalChannels == 3) {
 			pPixels = CBasicProcessing::Convert3To4Channels(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels);
 		} else {
 			int nSizeBytes = m_nOrigWidth*m_nOrigHeight*4;
@@ -1495,8 +1879,14 @@ CJPEGImage* CJPEGImage::CreateThumbnailImage() {
 		nWidth = psiSize.cx;
 		nHeight = psiSize.cy;
 		pPixels = m_pLDC->GetPSImageAsDIB();
+		bFromLDC = true;
+	}
+	CJPEGImage* pThumbnail = new CJPEGImage(nWidth, nHeight, pPixels, NULL, 4, -1, IF_CLIPBOARD, false, 0, 1, 0, m_pLDC, true);
+	if (!bFromLDC) {
+		// the point sampled image of the LDC has already been transformed with the LUT
+		pThumbnail->SetColorLUT3D(ICCProfileTransform::CopyLUT3D(m_pColorLUT3D));
 	}
-	return new CJPEGImage(nWidth, nHeight, pPixels, NULL, 4, -1, IF_CLIPBOARD, false, 0, 1, 0, m_pLDC, true);
+	return pThumbnail;
 }
 
 void CJPEGImage::DrawGridLines(void * pDIB, const CSize& dibSize) {
@@ -1,8 +1,11 @@
 #pragma once
 
 #include "ProcessParams.h"
+#include "BasicProcessing.h"
+#include "OverscanThread.h"
 
 class CHistogram;
+class CTileHistograms;
 class CLocalDensityCorr;
 class CEXIFReader;
 class CRawMetadata;
@@ -18,6 +21,7 @@ struct CDimRect {
 
 // Class holding a decoded image (not just JPEG - any supported format) and its meta data (if available).
 class CJPEGImage {
+	friend class COverscanThread;
 public:
 	// Ownership of memory in pPixels goes to class, accessing this pointer after the constructor has been called
 	// may causes access violations (use OriginalPixels() instead).
@@ -110,7 +114,7 @@ public:
 	bool ApplyUnsharpMaskToOriginalPixels(const CUnsharpMaskParams & unsharpMaskParams);
 
 	// Mirrors the image horizontally or vertically.
-	// Applies to original pixels!
+	// The mirroring is kept pending and applied while resampling, see OriginalPixels().
 	bool Mirror(bool bHorizontally);
 
 	// Crops the image. 
@@ -118,7 +122,7 @@ public:
 	bool Crop(CRect cropRect);
 
 	// Rotate the image clockwise by 90, 180 or 270 degrees. All other angles are invalid.
-	// Applies to original pixels!
+	// The rotation is kept pending and applied while resampling, see OriginalPixels().
 	bool Rotate(int nRotation);
 
 	// Rotate original pixels by given angle (in radians). The original pixels are replaced by this operation.
@@ -197,13 +201,21 @@ public:
 	// Returns if this image has been processed in a way not supported to be stored in the parameter DB.
 	bool IsProcessedNoParamDB() { return m_bIsProcessedNoParamDB; }
 
-	// raw access to original pixels - do not delete or store the returned pointer
-	void* OriginalPixels() { return  m_pOrigPixels; }
-	const void* OriginalPixels() const { return m_pOrigPixels; }
+	// raw access to original pixels - do not delete or store the returned pointer.
+	// A pending rotation or mirroring (see Rotate() and Mirror()) is applied to the original pixels first, returns NULL if this fails.
+	void* OriginalPixels() { return ApplyPendingOrientation() ? m_pOrigPixels : NULL; }
+	// raw access to the original pixels as stored, without applying the pending rotation and mirroring.
+	// Use OriginalPixelOffset() to address a pixel.
+	const void* StoredOriginalPixels() const { return m_pOrigPixels; }
+	// Size of StoredOriginalPixels(), width and height are swapped compared to OrigSize() if a 90 or 270 degrees rotation is pending
+	CSize StoredOrigSize() const;
+	// Gets the offset in bytes of the pixel (nX, nY) in StoredOriginalPixels(), with (nX, nY) given in the orientation
+	// of the image (see OrigSize())
+	int OriginalPixelOffset(int nX, int nY) const;
 	// remove original pixels from class - OriginalPixels() will return NULL afterwards
 	void DetachOriginalPixels() { m_pOrigPixels = NULL; }
 
-	// returns the number of channels in the OriginalPixels (3 or 4, corresponding to 24 bpp and 32 bpp)
+	// returns the number of channels in the OriginalPixels (1, 3 or 4, corresponding to 8 bpp gray, 24 bpp and 32 bpp)
 	int OriginalChannels() const { return m_nOriginalChannels; }
 
 	// raw access to DIB pixels with no LUT applied - do not delete or store the returned pointer
@@ -318,6 +330,21 @@ public:
 	// Gets the metadata for RAW camera images, NULL if none
 	CRawMetadata* GetRawMetadata() { return m_pRawMetadata; }
 
+	// Sets the 3D LUT of the deferred color transform of the embedded color profile, takes ownership of the LUT.
+	// If set, the original pixels are in the color space of the embedded profile and the LUT is applied to the resampled pixels.
+	// Histogram, pixel hash and LDC are taken from the pixels transformed with the exact color transform the LUT has been
+	// compiled from, so they are the same as without deferring. Takes ownership of a reference to the transform, may be NULL.
+	void SetColorLUT3D(uint8* pLUT, void* pColorTransform = NULL);
+	bool HasColorLUT3D() const { return m_pColorLUT3D != NULL; }
+	const uint8* GetColorLUT3D() const { return m_pColorLUT3D; }
+	void* GetColorTransform() const { return m_pColorTransform; }
+
+	// Sets if the unprocessed DIB shall be kept after resampling, this is only worth when the processing parameters
+	// are likely to change (e.g. while the image processing sliders are visible). If not kept, LUTs and LDC are
+	// applied while resampling, saving a pass over the DIB. The unprocessed DIB is always kept after the processing
+	// parameters of the image have been changed once (e.g. with the keyboard).
+	void SetKeepUnprocessedDIB(bool bKeep) { m_bKeepUnprocessedDIB = bKeep; }
+
 	// Converts the target offset from 'center of image' based format to pixel coordinate format 
 	static CPoint ConvertOffset(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset);
 
@@ -347,7 +374,8 @@ private:
 	};
 
 	// Original pixel data - only rotations and crop are done directly on this data because this is non-destructive
-	// The data is not modified in all other cases
+	// The data is not modified in all other cases. 90 degrees rotations and mirroring are kept pending until the
+	// original pixels are needed in the rotated orientation (see m_nPendingRotation)
 	void* m_pOrigPixels;
 	void* m_pEXIFData;
 	CRawMetadata* m_pRawMetadata;
@@ -358,6 +386,7 @@ private:
 	int m_nInitOrigWidth, m_nInitOrigHeight; // original width of image when constructed (before any rotation and crop)
 	int m_nOriginalChannels;
 	__int64 m_nPixelHash;
+	bool m_bPixelHashFromLDC; // no JPEG hash available, the pixel hash is the hash of the LDC
 	EImageFormat m_eImageFormat;
 	TJSAMP m_eJPEGChromoSampling;
 
@@ -370,6 +399,10 @@ private:
 	// cached thumbnail image, created on first request
 	CJPEGImage* m_pThumbnail;
 
+	// 3D LUT transforming the original pixels to sRGB, NULL if the original pixels are sRGB
+	uint8* m_pColorLUT3D;
+	void* m_pColorTransform; // the transform m_pColorLUT3D has been compiled from, NULL if not available
+
 	// thumbnail image for histogram of the processed image
 	// this thumbnail is needed because not the whole image is processed, only the visible section,
 	// however the histogram must be calculated over the whole processed image
@@ -379,6 +412,9 @@ private:
 	bool m_bIsThumbnailImage;
 	CHistogram* m_pCachedProcessedHistogram;
 
+	// histograms of tiles of the stored original pixels for the auto contrast correction of the visible section, created when needed
+	CTileHistograms* m_pTileHistograms;
+
 	// Processed data of size m_ClippingSize, with LUT/LDC applied and without
 	// The version without LUT/LDC is used to efficiently reapply a different LUT/LDC
 	// Size of the DIBs is m_ClippingSize
@@ -386,6 +422,14 @@ private:
 	void* m_pDIBPixels;
 	void* m_pLastDIB; // one of the pointers above
 
+	// Unprocessed pixels of a section around the visible area, resampled in the background on the overscan thread.
+	// The newly visible areas when panning are copied from this section if contained. While m_pOverscanRequest
+	// is not NULL, the thread reads the original pixels and the section, the original pixels and orientation must
+	// not be changed and the section not be freed without calling DiscardOverscan() before.
+	COverscanSection m_overscan;
+	COverscanRequest* m_pOverscanRequest;
+	CPoint m_panDirection; // sign of the last pan in x and y, the overscan margin is larger in this direction
+
 	// Cached gray and smoothed gray image for unsharp masking
 	int16* m_pGrayImage;
 	int16* m_pSmoothGrayImage;
@@ -409,6 +453,8 @@ private:
 	bool m_bIsProcessedNoParamDB;
 	CRotationParams m_rotationParams; // current rotation
 	bool m_bRotationByEXIF; // is the rotation given by EXIF
+	int m_nPendingRotation; // clockwise rotation (0, 90, 180, 270) not yet applied to m_pOrigPixels
+	bool m_bPendingMirror; // horizontal mirroring after m_nPendingRotation, not yet applied to m_pOrigPixels
 
 	// This is the geometry that was requested during last GetDIB() call
 	CSize m_FullTargetSize; 
@@ -425,6 +471,8 @@ private:
 	int m_nNumDimRects;
 	bool m_bEnableDimming;
 	bool m_bShowGrid;
+	bool m_bKeepUnprocessedDIB;
+	bool m_bProcessingParamsChanged; // the LUT or LDC parameters have been changed after the image was shown
 
 	double m_dLastOpTickCount;
 	double m_dLoadTickCount;
@@ -453,9 +501,30 @@ private:
 		CSize clippingSize, CPoint targetOffset, CRect oldClippingRect,
 		EProcessingFlags eProcFlags, const CImageProcessingParams & imageProcParams, double dRotation, EResizeType eResizeType);
 
+	// Same as Resample() without corrections, but copies the pixels from the overscan section if possible
+	void* ResampleOrCopyOverscan(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, 
+		EProcessingFlags eProcFlags, double dSharpen, double dRotation, EResizeType eResizeType);
+
+	// Takes the overscan section resampled by the overscan thread if finished
+	void AdoptOverscan();
+
+	// Starts resampling a new overscan section in the background if the margin around the visible area gets too small
+	void UpdateOverscan(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, EProcessingFlags eProcFlags, double dSharpen);
+
+	// Cancels and waits for the background resampling and frees the overscan section
+	void DiscardOverscan();
+
+	// Called on the overscan thread to resample the section of the request
+	void ResampleOverscanSection(COverscanRequest& request);
+
+	// Resamples the given rectangle (full target image coordinates) of the overscan section into the section pixels
+	bool ResampleOverscanRect(const COverscanSection& section, void* pSectionPixels, CRect rect, EResizeType eResizeType);
+
 	// Resample to given target size. Returns resampled DIB
+	// If pCorrections is not NULL, the corrections are applied to the resampled DIB, if possible while resampling.
 	void* Resample(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, 
-		EProcessingFlags eProcFlags, double dSharpen, double dRotation, EResizeType eResizeType);
+		EProcessingFlags eProcFlags, double dSharpen, double dRotation, EResizeType eResizeType,
+		const CBasicProcessing::Corrections* pCorrections = NULL);
 
 	// Resize to given target size. Returns resampled DIB. Used when resizing original pixels.
 	void* InternalResize(void* pixels, int channels, EResizeFilter filter, CSize targetSize, CSize sourceSize);
@@ -468,9 +537,12 @@ private:
 	// If bOnlyCheck is set to true, the method does nothing but only checks if the existing processed DIB
 	// can be used (return != NULL) or not (return == NULL)
 	// The out parameter bParametersChanged returns if one of the parameters relevant for image processing has been changed since the last call
+	// If bResampleSource is true, pSourceDIB is not used but the original image is resampled, applying LUTs and LDC while resampling.
+	// NULL is returned in this case if neither LUTs nor LDC must be applied.
 	void* ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageProcParams, EProcessingFlags eProcFlags,
 		void * & pCachedTargetDIB, CSize fullTargetSize, CPoint targetOffset, 
-		void * pSourceDIB, CSize dibSize, bool bGeometryChanged, bool bOnlyCheck, bool bCanTakeOwnershipOfSourceDIB, bool &bParametersChanged);
+		void * pSourceDIB, CSize dibSize, bool bGeometryChanged, bool bOnlyCheck, bool bCanTakeOwnershipOfSourceDIB, bool &bParametersChanged,
+		bool bResampleSource = false);
 
 	void* ApplyCorrectionLUTandLDC(const CImageProcessingParams & imageProcParams, EProcessingFlags eProcFlags,
 		void * & pCachedTargetDIB, CSize fullTargetSize, CPoint targetOffset, 
@@ -483,6 +555,13 @@ private:
 	// makes sure that the input image (m_pOrigPixels) is a 4 channel BGRA image (converts if necessary)
 	bool ConvertSrcTo4Channels();
 
+	// Rotates and mirrors m_pOrigPixels by the pending rotation and mirroring. The DIBs stay valid.
+	bool ApplyPendingOrientation();
+
+	// Maps the pixel position pt in an image of the given size (original image or full target image) to the position
+	// in the same image before applying the pending rotation and mirroring
+	CPoint ToStoredOrientation(CPoint pt, CSize size) const;
+
 	// Gets the processing flags according to the inclusion/exclusion list in INI file
 	EProcessingFlags GetProcFlagsIncludeExcludeFolders(LPCTSTR sFileName, EProcessingFlags procFlags) const;
 
@@ -501,8 +580,13 @@ private:
 	// Sets the m_bIsDestructivelyProcessed flag to true and resets rotation
 	void MarkAsDestructivelyProcessed();
 
-	// Called when the original pixels have changed (rotate, crop, unsharp mask), all cached pixel data gets invalid
-	void InvalidateAllCachedPixelData();
+	// Called when the original pixels have changed (rotate, crop, unsharp mask), all cached pixel data gets invalid.
+	// bOnlyOrientationChanged is set for a pending rotation or mirroring, the stored original pixels do not change then
+	// and the LDC object has been rotated or mirrored with the image.
+	void InvalidateAllCachedPixelData(bool bOnlyOrientationChanged = false);
+
+	// Creates the histogram of the visible section of the original image, NULL if not possible
+	CHistogram* CreateSectionHistogram();
 
 	// Create a thumbnail image of this image
 	CJPEGImage* CreateThumbnailImage();
@@ -7,12 +7,18 @@
 #include "ProcessParams.h"
 #include "BasicProcessing.h"
 
+static const int MAX_ANIMATION_RING_FRAMES = 8; // maximal number of animation frames decoded ahead
+
 CJPEGProvider::CJPEGProvider(HWND handlerWnd, int nNumThreads, int nNumBuffers) {
 	m_hHandlerWnd = handlerWnd;
 	m_nNumThread = nNumThreads;
 	m_nNumBuffers = nNumBuffers;
 	m_nCurrentTimeStamp = 0;
 	m_eOldDirection = FORWARD;
+	m_nAnimationBuffers = 0;
+	m_nAnimationFrameIndex = 0;
+	m_nAnimationNumFrames = 0;
+	m_pAnimationProcessParams = NULL;
 	m_pWorkThreads = new CImageLoadThread*[nNumThreads];
 	for (int i = 0; i < nNumThreads; i++) {
 		m_pWorkThreads[i] = new CImageLoadThread();
@@ -24,6 +30,7 @@ CJPEGProvider::~CJPEGProvider(void) {
 		delete m_pWorkThreads[i];
 	}
 	delete[] m_pWorkThreads;
+	delete m_pAnimationProcessParams;
 	std::list<CImageRequest*>::iterator iter;
 	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
 		delete (*iter)->Image;
@@ -78,10 +85,25 @@ CJPEGImage* CJPEGProvider::RequestImage(CFileList* pFileList, EReadAheadDirectio
 #endif
 	}
 
+	if (pRequest->SkippedOverBudget) {
+		// the read ahead did not load the image because it is too large, load it now as it is requested
+		DeleteElement(pRequest);
+		pRequest = StartRequestAndWaitUntilReady(strFileName, nFrameIndex, processParams);
+	}
+
 	// set before removing unused images!
 	pRequest->InUse = true;
 	pRequest->AccessTimeStamp = m_nCurrentTimeStamp++;
 
+	bool bAnimationFrame = pRequest->Image != NULL && pRequest->Image->IsAnimation() && eDirection == FORWARD;
+	if (bAnimationFrame) {
+		StartAnimationReadAhead(pRequest, processParams);
+	} else if (m_nAnimationBuffers > 0) {
+		// animation left, the frames read ahead are no longer needed
+		StopAnimationReadAhead();
+		bRemoveAlsoActiveRequests = true;
+	}
+
 	if (pRequest->OutOfMemory) {
 		// The request could not be satisfied because the system is out of memory.
 		// Clear all memory and try again - maybe some readahead requests can be deleted
@@ -100,7 +122,11 @@ CJPEGImage* CJPEGProvider::RequestImage(CFileList* pFileList, EReadAheadDirectio
 	ClearOldestInactiveRequest();
 
 	// check if we shall start new requests (don't start another request if we are short of memory!)
-	if (m_requestList.size() < (unsigned int)m_nNumBuffers && !bDirectionChanged && !bWasOutOfMemory && eDirection != NONE) {
+	if (bAnimationFrame) {
+		if (!bWasOutOfMemory) {
+			ContinueAnimationReadAhead();
+		}
+	} else if (m_requestList.size() < (unsigned int)m_nNumBuffers && !bDirectionChanged && !bWasOutOfMemory && eDirection != NONE) {
 		StartNewRequestBundle(pFileList, eDirection, processParams, m_nNumThread, pRequest);
 	}
 
@@ -124,6 +150,7 @@ void CJPEGProvider::NotifyNotUsed(CJPEGImage* pImage) {
 }
 
 void CJPEGProvider::ClearAllRequests() {
+	StopAnimationReadAhead();
 	std::list<CImageRequest*>::iterator iter;
 	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
 		if (ClearRequest((*iter)->Image)) {
@@ -158,6 +185,22 @@ void CJPEGProvider::FileHasRenamed(LPCTSTR sOldFileName, LPCTSTR sNewFileName) {
 	}
 }
 
+void CJPEGProvider::FileChangedOnDisk(LPCTSTR sFileName) {
+	std::list<CImageRequest*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		CImageRequest* pRequest = *iter;
+		if (!pRequest->InUse && !pRequest->Deleted && _tcsicmp(sFileName, pRequest->FileName) == 0) {
+			if (pRequest->Ready) {
+				DeleteElementAt(iter);
+				FileChangedOnDisk(sFileName); // removed from iteration, restart iteration
+				break;
+			} else {
+				pRequest->Deleted = true; // deleted when loading has finished
+			}
+		}
+	}
+}
+
 bool CJPEGProvider::ClearRequest(CJPEGImage* pImage, bool releaseLockedFile) {
 	if (pImage == NULL) {
 		return false;
@@ -193,6 +236,9 @@ void CJPEGProvider::OnImageLoadCompleted(int nHandle) {
 			break;
 		}
 	}
+	if (m_nAnimationBuffers > 0) {
+		ContinueAnimationReadAhead();
+	}
 }
 
 CJPEGProvider::CImageRequest* CJPEGProvider::FindRequest(LPCTSTR strFileName, int nFrameIndex) {
@@ -217,6 +263,10 @@ void CJPEGProvider::StartNewRequestBundle(CFileList* pFileList, EReadAheadDirect
 	if (nNumRequests == 0 || pFileList == NULL) {
 		return;
 	}
+	// Read ahead may use a quarter of the available memory, images above are decoded when requested.
+	// This prevents that a read ahead of a huge image pushes out the visible image or fails with out of memory.
+	// The image size is probed by the loading thread, not here, to keep file access away from the GUI thread.
+	unsigned __int64 nReadAheadBudget = GetReadAheadMemoryBudget();
 	for (int i = 0; i < nNumRequests; i++) {
 		bool bSwitchImage = true;
 		int nFrameIndex = (pLastReadyRequest != NULL) ? Helpers::GetFrameIndex(pLastReadyRequest->Image, eDirection == FORWARD, true, bSwitchImage) : 0;
@@ -226,15 +276,16 @@ void CJPEGProvider::StartNewRequestBundle(CFileList* pFileList, EReadAheadDirect
 				// The read ahead threads need this flag to be deleted - we can speculatively process the image with good hit rate
 				CProcessParams paramsCopied = processParams;
 				paramsCopied.ProcFlags = SetProcessingFlag(paramsCopied.ProcFlags, PFLAG_NoProcessingAfterLoad, false);
-				StartNewRequest(sFileName, nFrameIndex, paramsCopied);
+				StartNewRequest(sFileName, nFrameIndex, paramsCopied, nReadAheadBudget);
 			} else {
-				StartNewRequest(sFileName, nFrameIndex, processParams);
+				StartNewRequest(sFileName, nFrameIndex, processParams, nReadAheadBudget);
 			}
 		}
 	}
 }
 
-CJPEGProvider::CImageRequest* CJPEGProvider::StartNewRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams) {
+CJPEGProvider::CImageRequest* CJPEGProvider::StartNewRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams,
+															  unsigned __int64 nMaxDecodedSize) {
 #ifdef DEBUG
 	::OutputDebugString(_T("Start new request: ")); ::OutputDebugString(sFileName); ::OutputDebugString(_T("\n"));
 #endif
@@ -242,7 +293,7 @@ CJPEGProvider::CImageRequest* CJPEGProvider::StartNewRequest(LPCTSTR sFileName,
 	m_requestList.push_back(pRequest);
 	pRequest->HandlingThread = SearchThreadForNewRequest();
 	pRequest->Handle = pRequest->HandlingThread->AsyncLoad(pRequest->FileName, nFrameIndex,
-		processParams, m_hHandlerWnd, pRequest->EventFinished);
+		processParams, m_hHandlerWnd, pRequest->EventFinished, nMaxDecodedSize);
 	return pRequest;
 }
 
@@ -255,6 +306,7 @@ void CJPEGProvider::GetLoadedImageFromWorkThread(CImageRequest* pRequest) {
 		pRequest->Image = imageData.Image;
 		pRequest->OutOfMemory = imageData.IsRequestFailedOutOfMemory;
 		pRequest->ExceptionError = imageData.IsRequestFailedException;
+		pRequest->SkippedOverBudget = imageData.IsRequestSkippedOverBudget;
 		pRequest->Ready = true;
 		pRequest->HandlingThread = NULL;
 	}
@@ -312,7 +364,7 @@ void CJPEGProvider::RemoveUnusedImages(bool bRemoveAlsoActiveRequests) {
 		}
 		nTimeStampToRemove = -2;
 		// Make one buffer free for next readahead (except when bRemoveAlsoActiveRequests)
-		int nMaxListSize = bRemoveAlsoActiveRequests ? (unsigned int)m_nNumBuffers : (unsigned int)m_nNumBuffers - 1;
+		int nMaxListSize = bRemoveAlsoActiveRequests ? GetNumBuffers() : GetNumBuffers() - 1;
 		if (m_requestList.size() > (unsigned int)nMaxListSize) {
 			// remove element with smallest timestamp
 			if (nSmallestTimeStamp < INT_MAX) {
@@ -324,14 +376,14 @@ void CJPEGProvider::RemoveUnusedImages(bool bRemoveAlsoActiveRequests) {
 }
 
 void CJPEGProvider::ClearOldestInactiveRequest() {
-	if (m_requestList.size() >= (unsigned int)m_nNumBuffers) {
+	if (m_requestList.size() >= (unsigned int)GetNumBuffers()) {
 		int nFirstHandle = INT_MAX;
 		CImageRequest* pFirstRequest = NULL;
 		std::list<CImageRequest*>::iterator iter;
 		for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
 			if ((*iter)->IsActive) {
 				// mark very old requests for removal
-				if (CImageLoadThread::GetCurHandleValue() - (*iter)->Handle > m_nNumBuffers) {
+				if (CImageLoadThread::GetCurHandleValue() - (*iter)->Handle > GetNumBuffers()) {
 					(*iter)->IsActive = false;
 				}
 				if ((*iter)->Handle < nFirstHandle) {
@@ -359,6 +411,63 @@ void CJPEGProvider::DeleteElement(CImageRequest* pRequest) {
 	m_requestList.remove(pRequest);
 }
 
+unsigned __int64 CJPEGProvider::GetReadAheadMemoryBudget() {
+	MEMORYSTATUSEX memoryStatus;
+	memoryStatus.dwLength = sizeof(MEMORYSTATUSEX);
+	if (!::GlobalMemoryStatusEx(&memoryStatus)) {
+		return _UI64_MAX;
+	}
+	return min(memoryStatus.ullAvailPhys, memoryStatus.ullAvailVirtual) / 4;
+}
+
+void CJPEGProvider::StartAnimationReadAhead(CImageRequest* pRequest, const CProcessParams & processParams) {
+	CJPEGImage* pImage = pRequest->Image;
+	if (m_nAnimationBuffers == 0 || _tcsicmp(m_sAnimationFileName, pRequest->FileName) != 0) {
+		// size the ring by the memory of a frame, the original pixels and the processed DIB are kept per frame
+		unsigned __int64 nFrameSize = ((unsigned __int64)pImage->OrigWidth() * pImage->OrigHeight() +
+			(unsigned __int64)processParams.TargetWidth * processParams.TargetHeight) * 4;
+		unsigned __int64 nFramesInBudget = GetReadAheadMemoryBudget() / max((unsigned __int64)1, nFrameSize);
+		int nRingSize = (int)min((unsigned __int64)MAX_ANIMATION_RING_FRAMES, nFramesInBudget);
+		m_nAnimationBuffers = max(1, min(nRingSize, pImage->NumberOfFrames() - 1));
+		m_sAnimationFileName = pRequest->FileName;
+		m_nAnimationNumFrames = pImage->NumberOfFrames();
+	}
+	m_nAnimationFrameIndex = pRequest->FrameIndex;
+	// The read ahead threads need this flag to be deleted, the frames are displayed without further processing
+	delete m_pAnimationProcessParams;
+	m_pAnimationProcessParams = new CProcessParams(processParams);
+	m_pAnimationProcessParams->ProcFlags = SetProcessingFlag(processParams.ProcFlags, PFLAG_NoProcessingAfterLoad, false);
+}
+
+void CJPEGProvider::StopAnimationReadAhead() {
+	m_nAnimationBuffers = 0;
+	m_sAnimationFileName.Empty();
+	delete m_pAnimationProcessParams;
+	m_pAnimationProcessParams = NULL;
+}
+
+void CJPEGProvider::ContinueAnimationReadAhead() {
+	if (m_pAnimationProcessParams == NULL) {
+		return;
+	}
+	// only one frame in work at a time, the decoders compose the frames in sequence
+	std::list<CImageRequest*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		if (!(*iter)->Ready && _tcsicmp((*iter)->FileName, m_sAnimationFileName) == 0) {
+			return;
+		}
+	}
+	for (int i = 1; i <= m_nAnimationBuffers; i++) {
+		int nFrameIndex = (m_nAnimationFrameIndex + i) % m_nAnimationNumFrames;
+		if (FindRequest(m_sAnimationFileName, nFrameIndex) == NULL) {
+			if (m_requestList.size() < (unsigned int)GetNumBuffers()) {
+				StartNewRequest(m_sAnimationFileName, nFrameIndex, *m_pAnimationProcessParams);
+			}
+			return;
+		}
+	}
+}
+
 bool CJPEGProvider::IsDestructivelyProcessed(CJPEGImage* pImage) {
 	return pImage != NULL && pImage->IsDestructivelyProcessed();
 }
\ No newline at end of file
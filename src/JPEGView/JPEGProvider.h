@@ -63,6 +63,10 @@ public:
 	// Tells the provider that a file has been renamed externally so that pending requests to read this file can be updated.
 	void FileHasRenamed(LPCTSTR sOldFileName, LPCTSTR sNewFileName);
 
+	// Tells the provider that a file has been modified or deleted on disk. Cached images of this file that are not
+	// in use are removed, all other cached images stay valid.
+	void FileChangedOnDisk(LPCTSTR sFileName);
+
 	// Must be called by the message handler window (see constructor) when the WM_IMAGE_LOAD_COMPLETED
 	// message was received.
 	void OnImageLoadCompleted(int nHandle);
@@ -80,6 +84,7 @@ private:
 		bool IsActive; // true if this request is active (i.e. requested but not ready or ready and in use).
 		bool OutOfMemory; // true if the image failed loading due to out of memory
 		bool ExceptionError; // true if the image failed loading due to an unhandled exception
+		bool SkippedOverBudget; // true if the read ahead has been skipped because the image exceeds the memory budget
 		int AccessTimeStamp; // LRU handling
 		CImageLoadThread* HandlingThread; // thread that is loading the image, NULL when image is ready
 		HANDLE EventFinished; // event fired when image has finished loading
@@ -95,6 +100,7 @@ private:
 			IsActive = true;
 			OutOfMemory = false;
 			ExceptionError = false;
+			SkippedOverBudget = false;
 			AccessTimeStamp = -1;
 			HandlingThread = NULL;
 			EventFinished = ::CreateEvent(NULL, TRUE, FALSE, NULL);
@@ -114,16 +120,30 @@ private:
 	int m_nCurrentTimeStamp;
 	EReadAheadDirection m_eOldDirection;
 
+	// Frame ring of animations: The frames following the displayed frame are decoded and processed ahead, one frame
+	// after the other, until m_nAnimationBuffers frames are ready. Only one frame is in work at a time so that
+	// requests for other images do not have to wait for a whole queue of frames.
+	int m_nAnimationBuffers; // number of additional buffers used for the frame ring, 0 if no animation is played
+	CString m_sAnimationFileName;
+	int m_nAnimationFrameIndex; // frame index of the displayed frame
+	int m_nAnimationNumFrames;
+	CProcessParams* m_pAnimationProcessParams; // parameters to process the frames read ahead
+
 	bool WaitForAsyncRequest(int nHandle, int nMessage);
 	void GetLoadedImageFromWorkThread(CImageRequest* pRequest);
 	CImageLoadThread* SearchThreadForNewRequest(void);
 	void RemoveUnusedImages(bool bRemoveAlsoReadAhead);
 	CImageRequest* StartRequestAndWaitUntilReady(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams);
-	CImageRequest* StartNewRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams);
+	CImageRequest* StartNewRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams, unsigned __int64 nMaxDecodedSize = 0);
 	void StartNewRequestBundle(CFileList* pFileList, EReadAheadDirection eDirection, const CProcessParams & processParams, int nNumRequests, CImageRequest* pLastReadyRequest);
 	CImageRequest* FindRequest(LPCTSTR strFileName, int nFrameIndex);
 	void ClearOldestInactiveRequest();
 	void DeleteElementAt(std::list<CImageRequest*>::iterator iteratorAt); // also deletes the request and the image in the request
 	void DeleteElement(CImageRequest* pRequest);
 	bool IsDestructivelyProcessed(CJPEGImage* pImage);
+	static unsigned __int64 GetReadAheadMemoryBudget();
+	int GetNumBuffers() const { return m_nNumBuffers + m_nAnimationBuffers; }
+	void StartAnimationReadAhead(CImageRequest* pRequest, const CProcessParams & processParams);
+	void StopAnimationReadAhead();
+	void ContinueAnimationReadAhead();
 };
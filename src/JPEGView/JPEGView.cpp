@@ -6,6 +6,8 @@
 #include "resource.h"
 #include "MainDlg.h"
 #include "SettingsProvider.h"
+#include "BufferPool.h"
+#include "LocalDensityCorr.h"
 
 #ifdef DEBUG
 #include <dbghelp.h>
@@ -86,6 +88,10 @@ static bool ParseCommandLineForAutoExit(LPCTSTR sCommandLine) {
 	return Helpers::stristr(sCommandLine, _T("/autoexit")) != NULL;
 }
 
+static bool ParseCommandLineForSelfTest(LPCTSTR sCommandLine) {
+	return Helpers::stristr(sCommandLine, _T("/selftest")) != NULL;
+}
+
 static int ParseCommandLineForDisplayMonitor(LPCTSTR sCommandLine) {
 	LPCTSTR sMonitor = Helpers::stristr(sCommandLine, _T("/monitor"));
 	if (sMonitor == NULL) {
@@ -106,7 +112,8 @@ static Helpers::ESorting ParseCommandLineForSorting(LPCTSTR sCommandLine) {
 			(_totupper(sSortingMode[1]) == _T('C')) ? Helpers::FS_CreationTime :
 			(_totupper(sSortingMode[1]) == _T('N')) ? Helpers::FS_FileName :
 			(_totupper(sSortingMode[1]) == _T('Z')) ? Helpers::FS_Random :
-			(_totupper(sSortingMode[1]) == _T('S')) ? Helpers::FS_FileSize : Helpers::FS_Undefined;
+			(_totupper(sSortingMode[1]) == _T('S')) ? Helpers::FS_FileSize :
+			(_totupper(sSortingMode[1]) == _T('E')) ? Helpers::FS_CaptureTime : Helpers::FS_Undefined;
 	}
 	return Helpers::FS_Undefined; 
 }
@@ -202,6 +209,17 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR lp
 	hRes = _Module.Init(NULL, hInstance);
 	ATLASSERT(SUCCEEDED(hRes));
 
+	// Self test: checks that the point sampling of the LDC still produces the pixel hashes of the existing image DBs
+	if (ParseCommandLineForSelfTest(lpstrCmdLine)) {
+		CBufferPool::This();
+		CString sReport;
+		bool bPassed = CLocalDensityCorr::SelfTest(sReport);
+		::MessageBox(NULL, sReport, _T("JPEGView self test"), MB_OK | (bPassed ? MB_ICONINFORMATION : MB_ICONERROR));
+		_Module.Term();
+		::CoUninitialize();
+		return bPassed ? 0 : 1;
+	}
+
 	CString sStartupFile = ParseCommandLineForStartupFile(lpstrCmdLine);
 	int nAutostartSlideShow = (sStartupFile.GetLength() == 0) ? 0 : ParseCommandLineForAutostart(lpstrCmdLine);
 	bool bForceFullScreen = ParseCommandLineForFullScreen(lpstrCmdLine);
@@ -237,6 +255,9 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR lp
 		ULONG_PTR gdiplusToken;
 		Gdiplus::GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
 
+		// Create the buffer pool before it gets used by the processing threads
+		CBufferPool::This();
+
 		CMainDlg dlgMain(bForceFullScreen);
 
 		dlgMain.SetStartupInfo(sStartupFile, nAutostartSlideShow, eSorting, eTransitionEffect, nTransitionTime, bAutoExit, nDisplayMonitor);
@@ -3,14 +3,13 @@
 #include "JXLWrapper.h"
 #include "jxl/decode.h"
 #include "jxl/decode_cxx.h"
-#include "jxl/resizable_parallel_runner.h"
-#include "jxl/resizable_parallel_runner_cxx.h"
 #include "MaxImageDef.h"
 #include "ICCProfileTransform.h"
+#include "ProcessingThreadPool.h"
+#include "BasicProcessing.h"
 
 struct JxlReader::jxl_cache {
 	JxlDecoderPtr decoder;
-	JxlResizableParallelRunnerPtr runner;
 	JxlBasicInfo info;
 	uint8_t* data;
 	size_t data_size;
@@ -23,14 +22,35 @@ struct JxlReader::jxl_cache {
 
 JxlReader::jxl_cache JxlReader::cache = { 0 };
 
+struct JxlRunContext {
+	void* jpegxl_opaque;
+	JxlParallelRunFunction func;
+};
+
+static void JxlRunValue(void* context, int value, int thread_index) {
+	JxlRunContext* run_context = (JxlRunContext*)context;
+	run_context->func(run_context->jpegxl_opaque, (uint32_t)value, (size_t)thread_index);
+}
+
+// Parallel runner using the threads of the processing thread pool instead of creating own threads,
+// this way decoding does not compete with image processing for the CPU cores
+static JxlParallelRetCode JxlThreadPoolRunner(void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init,
+	JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range) {
+	JxlParallelRetCode ret = init(jpegxl_opaque, CProcessingThreadPool::This().GetNumberOfThreads());
+	if (ret != 0) {
+		return ret;
+	}
+	JxlRunContext run_context = { jpegxl_opaque, func };
+	CProcessingThreadPool::This().ParallelFor((int)start_range, (int)end_range, &run_context, JxlRunValue);
+	return 0;
+}
+
 // based on https://github.com/libjxl/libjxl/blob/main/examples/decode_oneshot.cc
 // and https://github.com/libjxl/libjxl/blob/main/examples/decode_exif_metadata.cc
 bool JxlReader::DecodeJpegXlOneShot(const uint8_t* jxl, size_t size, std::vector<uint8_t>* pixels, int& xsize,
 	int& ysize, bool& have_animation, int& frame_count, int& frame_time, std::vector<uint8_t>* icc_profile, bool& outOfMemory) {
 
 	if (cache.decoder.get() == NULL) {
-		cache.runner = JxlResizableParallelRunnerMake(nullptr);
-
 		cache.decoder = JxlDecoderMake(nullptr);
 		if (JXL_DEC_SUCCESS !=
 			JxlDecoderSubscribeEvents(cache.decoder.get(), JXL_DEC_BASIC_INFO |
@@ -46,8 +66,8 @@ bool JxlReader::DecodeJpegXlOneShot(const uint8_t* jxl, size_t size, std::vector
 		}
 
 		if (JXL_DEC_SUCCESS != JxlDecoderSetParallelRunner(cache.decoder.get(),
-			JxlResizableParallelRunner,
-			cache.runner.get())) {
+			JxlThreadPoolRunner,
+			NULL)) {
 			return false;
 		}
 
@@ -81,9 +101,6 @@ bool JxlReader::DecodeJpegXlOneShot(const uint8_t* jxl, size_t size, std::vector
 				outOfMemory = true;
 				return false;
 			}
-			JxlResizableParallelRunnerSetThreads(
-				cache.runner.get(),
-				JxlResizableParallelRunnerSuggestThreads(info.xsize, info.ysize));
 		} else if (status == JXL_DEC_COLOR_ENCODING) {
 			// Get the ICC color profile of the pixel data
 			size_t icc_size;
@@ -207,11 +224,7 @@ void* JxlReader::ReadImage(int& width,
 	if (cache.transform == NULL)
 		cache.transform = ICCProfileTransform::CreateTransform(icc_profile.data(), icc_profile.size(), ICCProfileTransform::FORMAT_RGBA);
 	if (!ICCProfileTransform::DoTransform(cache.transform, pixels.data(), pPixelData, width, height)) {
-		// RGBA -> BGRA conversion (with little-endian integers)
-		uint32_t* data = (uint32_t*)pixels.data();
-		for (size_t i = 0; i * sizeof(uint32_t) < size; i++) {
-			((uint32_t*)pPixelData)[i] = _rotr(_byteswap_ulong(data[i]), 8);
-		}
+		CBasicProcessing::ConvertRGBAToBGRA(width, height, width * 4, pixels.data(), pPixelData);
 	}
 
 	// Copy Exif data into the format understood by CEXIFReader
@@ -233,6 +246,6 @@ void* JxlReader::ReadImage(int& width,
 void JxlReader::DeleteCache() {
 	free(cache.data);
 	ICCProfileTransform::DeleteTransform(cache.transform);
-	// Setting the decoder and runner to 0 (NULL) will automatically destroy them
+	// Setting the decoder to 0 (NULL) will automatically destroy it
 	cache = { 0 };
 }
@@ -3,6 +3,9 @@
 #include "HistogramCorr.h"
 #include "JPEGImage.h"
 #include "Helpers.h"
+#include "ProcessingThreadPool.h"
+#include "ICCProfileTransform.h"
+#include "BasicProcessing.h"
 #include <math.h>
 #include <assert.h>
 
@@ -10,6 +13,71 @@
 // static helpers
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+// Number of rows of the point sampled image sampled by one thread pool task
+#define SAMPLING_ROWS_PER_BLOCK 16
+
+// Point sampling of the original pixels, done in parallel on blocks of rows of the point sampled image
+struct CPointSampling {
+	const uint8* SourcePixels;
+	const int* ColumnOffsets; // offset in the stored image of the sampled pixels, for each column
+	const int* RowOffsets; // and for each row
+	int OffsetG, OffsetR;
+	uint16* SampledImage;
+	int Width, Height; // size of the point sampled image
+};
+
+static void SampleRowBlock(void* pContext, int nBlock, int /* nThreadIndex */) {
+	const CPointSampling& sampling = *(const CPointSampling*)pContext;
+	int nFirstRow = nBlock * SAMPLING_ROWS_PER_BLOCK;
+	int nLastRow = min(sampling.Height, nFirstRow + SAMPLING_ROWS_PER_BLOCK);
+	int nWidth = sampling.Width;
+	for (int j = nFirstRow; j < nLastRow; j++) {
+		const uint8* pSourceRow = sampling.SourcePixels + sampling.RowOffsets[j];
+		uint16* pSubSampImage = sampling.SampledImage + j*nWidth*3;
+		for (int i = 0; i < nWidth; i++) {
+			const uint8* pSrc = pSourceRow + sampling.ColumnOffsets[i];
+			pSubSampImage[0] = pSrc[0];
+			pSubSampImage[nWidth] = pSrc[sampling.OffsetG];
+			pSubSampImage[nWidth*2] = pSrc[sampling.OffsetR];
+			pSubSampImage++;
+		}
+	}
+}
+
+// Point sampling as it was done before the sampling was parallelized, all existing image DBs have been built with the
+// pixel hash of these samples. Gray images were expanded to 32 bpp when loaded then. Used by the self test only.
+static uint16* BaselinePointSampling(const void* pPixels, int nWidth, int nHeight, int nChannels, int nPSIWidth, int nPSIHeight) {
+	uint32* pExpanded = NULL;
+	if (nChannels == 1) {
+		pExpanded = (uint32*)CBasicProcessing::Convert1To4Channels(nWidth, nHeight, pPixels);
+		pPixels = pExpanded;
+		nChannels = 4;
+	}
+	const uint8* pSourcePixels = (const uint8*)pPixels;
+	uint16* pPointSampledImage = new uint16[nPSIWidth*nPSIHeight*3];
+
+	uint32 nY = 0;
+	uint32 nIncX = (uint32)nWidth*65536/nPSIWidth;
+	uint32 nIncY = (uint32)nHeight*65536/nPSIHeight;
+	int nLineSize = Helpers::DoPadding(nWidth * nChannels, 4);
+	for (int j = 0; j < nPSIHeight; j++) {
+		uint32 nX = 0;
+		const uint8* pSrcStart = pSourcePixels + nLineSize*(nY >> 16);
+		uint16* pSubSampImage = pPointSampledImage + j*nPSIWidth*3;
+		for (int i = 0; i < nPSIWidth; i++) {
+			const uint8* pSrc = (nChannels == 3) ? pSrcStart + (nX >> 16)*3 : pSrcStart + (nX >> 16)*4;
+			pSubSampImage[0] = pSrc[0];
+			pSubSampImage[nPSIWidth] = pSrc[1];
+			pSubSampImage[nPSIWidth*2] = pSrc[2];
+			pSubSampImage++;
+			nX += nIncX;
+		}
+		nY += nIncY;
+	}
+	delete[] pExpanded;
+	return pPointSampledImage;
+}
+
 // Calculates the LDC response LUT used to map mean brightness values to LDC correction
 // values. The curve is piecewise polynominal and has the form of a saddle.
 static void CalculateLDCResponseLUT(uint8* pLUT) {
@@ -74,44 +142,167 @@ CLocalDensityCorr::CLocalDensityCorr(const CJPEGImage & image, bool bFullConstru
 	m_pLDCMapMultiplied = NULL;
 	m_fIsSunset = m_fMiddleGrey = m_fSunsetPixels = -1.0f;
 
-	// LDC also needs the histogram of the image
-	int channelR[256]{ 0 }, channelG[256]{ 0 }, channelB[256]{ 0 };
-	int channelGrey[256]{ 0 };
+	m_dLightenShadows = 0.5;
+	m_dDarkenHighlights = 0.25;
 
 	int nWidth = image.OrigWidth();
 	int nHeight = image.OrigHeight();
-	int nChannels = image.OriginalChannels();
-	const uint8* pSourcePixels = (const uint8*)image.OriginalPixels();
+	// the original pixels may be stored in another orientation, see CJPEGImage::Rotate()
+	const uint8* pSourcePixels = (const uint8*)image.StoredOriginalPixels();
+	// gray images are stored with one channel, B, G and R are the same byte then
+	int nOffsetG = (image.OriginalChannels() == 1) ? 0 : 1;
+	int nOffsetR = (image.OriginalChannels() == 1) ? 0 : 2;
 
 	double dFactor = (double)nWidth/nHeight;
 	m_nPSIWidth  = Helpers::DoPadding((int)(dFactor*sqrt(NUM_VALUES/dFactor)), 4);
 	m_nPSIHeight = Helpers::DoPadding((int)(m_nPSIWidth/dFactor), 4);
 
-	uint32 nY = 0;
 	uint32 nIncX = (uint32)nWidth*65536/m_nPSIWidth;
 	uint32 nIncY = (uint32)nHeight*65536/m_nPSIHeight;
-	int nLineSize = Helpers::DoPadding(nWidth * nChannels, 4);
+
+	// In all orientations the offset of a pixel in the stored image is the sum of an offset depending only on
+	// the column and an offset depending only on the row, so the column offsets are the same for all sampled rows.
+	int nBaseOffset = image.OriginalPixelOffset(0, 0);
+	int* pColumnOffsets = new int[m_nPSIWidth + m_nPSIHeight];
+	int* pRowOffsets = pColumnOffsets + m_nPSIWidth;
+	uint32 nX = 0;
+	for (int i = 0; i < m_nPSIWidth; i++) {
+		pColumnOffsets[i] = image.OriginalPixelOffset(nX >> 16, 0) - nBaseOffset;
+		nX += nIncX;
+	}
+	uint32 nY = 0;
+	for (int j = 0; j < m_nPSIHeight; j++) {
+		pRowOffsets[j] = image.OriginalPixelOffset(0, nY >> 16);
+		nY += nIncY;
+	}
 
 	// The subsampled image has 16 bits per channel and three line interleaved channels B, G, R
 	m_pPointSampledImage = new uint16[m_nPSIWidth*m_nPSIHeight*3];
 
+	// Each sample is a cache miss in a large image, the threads sample blocks of rows in parallel
+	CPointSampling sampling = { pSourcePixels, pColumnOffsets, pRowOffsets, nOffsetG, nOffsetR, m_pPointSampledImage, m_nPSIWidth, m_nPSIHeight };
+	CProcessingThreadPool::This().ParallelFor(0, (m_nPSIHeight + SAMPLING_ROWS_PER_BLOCK - 1) / SAMPLING_ROWS_PER_BLOCK, &sampling, SampleRowBlock);
+	delete[] pColumnOffsets;
+
+	// With deferred color management the original pixels are not in sRGB, the statistics are taken in sRGB
+	TransformSamples(image.GetColorTransform(), image.GetColorLUT3D());
+
+	// histogram, pixel hash, black and white point are all derived from the sampled image
+	CalculateHistogramAndHash();
+
+	if (bFullConstruct) {
+		CreateLDCMap();
+	}
+}
+
+CLocalDensityCorr::~CLocalDensityCorr(void) {
+	delete[] m_pPointSampledImage;
+	m_pPointSampledImage = NULL;
+	delete m_pHistogramm;
+	m_pHistogramm = NULL;
+	delete[] m_pLDCMap;
+	m_pLDCMap = NULL;
+	delete[] m_pLDCMapMultiplied;
+	m_pLDCMapMultiplied = NULL;
+}
+
+void* CLocalDensityCorr::GetPSImageAsDIB() {
+	uint32* pDIBStart = new uint32[m_nPSIWidth*m_nPSIHeight];
+	uint32* pDIB = pDIBStart;
 	for (int j = 0; j < m_nPSIHeight; j++) {
-		uint32 nX = 0;
-		const uint8* pSrcStart = pSourcePixels + nLineSize*(nY >> 16);
-		uint16* pSubSampImage = m_pPointSampledImage + j*m_nPSIWidth*3;
+		uint16* pSrc = m_pPointSampledImage + m_nPSIWidth*j*3;
 		for (int i = 0; i < m_nPSIWidth; i++) {
-			const uint8* pSrc = (nChannels == 3) ? pSrcStart + (nX >> 16)*3 : pSrcStart + (nX >> 16)*4;
-			channelB[pSrc[0]]++;
-			channelG[pSrc[1]]++;
-			channelR[pSrc[2]]++;
-			channelGrey[(pSrc[0]*128 + pSrc[1]*640 + pSrc[2]*256) >> 10]++;
-			pSubSampImage[0] = pSrc[0];
-			pSubSampImage[m_nPSIWidth] = pSrc[1];
-			pSubSampImage[m_nPSIWidth*2] = pSrc[2];
+			*pDIB = (pSrc[m_nPSIWidth*2] << 16) + (pSrc[m_nPSIWidth] << 8) + pSrc[0];
+			pDIB++;
+			pSrc++;
+		}
+	}
+	return pDIBStart;
+}
+
+void CLocalDensityCorr::ApplyColorTransform(void* pTransform, const uint8* pLUT) {
+	if (!TransformSamples(pTransform, pLUT)) {
+		return;
+	}
+	delete m_pHistogramm;
+	m_pHistogramm = NULL;
+	CalculateHistogramAndHash();
+
+	if (m_pLDCMap != NULL) {
+		delete[] m_pLDCMap;
+		m_pLDCMap = NULL;
+		delete[] m_pLDCMapMultiplied;
+		m_pLDCMapMultiplied = NULL;
+		CreateLDCMap();
+	}
+}
+
+void CLocalDensityCorr::VerifyFullyConstructed() {
+	if (m_pLDCMap == NULL) {
+		CreateLDCMap();
+	}
+}
+
+const uint8* CLocalDensityCorr::GetLDCMap() {
+	assert(m_pLDCMap != NULL);
+	if (m_pLDCMapMultiplied == NULL) {
+		m_pLDCMapMultiplied = MultiplyMap(m_dLightenShadows, m_dDarkenHighlights);
+	}
+	return m_pLDCMapMultiplied; 
+}
+
+void CLocalDensityCorr::SetLDCAmount(double dLightenShadows, double dDarkenHighlights) {
+	assert(m_pLDCMap != NULL);
+	m_dLightenShadows = min(1.0, max(0.0, dLightenShadows));
+	m_dDarkenHighlights = min(1.0, max(0.0, dDarkenHighlights));
+	delete[] m_pLDCMapMultiplied;
+	m_pLDCMapMultiplied = MultiplyMap(m_dLightenShadows, m_dDarkenHighlights);
+}
+
+void CLocalDensityCorr::Rotate(int nRotation) {
+	// pixel (i, j) of the rotated image is the pixel at element nStart + i*nStepX + j*nStepY of the sampled image
+	int nLineStep = m_nPSIWidth*3;
+	switch (nRotation) {
+		case 90:
+			TransformSampledImage(m_nPSIHeight, m_nPSIWidth, (m_nPSIHeight - 1)*nLineStep, -nLineStep, 1);
+			break;
+		case 180:
+			TransformSampledImage(m_nPSIWidth, m_nPSIHeight, (m_nPSIHeight - 1)*nLineStep + m_nPSIWidth - 1, -1, -nLineStep);
+			break;
+		case 270:
+			TransformSampledImage(m_nPSIHeight, m_nPSIWidth, m_nPSIWidth - 1, nLineStep, -1);
+			break;
+	}
+}
+
+void CLocalDensityCorr::Mirror(bool bHorizontally) {
+	int nLineStep = m_nPSIWidth*3;
+	if (bHorizontally) {
+		TransformSampledImage(m_nPSIWidth, m_nPSIHeight, m_nPSIWidth - 1, -1, nLineStep);
+	} else {
+		TransformSampledImage(m_nPSIWidth, m_nPSIHeight, (m_nPSIHeight - 1)*nLineStep, 1, -nLineStep);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Private
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+// Calculates histogram, pixel hash and black and white points from the point sampled image
+void CLocalDensityCorr::CalculateHistogramAndHash() {
+	int channelR[256]{ 0 }, channelG[256]{ 0 }, channelB[256]{ 0 };
+	int channelGrey[256]{ 0 };
+
+	for (int j = 0; j < m_nPSIHeight; j++) {
+		const uint16* pSubSampImage = m_pPointSampledImage + j*m_nPSIWidth*3;
+		for (int i = 0; i < m_nPSIWidth; i++) {
+			int nB = pSubSampImage[0], nG = pSubSampImage[m_nPSIWidth], nR = pSubSampImage[m_nPSIWidth*2];
+			channelB[nB]++;
+			channelG[nG]++;
+			channelR[nR]++;
+			channelGrey[(nB*128 + nG*640 + nR*256) >> 10]++;
 			pSubSampImage++;
-			nX += nIncX;
 		}
-		nY += nIncY;
 	}
 
 	// Calculate a CRC over the histograms
@@ -157,61 +348,102 @@ CLocalDensityCorr::CLocalDensityCorr(const CJPEGImage & image, bool bFullConstru
 	m_fWhitePt = (i+1)/255.0f;
 
 	m_pHistogramm = new CHistogram(channelB, channelG, channelR, channelGrey);
-
-	if (bFullConstruct) {
-		CreateLDCMap();
-	}
 }
 
-CLocalDensityCorr::~CLocalDensityCorr(void) {
-	delete[] m_pPointSampledImage;
-	m_pPointSampledImage = NULL;
-	delete m_pHistogramm;
-	m_pHistogramm = NULL;
-	delete[] m_pLDCMap;
-	m_pLDCMap = NULL;
-	delete[] m_pLDCMapMultiplied;
-	m_pLDCMapMultiplied = NULL;
+bool CLocalDensityCorr::SelfTest(CString& sReport) {
+	const int cnChannels[] = { 1, 3, 4 };
+	// odd widths, so that the rows of the 8 and 24 bpp images are padded
+	const CSize cSizes[] = { CSize(641, 479), CSize(1001, 333), CSize(257, 1023), CSize(3, 5) };
+	bool bAllPassed = true;
+	for (int c = 0; c < sizeof(cnChannels)/sizeof(int); c++) {
+		for (int s = 0; s < sizeof(cSizes)/sizeof(CSize); s++) {
+			int nChannels = cnChannels[c];
+			int nWidth = cSizes[s].cx, nHeight = cSizes[s].cy;
+			int nLineSize = Helpers::DoPadding(nWidth * nChannels, 4);
+			uint8* pPixels = new uint8[nLineSize * nHeight];
+			for (int i = 0; i < nLineSize * nHeight; i++) {
+				pPixels[i] = (uint8)rand();
+			}
+			// the image takes ownership of the pixels, its pixel hash is taken from the LDC
+			CJPEGImage* pImage = new CJPEGImage(nWidth, nHeight, pPixels, NULL, nChannels, 0, IF_CLIPBOARD, false, 0, 1, 0);
+			CLocalDensityCorr ldc(*pImage, false);
+			int nNumSamples = ldc.m_nPSIWidth*ldc.m_nPSIHeight*3;
+			uint16* pBaseline = BaselinePointSampling(pPixels, nWidth, nHeight, nChannels, ldc.m_nPSIWidth, ldc.m_nPSIHeight);
+			bool bSamplesEqual = memcmp(pBaseline, ldc.m_pPointSampledImage, nNumSamples*sizeof(uint16)) == 0;
+
+			// the hash is calculated from the samples by the same code as before
+			CLocalDensityCorr baselineLDC(*pImage, false);
+			memcpy(baselineLDC.m_pPointSampledImage, pBaseline, nNumSamples*sizeof(uint16));
+			delete baselineLDC.m_pHistogramm;
+			baselineLDC.CalculateHistogramAndHash();
+			bool bHashEqual = pImage->GetPixelHash() == baselineLDC.GetPixelHash();
+
+			CString sLine;
+			sLine.Format(_T("LDC sampling %d x %d, %d channels: %s\n"), nWidth, nHeight, nChannels,
+				(bSamplesEqual && bHashEqual) ? _T("passed") : (bSamplesEqual ? _T("FAILED (hash)") : _T("FAILED (samples)")));
+			sReport += sLine;
+			bAllPassed = bAllPassed && bSamplesEqual && bHashEqual;
+			delete[] pBaseline;
+			delete pImage;
+		}
+	}
+	return bAllPassed;
 }
 
-void* CLocalDensityCorr::GetPSImageAsDIB() {
-	uint32* pDIBStart = new uint32[m_nPSIWidth*m_nPSIHeight];
-	uint32* pDIB = pDIBStart;
+// Transforms the point sampled image in-place with the given color transform. The statistics and the pixel hash must be the
+// same as when the decoder transforms the pixels, so the 3D LUT is only used if the exact transform is not available.
+// Returns false if there is nothing to transform.
+bool CLocalDensityCorr::TransformSamples(void* pTransform, const uint8* pLUT) {
+	if (pTransform == NULL && pLUT == NULL) {
+		return false;
+	}
+	uint32* pDIB = (uint32*)GetPSImageAsDIB();
+	if (!ICCProfileTransform::TransformBGR0Pixels(pTransform, pDIB, m_nPSIWidth*m_nPSIHeight)) {
+		ICCProfileTransform::ApplyLUT3D(pLUT, pDIB, m_nPSIWidth, m_nPSIHeight);
+	}
+	const uint32* pSrc = pDIB;
 	for (int j = 0; j < m_nPSIHeight; j++) {
-		uint16* pSrc = m_pPointSampledImage + m_nPSIWidth*j*3;
+		uint16* pDst = m_pPointSampledImage + m_nPSIWidth*j*3;
 		for (int i = 0; i < m_nPSIWidth; i++) {
-			*pDIB = (pSrc[m_nPSIWidth*2] << 16) + (pSrc[m_nPSIWidth] << 8) + pSrc[0];
-			pDIB++;
+			pDst[0] = *pSrc & 0xFF;
+			pDst[m_nPSIWidth] = (*pSrc >> 8) & 0xFF;
+			pDst[m_nPSIWidth*2] = (*pSrc >> 16) & 0xFF;
+			pDst++;
 			pSrc++;
 		}
 	}
-	return pDIBStart;
+	delete[] pDIB;
+	return true;
 }
 
-void CLocalDensityCorr::VerifyFullyConstructed() {
-	if (m_pLDCMap == NULL) {
-		CreateLDCMap();
+// Replaces the point sampled image by a rotated or mirrored copy, see Rotate(). The LDC map depends on the
+// orientation and is created again from the transformed image if it was already built.
+void CLocalDensityCorr::TransformSampledImage(int nNewWidth, int nNewHeight, int nStart, int nStepX, int nStepY) {
+	uint16* pNewImage = new uint16[nNewWidth*nNewHeight*3];
+	for (int j = 0; j < nNewHeight; j++) {
+		for (int nChannel = 0; nChannel < 3; nChannel++) {
+			const uint16* pSrc = m_pPointSampledImage + nStart + j*nStepY + nChannel*m_nPSIWidth;
+			uint16* pDst = pNewImage + (j*3 + nChannel)*nNewWidth;
+			for (int i = 0; i < nNewWidth; i++) {
+				pDst[i] = *pSrc;
+				pSrc += nStepX;
+			}
+		}
 	}
-}
-
-const uint8* CLocalDensityCorr::GetLDCMap() {
-	assert(m_pLDCMap != NULL);
-	if (m_pLDCMapMultiplied == NULL) {
-		m_pLDCMapMultiplied = MultiplyMap(0.5, 0.25);
+	delete[] m_pPointSampledImage;
+	m_pPointSampledImage = pNewImage;
+	m_nPSIWidth = nNewWidth;
+	m_nPSIHeight = nNewHeight;
+
+	if (m_pLDCMap != NULL) {
+		delete[] m_pLDCMap;
+		m_pLDCMap = NULL;
+		delete[] m_pLDCMapMultiplied;
+		m_pLDCMapMultiplied = NULL;
+		CreateLDCMap();
 	}
-	return m_pLDCMapMultiplied; 
 }
 
-void CLocalDensityCorr::SetLDCAmount(double dLightenShadows, double dDarkenHighlights) {
-	assert(m_pLDCMap != NULL);
-	delete[] m_pLDCMapMultiplied;
-	m_pLDCMapMultiplied = MultiplyMap(min(1.0, max(0.0, dLightenShadows)), min(1.0, max(0.0, dDarkenHighlights)));
-}
-
-/////////////////////////////////////////////////////////////////////////////////////////////
-// Private
-/////////////////////////////////////////////////////////////////////////////////////////////
-
 // Second phase construction of LDC map using the point sampled image
 void CLocalDensityCorr::CreateLDCMap() {
 	assert(m_pLDCMap == NULL);
@@ -37,6 +37,16 @@ public:
 	// Sets the amount of LDC for shadows and highlights. Both values must be between 0 and 1
 	void SetLDCAmount(double dLightenShadows, double dDarkenHighlights);
 
+	// Rotates (90, 180, 270 degrees) respectively mirrors the point sampled image together with the image,
+	// so the original pixels need not be sampled again. The histogram and the pixel hash do not change.
+	void Rotate(int nRotation);
+	void Mirror(bool bHorizontally);
+
+	// Transforms the point sampled image with the deferred color transform of the image, see CJPEGImage::SetColorLUT3D().
+	// The exact transform is used if available, else the 3D LUT. Histogram, pixel hash and LDC map are recalculated
+	// from the transformed samples. Must only be called if the samples have not been transformed yet.
+	void ApplyColorTransform(void* pTransform, const uint8* pLUT);
+
 	// Returns if this could be a sunset picture.
 	// The returned number is between 0 (no sunset) and 1 (sunset)
 	float IsSunset() const { return m_fIsSunset; }
@@ -50,6 +60,11 @@ public:
 	// and must delete it when no longer used.
 	void* GetPSImageAsDIB();
 
+	// Self test, started with the /selftest command line switch. Compares the point samples and the pixel hash with the
+	// sampling all existing image DBs have been built with, for gray, 24 and 32 bpp images with padded rows.
+	// Returns if all tests passed, a line per tested image is added to sReport.
+	static bool SelfTest(CString& sReport);
+
 private:
 	CHistogram* m_pHistogramm;
 	int m_nLDCWidth;
@@ -60,12 +75,16 @@ private:
 	float m_fIsSunset;
 	float m_fMiddleGrey;
 	float m_fSunsetPixels;
+	double m_dLightenShadows, m_dDarkenHighlights;
 	__int64 m_nPixelHash;
 
 	uint16* m_pPointSampledImage;
 	int m_nPSIWidth;
 	int m_nPSIHeight;
 
+	void CalculateHistogramAndHash();
+	bool TransformSamples(void* pTransform, const uint8* pLUT);
+	void TransformSampledImage(int nNewWidth, int nNewHeight, int nStart, int nStepX, int nStepY);
 	void SmoothLDCMask();
 	uint8* MultiplyMap(double dLightenShadows, double dDarkenHighlights);
 	float CheckIfSunset(uint32* pRowBGR, int nHeight);
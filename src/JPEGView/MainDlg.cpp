@@ -19,6 +19,7 @@
 #include "UserCommand.h"
 #include "Clipboard.h"
 #include "ParameterDB.h"
+#include "MetadataScanner.h"
 #include "SaveImage.h"
 #include "NLS.h"
 #include "HelpersGUI.h"
@@ -53,6 +54,7 @@
 #include "DirectoryWatcher.h"
 #include "DesktopWallpaper.h"
 #include "PrintImage.h"
+#include "BufferPool.h"
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 // Constants
@@ -258,8 +260,8 @@ CMainDlg::CMainDlg(bool bForceFullScreen) {
 	m_bMouseOn = false;
 	m_bKeepParametersBeforeAnimation = false;
 	m_bIsAnimationPlaying = false;
-	m_nLastAnimationOffset = 0;
-	m_nExpectedNextAnimationTickCount = 0;
+	m_dNextAnimationFrameTime = 0.0;
+	m_nLateAnimationFrames = 0;
 	m_bUseLosslessWEBP = false;
 	m_isBeforeFileSelected = true;
 	m_dLastImageDisplayTime = 0.0;
@@ -317,6 +319,9 @@ LRESULT CMainDlg::OnInitDialog(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam
 
 	m_pDirectoryWatcher = new CDirectoryWatcher(m_hWnd);
 
+	// the pool only sees the idle blocks when allocating or freeing, that does not happen when the viewer is idle
+	::SetTimer(this->m_hWnd, BUFFERPOOL_TIMER_EVENT_ID, CBufferPool::IDLE_CHECK_INTERVAL, NULL);
+
 	// determine the monitor rectangle and client rectangle
 	CSettingsProvider& sp = CSettingsProvider::This();
 	m_nMonitor = sp.DisplayMonitor();
@@ -376,7 +381,7 @@ LRESULT CMainDlg::OnInitDialog(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam
 	// intitialize list of files to show with startup file (and folder)
 	m_pFileList = new CFileList(m_sStartupFile, *m_pDirectoryWatcher,
 		(m_eForcedSorting == Helpers::FS_Undefined) ? sp.Sorting() : m_eForcedSorting, sp.IsSortedAscending(), sp.WrapAroundFolder(),
-		0, m_eForcedSorting != Helpers::FS_Undefined);
+		0, m_eForcedSorting != Helpers::FS_Undefined, m_hWnd);
 	m_pFileList->SetNavigationMode(sp.Navigation());
 
 	// create thread pool for processing requests on multiple CPU cores
@@ -499,6 +504,10 @@ LRESULT CMainDlg::OnPaint(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, B
 		CSize clippedSize(min(m_clientRect.Width(), newSize.cx), min(m_clientRect.Height(), newSize.cy));
 		CPoint offsetsInImage = m_pCurrentImage->ConvertOffset(newSize, clippedSize, m_offsets);
 
+		// the unprocessed DIB is kept for fast reprocessing while the processing parameters can be changed with the sliders,
+		// the image also keeps it after the parameters have been changed with the keyboard
+		m_pCurrentImage->SetKeepUnprocessedDIB(m_pImageProcPanelCtl->IsVisible() || m_pUnsharpMaskPanelCtl->IsVisible());
+
 		void* pDIBData;
 		if (m_pUnsharpMaskPanelCtl->IsVisible()) {
 			pDIBData = m_pUnsharpMaskPanelCtl->GetUSMDIBForPreview(clippedSize, offsetsInImage, 
@@ -559,6 +568,11 @@ LRESULT CMainDlg::OnPaint(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, B
 		TCHAR buff[256];
 		_stprintf_s(buff, 256, _T("Loading: %.2f ms, Last op: %.2f ms, Last resize: %s, Last sharpen: %.2f ms"), m_pCurrentImage->GetLoadTickCount(), 
 			m_pCurrentImage->LastOpTickCount(), CBasicProcessing::TimingInfo(), m_pCurrentImage->GetUnsharpMaskTickCount());
+		if (m_bIsAnimationPlaying) {
+			TCHAR buffAnimation[64];
+			_stprintf_s(buffAnimation, 64, _T(", Late animation frames: %d"), m_nLateAnimationFrames);
+			_tcscat_s(buff, 256, buffAnimation);
+		}
 		dc.SetTextColor(RGB(255, 255, 255));
 		dc.SetBkMode(OPAQUE);
 		dc.TextOut(5, 5, buff);
@@ -1037,13 +1051,40 @@ LRESULT CMainDlg::OnDisplayedFileChangedOnDisk(UINT /*uMsg*/, WPARAM /*wParam*/,
 }
 
 LRESULT CMainDlg::OnActiveDirectoryFilelistChanged(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/) {
+	std::list<CDirectoryChange> changes;
+	bool bChangesComplete = m_pDirectoryWatcher->GetDirectoryChanges(changes);
 	if (CSettingsProvider::This().ReloadWhenDisplayedImageChanged() && m_pFileList != NULL && m_pFileList->CurrentFileExists()) {
-		m_pFileList->Reload(NULL, false);
+		// apply the changes to the file list, only when this is not possible the folder is read again
+		if (!bChangesComplete || !m_pFileList->ApplyDirectoryChanges(changes)) {
+			m_pFileList->Reload(NULL, false);
+		}
+		// only the cached images of the changed files need to be read again
+		for (const CDirectoryChange& change : changes) {
+			if (change.Action == CDirectoryChange::Renamed) {
+				m_pJPEGProvider->FileHasRenamed(change.OldFileName, change.FileName);
+			} else if (change.Action != CDirectoryChange::Added) {
+				m_pJPEGProvider->FileChangedOnDisk(change.FileName);
+			}
+		}
 		Invalidate(FALSE);
 	}
 	return 0;
 }
 
+LRESULT CMainDlg::OnFileListSnapshotReady(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/) {
+	if (m_pFileList != NULL && m_pFileList->ApplyListingSnapshot()) {
+		Invalidate(FALSE); // the index of the current file and the number of files have changed
+	}
+	return 0;
+}
+
+LRESULT CMainDlg::OnCaptureTimesScanned(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/) {
+	if (m_pFileList != NULL && m_pFileList->ApplyScannedCaptureTimes()) {
+		Invalidate(FALSE); // the index of the current file has changed
+	}
+	return 0;
+}
+
 LRESULT CMainDlg::OnDropFiles(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /*bHandled*/) {
 	HDROP hDrop = (HDROP) wParam;
 	if (hDrop != NULL && !m_pPanelMgr->IsModalPanelShown()) {
@@ -1110,6 +1151,8 @@ LRESULT CMainDlg::OnTimer(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL&
 		m_pZoomNavigatorCtl->InvalidateZoomNavigatorRect();
 		CRect imageProcArea = m_pImageProcPanelCtl->PanelRect();
 		this->InvalidateRect(GetZoomTextRect(imageProcArea), FALSE);
+	} else if (wParam == BUFFERPOOL_TIMER_EVENT_ID) {
+		CBufferPool::This().TrimIdleBlocks();
 	} else {
 		if (!m_pCropCtl->OnTimer((int)wParam)) {
 			m_pPanelMgr->OnTimer((int)wParam);
@@ -1151,7 +1194,8 @@ LRESULT CMainDlg::OnContextMenu(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam,
 		(m_pFileList->GetSorting() == Helpers::FS_LastModTime) ? IDM_SORT_MOD_DATE :
 		(m_pFileList->GetSorting() == Helpers::FS_CreationTime) ? IDM_SORT_CREATION_DATE :
 		(m_pFileList->GetSorting() == Helpers::FS_FileName) ? IDM_SORT_NAME :
-		(m_pFileList->GetSorting() == Helpers::FS_Random) ? IDM_SORT_RANDOM : IDM_SORT_SIZE
+		(m_pFileList->GetSorting() == Helpers::FS_Random) ? IDM_SORT_RANDOM :
+		(m_pFileList->GetSorting() == Helpers::FS_CaptureTime) ? IDM_SORT_CAPTURE_DATE : IDM_SORT_SIZE
 		, MF_CHECKED);
 	::CheckMenuItem(hMenuOrdering, m_pFileList->IsSortedAscending() ? IDM_SORT_ASCENDING : IDM_SORT_DESCENDING, MF_CHECKED);
 	if (m_pFileList->GetSorting() == Helpers::FS_Random) {
@@ -1476,11 +1520,13 @@ void CMainDlg::ExecuteCommand(int nCommand) {
 		case IDM_SORT_NAME:
 		case IDM_SORT_RANDOM:
 		case IDM_SORT_SIZE:
+		case IDM_SORT_CAPTURE_DATE:
 			m_pFileList->SetSorting(
 				(nCommand == IDM_SORT_CREATION_DATE) ? Helpers::FS_CreationTime : 
 				(nCommand == IDM_SORT_MOD_DATE) ? Helpers::FS_LastModTime : 
 				(nCommand == IDM_SORT_RANDOM) ? Helpers::FS_Random : 
-				(nCommand == IDM_SORT_SIZE) ? Helpers::FS_FileSize : Helpers::FS_FileName, m_pFileList->IsSortedAscending());
+				(nCommand == IDM_SORT_SIZE) ? Helpers::FS_FileSize : 
+				(nCommand == IDM_SORT_CAPTURE_DATE) ? Helpers::FS_CaptureTime : Helpers::FS_FileName, m_pFileList->IsSortedAscending());
 			if (m_pEXIFDisplayCtl->IsActive() || m_bShowFileName) {
 				this->Invalidate(FALSE);
 			}
@@ -2154,7 +2200,8 @@ void CMainDlg::OpenFile(LPCTSTR sFileName, bool bAfterStartup) {
 	bool oOldAscending = m_pFileList->IsSortedAscending();
 	delete m_pFileList;
 	m_sStartupFile = sFileName;
-	m_pFileList = new CFileList(m_sStartupFile, *m_pDirectoryWatcher, eOldSorting, oOldAscending, CSettingsProvider::This().WrapAroundFolder());
+	m_pFileList = new CFileList(m_sStartupFile, *m_pDirectoryWatcher, eOldSorting, oOldAscending, CSettingsProvider::This().WrapAroundFolder(),
+		0, false, m_hWnd);
 	// free current image and all read ahead images
 	InitParametersForNewImage();
 	m_pJPEGProvider->NotifyNotUsed(m_pCurrentImage);
@@ -3466,6 +3513,7 @@ void CMainDlg::CleanupAndTerminate() {
 	StopAnimation();
 	delete m_pJPEGProvider; // delete this early to properly shut down the loading threads
 	m_pJPEGProvider = NULL;
+	CMetadataScanner::This().SaveCache();
 	EndDialog(0);
 }
 	
@@ -3487,17 +3535,25 @@ void CMainDlg::StartAnimation() {
 	::SetTimer(this->m_hWnd, ANIMATION_TIMER_EVENT_ID, nNewFrameTime, NULL);
 	m_pNavPanelCtl->EndNavPanelAnimation();
 	m_nLastSlideShowImageTickCount = ::GetTickCount();
-	m_nLastAnimationOffset = 0;
-	m_nExpectedNextAnimationTickCount = ::GetTickCount() + nNewFrameTime;
+	m_dNextAnimationFrameTime = Helpers::GetExactTickCount() + nNewFrameTime;
+	m_nLateAnimationFrames = 0;
 }
 
 void CMainDlg::AdjustAnimationFrameTime() {
 	// restart timer with new frame time
 	::KillTimer(this->m_hWnd, ANIMATION_TIMER_EVENT_ID);
-	m_nLastAnimationOffset += ::GetTickCount() - m_nExpectedNextAnimationTickCount;
-	m_nLastAnimationOffset = min(m_nLastAnimationOffset, max(100, m_pCurrentImage->FrameTimeMs())); // prevent offset from getting too big
-	int nNewFrameTime = max(10, m_pCurrentImage->FrameTimeMs() - max(0, m_nLastAnimationOffset));
-	m_nExpectedNextAnimationTickCount = ::GetTickCount() + max(10, m_pCurrentImage->FrameTimeMs());
+	// The frames are scheduled on the playback clock and not relative to the time the frame was ready,
+	// this way the delays of the timer and of decoding do not add up over the frames.
+	double dNow = Helpers::GetExactTickCount();
+	int nFrameTime = max(10, m_pCurrentImage->FrameTimeMs());
+	if (dNow - m_dNextAnimationFrameTime > nFrameTime) {
+		// the frame is shown too late to keep its time slot, resynchronize the clock. No frame is skipped,
+		// the late frames are counted and shown in the timing info.
+		m_nLateAnimationFrames++;
+		m_dNextAnimationFrameTime = dNow;
+	}
+	m_dNextAnimationFrameTime += nFrameTime;
+	int nNewFrameTime = max(10, (int)(m_dNextAnimationFrameTime - dNow + 0.5));
 	::SetTimer(this->m_hWnd, ANIMATION_TIMER_EVENT_ID, nNewFrameTime, NULL);
 }
 
@@ -32,10 +32,11 @@ const unsigned int MAX_HEIF_FILE_SIZE = 1024 * 1024 * 150;
 const unsigned int MAX_HEIF_FILE_SIZE = 1024 * 1024 * 50;
 #endif
 
+// PSD files are mapped into memory and not read into a buffer
 #ifdef _WIN64
-const unsigned int MAX_PSD_FILE_SIZE = 1024 * 1024 * 500;
+const unsigned long long MAX_PSD_FILE_SIZE = 1024ULL * 1024 * 1024 * 8;
 #else
-const unsigned int MAX_PSD_FILE_SIZE = 1024 * 1024 * 100;
+const unsigned long long MAX_PSD_FILE_SIZE = 1024 * 1024 * 500;
 #endif
 
 #ifdef _WIN64
@@ -14,4 +14,12 @@
 // Posted to main dialog for asynchronously loading the image with file name CMainDlg::m_sStartupFile
 #define WM_LOAD_FILE_ASYNCH (WM_APP + 24)
 
+// Message posted when the folder listing running in the background has a new snapshot of the file list ready,
+// see CFileList::ApplyListingSnapshot()
+#define WM_FILELIST_SNAPSHOT_READY (WM_APP + 25)
+
+// Message posted when the capture times scanned in the background have been added to the cache,
+// see CMetadataScanner::ScanCaptureTimesAsync()
+#define WM_CAPTURE_TIMES_SCANNED (WM_APP + 26)
+
 #define KEY_MAGIC 2978465
\ No newline at end of file
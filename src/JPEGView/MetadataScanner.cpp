@@ -0,0 +1,949 @@
+#include "StdAfx.h"
+#include "MetadataScanner.h"
+#include "FileList.h"
+#include "EXIFReader.h"
+#include "ImageProcessingTypes.h"
+#include "Helpers.h"
+#include "MessageDef.h"
+#include <algorithm>
+#include <process.h>
+
+CMetadataScanner* CMetadataScanner::sm_instance;
+
+static const TCHAR CAPTURE_TIME_CACHE_NAME[] = _T("CaptureTimes.db");
+static const uint32 CACHE_MAGIC = 0x54435645; // 'EVCT'
+static const uint32 CACHE_VERSION = 1;
+static const int MAX_CACHE_ENTRIES = 200000; // the cache is cleared when it grows beyond this size
+static const int HEADER_BUFFER_SIZE = 16384; // covers the metadata of most files, read with one read operation
+static const int MAX_EXIF_SIZE = 65535 - 8; // TIFF data that fits into an APP1 block (16 bit length field)
+static const int MAX_BOX_SIZE = 1024 * 1024; // maximal size of the ISOBMFF item information and location boxes
+static const int MAX_SCAN_THREADS = 8; // scanning is I/O bound, use this number of threads independent of the number of cores
+
+///////////////////////////////////////////////////////////////////////////////////
+// Helpers
+///////////////////////////////////////////////////////////////////////////////////
+
+static uint32 ReadBE16(const uint8* p) { return (p[0] << 8) | p[1]; }
+static uint32 ReadBE32(const uint8* p) { return ((uint32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static uint32 ReadLE32(const uint8* p) { return ((uint32)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0]; }
+
+// Reads a big endian number of nBytes bytes (0 to 8)
+static unsigned __int64 ReadBE(const uint8* p, int nBytes) {
+	unsigned __int64 nValue = 0;
+	for (int i = 0; i < nBytes; i++) {
+		nValue = (nValue << 8) | p[i];
+	}
+	return nValue;
+}
+
+// Read only access to the parts of a file. The start of the file is buffered, as the metadata is
+// located there in most files.
+class CMetadataFile {
+public:
+	CMetadataFile(LPCTSTR sFileName) {
+		m_nSize = 0;
+		m_nHeaderSize = 0;
+		m_hFile = ::CreateFile(sFileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		LARGE_INTEGER size;
+		if (m_hFile != INVALID_HANDLE_VALUE && ::GetFileSizeEx(m_hFile, &size)) {
+			m_nSize = size.QuadPart;
+			DWORD nRead;
+			if (::ReadFile(m_hFile, m_header, (DWORD)min(m_nSize, (__int64)HEADER_BUFFER_SIZE), &nRead, NULL)) {
+				m_nHeaderSize = nRead;
+			}
+		}
+	}
+	~CMetadataFile() {
+		if (m_hFile != INVALID_HANDLE_VALUE) {
+			::CloseHandle(m_hFile);
+		}
+	}
+
+	__int64 Size() const { return m_nSize; }
+
+	// Reads nSize bytes at offset nOffset, returns false if not all bytes could be read
+	bool Read(__int64 nOffset, void* pBuffer, int nSize) {
+		if (nOffset < 0 || nSize < 0 || nOffset + nSize > m_nSize) {
+			return false;
+		}
+		if (nOffset + nSize <= m_nHeaderSize) {
+			memcpy(pBuffer, m_header + nOffset, nSize);
+			return true;
+		}
+		LARGE_INTEGER pos;
+		pos.QuadPart = nOffset;
+		DWORD nRead;
+		return ::SetFilePointerEx(m_hFile, pos, NULL, FILE_BEGIN) && ::ReadFile(m_hFile, pBuffer, nSize, &nRead, NULL) && nRead == (DWORD)nSize;
+	}
+private:
+	HANDLE m_hFile;
+	__int64 m_nSize;
+	int m_nHeaderSize;
+	uint8 m_header[HEADER_BUFFER_SIZE];
+};
+
+// EXIF data of a file as APP1 block, as expected by the EXIF reader
+struct EXIFBlock {
+	std::vector<uint8> APP1; // zero padded, the EXIF reader may read a few bytes beyond tags at the end of the block
+	__int64 FileOffset; // position in the file corresponding to the start of the APP1 block
+};
+
+// Reads the APP1 block of the given size at the given position of a JPEG stream
+static bool ReadAPP1(CMetadataFile& file, __int64 nOffset, int nSize, EXIFBlock& exif) {
+	exif.APP1.assign(nSize + 16, 0);
+	exif.FileOffset = nOffset;
+	return file.Read(nOffset, &exif.APP1[0], nSize) && memcmp(&exif.APP1[4], "Exif", 4) == 0;
+}
+
+// Reads TIFF structured EXIF data at the given position of the file, starting with the byte order mark.
+// The data is wrapped into an APP1 block.
+static bool ReadTIFF(CMetadataFile& file, __int64 nOffset, __int64 nSize, EXIFBlock& exif) {
+	uint8 signature[6];
+	if (nSize >= 6 && file.Read(nOffset, signature, 6) && memcmp(signature, "Exif\0\0", 6) == 0) {
+		nOffset += 6; // some encoders keep the JPEG APP1 signature
+		nSize -= 6;
+	}
+	int nTIFFSize = (int)min(min(nSize, file.Size() - nOffset), (__int64)MAX_EXIF_SIZE);
+	if (nTIFFSize < 8) {
+		return false;
+	}
+	exif.APP1.assign(nTIFFSize + 10 + 16, 0);
+	exif.FileOffset = nOffset - 10;
+	memcpy(&exif.APP1[0], "\xFF\xE1\0\0Exif\0\0", 10);
+	exif.APP1[2] = (uint8)((nTIFFSize + 8) >> 8);
+	exif.APP1[3] = (uint8)((nTIFFSize + 8) & 0xFF);
+	return file.Read(nOffset, &exif.APP1[10], nTIFFSize);
+}
+
+// Reads the EXIF item of HEIF/AVIF files respectively the Exif box of JPEG XL files. The TIFF data
+// is preceded by a 4 byte big endian offset to the TIFF header.
+static bool ReadExifItem(CMetadataFile& file, __int64 nOffset, __int64 nSize, EXIFBlock& exif) {
+	uint8 headerOffset[4];
+	if (nSize < 4 || !file.Read(nOffset, headerOffset, 4)) {
+		return false;
+	}
+	uint32 nTIFFOffset = ReadBE32(headerOffset);
+	if (nTIFFOffset > nSize - 4) {
+		return false;
+	}
+	return ReadTIFF(file, nOffset + 4 + nTIFFOffset, nSize - 4 - nTIFFOffset, exif);
+}
+
+// Walks the blocks of a JPEG stream starting at nOffset, only the headers of the blocks are read.
+// Stops at the first EXIF block (if pEXIF is not NULL) respectively the first frame header (if pFrameHeader is not NULL).
+static bool ReadJPEGBlocks(CMetadataFile& file, __int64 nOffset, EXIFBlock* pEXIF, uint8* pFrameHeader) {
+	nOffset += 2; // SOI marker
+	uint8 segment[4];
+	while (file.Read(nOffset, segment, 4) && segment[0] == 0xFF) {
+		uint8 nMarker = segment[1];
+		if (nMarker == 0xFF) {
+			nOffset++; // padding
+			continue;
+		}
+		if (nMarker == 0xDA || nMarker == 0xD9) {
+			break; // start of scan or end of image, no header follows
+		}
+		int nLength = ReadBE16(segment + 2);
+		if (pEXIF != NULL && nMarker == 0xE1 && nLength > 16 && ReadAPP1(file, nOffset, nLength + 2, *pEXIF)) {
+			return true;
+		}
+		// SOF0 to SOF15, except DHT, JPG and DAC: precision, height, width, number of components
+		if (pFrameHeader != NULL && nMarker >= 0xC0 && nMarker <= 0xCF && nMarker != 0xC4 && nMarker != 0xC8 && nMarker != 0xCC) {
+			return file.Read(nOffset + 4, pFrameHeader, 6);
+		}
+		nOffset += nLength + 2;
+	}
+	return false;
+}
+
+// Walks the chunks of a PNG before the image data and calls the handler for each chunk with its name, offset and size
+// of the data. Stops when the handler returns true. The chunks after the image data are not examined, to avoid reading the whole file.
+template<typename HANDLER>
+static bool ReadPNGChunks(CMetadataFile& file, HANDLER handler) {
+	__int64 nOffset = 8; // signature
+	uint8 chunk[8];
+	while (file.Read(nOffset, chunk, 8)) {
+		uint32 nLength = ReadBE32(chunk);
+		if (memcmp(chunk + 4, "IDAT", 4) == 0 || memcmp(chunk + 4, "IEND", 4) == 0) {
+			break;
+		}
+		if (handler((const char*)chunk + 4, nOffset + 8, nLength)) {
+			return true;
+		}
+		nOffset += (__int64)nLength + 12; // length, chunk name and CRC32
+	}
+	return false;
+}
+
+// Walks the chunks of a WebP RIFF container, same semantics as above. The chunks have a 4 byte tag and
+// 4 byte little endian size and are padded to even size.
+template<typename HANDLER>
+static bool ReadWebPChunks(CMetadataFile& file, HANDLER handler) {
+	uint8 chunk[8];
+	if (!file.Read(0, chunk, 8)) {
+		return false;
+	}
+	__int64 nEnd = min(file.Size(), (__int64)ReadLE32(chunk + 4) + 8);
+	__int64 nOffset = 12;
+	while (nOffset + 8 <= nEnd && file.Read(nOffset, chunk, 8)) {
+		uint32 nLength = ReadLE32(chunk + 4);
+		if (handler((const char*)chunk, nOffset + 8, nLength)) {
+			return true;
+		}
+		nOffset += 8 + (__int64)nLength + (nLength & 1);
+	}
+	return false;
+}
+
+// Finds the first ISOBMFF box of the given type in the box sequence in [nOffset, nEnd) of the file.
+// Returns offset and size of the content of the box, excluding the box header.
+static bool FindBox(CMetadataFile& file, __int64 nOffset, __int64 nEnd, const char* sType, __int64& nContentOffset, __int64& nContentSize) {
+	uint8 header[16];
+	while (nOffset + 8 <= nEnd && file.Read(nOffset, header, 8)) {
+		__int64 nBoxSize = ReadBE32(header);
+		int nHeaderSize = 8;
+		if (nBoxSize == 1) {
+			if (!file.Read(nOffset + 8, header + 8, 8)) {
+				return false;
+			}
+			nBoxSize = (__int64)ReadBE(header + 8, 8);
+			nHeaderSize = 16;
+		} else if (nBoxSize == 0) {
+			nBoxSize = nEnd - nOffset; // box extends to the end
+		}
+		if (nBoxSize < nHeaderSize || nBoxSize > nEnd - nOffset) {
+			return false;
+		}
+		if (memcmp(header + 4, sType, 4) == 0) {
+			nContentOffset = nOffset + nHeaderSize;
+			nContentSize = nBoxSize - nHeaderSize;
+			return true;
+		}
+		nOffset += nBoxSize;
+	}
+	return false;
+}
+
+// Reads the content of the box into the buffer, the box must not be larger than MAX_BOX_SIZE
+static bool ReadBox(CMetadataFile& file, __int64 nOffset, __int64 nSize, std::vector<uint8>& buffer) {
+	if (nSize < 8 || nSize > MAX_BOX_SIZE) {
+		return false;
+	}
+	buffer.resize((size_t)nSize);
+	return file.Read(nOffset, &buffer[0], (int)nSize);
+}
+
+// Finds a box contained in the meta box of a HEIF/AVIF file and reads its content
+static bool ReadMetaBox(CMetadataFile& file, const char* sType, std::vector<uint8>& buffer) {
+	__int64 nMetaOffset, nMetaSize, nOffset, nSize;
+	// meta is a full box, the contained boxes follow version and flags
+	return FindBox(file, 0, file.Size(), "meta", nMetaOffset, nMetaSize) && nMetaSize >= 4 &&
+		FindBox(file, nMetaOffset + 4, nMetaOffset + nMetaSize, sType, nOffset, nSize) &&
+		ReadBox(file, nOffset, nSize, buffer);
+}
+
+// Gets the ID of the item of type 'Exif' from the content of the item information box (iinf)
+static bool FindExifItemID(const std::vector<uint8>& info, uint32& nItemID) {
+	const uint8* pEnd = &info[0] + info.size();
+	const uint8* p = &info[0] + ((info[0] == 0) ? 6 : 8); // version, flags and entry count
+	while (p + 8 <= pEnd) {
+		uint32 nBoxSize = ReadBE32(p);
+		if (nBoxSize < 8 || nBoxSize > (uint32)(pEnd - p)) {
+			break;
+		}
+		// item info entry (infe) of version 2 or 3: version, flags, item ID, protection index, item type
+		int nVersion = (nBoxSize > 8) ? p[8] : 0;
+		int nIDSize = (nVersion == 2) ? 2 : 4;
+		if (memcmp(p + 4, "infe", 4) == 0 && nVersion >= 2 && nBoxSize >= (uint32)(12 + nIDSize + 2 + 4)) {
+			const uint8* pType = p + 12 + nIDSize + 2;
+			if (memcmp(pType, "Exif", 4) == 0) {
+				nItemID = (uint32)ReadBE(p + 12, nIDSize);
+				return true;
+			}
+		}
+		p += nBoxSize;
+	}
+	return false;
+}
+
+// Gets the position of the item in the file from the content of the item location box (iloc).
+// Only items stored in the file (not in the meta box) are supported, of which the first extent is used.
+static bool FindItemLocation(const std::vector<uint8>& location, uint32 nItemID, __int64& nOffset, __int64& nSize) {
+	const uint8* p = &location[0];
+	const uint8* pEnd = p + location.size();
+	int nVersion = p[0];
+	int nOffsetSize = p[4] >> 4;
+	int nLengthSize = p[4] & 0x0F;
+	int nBaseOffsetSize = p[5] >> 4;
+	int nIndexSize = (nVersion == 1 || nVersion == 2) ? (p[5] & 0x0F) : 0;
+	int nIDSize = (nVersion < 2) ? 2 : 4;
+	p += 6;
+	if (p + nIDSize > pEnd) {
+		return false;
+	}
+	uint32 nItemCount = (uint32)ReadBE(p, nIDSize);
+	p += nIDSize;
+	for (uint32 i = 0; i < nItemCount; i++) {
+		int nConstructionMethodSize = (nVersion == 1 || nVersion == 2) ? 2 : 0;
+		if (p + nIDSize + nConstructionMethodSize + 2 + nBaseOffsetSize + 2 > pEnd) {
+			return false;
+		}
+		uint32 nID = (uint32)ReadBE(p, nIDSize);
+		p += nIDSize;
+		int nConstructionMethod = (nConstructionMethodSize > 0) ? (ReadBE16(p) & 0x0F) : 0;
+		p += nConstructionMethodSize + 2; // construction method and data reference index
+		unsigned __int64 nBaseOffset = ReadBE(p, nBaseOffsetSize);
+		p += nBaseOffsetSize;
+		int nExtentCount = ReadBE16(p);
+		p += 2;
+		int nExtentSize = nIndexSize + nOffsetSize + nLengthSize;
+		if (p + nExtentCount * nExtentSize > pEnd) {
+			return false;
+		}
+		if (nID == nItemID) {
+			if (nConstructionMethod != 0 || nExtentCount < 1) {
+				return false;
+			}
+			nOffset = (__int64)(nBaseOffset + ReadBE(p + nIndexSize, nOffsetSize));
+			nSize = (__int64)ReadBE(p + nIndexSize + nOffsetSize, nLengthSize);
+			return true;
+		}
+		p += nExtentCount * nExtentSize;
+	}
+	return false;
+}
+
+// HEIF and AVIF: the EXIF data is an item, declared in the item information box and located by the item location box
+static bool ReadISOBMFFExif(CMetadataFile& file, EXIFBlock& exif) {
+	std::vector<uint8> info, location;
+	if (!ReadMetaBox(file, "iinf", info) || !ReadMetaBox(file, "iloc", location)) {
+		return false;
+	}
+	uint32 nExifItemID;
+	__int64 nExifOffset, nExifSize;
+	if (!FindExifItemID(info, nExifItemID) || !FindItemLocation(location, nExifItemID, nExifOffset, nExifSize)) {
+		return false;
+	}
+	if (nExifSize == 0) {
+		nExifSize = file.Size() - nExifOffset; // extent reaches to the end of the file
+	}
+	return ReadExifItem(file, nExifOffset, nExifSize, exif);
+}
+
+// Reads the EXIF data of the file, the file format is detected by the signature in the header (at least 16 bytes)
+static bool ReadEXIF(CMetadataFile& file, const uint8* pHeader, EXIFBlock& exif) {
+	if (pHeader[0] == 0xFF && pHeader[1] == 0xD8) {
+		return ReadJPEGBlocks(file, 0, &exif, NULL);
+	} else if (memcmp(pHeader, "\x89PNG", 4) == 0) {
+		return ReadPNGChunks(file, [&](const char* sName, __int64 nOffset, uint32 nSize) {
+			return memcmp(sName, "eXIf", 4) == 0 && ReadTIFF(file, nOffset, nSize, exif);
+		});
+	} else if (memcmp(pHeader, "RIFF", 4) == 0 && memcmp(pHeader + 8, "WEBP", 4) == 0) {
+		return ReadWebPChunks(file, [&](const char* sName, __int64 nOffset, uint32 nSize) {
+			return memcmp(sName, "EXIF", 4) == 0 && ReadTIFF(file, nOffset, nSize, exif);
+		});
+	} else if (memcmp(pHeader + 4, "ftyp", 4) == 0) {
+		return ReadISOBMFFExif(file, exif);
+	} else if (memcmp(pHeader, "\0\0\0\x0CJXL ", 8) == 0) {
+		// JPEG XL: the EXIF data is in the Exif box of the container, bare codestreams have no EXIF data
+		__int64 nExifOffset, nExifSize;
+		return FindBox(file, 0, file.Size(), "Exif", nExifOffset, nExifSize) && ReadExifItem(file, nExifOffset, nExifSize, exif);
+	} else if (memcmp(pHeader, "FUJIFILMCCD-RAW", 15) == 0) {
+		// Fuji RAF: contains a JPEG preview with the EXIF data, its offset is stored at position 84 of the header
+		uint8 jpegOffset[4];
+		return file.Read(84, jpegOffset, 4) && ReadJPEGBlocks(file, ReadBE32(jpegOffset), &exif, NULL);
+	} else if ((pHeader[0] == 'I' && pHeader[1] == 'I') || (pHeader[0] == 'M' && pHeader[1] == 'M')) {
+		return ReadTIFF(file, 0, file.Size(), exif); // TIFF and TIFF based camera RAW formats
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+// Image header parsing
+///////////////////////////////////////////////////////////////////////////////////
+
+// Reads bits in the order of the JPEG XL codestream (least significant bit first)
+class CBitReader {
+public:
+	CBitReader(const uint8* pData, int nSize) : m_pData(pData), m_nSize(nSize), m_nBitPos(0) {}
+	uint32 Read(int nBits) {
+		uint32 nValue = 0;
+		for (int i = 0; i < nBits; i++, m_nBitPos++) {
+			int nByte = m_nBitPos >> 3;
+			uint32 nBit = (nByte < m_nSize) ? ((m_pData[nByte] >> (m_nBitPos & 7)) & 1) : 0;
+			nValue |= nBit << i;
+		}
+		return nValue;
+	}
+	// U32() distribution of the size header: 2 bit selector, followed by 9, 13, 18 or 30 bits
+	uint32 ReadSize() {
+		static const int BITS[4] = { 9, 13, 18, 30 };
+		return Read(BITS[Read(2)]) + 1;
+	}
+private:
+	const uint8* m_pData;
+	int m_nSize;
+	int m_nBitPos;
+};
+
+// JPEG XL: parses the size header and the orientation from the image metadata at the start of the codestream
+static bool ProbeJXL(CMetadataFile& file, const uint8* pHeader, CImageHeaderInfo& info) {
+	__int64 nCodestreamOffset = 0;
+	if (pHeader[0] != 0xFF) {
+		__int64 nBoxOffset, nBoxSize;
+		if (FindBox(file, 0, file.Size(), "jxlc", nBoxOffset, nBoxSize)) {
+			nCodestreamOffset = nBoxOffset;
+		} else if (FindBox(file, 0, file.Size(), "jxlp", nBoxOffset, nBoxSize)) {
+			nCodestreamOffset = nBoxOffset + 4; // partial codestream box, starting with its index
+		} else {
+			return false;
+		}
+	}
+	uint8 codestream[32] = { 0 };
+	int nSize = (int)min((__int64)sizeof(codestream), file.Size() - nCodestreamOffset);
+	if (nSize < 4 || !file.Read(nCodestreamOffset, codestream, nSize) || codestream[0] != 0xFF || codestream[1] != 0x0A) {
+		return false;
+	}
+	CBitReader bits(codestream + 2, nSize - 2);
+	bool bSmall = bits.Read(1) != 0;
+	uint32 nHeight = bSmall ? (bits.Read(5) + 1) * 8 : bits.ReadSize();
+	uint32 nRatio = bits.Read(3);
+	uint32 nWidth;
+	if (nRatio == 0) {
+		nWidth = bSmall ? (bits.Read(5) + 1) * 8 : bits.ReadSize();
+	} else {
+		static const uint32 RATIO_NUM[8] = { 0, 1, 12, 4, 3, 16, 5, 2 };
+		static const uint32 RATIO_DEN[8] = { 1, 1, 10, 3, 2, 9, 4, 1 };
+		nWidth = (uint32)((unsigned __int64)nHeight * RATIO_NUM[nRatio] / RATIO_DEN[nRatio]);
+	}
+	info.Width = (int)min(nWidth, (uint32)INT_MAX);
+	info.Height = (int)min(nHeight, (uint32)INT_MAX);
+	// image metadata: all_default, extra_fields, orientation
+	info.Orientation = 1;
+	if (bits.Read(1) == 0 && bits.Read(1) != 0) {
+		info.Orientation = bits.Read(3) + 1;
+	}
+	return true;
+}
+
+// HEIF and AVIF: the image size is in the image spatial extents property (ispe), the rotation in the image rotation property (irot)
+static bool ProbeISOBMFF(CMetadataFile& file, const uint8* pHeader, CImageHeaderInfo& info) {
+	std::vector<uint8> properties;
+	if (!ReadMetaBox(file, "iprp", properties)) {
+		return false;
+	}
+	const uint8* p = &properties[0];
+	const uint8* pEnd = p + properties.size();
+	if (p + 8 > pEnd || memcmp(p + 4, "ipco", 4) != 0) {
+		return false;
+	}
+	pEnd = min(pEnd, p + ReadBE32(p));
+	p += 8;
+	while (p + 8 <= pEnd) {
+		uint32 nBoxSize = ReadBE32(p);
+		if (nBoxSize < 8 || nBoxSize > (uint32)(pEnd - p)) {
+			break;
+		}
+		if (memcmp(p + 4, "ispe", 4) == 0 && nBoxSize >= 20) {
+			// the primary image is the largest one, the others are thumbnails or tiles of a grid image
+			int nWidth = (int)min(ReadBE32(p + 12), (uint32)INT_MAX);
+			int nHeight = (int)min(ReadBE32(p + 16), (uint32)INT_MAX);
+			if ((__int64)nWidth * nHeight > (__int64)info.Width * info.Height) {
+				info.Width = nWidth;
+				info.Height = nHeight;
+			}
+		} else if (memcmp(p + 4, "irot", 4) == 0 && nBoxSize >= 9) {
+			// anti-clockwise rotation in steps of 90 degrees
+			static const int ORIENTATION[4] = { 1, 8, 3, 6 };
+			info.Orientation = ORIENTATION[p[8] & 3];
+		} else if (memcmp(p + 4, "pixi", 4) == 0 && nBoxSize >= 13) {
+			info.Channels = max(info.Channels, (int)p[12]);
+		}
+		p += nBoxSize;
+	}
+	// image sequences have a movie box with the frames
+	bool bSequence = memcmp(pHeader + 8, "avis", 4) == 0 || memcmp(pHeader + 8, "msf1", 4) == 0 || memcmp(pHeader + 8, "hevs", 4) == 0;
+	info.FrameCount = bSequence ? 0 : 1;
+	if (info.Orientation == 0) {
+		info.Orientation = 1;
+	}
+	return info.Width > 0;
+}
+
+// Reads a SHORT or LONG value of a TIFF tag
+static uint32 ReadTIFFTagValue(const uint8* pTag, bool bLittleEndian) {
+	uint32 nType = bLittleEndian ? (pTag[2] | (pTag[3] << 8)) : ReadBE16(pTag + 2);
+	if (nType == 3) {
+		return bLittleEndian ? (pTag[8] | (pTag[9] << 8)) : ReadBE16(pTag + 8);
+	}
+	return bLittleEndian ? ReadLE32(pTag + 8) : ReadBE32(pTag + 8);
+}
+
+// TIFF: the image size is in the first IFD, the number of pages is the number of IFDs in the chain
+static bool ProbeTIFF(CMetadataFile& file, CImageHeaderInfo& info) {
+	const int MAX_PAGES = 1024;
+	uint8 header[8];
+	if (!file.Read(0, header, 8)) {
+		return false;
+	}
+	bool bLittleEndian = header[0] == 'I';
+	uint32 nIFDOffset = bLittleEndian ? ReadLE32(header + 4) : ReadBE32(header + 4);
+	int nPages = 0;
+	while (nIFDOffset != 0 && nPages < MAX_PAGES) {
+		uint8 count[2];
+		if (!file.Read(nIFDOffset, count, 2)) {
+			break;
+		}
+		int nTags = bLittleEndian ? (count[0] | (count[1] << 8)) : ReadBE16(count);
+		std::vector<uint8> ifd(nTags * 12 + 4);
+		if (!file.Read(nIFDOffset + 2, &ifd[0], (int)ifd.size())) {
+			break;
+		}
+		if (nPages == 0) {
+			for (int i = 0; i < nTags; i++) {
+				const uint8* pTag = &ifd[i * 12];
+				uint32 nTag = bLittleEndian ? (pTag[0] | (pTag[1] << 8)) : ReadBE16(pTag);
+				uint32 nValue = ReadTIFFTagValue(pTag, bLittleEndian);
+				if (nTag == 0x100) info.Width = (int)min(nValue, (uint32)INT_MAX);
+				else if (nTag == 0x101) info.Height = (int)min(nValue, (uint32)INT_MAX);
+				else if (nTag == 0x112) info.Orientation = (int)nValue;
+				else if (nTag == 0x115) info.Channels = (int)nValue;
+			}
+		}
+		nPages++;
+		const uint8* pNext = &ifd[nTags * 12];
+		uint32 nNextOffset = bLittleEndian ? ReadLE32(pNext) : ReadBE32(pNext);
+		nIFDOffset = (nNextOffset > nIFDOffset) ? nNextOffset : 0; // only forward links, protects against loops
+	}
+	info.FrameCount = nPages;
+	if (info.Channels == 0) {
+		info.Channels = 1; // default of SamplesPerPixel
+	}
+	return info.Width > 0;
+}
+
+// Parses the header of the given format, the size, channels and frame count are set if known
+static bool ProbeFormat(CMetadataFile& file, const uint8* pHeader, CImageHeaderInfo& info) {
+	switch (info.Format) {
+		case IF_JPEG: {
+			uint8 frameHeader[6];
+			if (!ReadJPEGBlocks(file, 0, NULL, frameHeader)) {
+				return false;
+			}
+			info.Height = ReadBE16(frameHeader + 1);
+			info.Width = ReadBE16(frameHeader + 3);
+			info.Channels = frameHeader[5];
+			info.FrameCount = 1;
+			return true;
+		}
+		case IF_PNG: {
+			// IHDR is the first chunk: width, height, bit depth, color type
+			static const int CHANNELS[7] = { 1, 0, 3, 3, 2, 0, 4 };
+			uint8 ihdr[10];
+			if (!file.Read(16, ihdr, 10)) {
+				return false;
+			}
+			info.Width = (int)min(ReadBE32(ihdr), (uint32)INT_MAX);
+			info.Height = (int)min(ReadBE32(ihdr + 4), (uint32)INT_MAX);
+			int nColorType = ihdr[9];
+			info.Channels = (nColorType <= 6) ? CHANNELS[nColorType] : 0;
+			info.FrameCount = 1;
+			ReadPNGChunks(file, [&](const char* sName, __int64 nOffset, uint32 nSize) {
+				uint8 data[4];
+				if (memcmp(sName, "acTL", 4) == 0 && nSize >= 4 && file.Read(nOffset, data, 4)) {
+					info.FrameCount = (int)min(ReadBE32(data), (uint32)INT_MAX); // animated PNG
+				} else if (memcmp(sName, "tRNS", 4) == 0 && (nColorType == 2 || nColorType == 3)) {
+					info.Channels = 4;
+				}
+				return false;
+			});
+			return true;
+		}
+		case IF_GIF:
+			// logical screen size, the number of frames is only known after reading the whole file
+			info.Width = pHeader[6] | (pHeader[7] << 8);
+			info.Height = pHeader[8] | (pHeader[9] << 8);
+			info.Channels = 3;
+			return true;
+		case IF_WEBP: {
+			bool bAnimated = false;
+			int nFrames = 0;
+			ReadWebPChunks(file, [&](const char* sName, __int64 nOffset, uint32 nSize) {
+				uint8 data[10];
+				if (memcmp(sName, "VP8X", 4) == 0 && nSize >= 10 && file.Read(nOffset, data, 10)) {
+					// flags, reserved, canvas width - 1 and canvas height - 1 (24 bits each)
+					bAnimated = (data[0] & 0x02) != 0;
+					info.Channels = (data[0] & 0x10) ? 4 : 3;
+					info.Width = (data[4] | (data[5] << 8) | (data[6] << 16)) + 1;
+					info.Height = (data[7] | (data[8] << 8) | (data[9] << 16)) + 1;
+					return !bAnimated;
+				} else if (memcmp(sName, "VP8 ", 4) == 0 && nSize >= 10 && file.Read(nOffset, data, 10)) {
+					// frame tag, start code, width and height (14 bits each)
+					if (info.Width == 0) {
+						info.Width = (data[6] | (data[7] << 8)) & 0x3FFF;
+						info.Height = (data[8] | (data[9] << 8)) & 0x3FFF;
+						info.Channels = 3;
+					}
+					return true;
+				} else if (memcmp(sName, "VP8L", 4) == 0 && nSize >= 5 && file.Read(nOffset, data, 5)) {
+					// signature, width - 1 and height - 1 (14 bits each), alpha flag
+					if (info.Width == 0) {
+						uint32 nBits = ReadLE32(data + 1);
+						info.Width = (nBits & 0x3FFF) + 1;
+						info.Height = ((nBits >> 14) & 0x3FFF) + 1;
+						info.Channels = ((nBits >> 28) & 1) ? 4 : 3;
+					}
+					return true;
+				} else if (memcmp(sName, "ANMF", 4) == 0) {
+					nFrames++;
+				}
+				return false;
+			});
+			info.FrameCount = bAnimated ? nFrames : 1;
+			return info.Width > 0;
+		}
+		case IF_JXL:
+			return ProbeJXL(file, pHeader, info);
+		case IF_HEIF:
+		case IF_AVIF:
+			return ProbeISOBMFF(file, pHeader, info);
+		case IF_TIFF:
+			return ProbeTIFF(file, info);
+		case IF_PSD: {
+			// signature, version, reserved, channels, height, width, depth, color mode
+			uint8 psd[26];
+			if (!file.Read(0, psd, 26)) {
+				return false;
+			}
+			info.Channels = ReadBE16(psd + 12);
+			info.Height = (int)min(ReadBE32(psd + 14), (uint32)INT_MAX);
+			info.Width = (int)min(ReadBE32(psd + 18), (uint32)INT_MAX);
+			info.FrameCount = 1;
+			return true;
+		}
+		case IF_WindowsBMP: {
+			// file header, followed by the DIB header: OS/2 BITMAPCOREHEADER (12 bytes) or BITMAPINFOHEADER and later
+			uint8 dib[16];
+			if (!file.Read(14, dib, 16)) {
+				return false;
+			}
+			uint32 nDIBSize = ReadLE32(dib);
+			if (nDIBSize == 12) {
+				info.Width = dib[4] | (dib[5] << 8);
+				info.Height = dib[6] | (dib[7] << 8);
+				info.Channels = 3;
+			} else {
+				info.Width = abs((int)ReadLE32(dib + 4));
+				info.Height = abs((int)ReadLE32(dib + 8)); // negative for top-down bitmaps
+				info.Channels = ((dib[14] | (dib[15] << 8)) == 32) ? 4 : 3;
+			}
+			info.FrameCount = 1;
+			return true;
+		}
+		case IF_TGA: {
+			// image type at 2, width and height at 12 and 14, bits per pixel at 16
+			uint8 tga[18];
+			if (!file.Read(0, tga, 18)) {
+				return false;
+			}
+			info.Width = tga[12] | (tga[13] << 8);
+			info.Height = tga[14] | (tga[15] << 8);
+			info.Channels = (tga[2] == 3 || tga[2] == 11) ? 1 : ((tga[16] == 32) ? 4 : 3);
+			info.FrameCount = 1;
+			return true;
+		}
+		case IF_QOI:
+			// magic, width, height, channels
+			info.Width = (int)min(ReadBE32(pHeader + 4), (uint32)INT_MAX);
+			info.Height = (int)min(ReadBE32(pHeader + 8), (uint32)INT_MAX);
+			info.Channels = pHeader[12];
+			info.FrameCount = 1;
+			return true;
+		default:
+			return false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+// Parallel scanning
+///////////////////////////////////////////////////////////////////////////////////
+
+// Shared state of the threads scanning a list of files
+struct ScanContext {
+	const std::vector<const CFileDesc*>* Files;
+	const std::vector<int>* IndicesToScan;
+	std::vector<unsigned __int64>* CaptureTimes;
+	volatile LONG NextIndex;
+	volatile LONG RunningThreads;
+	HANDLE EventFinished;
+};
+
+// Scans the files until all files are taken by one of the threads
+static void ScanFiles(ScanContext& context) {
+	LONG nIndex;
+	while ((nIndex = ::InterlockedIncrement(&context.NextIndex) - 1) < (LONG)context.IndicesToScan->size()) {
+		int nFileIndex = (*context.IndicesToScan)[nIndex];
+		FILETIME captureTime;
+		bool bHasCaptureTime = CMetadataScanner::ReadCaptureTime((*context.Files)[nFileIndex]->GetName(), captureTime);
+		(*context.CaptureTimes)[nFileIndex] = bHasCaptureTime ? (((unsigned __int64)captureTime.dwHighDateTime << 32) | captureTime.dwLowDateTime) : 0;
+	}
+}
+
+static void __cdecl ScanThreadFunc(void* arg) {
+	ScanContext* pContext = (ScanContext*)arg;
+	ScanFiles(*pContext);
+	if (::InterlockedDecrement(&pContext->RunningThreads) == 0) {
+		::SetEvent(pContext->EventFinished);
+	}
+}
+
+// Files scanned by ScanCaptureTimesAsync(), copied because the file list may change while scanning
+struct CMetadataScanner::BackgroundScanJob {
+	std::vector<CFileDesc> Files;
+	HWND WndNotify;
+};
+
+void __cdecl CMetadataScanner::BackgroundScanThreadFunc(void* arg) {
+	BackgroundScanJob* pJob = (BackgroundScanJob*)arg;
+	std::vector<const CFileDesc*> files;
+	files.reserve(pJob->Files.size());
+	for (const CFileDesc& fileDesc : pJob->Files) {
+		files.push_back(&fileDesc);
+	}
+	std::vector<unsigned __int64> captureTimes;
+	CMetadataScanner::This().GetCaptureTimes(files, captureTimes);
+	::InterlockedExchange(&CMetadataScanner::This().m_nBackgroundScanRunning, 0);
+	::PostMessage(pJob->WndNotify, WM_CAPTURE_TIMES_SCANNED, 0, 0);
+	delete pJob;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+// Public interface
+///////////////////////////////////////////////////////////////////////////////////
+
+CMetadataScanner& CMetadataScanner::This() {
+	if (sm_instance == NULL) {
+		sm_instance = new CMetadataScanner();
+	}
+	return *sm_instance;
+}
+
+CMetadataScanner::CMetadataScanner() {
+	::InitializeCriticalSection(&m_csCache);
+	m_bCacheLoaded = false;
+	m_bCacheModified = false;
+	m_nBackgroundScanRunning = 0;
+}
+
+bool CMetadataScanner::ReadCaptureTime(LPCTSTR sFileName, FILETIME& captureTime) {
+	CMetadataFile file(sFileName);
+	uint8 header[16];
+	EXIFBlock exif;
+	if (!file.Read(0, header, sizeof(header)) || !ReadEXIF(file, header, exif)) {
+		return false;
+	}
+	CEXIFReader exifReader(&exif.APP1[0], IF_JPEG);
+	if (!exifReader.GetAcquisitionTimePresent()) {
+		return false;
+	}
+	return ::SystemTimeToFileTime(&exifReader.GetAcquisitionTime(), &captureTime) != FALSE;
+}
+
+bool CMetadataScanner::ProbeImage(LPCTSTR sFileName, CImageHeaderInfo& info) {
+	info = CImageHeaderInfo();
+	CMetadataFile file(sFileName);
+	uint8 header[16];
+	if (!file.Read(0, header, sizeof(header))) {
+		return false;
+	}
+	info.Format = Helpers::GetImageFormat(header, sizeof(header), sFileName);
+	bool bSizeKnown = ProbeFormat(file, header, info) && info.Width > 0 && info.Height > 0;
+
+	EXIFBlock exif;
+	if (ReadEXIF(file, header, exif)) {
+		CEXIFReader exifReader(&exif.APP1[0], info.Format);
+		if (info.Orientation == 0 && exifReader.ImageOrientationPresent()) {
+			info.Orientation = exifReader.GetImageOrientation();
+		}
+		int nThumbOffset = exifReader.GetJPEGThumbStreamOffset();
+		int nThumbSize = exifReader.GetJPEGThumbStreamLen();
+		if (exifReader.HasJPEGCompressedThumbnail() && nThumbOffset > 0 && nThumbSize > 0 && nThumbOffset + nThumbSize <= (int)exif.APP1.size() - 16) {
+			info.ThumbnailOffset = exif.FileOffset + nThumbOffset;
+			info.ThumbnailSize = nThumbSize;
+		}
+	}
+	return bSizeKnown;
+}
+
+void CMetadataScanner::GetCaptureTimes(const std::vector<const CFileDesc*>& files, std::vector<unsigned __int64>& captureTimes) {
+	std::vector<bool> found;
+	if (GetCachedCaptureTimes(files, captureTimes, found)) {
+		return;
+	}
+	std::vector<int> indicesToScan;
+	for (int i = 0; i < (int)files.size(); i++) {
+		if (!found[i]) indicesToScan.push_back(i);
+	}
+
+	// scan the files not in the cache, the calling thread takes part in scanning
+	ScanContext context;
+	context.Files = &files;
+	context.IndicesToScan = &indicesToScan;
+	context.CaptureTimes = &captureTimes;
+	context.NextIndex = 0;
+	int nThreads = min((int)indicesToScan.size() / 16, MAX_SCAN_THREADS - 1);
+	context.RunningThreads = nThreads + 1; // including the calling thread
+	context.EventFinished = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+	for (int i = 0; i < nThreads; i++) {
+		if ((HANDLE)_beginthread(ScanThreadFunc, 0, &context) == (HANDLE)-1) {
+			::InterlockedDecrement(&context.RunningThreads); // the other threads scan the remaining files
+		}
+	}
+	ScanFiles(context);
+	if (::InterlockedDecrement(&context.RunningThreads) != 0) {
+		::WaitForSingleObject(context.EventFinished, INFINITE);
+	}
+	::CloseHandle(context.EventFinished);
+
+	{
+		Helpers::CAutoCriticalSection lock(m_csCache);
+		if (m_cache.size() + indicesToScan.size() > MAX_CACHE_ENTRIES) {
+			m_cache.clear();
+		}
+		for (int nIndex : indicesToScan) {
+			const FILETIME& modTime = files[nIndex]->GetLastModTime();
+			CacheEntry entry;
+			entry.ModificationTime = ((unsigned __int64)modTime.dwHighDateTime << 32) | modTime.dwLowDateTime;
+			entry.CaptureTime = captureTimes[nIndex];
+			m_cache[CacheKey(files[nIndex]->GetName())] = entry;
+		}
+		m_bCacheModified = true; // saved on exit
+	}
+}
+
+bool CMetadataScanner::GetCachedCaptureTimes(const std::vector<const CFileDesc*>& files, std::vector<unsigned __int64>& captureTimes, std::vector<bool>& found) {
+	captureTimes.assign(files.size(), 0);
+	found.assign(files.size(), false);
+	bool bAllFound = true;
+	Helpers::CAutoCriticalSection lock(m_csCache);
+	if (!m_bCacheLoaded) {
+		LoadCache();
+	}
+	for (int i = 0; i < (int)files.size(); i++) {
+		const FILETIME& modTime = files[i]->GetLastModTime();
+		unsigned __int64 nModTime = ((unsigned __int64)modTime.dwHighDateTime << 32) | modTime.dwLowDateTime;
+		auto iter = m_cache.find(CacheKey(files[i]->GetName()));
+		if (iter != m_cache.end() && iter->second.ModificationTime == nModTime) {
+			captureTimes[i] = iter->second.CaptureTime;
+			found[i] = true;
+		} else {
+			bAllFound = false;
+		}
+	}
+	return bAllFound;
+}
+
+void CMetadataScanner::ScanCaptureTimesAsync(const std::vector<const CFileDesc*>& files, HWND hWndNotify) {
+	if (files.empty() || ::InterlockedCompareExchange(&m_nBackgroundScanRunning, 1, 0) != 0) {
+		return;
+	}
+	BackgroundScanJob* pJob = new BackgroundScanJob();
+	pJob->Files.reserve(files.size());
+	for (const CFileDesc* pFileDesc : files) {
+		pJob->Files.push_back(*pFileDesc);
+	}
+	pJob->WndNotify = hWndNotify;
+	if ((HANDLE)_beginthread(BackgroundScanThreadFunc, 0, pJob) == (HANDLE)-1) {
+		delete pJob;
+		::InterlockedExchange(&m_nBackgroundScanRunning, 0);
+	}
+}
+
+// Cache file format: magic, version, number of entries, followed by the entries. Each entry consists of
+// the modification time, the capture time (both 64 bit), the length of the file name and the file name (UTF-16).
+void CMetadataScanner::SaveCache() {
+	// only the serialization needs the lock, not writing the file
+	std::vector<uint8> buffer;
+	{
+		Helpers::CAutoCriticalSection lock(m_csCache);
+		if (!m_bCacheModified) {
+			return;
+		}
+		m_bCacheModified = false;
+
+		uint32 header[3] = { CACHE_MAGIC, CACHE_VERSION, (uint32)m_cache.size() };
+		buffer.insert(buffer.end(), (uint8*)header, (uint8*)(header + 3));
+		for (const auto& entry : m_cache) {
+			uint32 nLength = (uint32)entry.first.size();
+			buffer.insert(buffer.end(), (uint8*)&entry.second.ModificationTime, (uint8*)(&entry.second.ModificationTime + 1));
+			buffer.insert(buffer.end(), (uint8*)&entry.second.CaptureTime, (uint8*)(&entry.second.CaptureTime + 1));
+			buffer.insert(buffer.end(), (uint8*)&nLength, (uint8*)(&nLength + 1));
+			buffer.insert(buffer.end(), (uint8*)entry.first.c_str(), (uint8*)(entry.first.c_str() + nLength));
+		}
+	}
+
+	// Create the directory in the application data path if it does not exist
+	if (::GetFileAttributes(Helpers::JPEGViewAppDataPath()) == INVALID_FILE_ATTRIBUTES) {
+		::CreateDirectory(Helpers::JPEGViewAppDataPath(), NULL);
+	}
+	HANDLE hFile = ::CreateFile(GetCacheFileName(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile != INVALID_HANDLE_VALUE) {
+		DWORD numWritten;
+		::WriteFile(hFile, &buffer[0], (DWORD)buffer.size(), &numWritten, NULL);
+		::CloseHandle(hFile);
+	}
+}
+
+// Loads the cache file, a missing or invalid cache file is no error
+void CMetadataScanner::LoadCache() {
+	m_bCacheLoaded = true;
+	HANDLE hFile = ::CreateFile(GetCacheFileName(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	std::vector<uint8> buffer;
+	LARGE_INTEGER size;
+	if (::GetFileSizeEx(hFile, &size) && size.QuadPart >= 12 && size.QuadPart < 256 * 1024 * 1024) {
+		buffer.resize((size_t)size.QuadPart);
+		DWORD numRead;
+		if (!::ReadFile(hFile, &buffer[0], (DWORD)buffer.size(), &numRead, NULL) || numRead != buffer.size()) {
+			buffer.clear();
+		}
+	}
+	::CloseHandle(hFile);
+	if (buffer.empty()) {
+		return;
+	}
+
+	const uint8* p = &buffer[0];
+	const uint8* pEnd = p + buffer.size();
+	const uint32* pHeader = (const uint32*)p;
+	if (pHeader[0] != CACHE_MAGIC || pHeader[1] != CACHE_VERSION) {
+		return;
+	}
+	uint32 nEntries = pHeader[2];
+	p += 12;
+	for (uint32 i = 0; i < nEntries && p + 20 <= pEnd; i++) {
+		CacheEntry entry;
+		memcpy(&entry.ModificationTime, p, 8);
+		memcpy(&entry.CaptureTime, p + 8, 8);
+		uint32 nLength;
+		memcpy(&nLength, p + 16, 4);
+		p += 20;
+		if (nLength > (uint32)(pEnd - p) / sizeof(wchar_t)) {
+			break;
+		}
+		m_cache[std::wstring((const wchar_t*)p, nLength)] = entry;
+		p += nLength * sizeof(wchar_t);
+	}
+}
+
+CString CMetadataScanner::GetCacheFileName() {
+	return CString(Helpers::JPEGViewAppDataPath()) + CAPTURE_TIME_CACHE_NAME;
+}
+
+std::wstring CMetadataScanner::CacheKey(LPCTSTR sFileName) {
+	std::wstring key(sFileName);
+	std::transform(key.begin(), key.end(), key.begin(), ::towlower);
+	return key;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+class CFileDesc;
+
+// Image information read from the headers of an image file by CMetadataScanner::ProbeImage().
+// Values that cannot be determined without decoding the image are zero.
+class CImageHeaderInfo {
+public:
+	CImageHeaderInfo() {
+		Format = IF_Unknown;
+		Width = Height = Channels = Orientation = FrameCount = ThumbnailSize = 0;
+		ThumbnailOffset = 0;
+	}
+
+	EImageFormat Format;
+	int Width; // size of the image as stored, before applying the orientation
+	int Height;
+	int Channels; // number of channels stored in the file, including alpha
+	int Orientation; // EXIF orientation (1-8). Note that the JPEG XL and HEIF/AVIF decoders apply the orientation themselves.
+	int FrameCount; // number of frames respectively pages, 0 if only known after reading the whole file (e.g. GIF)
+	__int64 ThumbnailOffset; // position of the JPEG compressed EXIF thumbnail in the file
+	int ThumbnailSize; // size of the EXIF thumbnail in bytes, 0 if there is no thumbnail
+};
+
+// Reads metadata of image files without decoding the images, only the headers and the metadata region of a file are read.
+// For the EXIF data, these are the APP1 block of JPEGs, the TIFF header of TIFF based camera RAW files,
+// the eXIf chunk of PNGs, the EXIF chunk of WebPs and the Exif item/box of HEIF, AVIF and JPEG XL files.
+// The capture dates are cached persistently, keyed by file name and modification time.
+class CMetadataScanner
+{
+public:
+	// Singleton instance
+	static CMetadataScanner& This();
+
+	// Reads the capture date of the given file, returns false if the file has no capture date.
+	// The capture date is in local time, as stored in the EXIF data.
+	static bool ReadCaptureTime(LPCTSTR sFileName, FILETIME& captureTime);
+
+	// Reads format, size, channels, orientation, frame count and EXIF thumbnail location from the headers of the file
+	// (JPEG SOF, PNG IHDR/acTL, WebP VP8X/VP8/VP8L, JPEG XL size header, HEIF/AVIF ispe, TIFF IFD, PSD, BMP, TGA and QOI headers).
+	// Returns false if the size of the image cannot be determined this way, the other values may be set anyway.
+	static bool ProbeImage(LPCTSTR sFileName, CImageHeaderInfo& info);
+
+	// Gets the capture dates of the given files as 64 bit FILETIME values, 0 for files without capture date.
+	// Files not found in the cache are scanned in parallel. Can be called from any thread.
+	void GetCaptureTimes(const std::vector<const CFileDesc*>& files, std::vector<unsigned __int64>& captureTimes);
+
+	// Gets the capture times of the given files from the cache only, no file is read. The found flags of the files
+	// not in the cache are false and their capture times 0. Returns if all files have been found in the cache.
+	bool GetCachedCaptureTimes(const std::vector<const CFileDesc*>& files, std::vector<unsigned __int64>& captureTimes, std::vector<bool>& found);
+
+	// Scans the capture times of the given files on a background thread and adds them to the cache. The message
+	// WM_CAPTURE_TIMES_SCANNED is posted to the given window when done. Does nothing while another background scan
+	// is running, the files still missing in the cache shall be requested again when receiving the message.
+	void ScanCaptureTimesAsync(const std::vector<const CFileDesc*>& files, HWND hWndNotify);
+
+	// Writes the cache to disk if it has been modified, called on exit
+	void SaveCache();
+
+private:
+	struct CacheEntry {
+		unsigned __int64 ModificationTime;
+		unsigned __int64 CaptureTime;
+	};
+
+	static CMetadataScanner* sm_instance;
+
+	CRITICAL_SECTION m_csCache; // protects the members below
+	std::unordered_map<std::wstring, CacheEntry> m_cache; // key is the lower case file name with path
+	bool m_bCacheLoaded;
+	bool m_bCacheModified;
+	volatile LONG m_nBackgroundScanRunning; // 1 while ScanCaptureTimesAsync() scans
+
+	struct BackgroundScanJob;
+	static void __cdecl BackgroundScanThreadFunc(void* arg);
+
+	CMetadataScanner();
+	void LoadCache();
+	static CString GetCacheFileName();
+	static std::wstring CacheKey(LPCTSTR sFileName);
+};
@@ -0,0 +1,19 @@
+#include "StdAfx.h"
+#include "OverscanThread.h"
+#include "JPEGImage.h"
+
+COverscanThread* COverscanThread::sm_instance;
+
+COverscanThread& COverscanThread::This() {
+	if (sm_instance == NULL) {
+		sm_instance = new COverscanThread();
+	}
+	return *sm_instance;
+}
+
+void COverscanThread::ProcessRequest(CRequestBase& request) {
+	COverscanRequest& rq = (COverscanRequest&)request;
+	if (!rq.Cancel) {
+		rq.Image->ResampleOverscanSection(rq);
+	}
+}
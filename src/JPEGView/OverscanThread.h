@@ -0,0 +1,84 @@
+#pragma once
+
+#include "ProcessParams.h"
+#include "WorkThread.h"
+
+class CJPEGImage;
+
+// Section of the resampled image around the visible area (the visible area plus a margin) and the parameters
+// it has been resampled with. Pans staying within the section are served by copying from the section.
+class COverscanSection {
+public:
+	COverscanSection() {
+		FullTargetSize = CSize(0, 0);
+		Rect = CRect(0, 0, 0, 0);
+		ProcFlags = PFLAG_None;
+		Sharpen = 0.0;
+		Pixels = NULL;
+	}
+
+	COverscanSection(CSize fullTargetSize, CRect rect, EProcessingFlags eProcFlags, double dSharpen) {
+		FullTargetSize = fullTargetSize;
+		Rect = rect;
+		ProcFlags = eProcFlags;
+		Sharpen = dSharpen;
+		Pixels = NULL;
+	}
+
+	// Gets if the section has been resampled with the given geometry and parameters
+	bool HasSameParameters(CSize fullTargetSize, EProcessingFlags eProcFlags, double dSharpen) const {
+		bool bHQ = GetProcessingFlag(ProcFlags, PFLAG_HighQualityResampling);
+		return FullTargetSize == fullTargetSize && bHQ == GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling) &&
+			(!bHQ || fabs(Sharpen - dSharpen) <= 1e-2);
+	}
+
+	// Gets if the section contains the given rectangle (in full target image coordinates)
+	bool Contains(const CRect& rect) const {
+		return rect.left >= Rect.left && rect.top >= Rect.top && rect.right <= Rect.right && rect.bottom <= Rect.bottom;
+	}
+
+	CSize FullTargetSize;
+	CRect Rect; // in the coordinates of the full target image
+	EProcessingFlags ProcFlags;
+	double Sharpen;
+	void* Pixels; // 32 bpp DIB of the size of Rect, allocated from the buffer pool, NULL if not available
+};
+
+// Request for resampling an overscan section of an image in the background
+class COverscanRequest : public CRequestBase {
+public:
+	// The pixels of the reused section are copied where it overlaps the new section, only the rest is resampled.
+	// The pixels of the reused section must not be freed before the request has been processed.
+	COverscanRequest(CJPEGImage* pImage, const COverscanSection& section, const COverscanSection& reusedSection)
+		: CRequestBase(::CreateEvent(0, TRUE, FALSE, NULL)) {
+		Image = pImage;
+		Section = section;
+		ReusedSection = reusedSection;
+		Cancel = false;
+	}
+
+	CJPEGImage* Image;
+	COverscanSection Section; // the resampled pixels are set by the thread, NULL if resampling failed or was cancelled
+	COverscanSection ReusedSection;
+	volatile bool Cancel; // set to stop resampling as soon as possible
+};
+
+// Thread resampling the overscan sections of the displayed image in the background.
+// The resampling itself is done on the processing thread pool, requests of the GUI thread take precedence there.
+class COverscanThread : public CWorkThread {
+public:
+	// Singleton instance, creation is not thread safe
+	static COverscanThread& This();
+
+	// Posts the request and returns immediately. The EventFinished of the request is signaled when processing is finished.
+	// Ownership of the request goes to the thread. The caller must close the EventFinished handle and set the Deleted flag
+	// of the request after having taken the result, the request object must not be accessed after that.
+	void ProcessAsync(COverscanRequest* pRequest) { CWorkThread::ProcessAsync(pRequest); }
+
+private:
+	static COverscanThread* sm_instance;
+
+	COverscanThread(void) : CWorkThread(false) {}
+
+	virtual void ProcessRequest(CRequestBase& request);
+};
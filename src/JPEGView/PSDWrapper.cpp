@@ -49,9 +49,13 @@
 #include "TJPEGWrapper.h"
 #include "ICCProfileTransform.h"
 #include "SettingsProvider.h"
+#include "ProcessingThreadPool.h"
+#include "zlib.h"
+#include <emmintrin.h>
 
 
 #define PSD_HEADER_SIZE 26
+#define PSD_ROWS_PER_BLOCK 64
 
 // Throw exception if bShouldThrow is true. Setting a breakpoint in here is useful for debugging
 static inline void ThrowIf(bool bShouldThrow) {
@@ -100,15 +104,176 @@ static inline void SeekFile(HANDLE file, LONG offset) {
 }
 
 // Move file pointer to offset from beginning of file
-static inline void SeekFileFromStart(HANDLE file, LONG offset) {
-	ThrowIf(::SetFilePointer(file, offset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER);
+static inline void SeekFileFromStart(HANDLE file, unsigned long long offset) {
+	LARGE_INTEGER pos;
+	pos.QuadPart = offset;
+	ThrowIf(!::SetFilePointerEx(file, pos, NULL, FILE_BEGIN));
 }
 
 // Get current position in the file
-static inline unsigned int TellFile(HANDLE file) {
-	unsigned int ret = ::SetFilePointer(file, 0, NULL, FILE_CURRENT);
-	ThrowIf(ret == INVALID_SET_FILE_POINTER);
-	return ret;
+static inline unsigned long long TellFile(HANDLE file) {
+	LARGE_INTEGER pos, ret;
+	pos.QuadPart = 0;
+	ThrowIf(!::SetFilePointerEx(file, pos, &ret, FILE_CURRENT));
+	return ret.QuadPart;
+}
+
+// Merged image data of a PSD file, decoded in blocks of rows in parallel on the processing thread pool
+struct PsdImageData {
+	const unsigned char* pData; // planar image data (uncompressed) or RLE compressed rows
+	const unsigned char* pDataEnd;
+	unsigned char* pInflated; // planar image data inflated from ZIP compressed data, NULL if not ZIP compressed
+	std::vector<const unsigned char*> RowStart; // RLE compressed rows, index is channel * nHeight + row
+	bool bRLE;
+	bool bPrediction; // ZIP with prediction, the rows are delta encoded
+	bool bLab;
+	unsigned char* pPixelData;
+	unsigned int nWidth, nHeight;
+	int nRowSize;
+	int nChannels;
+	volatile bool bError;
+};
+
+// Channel in the BGR(A) pixel for a channel in the file. The channels are stored RGB(A), Lab stays in file order.
+static inline unsigned TargetChannel(unsigned channel, unsigned nChannels, bool bLab) {
+	return bLab ? channel : (-channel - 2) % nChannels;
+}
+
+// Decodes a PackBits compressed row, returns false if the compressed data ends before the row is complete.
+// Runs that exceed the row are cut.
+static bool DecodeRLERow(const unsigned char* p, const unsigned char* pEnd, unsigned char* pRow, unsigned int nWidth) {
+	unsigned int count = 0;
+	while (count < nWidth) {
+		if (p >= pEnd) {
+			return false;
+		}
+		unsigned char c = *p++;
+		if (c > 128) {
+			if (p >= pEnd) {
+				return false;
+			}
+			unsigned int n = min(257u - c, nWidth - count);
+			memset(pRow + count, *p++, n);
+			count += n;
+		} else if (c < 128) {
+			unsigned int n = c + 1u;
+			if (n > (unsigned int)(pEnd - p)) {
+				return false;
+			}
+			memcpy(pRow + count, p, min(n, nWidth - count));
+			p += n;
+			count += n;
+		}
+	}
+	return true;
+}
+
+// Interleaves the planes (in BGR(A) order) of one row into the pixels of the row
+static void InterleaveRow(const unsigned char* const* pPlanes, int nChannels, unsigned int nWidth, unsigned char* pTarget) {
+	unsigned int x = 0;
+	if (nChannels == 4) {
+		for (; x + 16 <= nWidth; x += 16) {
+			__m128i b = _mm_loadu_si128((const __m128i*)(pPlanes[0] + x));
+			__m128i g = _mm_loadu_si128((const __m128i*)(pPlanes[1] + x));
+			__m128i r = _mm_loadu_si128((const __m128i*)(pPlanes[2] + x));
+			__m128i a = _mm_loadu_si128((const __m128i*)(pPlanes[3] + x));
+			__m128i bgLow = _mm_unpacklo_epi8(b, g);
+			__m128i bgHigh = _mm_unpackhi_epi8(b, g);
+			__m128i raLow = _mm_unpacklo_epi8(r, a);
+			__m128i raHigh = _mm_unpackhi_epi8(r, a);
+			__m128i* pDst = (__m128i*)(pTarget + x * 4);
+			_mm_storeu_si128(pDst, _mm_unpacklo_epi16(bgLow, raLow));
+			_mm_storeu_si128(pDst + 1, _mm_unpackhi_epi16(bgLow, raLow));
+			_mm_storeu_si128(pDst + 2, _mm_unpacklo_epi16(bgHigh, raHigh));
+			_mm_storeu_si128(pDst + 3, _mm_unpackhi_epi16(bgHigh, raHigh));
+		}
+	}
+	for (; x < nWidth; x++) {
+		for (int channel = 0; channel < nChannels; channel++) {
+			pTarget[x * nChannels + channel] = pPlanes[channel][x];
+		}
+	}
+}
+
+// The image data is read from a view of the mapped file. If the file cannot be read (truncated file, network
+// share disconnected), accessing the view raises EXCEPTION_IN_PAGE_ERROR, this must fail the load and not crash.
+static int InPageErrorFilter(DWORD nExceptionCode) {
+	return (nExceptionCode == EXCEPTION_IN_PAGE_ERROR) ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH;
+}
+
+// Gets the start of the RLE compressed rows from the byte counts preceding them, returns false if the view cannot be read
+static bool GetRLERowStarts(const unsigned char* pImageData, size_t nImageDataSize, size_t nByteCountsSize, unsigned short nVersion,
+	const unsigned char** pRowStart, size_t nNumRows) {
+	__try {
+		size_t nRowOffset = nByteCountsSize;
+		for (size_t i = 0; i < nNumRows; i++) {
+			pRowStart[i] = pImageData + min(nRowOffset, nImageDataSize);
+			if (nVersion == 2) {
+				nRowOffset += _byteswap_ulong(*(unsigned int*)(pImageData + i * 4));
+			} else {
+				nRowOffset += _byteswap_ushort(*(unsigned short*)(pImageData + i * 2));
+			}
+		}
+		return true;
+	}
+	__except (InPageErrorFilter(GetExceptionCode())) {
+		return false;
+	}
+}
+
+// Inflates the ZIP compressed data from the view, returns the zlib result
+static int InflateFromView(unsigned char* pDest, unsigned long* pDestSize, const unsigned char* pSource, unsigned long nSourceSize) {
+	__try {
+		return uncompress(pDest, pDestSize, pSource, nSourceSize);
+	}
+	__except (InPageErrorFilter(GetExceptionCode())) {
+		return Z_DATA_ERROR;
+	}
+}
+
+// Decodes the rows of the given block for all channels
+static void DecodeRows(PsdImageData& data, int nBlock) {
+	unsigned int nFirstRow = nBlock * PSD_ROWS_PER_BLOCK;
+	unsigned int nEndRow = min(data.nHeight, nFirstRow + PSD_ROWS_PER_BLOCK);
+	std::vector<unsigned char> decodedRows;
+	if (data.bRLE) {
+		decodedRows.resize((size_t)data.nWidth * data.nChannels);
+	}
+	const unsigned char* pPlanes[4];
+	for (unsigned int row = nFirstRow; row < nEndRow && !data.bError; row++) {
+		for (int channel = 0; channel < data.nChannels; channel++) {
+			unsigned char* pRow;
+			if (data.bRLE) {
+				pRow = &decodedRows[(size_t)channel * data.nWidth];
+				if (!DecodeRLERow(data.RowStart[channel * data.nHeight + row], data.pDataEnd, pRow, data.nWidth)) {
+					data.bError = true;
+					return;
+				}
+			} else if (data.pInflated != NULL) {
+				pRow = data.pInflated + ((size_t)channel * data.nHeight + row) * data.nWidth;
+				if (data.bPrediction) {
+					for (unsigned int x = 1; x < data.nWidth; x++) {
+						pRow[x] += pRow[x - 1];
+					}
+				}
+			} else {
+				pRow = (unsigned char*)data.pData + ((size_t)channel * data.nHeight + row) * data.nWidth;
+			}
+			pPlanes[TargetChannel(channel, data.nChannels, data.bLab)] = pRow;
+		}
+		InterleaveRow(pPlanes, data.nChannels, data.nWidth, data.pPixelData + (size_t)row * data.nRowSize);
+	}
+}
+
+// Decodes the rows of the given block, called on the thread pool threads
+static void DecodeRowBlock(void* pContext, int nBlock, int /* nThreadIndex */) {
+	PsdImageData& data = *(PsdImageData*)pContext;
+	__try {
+		DecodeRows(data, nBlock);
+	}
+	__except (InPageErrorFilter(GetExceptionCode())) {
+		data.bError = true;
+	}
 }
 
 CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
@@ -118,7 +283,10 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 	if (hFile == INVALID_HANDLE_VALUE) {
 		return NULL;
 	}
-	char* pBuffer = NULL;
+	HANDLE hMapping = NULL;
+	const unsigned char* pFileView = NULL;
+	PsdImageData data;
+	data.pInflated = NULL;
 	void* pPixelData = NULL;
 	void* pEXIFData = NULL;
 	char* pICCProfile = NULL;
@@ -274,23 +442,29 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 		} else {
 			nLayerSize = ReadUIntFromFile(hFile);
 		}
+		unsigned long long nLayerSectionStart = TellFile(hFile);
 		unsigned char nLayerSizeBytes = 4 * nVersion;
 		SeekFile(hFile, nLayerSizeBytes);
 		short nLayerCount = ReadUShortFromFile(hFile);
 		bUseAlpha = bUseAlpha && (nLayerCount <= 0);
-		SeekFile(hFile, nLayerSize - 2 - nLayerSizeBytes);
+		SeekFileFromStart(hFile, nLayerSectionStart + nLayerSize);
 
 		// Compression. 0 = Raw Data, 1 = RLE compressed, 2 = ZIP without prediction, 3 = ZIP with prediction.
 		unsigned short nCompressionMethod = ReadUShortFromFile(hFile);
-		ThrowIf(nCompressionMethod != COMPRESSION_RLE && nCompressionMethod != COMPRESSION_None);
-
-		unsigned int nImageDataSize = nFileSize - TellFile(hFile);
-		pBuffer = new(std::nothrow) char[nImageDataSize];
-		if (pBuffer == NULL) {
+		ThrowIf(nCompressionMethod > COMPRESSION_ZipWithPrediction);
+
+		// The image data is decoded directly from the mapped file
+		unsigned long long nImageDataStart = TellFile(hFile);
+		ThrowIf(nImageDataStart > (unsigned long long)nFileSize);
+		size_t nImageDataSize = (size_t)(nFileSize - nImageDataStart);
+		hMapping = ::CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		ThrowIf(hMapping == NULL);
+		pFileView = (const unsigned char*)::MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (pFileView == NULL) {
 			bOutOfMemory = true;
 			ThrowIf(true);
 		}
-		ReadFromFile(pBuffer, hFile, nImageDataSize);
+		const unsigned char* pImageData = pFileView + nImageDataStart;
 
 		if (!bUseAlpha && nColorMode != MODE_CMYK) {
 			nChannels = min(nChannels, 3);
@@ -317,95 +491,41 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 		}
 		// TODO: non-8bit, better non-RGB support
 		// non-8bit must first be decompressed as arbitrary data
-		// TODO: continue next row at end of row bytes (to support corrupt images)
-		unsigned char* p = (unsigned char*)pBuffer;
+		data.pData = pImageData;
+		data.pDataEnd = pImageData + nImageDataSize;
+		data.bRLE = nCompressionMethod == COMPRESSION_RLE;
+		data.bPrediction = nCompressionMethod == COMPRESSION_ZipWithPrediction;
+		data.bLab = nColorMode == MODE_Lab;
+		data.pPixelData = (unsigned char*)pPixelData;
+		data.nWidth = nWidth;
+		data.nHeight = nHeight;
+		data.nRowSize = nRowSize;
+		data.nChannels = nChannels;
+		data.bError = false;
+		size_t nPlanesSize = (size_t)nChannels * nHeight * nWidth;
 		if (nCompressionMethod == COMPRESSION_RLE) {
-			// Skip byte counts for scanlines
-			p += nHeight * nRealChannels * 2 * nVersion;
-			unsigned char* pOffset = p;
-			for (unsigned channel = 0; channel < nChannels; channel++) {
-				unsigned rchannel;
-				if (nColorMode == MODE_Lab) {
-					rchannel = channel;
-				} else {
-					rchannel = (-channel - 2) % nChannels;
-				}
-				for (unsigned row = 0; row < nHeight; row++) {
-					p = pOffset;
-
-					for (unsigned count = 0; count < nWidth; ) {
-						unsigned char c;
-						ThrowIf(p >= (unsigned char*)pBuffer + nImageDataSize);
-						c = *p;
-						p += 1;
-
-						if (c > 128) {
-							c = ~c + 2;
-
-							ThrowIf(p >= (unsigned char*)pBuffer + nImageDataSize);
-							unsigned char value = *p;
-							p += 1;
-
-							for (unsigned i = count; i < count + c; i++) {
-								unsigned char* scan = (unsigned char*)pPixelData + row * nRowSize + i * nChannels;
-								unsigned char* pixel = scan + rchannel;
-								ThrowIf(pixel >= (unsigned char*)pPixelData + nRowSize * nHeight);
-								*pixel = value;
-							}
-						} else if (c < 128) {
-							c++;
-
-							for (unsigned i = count; i < count + c; i++) {
-								ThrowIf(p >= (unsigned char*)pBuffer + nImageDataSize);
-								unsigned char value = *p;
-								p += 1;
-
-								unsigned char* scan = (unsigned char*)pPixelData + row * nRowSize + i * nChannels;
-								unsigned char* pixel = scan + rchannel;
-								ThrowIf(pixel >= (unsigned char*)pPixelData + nRowSize * nHeight);
-								*pixel = value;
-							}
-						}
-
-						count += c;
-					}
-
-					if (nVersion == 2) {
-						pOffset += _byteswap_ulong(*(unsigned int*)(pBuffer + (channel * nHeight + row) * 4));
-					} else {
-						pOffset += _byteswap_ushort(*(unsigned short*)(pBuffer + (channel * nHeight + row) * 2));
-					}
-#ifdef DEBUG
-					if (p != pOffset) {
-						WCHAR buf[100];
-						swprintf(buf, _T("Misaligned scan line bytes (%+d) for channel %d row %d\n"), p - pOffset, channel, row);
-						::OutputDebugString(buf);
-					}
-#endif
-				}
-			}
-		} else { // No compression
-			for (unsigned channel = 0; channel < nChannels; channel++) {
-				unsigned rchannel;
-				if (nColorMode == MODE_Lab) {
-					rchannel = channel;
-				} else {
-					rchannel = (-channel - 2) % nChannels;
-				}
-				for (unsigned row = 0; row < nHeight; row++) {
-					for (unsigned count = 0; count < nWidth; count++) {
-						ThrowIf(p >= (unsigned char*)pBuffer + nImageDataSize);
-						unsigned char value = *p;
-						p += 1;
-
-						unsigned char* scan = (unsigned char*)pPixelData + row * nRowSize + count * nChannels;
-						unsigned char* pixel = scan + rchannel;
-						ThrowIf(pixel >= (unsigned char*)pPixelData + nRowSize * nHeight);
-						*pixel = value;
-					}
-				}
+			// The byte counts of all rows of all channels precede the compressed rows, this gives the start of each row
+			size_t nByteCountsSize = (size_t)nHeight * nRealChannels * 2 * nVersion;
+			ThrowIf(nByteCountsSize > nImageDataSize);
+			data.RowStart.resize((size_t)nChannels * nHeight);
+			ThrowIf(!GetRLERowStarts(pImageData, nImageDataSize, nByteCountsSize, nVersion, &data.RowStart[0], data.RowStart.size()));
+		} else if (nCompressionMethod == COMPRESSION_None) {
+			ThrowIf(nPlanesSize > nImageDataSize);
+		} else {
+			// ZIP, all channels are compressed in one zlib stream
+			ThrowIf(nPlanesSize > ULONG_MAX || nImageDataSize > ULONG_MAX);
+			data.pInflated = new(std::nothrow) unsigned char[nPlanesSize];
+			if (data.pInflated == NULL) {
+				bOutOfMemory = true;
+				ThrowIf(true);
 			}
+			unsigned long nInflatedSize = (unsigned long)nPlanesSize;
+			// Z_BUF_ERROR is returned when the stream contains more channels than decoded
+			int nResult = InflateFromView(data.pInflated, &nInflatedSize, pImageData, (unsigned long)nImageDataSize);
+			ThrowIf((nResult != Z_OK && nResult != Z_BUF_ERROR) || nInflatedSize != nPlanesSize);
 		}
+		CProcessingThreadPool::This().ParallelFor(0, (nHeight + PSD_ROWS_PER_BLOCK - 1) / PSD_ROWS_PER_BLOCK, &data, DecodeRowBlock);
+		ThrowIf(data.bError);
 
 		ICCProfileTransform::DoTransform(transform, pPixelData, pPixelData, nWidth, nHeight, nRowSize);
 
@@ -423,11 +543,17 @@ CJPEGImage* PsdReader::ReadImage(LPCTSTR strFileName, bool& bOutOfMemory)
 		delete Image;
 		Image = NULL;
 	}
+	if (pFileView != NULL) {
+		::UnmapViewOfFile(pFileView);
+	}
+	if (hMapping != NULL) {
+		::CloseHandle(hMapping);
+	}
 	::CloseHandle(hFile);
 	if (Image == NULL) {
 		delete[] pPixelData;
 	}
-	delete[] pBuffer;
+	delete[] data.pInflated;
 	delete[] pEXIFData;
 	delete[] pICCProfile;
 	ICCProfileTransform::DeleteTransform(transform);
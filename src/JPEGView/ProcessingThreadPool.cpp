@@ -23,6 +23,34 @@ public:
 	int SizeY;
 };
 
+// Request for ParallelFor(), one row per thread. The values of the range are handed out to the threads dynamically.
+class CRangeRequest : public CProcessingRequest {
+public:
+	CRangeRequest(int nStart, int nEnd, int nNumThreads, void* pContext, void (*pFunction)(void*, int, int))
+		: CProcessingRequest(NULL, CSize(1, nNumThreads), NULL, CSize(1, nNumThreads), CPoint(0, 0), CSize(1, nNumThreads)) {
+		StripPadding = 1;
+		m_nNextValue = nStart;
+		m_nEnd = nEnd;
+		m_pContext = pContext;
+		m_pFunction = pFunction;
+	}
+
+	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		// the row is the thread index
+		LONG nValue;
+		while ((nValue = ::InterlockedIncrement(&m_nNextValue) - 1) < m_nEnd) {
+			m_pFunction(m_pContext, nValue, offsetY);
+		}
+		return true;
+	}
+
+private:
+	volatile LONG m_nNextValue;
+	int m_nEnd;
+	void* m_pContext;
+	void (*m_pFunction)(void*, int, int);
+};
+
 
 // Worker thread in thread pool, executing image processing operations on image strips
 class CProcessingThread : public CWorkThread {
@@ -52,6 +80,7 @@ CProcessingThreadPool& CProcessingThreadPool::This() {
 }
 
 void CProcessingThreadPool::CreateThreadPoolThreads() {
+	m_nMainThreadId = ::GetCurrentThreadId();
 	m_nNumThreads = CSettingsProvider::This().NumberOfCoresToUse() - 1;
 	if (m_nNumThreads > 0) {
 		m_threads = new CProcessingThread*[m_nNumThreads];
@@ -87,32 +116,52 @@ bool CProcessingThreadPool::Process(CProcessingRequest* pRequest) {
 			while ((nSliceCY = ~(pRequest->StripPadding - 1) & (nTargetCY / nNumThreadsUsed)) < pRequest->StripPadding) {
 				nNumThreadsUsed--;
 			}
-			int nLastCY = nTargetCY - (nNumThreadsUsed - 1)*nSliceCY;
-			volatile LONG nRequestThreadCounter = nNumThreadsUsed - 1;
-			int nCurrCY = 0;
-			HANDLE eventFinished = ::CreateEvent(0, TRUE, FALSE, NULL);
-			CWrappedRequest** pAllWrappedRequests = new CWrappedRequest*[nNumThreadsUsed-1];
-			for (int i = 0; i < nNumThreadsUsed-1; i++) {
-				pAllWrappedRequests[i] = new CWrappedRequest(pRequest, nCurrCY, nSliceCY, eventFinished);
-				pAllWrappedRequests[i]->EventFinishedCounter = &nRequestThreadCounter;
-				m_threads[i]->StartProcess(pAllWrappedRequests[i]);
-				nCurrCY += nSliceCY;
-			}
-			CProcessingThread::DoProcess(pRequest, nCurrCY, nLastCY);
-			::WaitForSingleObject(eventFinished, INFINITE);
-			::CloseHandle(eventFinished);
-			for (int i = 0; i < nNumThreadsUsed-1; i++) {
-				pAllWrappedRequests[i]->Deleted = true; // thread pool threads will remove the requests from the queue
-			}
-			delete [] pAllWrappedRequests;
+			ProcessOnAllThreads(pRequest, nNumThreadsUsed, nSliceCY);
 		}
 	}
 	return pRequest->Success;
 }
 
+void CProcessingThreadPool::ParallelFor(int nStart, int nEnd, void* pContext, void (*pFunction)(void* pContext, int nValue, int nThreadIndex)) {
+	int nNumThreadsUsed = min(m_nNumThreads + 1, nEnd - nStart);
+	if (nNumThreadsUsed <= 1) {
+		for (int nValue = nStart; nValue < nEnd; nValue++) {
+			pFunction(pContext, nValue, 0);
+		}
+	} else {
+		CRangeRequest request(nStart, nEnd, nNumThreadsUsed, pContext, pFunction);
+		ProcessOnAllThreads(&request, nNumThreadsUsed, 1);
+	}
+}
+
+void CProcessingThreadPool::ProcessOnAllThreads(CProcessingRequest* pRequest, int nNumThreadsUsed, int nSliceCY) {
+	int nTargetCY = pRequest->ClippedTargetSize.cy;
+	int nLastCY = nTargetCY - (nNumThreadsUsed - 1)*nSliceCY;
+	int nPriority = (::GetCurrentThreadId() == m_nMainThreadId) ? 1 : 0;
+	volatile LONG nRequestThreadCounter = nNumThreadsUsed - 1;
+	int nCurrCY = 0;
+	HANDLE eventFinished = ::CreateEvent(0, TRUE, FALSE, NULL);
+	CWrappedRequest** pAllWrappedRequests = new CWrappedRequest*[nNumThreadsUsed-1];
+	for (int i = 0; i < nNumThreadsUsed-1; i++) {
+		pAllWrappedRequests[i] = new CWrappedRequest(pRequest, nCurrCY, nSliceCY, eventFinished);
+		pAllWrappedRequests[i]->EventFinishedCounter = &nRequestThreadCounter;
+		pAllWrappedRequests[i]->Priority = nPriority;
+		m_threads[i]->StartProcess(pAllWrappedRequests[i]);
+		nCurrCY += nSliceCY;
+	}
+	CProcessingThread::DoProcess(pRequest, nCurrCY, nLastCY);
+	::WaitForSingleObject(eventFinished, INFINITE);
+	::CloseHandle(eventFinished);
+	for (int i = 0; i < nNumThreadsUsed-1; i++) {
+		pAllWrappedRequests[i]->Deleted = true; // thread pool threads will remove the requests from the queue
+	}
+	delete [] pAllWrappedRequests;
+}
+
 CProcessingThreadPool::CProcessingThreadPool(void) {
 	m_threads = NULL;
 	m_nNumThreads = 0;
+	m_nMainThreadId = 0;
 }
 
 
@@ -51,13 +51,30 @@ public:
 	// Note that the method does NOT take ownership of the passed request object.
 	// The processing work is distributed to the thread pool threads. The pRequest->ProcessStrip()
 	// method is called to process a strip of the image.
+	// Requests of the thread that created the thread pool (the GUI thread, processing the visible image) are processed
+	// by the thread pool threads before requests of other threads (e.g. read ahead).
 	bool Process(CProcessingRequest* pRequest);
+
+	// Calls pFunction(pContext, nValue, nThreadIndex) for all values in [nStart, nEnd) using all thread pool threads and
+	// the current thread. Each thread takes the next value when done with the previous one.
+	// nThreadIndex is unique among the threads working on the range and smaller than GetNumberOfThreads().
+	// Codecs use this as parallel runner so that all threads of the process come from this pool.
+	void ParallelFor(int nStart, int nEnd, void* pContext, void (*pFunction)(void* pContext, int nValue, int nThreadIndex));
+
+	// Number of threads working in parallel in Process() and ParallelFor(), including the calling thread.
+	// Codecs that can only limit and not share their threads shall not use more threads than this.
+	int GetNumberOfThreads() const { return m_nNumThreads + 1; }
+
+	// Gets if the calling thread is the thread that created the thread pool (the GUI thread)
+	bool IsGUIThread() const { return ::GetCurrentThreadId() == m_nMainThreadId; }
 private:
 	static CProcessingThreadPool* sm_instance;
 
 	CProcessingThread** m_threads;
 	int m_nNumThreads;
+	DWORD m_nMainThreadId; // thread that created the thread pool
 
 	CProcessingThreadPool(void);
+	void ProcessOnAllThreads(CProcessingRequest* pRequest, int nNumThreadsUsed, int nSliceCY);
 };
 
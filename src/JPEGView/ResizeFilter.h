@@ -63,6 +63,17 @@ struct AVXFilterKernelBlock {
 	uint8* UnalignedMemory; // do not use directly
 };
 
+// Gets the length of the kernels with the indices [nFirstIndex, nFirstIndex + nNumIndices) of a FilterKernelBlock,
+// XMMFilterKernelBlock or AVXFilterKernelBlock. The border handling kernels may be shorter, all others have this length.
+// Used to select the filter loops that are specialized for a given kernel length.
+template<class TFilterKernelBlock>
+inline int GetMaxFilterLen(const TFilterKernelBlock& block, int nFirstIndex, int nNumIndices) {
+	int nMaxFilterLen = 0;
+	for (int i = nFirstIndex; i < nFirstIndex + nNumIndices; i++) {
+		nMaxFilterLen = max(nMaxFilterLen, block.Indices[i]->FilterLen);
+	}
+	return nMaxFilterLen;
+}
 
 // Class for resize filters. These filters are one dimensional FIR filters. Because these filters are separable,
 // resizing a 2D image can be done by applying a CResizeFilter to all x-rows, then another CResizeFilter to the
@@ -38,7 +38,7 @@ void CRotationPanelCtl::OnPostPaintMainDlg(HDC hPaintDC) {
 void* CRotationPanelCtl::GetDIBForPreview(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset,
 												 const CImageProcessingParams & imageProcParams, EProcessingFlags eProcFlags) {
 	return CurrentImage()->GetDIBRotated(fullTargetSize, clippingSize, targetOffset, imageProcParams, 
-		SetProcessingFlag(eProcFlags, PFLAG_LDC, false), m_dRotationLQ, m_bShowGrid);
+		eProcFlags, m_dRotationLQ, m_bShowGrid);
 }
 
 void CRotationPanelCtl::TerminatePanel() {
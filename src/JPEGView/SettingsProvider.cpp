@@ -142,6 +142,8 @@ CSettingsProvider::CSettingsProvider(void) {
 		m_nNumCores = Helpers::NumCoresPerPhysicalProc();
 		if (m_nNumCores > 4) m_nNumCores = 4;
 	}
+	m_bUseLargePages = GetBool(_T("UseLargePages"), false);
+	m_nBufferPoolSizeMB = GetInt(_T("BufferPoolSizeMB"), 0, 0, 2048);
 
 	CString sDownSampling = GetString(_T("DownSamplingFilter"), _T("BestQuality"));
 	if (sDownSampling.CompareNoCase(_T("NoAliasing")) == 0) {
@@ -192,6 +194,7 @@ CSettingsProvider::CSettingsProvider(void) {
 	m_bExchangeXButtons = GetBool(_T("ExchangeXButtons"), true);
 	m_bAutoRotateEXIF = GetBool(_T("AutoRotateEXIF"), true);
 	m_bUseEmbeddedColorProfiles = GetBool(_T("UseEmbeddedColorProfiles"), false);
+	m_bApplyColorProfileOnDisplay = GetBool(_T("ApplyColorProfileOnDisplay"), false);
 	m_nDisplayMonitor = GetInt(_T("DisplayMonitor"), -1, -1, 16);
 	m_dAutoContrastAmount = GetDouble(_T("AutoContrastCorrectionAmount"), 0.5, 0.0, 1.0);
 	m_dAutoBrightnessAmount = GetDouble(_T("AutoBrightnessCorrectionAmount"), 0.2, 0.0, 1.0);
@@ -431,6 +434,9 @@ void CSettingsProvider::ReadWriteableINISettings() {
 	else if (sSorting.CompareNoCase(_T("FileSize")) == 0) {
 		m_eSorting = Helpers::FS_FileSize;
 	}
+	else if (sSorting.CompareNoCase(_T("CaptureDate")) == 0) {
+		m_eSorting = Helpers::FS_CaptureTime;
+	}
 	else {
 		m_eSorting = Helpers::FS_LastModTime;
 	}
@@ -488,6 +494,8 @@ void CSettingsProvider::SaveSettings(const CImageProcessingParams& procParams,
 		sSorting = _T("Random");
 	} else if (eFileSorting == Helpers::FS_FileSize) {
 		sSorting = _T("FileSize");
+	} else if (eFileSorting == Helpers::FS_CaptureTime) {
+		sSorting = _T("CaptureDate");
 	}
 	WriteString(_T("FileDisplayOrder"), sSorting);
 
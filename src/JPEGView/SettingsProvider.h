@@ -47,6 +47,8 @@ public:
 	LPCTSTR Language() { return m_sLanguage; }
 	Helpers::CPUType AlgorithmImplementation() { return m_eCPUAlgorithm; }
 	int NumberOfCoresToUse() { return m_nNumCores; }
+	bool UseLargePages() { return m_bUseLargePages; }
+	int BufferPoolSizeMB() { return m_nBufferPoolSizeMB; }
 	EFilterType DownsamplingFilter() { return m_eDownsamplingFilter; }
 	Helpers::ESorting Sorting() { return m_eSorting; }
 	bool IsSortedAscending() { return m_bIsSortedAscending; }
@@ -89,6 +91,7 @@ public:
 	bool ExchangeXButtons() { return m_bExchangeXButtons; }
 	bool AutoRotateEXIF() { return m_bAutoRotateEXIF; }
 	bool UseEmbeddedColorProfiles() { return m_bUseEmbeddedColorProfiles; }
+	bool ApplyColorProfileOnDisplay() { return m_bApplyColorProfileOnDisplay; }
 	LPCTSTR ACCExclude() { return m_sACCExclude; }
 	LPCTSTR ACCInclude() { return m_sACCInclude; }
 	LPCTSTR LDCExclude() { return m_sLDCExclude; }
@@ -219,6 +222,8 @@ private:
 	CString m_sLanguage;
 	Helpers::CPUType m_eCPUAlgorithm;
 	int m_nNumCores;
+	bool m_bUseLargePages;
+	int m_nBufferPoolSizeMB;
 	EFilterType m_eDownsamplingFilter;
 	Helpers::ESorting m_eSorting;
 	bool m_bIsSortedAscending;
@@ -259,6 +264,7 @@ private:
 	bool m_bExchangeXButtons;
 	bool m_bAutoRotateEXIF;
 	bool m_bUseEmbeddedColorProfiles;
+	bool m_bApplyColorProfileOnDisplay;
 	CString m_sACCExclude;
 	CString m_sACCInclude;
 	CString m_sLDCExclude;
@@ -39,8 +39,7 @@ void* CTiltCorrectionPanelCtl::GetDIBForPreview(CSize fullTargetSize, CSize clip
 												 const CImageProcessingParams & imageProcParams, EProcessingFlags eProcFlags) {
 	CTrapezoid trapezoid = GetCurrentTrapezoid(fullTargetSize);
 	return CurrentImage()->GetDIBTrapezoid(fullTargetSize, clippingSize, targetOffset, imageProcParams, 
-		SetProcessingFlag(eProcFlags, PFLAG_LDC, false), 
-		&trapezoid , m_bShowGrid);
+		eProcFlags, &trapezoid , m_bShowGrid);
 }
 
 void CTiltCorrectionPanelCtl::StartPanel() {
@@ -90,13 +90,15 @@ void CWorkThread::ThreadFunc(void* arg) {
 		// Delete the requests marked for deletion from request queue
 		DeleteAllRequestsMarkedForDeletion(thisPtr);
 
-		// search a request that is not yet processed
+		// search a request that is not yet processed, taking the one with highest priority
 		CRequestBase* requestHandled = NULL;
 		int nNumUnprocessedRequests = 0;
 		std::list<CRequestBase*>::iterator iter;
 		for (iter = thisPtr->m_requestList.begin( ); iter != thisPtr->m_requestList.end( ); iter++ ) {
 			if ((*iter)->Processed == false) {
-				requestHandled = *iter;
+				if (requestHandled == NULL || (*iter)->Priority >= requestHandled->Priority) {
+					requestHandled = *iter;
+				}
 				nNumUnprocessedRequests++;
 			}
 		}
@@ -10,6 +10,7 @@ public:
 		Processed = false;
 		Deleted = false;
 		Type = 0;
+		Priority = 0;
 	}
 
 	CRequestBase() {
@@ -18,9 +19,11 @@ public:
 		Processed = false;
 		Deleted = false;
 		Type = 0;
+		Priority = 0;
 	}
 
 	int Type; // Can be used to set the type of the request, default is 0
+	int Priority; // Requests with higher priority are processed first, default is 0
 	HANDLE EventFinished; // Event signaled when processing is finished
 	volatile LONG* EventFinishedCounter; // if not NULL, this counter is decremented after having handled the request and the event is not fired until it gets zero
 	volatile bool Processed; // Set to true when processing is finished
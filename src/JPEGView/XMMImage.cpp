@@ -1,6 +1,7 @@
 #include "StdAfx.h"
 #include "XMMImage.h"
 #include "Helpers.h"
+#include "BufferPool.h"
 
 CXMMImage::CXMMImage(int nWidth, int nHeight, int padding) {
 	Init(nWidth, nHeight, false, padding);
@@ -35,6 +36,14 @@ CXMMImage::CXMMImage(int nWidth, int nHeight, int nFirstX, int nLastX, int nFirs
 					d += m_nPaddedWidth;
 					pDst[d] = ((uint16)nRed << 6); //((((uint16) nRed) << 8) + nRed) >> 2;
 				}
+			} else if (nChannels == 1) {
+				// grayscale, the same value in all three channels
+				for (int i = 0; i < nSectionWidth; i++) {
+					uint16 nGray = (uint16)pSrc[i] << 6;
+					pDst[i] = nGray;
+					pDst[i + m_nPaddedWidth] = nGray;
+					pDst[i + 2*m_nPaddedWidth] = nGray;
+				}
 			} else {
 				for (int i = 0; i < nSectionWidth; i++) {
 					int s = i*3;
@@ -54,8 +63,7 @@ CXMMImage::CXMMImage(int nWidth, int nHeight, int nFirstX, int nLastX, int nFirs
 
 CXMMImage::~CXMMImage(void) {
 	if (m_pMemory != NULL) {
-		// free the memory pages
-		::VirtualFree(m_pMemory, 0, MEM_RELEASE);
+		CBufferPool::This().Free(m_pMemory);
 		m_pMemory = NULL;
 	}
 }
@@ -102,10 +110,6 @@ void CXMMImage::Init(int nWidth, int nHeight, bool bPadHeight, int padding) {
 	m_nHeight = nHeight;
 	int nMemSize = GetMemSize();
 
-	// Allocate memory aligned on page boundaries
-	m_pMemory = ::VirtualAlloc(
-						NULL,	  // let the call determine the start address
-						nMemSize, // the size
-						MEM_RESERVE | MEM_COMMIT,	// I want that memory, now
-						PAGE_READWRITE);			// need both read and write
+	// Allocate memory aligned on cache lines, the images of each resampling step are reused from the pool
+	m_pMemory = CBufferPool::This().Allocate(nMemSize);
 }
@@ -16,7 +16,7 @@ public:
 	// padding is in pixels (not bytes)
 	CXMMImage(int nWidth, int nHeight, int padding);
 	CXMMImage(int nWidth, int nHeight, bool bPadHeight, int padding); // padding is in pixels (not bytes), width is always padded, height only when bPadHeight is true
-	// convert from section of 24 or 32 bpp DIB, from first to (and including) last column and row
+	// convert from section of 8 (gray), 24 or 32 bpp DIB, from first to (and including) last column and row
 	// padding is in pixels(not bytes)
 	CXMMImage(int nWidth, int nHeight, int nFirstX, int nLastX, int nFirstY, int nLastY, const void* pDIB, int nChannels, int padding);
 	~CXMMImage(void);
@@ -177,6 +177,7 @@
 #define IDM_SORT_NAME		7020		// :KeyMap: sorting order by name
 #define IDM_SORT_RANDOM		7030		// :KeyMap: sorting order random
 #define IDM_SORT_SIZE		7040		// :KeyMap: sorting order file size in bytes
+#define IDM_SORT_CAPTURE_DATE 7050		// :KeyMap: sorting order by capture date (EXIF)
 #define IDM_SORT_ASCENDING	7100		// :KeyMap: sort ascending (increasing in value, e.g. A->Z, 0->9)
 #define IDM_SORT_DESCENDING 7110		// :KeyMap: sort descending (decreasing in value, e.g. Z->A, 9->0)
 #define IDM_SLIDESHOW_RESUME 7399		// :KeyMap: resume slide show (after stop)